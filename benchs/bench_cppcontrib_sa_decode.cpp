@@ -18,6 +18,7 @@
 
 #include <faiss/Index.h>
 #include <faiss/Index2Layer.h>
+#include <faiss/IndexAdditiveQuantizer.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexPQ.h>
 #include <faiss/index_factory.h>
@@ -797,6 +798,23 @@ static void verifyMinMaxIndex2LevelDecoder(
 }
 
 //
+// the centroids table of the decoders that use a single table
+const float* getFineCentroids(const faiss::Index* const index) {
+    const faiss::IndexPQ* const indexPQ =
+            dynamic_cast<const faiss::IndexPQ*>(index);
+    if (indexPQ != nullptr) {
+        return indexPQ->pq.centroids.data();
+    }
+
+    const faiss::IndexAdditiveQuantizer* const indexAQ =
+            dynamic_cast<const faiss::IndexAdditiveQuantizer*>(index);
+    if (indexAQ != nullptr) {
+        return indexAQ->aq->codebooks.data();
+    }
+
+    return nullptr;
+}
+
 template <typename T>
 static void verifyIndexPQDecoder(
         const uint64_t n,
@@ -806,9 +824,7 @@ static void verifyIndexPQDecoder(
         const std::vector<uint8_t>& encodedData,
         const uint64_t nIterations) {
     //
-    const faiss::IndexPQ* const indexQ =
-            dynamic_cast<const faiss::IndexPQ*>(index.get());
-    const float* const pqFineCentroidsQ = indexQ->pq.centroids.data();
+    const float* const pqFineCentroidsQ = getFineCentroids(index.get());
 
     //
     const size_t codeSize = index->sa_code_size();
@@ -1105,9 +1121,7 @@ static void verifyMinMaxIndexPQDecoder(
     auto subIndex = indexMinMax->index;
 
     //
-    const faiss::IndexPQ* const indexQ =
-            dynamic_cast<const faiss::IndexPQ*>(subIndex);
-    const float* const pqFineCentroidsQ = indexQ->pq.centroids.data();
+    const float* const pqFineCentroidsQ = getFineCentroids(subIndex);
 
     //
     const size_t codeSize = index->sa_code_size();
@@ -1696,5 +1710,37 @@ int main(int argc, char** argv) {
                 INDEX_SIZE, 128, "Residual1x10,PQ4x10", N_ITERATIONS);
     }
 
+    // test additive quantizers, which share the IndexPQDecoder experiments
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 4>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "RQ4x8", N_ITERATIONS);
+    }
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 8>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "RQ8x8", N_ITERATIONS);
+    }
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 16>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "RQ16x8", N_ITERATIONS);
+    }
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 8, 10>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "RQ8x10", N_ITERATIONS);
+    }
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 8>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "LSQ8x8", N_ITERATIONS);
+    }
+    {
+        using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 16, 8, 2>;
+        testIndexPQDecoder<T>(INDEX_SIZE, 128, "PRQ2x8x8", N_ITERATIONS);
+    }
+    {
+        using SubT = faiss::cppcontrib::IndexAdditiveDecoder<128, 8>;
+        using T = faiss::cppcontrib::IndexMinMaxFP16Decoder<SubT>;
+        testMinMaxIndexPQDecoder<T>(
+                INDEX_SIZE, 128, "MinMaxFP16,RQ8x8", N_ITERATIONS);
+    }
+
     return 0;
 }
@@ -134,6 +134,22 @@ void Index::sa_decode(idx_t, const uint8_t*, float*) const {
     FAISS_THROW_MSG("standalone codec not implemented for this type of index");
 }
 
+void Index::sa_encode_arena(
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena&) const {
+    sa_encode(n, x, bytes);
+}
+
+void Index::sa_decode_arena(
+        idx_t n,
+        const uint8_t* bytes,
+        float* x,
+        ScratchArena&) const {
+    sa_decode(n, bytes, x);
+}
+
 void Index::add_sa_codes(idx_t, const uint8_t*, const idx_t*) {
     FAISS_THROW_MSG("add_sa_codes not implemented for this type of index");
 }
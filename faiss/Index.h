@@ -11,6 +11,7 @@
 #define FAISS_INDEX_H
 
 #include <faiss/MetricType.h>
+#include <faiss/utils/approx_topk/mode.h>
 #include <cstdio>
 #include <sstream>
 #include <string>
@@ -55,6 +56,7 @@ namespace faiss {
 struct IDSelector;
 struct RangeSearchResult;
 struct DistanceComputer;
+struct ScratchArena;
 
 /** Parent class for the optional search paramenters.
  *
@@ -64,6 +66,16 @@ struct DistanceComputer;
 struct SearchParameters {
     /// if non-null, only these IDs will be considered during search.
     IDSelector* sel = nullptr;
+    /// collect the k results with an approximate top-k (supported by
+    /// IndexFlat and IndexIVF), this is faster but may miss some results
+    ApproxTopK_mode_t approx_topk_mode = EXACT_TOPK;
+    /// top-k within radius: search returns only the results that
+    /// range_search would return with this radius, and the missing results
+    /// are padded with -1 labels. The result heaps start with the radius as
+    /// threshold, so the search can discard candidates early (supported by
+    /// IndexFlat, IndexIVF, IndexIVFFastScan and IndexHNSW)
+    bool use_radius = false;
+    float radius = 0;
     /// make sure we can dynamic_cast this
     virtual ~SearchParameters() {}
 };
@@ -297,6 +309,25 @@ struct Index {
      */
     virtual void sa_decode(idx_t n, const uint8_t* bytes, float* x) const;
 
+    /** same as sa_encode, with the temporary buffers taken from arena.
+     *
+     * Implementations avoid heap allocations once the arena has grown to
+     * the size needed for n vectors, see sa_encode_chunked. The default
+     * implementation calls sa_encode.
+     */
+    virtual void sa_encode_arena(
+            idx_t n,
+            const float* x,
+            uint8_t* bytes,
+            ScratchArena& arena) const;
+
+    /// same as sa_decode, with the temporary buffers taken from arena
+    virtual void sa_decode_arena(
+            idx_t n,
+            const uint8_t* bytes,
+            float* x,
+            ScratchArena& arena) const;
+
     /** moves the entries from another dataset to self.
      * On output, other is empty.
      * add_id is added to all moved ids
@@ -183,6 +183,24 @@ void search_with_LUT(
     }
 }
 
+/// call f with a heap-based result handler, or with a reservoir for large k
+/// where the heap updates dominate
+template <class C, class F>
+void dispatch_knn_handler(
+        idx_t n,
+        float* distances,
+        idx_t* labels,
+        idx_t k,
+        F f) {
+    if (k < distance_compute_min_k_reservoir) {
+        HeapBlockResultHandler<C> rh(n, distances, labels, k);
+        f(rh);
+    } else {
+        ReservoirBlockResultHandler<C> rh(n, distances, labels, k);
+        f(rh);
+    }
+}
+
 } // anonymous namespace
 
 FlatCodesDistanceComputer* IndexAdditiveQuantizer::
@@ -245,45 +263,54 @@ void IndexAdditiveQuantizer::search(
         if (metric_type == METRIC_L2) {
             using VD = VectorDistance<METRIC_L2>;
             VD vd = {size_t(d), metric_arg};
-            HeapBlockResultHandler<VD::C> rh(n, distances, labels, k);
-            search_with_decompress(*this, x, vd, rh);
+            dispatch_knn_handler<VD::C>(
+                    n, distances, labels, k, [&](auto& rh) {
+                        search_with_decompress(*this, x, vd, rh);
+                    });
         } else if (metric_type == METRIC_INNER_PRODUCT) {
             using VD = VectorDistance<METRIC_INNER_PRODUCT>;
             VD vd = {size_t(d), metric_arg};
-            HeapBlockResultHandler<VD::C> rh(n, distances, labels, k);
-            search_with_decompress(*this, x, vd, rh);
+            dispatch_knn_handler<VD::C>(
+                    n, distances, labels, k, [&](auto& rh) {
+                        search_with_decompress(*this, x, vd, rh);
+                    });
         }
     } else {
         if (metric_type == METRIC_INNER_PRODUCT) {
-            HeapBlockResultHandler<CMin<float, idx_t>> rh(
-                    n, distances, labels, k);
-            search_with_LUT<true, AdditiveQuantizer::ST_LUT_nonorm>(
-                    *this, x, rh);
+            dispatch_knn_handler<CMin<float, idx_t>>(
+                    n, distances, labels, k, [&](auto& rh) {
+                        search_with_LUT<true, AdditiveQuantizer::ST_LUT_nonorm>(
+                                *this, x, rh);
+                    });
         } else {
-            HeapBlockResultHandler<CMax<float, idx_t>> rh(
-                    n, distances, labels, k);
-            switch (aq->search_type) {
+            dispatch_knn_handler<CMax<float, idx_t>>(
+                    n, distances, labels, k, [&](auto& rh) {
+                        switch (aq->search_type) {
 #define DISPATCH(st)                                                 \
     case AdditiveQuantizer::st:                                      \
         search_with_LUT<false, AdditiveQuantizer::st>(*this, x, rh); \
         break;
-                DISPATCH(ST_norm_float)
-                DISPATCH(ST_LUT_nonorm)
-                DISPATCH(ST_norm_qint8)
-                DISPATCH(ST_norm_qint4)
-                DISPATCH(ST_norm_cqint4)
-                DISPATCH(ST_norm_from_LUT)
-                case AdditiveQuantizer::ST_norm_cqint8:
-                case AdditiveQuantizer::ST_norm_lsq2x4:
-                case AdditiveQuantizer::ST_norm_rq2x4:
-                    search_with_LUT<false, AdditiveQuantizer::ST_norm_cqint8>(
-                            *this, x, rh);
-                    break;
+                            DISPATCH(ST_norm_float)
+                            DISPATCH(ST_LUT_nonorm)
+                            DISPATCH(ST_norm_qint8)
+                            DISPATCH(ST_norm_qint4)
+                            DISPATCH(ST_norm_cqint4)
+                            DISPATCH(ST_norm_from_LUT)
+                            case AdditiveQuantizer::ST_norm_cqint8:
+                            case AdditiveQuantizer::ST_norm_lsq2x4:
+                            case AdditiveQuantizer::ST_norm_rq2x4:
+                                search_with_LUT<
+                                        false,
+                                        AdditiveQuantizer::ST_norm_cqint8>(
+                                        *this, x, rh);
+                                break;
 #undef DISPATCH
-                default:
-                    FAISS_THROW_FMT(
-                            "search type %d not supported", aq->search_type);
-            }
+                            default:
+                                FAISS_THROW_FMT(
+                                        "search type %d not supported",
+                                        aq->search_type);
+                        }
+                    });
         }
     }
 }
@@ -204,7 +204,9 @@ void IndexBinaryHNSW::search(
 
 #pragma omp parallel
     {
-        VisitedTable vt(ntotal);
+        ScopedVisitedTable scoped_vt(
+                ntotal, hnsw.use_visited_hashset(hnsw.efSearch));
+        VisitedTable& vt = scoped_vt.get();
         std::unique_ptr<DistanceComputer> dis(get_distance_computer());
         RH::SingleResultHandler res(bres);
 
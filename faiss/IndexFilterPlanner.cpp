@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexFilterPlanner.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <typeinfo>
+#include <vector>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+IndexFilterPlanner::IndexFilterPlanner(
+        IndexFlat* flat,
+        IndexIVF* ivf,
+        IndexHNSW* hnsw)
+        : Index(flat->d, flat->metric_type), flat(flat), ivf(ivf), hnsw(hnsw) {
+    ntotal = flat->ntotal;
+    is_trained = flat->is_trained;
+    if (ivf) {
+        FAISS_THROW_IF_NOT(ivf->d == d && ivf->metric_type == metric_type);
+        FAISS_THROW_IF_NOT(ivf->ntotal == ntotal);
+        is_trained = is_trained && ivf->is_trained;
+    }
+    if (hnsw) {
+        FAISS_THROW_IF_NOT(hnsw->d == d && hnsw->metric_type == metric_type);
+        FAISS_THROW_IF_NOT(hnsw->ntotal == ntotal);
+    }
+
+    // rough estimates, valid for SIMD distance computations
+    flat_cost_per_code = 2e-7 * d;
+    ivf_cost_per_code = 1.5 * flat_cost_per_code;
+    ivf_cost_per_query = ivf ? ivf->nlist * flat_cost_per_code : 0;
+    hnsw_cost_per_ef = hnsw ? 2.0 * hnsw->hnsw.nb_neighbors(0) *
+                    flat_cost_per_code
+                            : 0;
+}
+
+IndexFilterPlanner::IndexFilterPlanner()
+        : flat(nullptr),
+          flat_cost_per_code(0),
+          ivf_cost_per_query(0),
+          ivf_cost_per_code(0),
+          hnsw_cost_per_ef(0) {}
+
+void IndexFilterPlanner::train(idx_t n, const float* x) {
+    if (ivf && !ivf->is_trained) {
+        ivf->train(n, x);
+        ivf_cost_per_query = ivf->nlist * flat_cost_per_code;
+    }
+    is_trained = true;
+}
+
+void IndexFilterPlanner::add(idx_t n, const float* x) {
+    FAISS_THROW_IF_NOT(is_trained);
+    flat->add(n, x);
+    if (ivf) {
+        ivf->add(n, x);
+    }
+    if (hnsw) {
+        hnsw->add(n, x);
+    }
+    ntotal = flat->ntotal;
+}
+
+void IndexFilterPlanner::reset() {
+    flat->reset();
+    if (ivf) {
+        ivf->reset();
+    }
+    if (hnsw) {
+        hnsw->reset();
+    }
+    ntotal = 0;
+}
+
+void IndexFilterPlanner::reconstruct(idx_t key, float* recons) const {
+    flat->reconstruct(key, recons);
+}
+
+double IndexFilterPlanner::estimate_selectivity(const IDSelector* sel) const {
+    if (!sel || ntotal == 0) {
+        return 1.0;
+    }
+    idx_t card = sel->cardinality(ntotal);
+    if (card >= 0) {
+        return double(card) / ntotal;
+    }
+    size_t nhit = 0;
+    if (n_sample >= ntotal) {
+        for (idx_t i = 0; i < ntotal; i++) {
+            nhit += sel->is_member(i);
+        }
+        return double(nhit) / ntotal;
+    }
+    RandomGenerator rng(1234);
+    for (size_t i = 0; i < n_sample; i++) {
+        nhit += sel->is_member(rng.rand_int64() % ntotal);
+    }
+    // no hit does not mean that nothing is selected
+    return std::max(double(nhit), 0.5) / n_sample;
+}
+
+size_t IndexFilterPlanner::ivf_nprobe(double selectivity) const {
+    double nprobe = std::ceil(ivf->nprobe / selectivity);
+    return std::min(double(ivf->nlist), nprobe);
+}
+
+size_t IndexFilterPlanner::hnsw_efSearch(double selectivity, idx_t k) const {
+    int ef = std::max(hnsw->hnsw.efSearch, int(k));
+    return std::min(double(ntotal), std::ceil(ef / selectivity));
+}
+
+IndexFilterPlanner::Strategy IndexFilterPlanner::plan(
+        double selectivity,
+        idx_t k,
+        double* cost) const {
+    selectivity = std::max(selectivity, 1.0 / std::max(ntotal, idx_t(1)));
+    Strategy best = STRATEGY_FLAT_SUBSET;
+    double best_cost = selectivity * ntotal * flat_cost_per_code;
+
+    if (ivf && ivf->nlist > 0) {
+        double ncode = double(ivf_nprobe(selectivity)) * ntotal / ivf->nlist;
+        double c = ivf_cost_per_query + ncode * ivf_cost_per_code;
+        if (c < best_cost) {
+            best = STRATEGY_IVF;
+            best_cost = c;
+        }
+    }
+    if (hnsw && selectivity >= hnsw_min_selectivity) {
+        double c = hnsw_efSearch(selectivity, k) * hnsw_cost_per_ef;
+        if (c < best_cost) {
+            best = STRATEGY_HNSW;
+            best_cost = c;
+        }
+    }
+    if (cost) {
+        *cost = best_cost;
+    }
+    return best;
+}
+
+namespace {
+
+/// ids of [0, ntotal) that are selected by sel
+void collect_selected_ids(
+        const IDSelector* sel,
+        idx_t ntotal,
+        std::vector<idx_t>& ids) {
+    ids.clear();
+    if (auto selr = dynamic_cast<const IDSelectorRange*>(sel)) {
+        for (idx_t i = std::max(selr->imin, idx_t(0));
+             i < std::min(selr->imax, ntotal);
+             i++) {
+            ids.push_back(i);
+        }
+    } else if (auto sela = dynamic_cast<const IDSelectorArray*>(sel)) {
+        for (size_t i = 0; i < sela->n; i++) {
+            if (sela->ids[i] >= 0 && sela->ids[i] < ntotal) {
+                ids.push_back(sela->ids[i]);
+            }
+        }
+    } else {
+        for (idx_t i = 0; i < ntotal; i++) {
+            if (sel->is_member(i)) {
+                ids.push_back(i);
+            }
+        }
+    }
+}
+
+} // namespace
+
+void IndexFilterPlanner::search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters* params) const {
+    FAISS_THROW_IF_NOT(k > 0);
+    FAISS_THROW_IF_NOT_MSG(
+            !params || typeid(*params) == typeid(SearchParameters),
+            "only plain SearchParameters are supported");
+    FAISS_THROW_IF_NOT(flat->ntotal == ntotal);
+    const IDSelector* sel = params ? params->sel : nullptr;
+
+    double selectivity = estimate_selectivity(sel);
+    Strategy strategy = plan(selectivity, k);
+
+    if (strategy == STRATEGY_IVF) {
+        SearchParametersIVF ivf_params;
+        if (params) {
+            static_cast<SearchParameters&>(ivf_params) = *params;
+        }
+        ivf_params.nprobe = ivf_nprobe(selectivity);
+        ivf_params.max_codes = ivf->max_codes;
+        ivf->search(n, x, k, distances, labels, &ivf_params);
+        n_search_ivf++;
+    } else if (strategy == STRATEGY_HNSW) {
+        SearchParametersHNSW hnsw_params;
+        if (params) {
+            static_cast<SearchParameters&>(hnsw_params) = *params;
+        }
+        hnsw_params.efSearch = hnsw_efSearch(selectivity, k);
+        hnsw_params.check_relative_distance =
+                hnsw->hnsw.check_relative_distance;
+        hnsw_params.bounded_queue = hnsw->hnsw.search_bounded_queue;
+        hnsw->search(n, x, k, distances, labels, &hnsw_params);
+        n_search_hnsw++;
+    } else {
+        // IndexFlat computes only the distances to the vectors of an
+        // IDSelectorArray
+        SearchParameters flat_params;
+        if (params) {
+            flat_params = *params;
+        }
+        std::vector<idx_t> ids;
+        IDSelectorArray sel_ids(0, nullptr);
+        if (sel) {
+            collect_selected_ids(sel, ntotal, ids);
+            sel_ids.n = ids.size();
+            sel_ids.ids = ids.data();
+            flat_params.sel = &sel_ids;
+        }
+        flat->search(n, x, k, distances, labels, &flat_params);
+        n_search_flat_subset++;
+    }
+}
+
+void IndexFilterPlanner::calibrate(idx_t n, const float* x, idx_t k) {
+    FAISS_THROW_IF_NOT(n > 0 && ntotal > 0);
+    std::vector<float> D(n * k);
+    std::vector<idx_t> I(n * k);
+
+    {
+        std::vector<idx_t> ids(std::min(ntotal, idx_t(1 << 14)));
+        for (size_t i = 0; i < ids.size(); i++) {
+            ids[i] = i;
+        }
+        IDSelectorArray sel(ids.size(), ids.data());
+        SearchParameters params;
+        params.sel = &sel;
+        double t0 = getmillisecs();
+        flat->search(n, x, k, D.data(), I.data(), &params);
+        flat_cost_per_code = (getmillisecs() - t0) / (n * ids.size());
+    }
+    if (ivf) {
+        size_t nprobe = std::min(ivf->nprobe, ivf->nlist);
+        std::vector<float> coarse_dis(n * nprobe);
+        std::vector<idx_t> assign(n * nprobe);
+        double t0 = getmillisecs();
+        ivf->quantizer->search(
+                n, x, nprobe, coarse_dis.data(), assign.data());
+        double t1 = getmillisecs();
+        IndexIVFStats stats;
+        ivf->search_preassigned(
+                n,
+                x,
+                k,
+                assign.data(),
+                coarse_dis.data(),
+                D.data(),
+                I.data(),
+                false,
+                nullptr,
+                &stats);
+        double t2 = getmillisecs();
+        ivf_cost_per_query = (t1 - t0) / n;
+        ivf_cost_per_code = (t2 - t1) / std::max(stats.ndis, size_t(1));
+    }
+    if (hnsw) {
+        double t0 = getmillisecs();
+        hnsw->search(n, x, k, D.data(), I.data());
+        int ef = std::max(hnsw->hnsw.efSearch, int(k));
+        hnsw_cost_per_ef = (getmillisecs() - t0) / (n * ef);
+    }
+}
+
+IndexFilterPlanner::~IndexFilterPlanner() {
+    if (own_fields) {
+        delete flat;
+        delete ivf;
+        delete hnsw;
+    }
+}
+
+} // namespace faiss
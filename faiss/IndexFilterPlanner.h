@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <faiss/Index.h>
+
+namespace faiss {
+
+struct IndexFlat;
+struct IndexIVF;
+struct IndexHNSW;
+
+/** Index that plans the searches filtered with an IDSelector over several
+ * indexes of the same database.
+ *
+ * The vectors are stored in an IndexFlat, and optionally in an IndexIVF and
+ * in an IndexHNSW, with the same sequential ids. For a search with a
+ * selector, the fraction of selected vectors (selectivity) is obtained from
+ * IDSelector::cardinality or estimated by sampling the selector, and the
+ * cheapest of these strategies is run:
+ *
+ * - STRATEGY_FLAT_SUBSET: exact search among the selected vectors only,
+ *   best for very selective filters,
+ * - STRATEGY_IVF: IVF search with nprobe scaled by 1 / selectivity, so that
+ *   about as many selected vectors are scanned as without filter,
+ * - STRATEGY_HNSW: HNSW search with efSearch scaled by 1 / selectivity. It
+ *   is not used below hnsw_min_selectivity, where the graph search misses
+ *   too many results.
+ *
+ * The cost of a strategy is linear in the number of vectors it visits, with
+ * per-vector costs measured by calibrate(). All the queries of a search
+ * share the selector, so the strategy is chosen once per search call.
+ *
+ * To search with arbitrary ids, wrap the planner in an IndexIDMap: the
+ * selectors are then translated to sequential ids and sampled.
+ */
+struct IndexFilterPlanner : Index {
+    enum Strategy {
+        STRATEGY_FLAT_SUBSET = 0,
+        STRATEGY_IVF = 1,
+        STRATEGY_HNSW = 2,
+    };
+
+    IndexFlat* flat;           ///< exact storage, required
+    IndexIVF* ivf = nullptr;   ///< optional
+    IndexHNSW* hnsw = nullptr; ///< optional
+    bool own_fields = false;   ///< delete the sub-indexes in the destructor
+
+    /// nb of ids sampled to estimate the selectivity of the selectors that
+    /// do not provide their cardinality
+    size_t n_sample = 1024;
+
+    /// HNSW is not used below this selectivity
+    double hnsw_min_selectivity = 0.02;
+
+    /// costs of the strategies in ms, per query. The constructor sets rough
+    /// defaults, calibrate() measures them.
+    double flat_cost_per_code; ///< per selected vector
+    double ivf_cost_per_query; ///< coarse quantization
+    double ivf_cost_per_code;  ///< per scanned code, selected or not
+    double hnsw_cost_per_ef;   ///< per unit of efSearch
+
+    /// nb of searches run with each strategy
+    mutable size_t n_search_flat_subset = 0;
+    mutable size_t n_search_ivf = 0;
+    mutable size_t n_search_hnsw = 0;
+
+    /// the sub-indexes should contain the same vectors
+    explicit IndexFilterPlanner(
+            IndexFlat* flat,
+            IndexIVF* ivf = nullptr,
+            IndexHNSW* hnsw = nullptr);
+
+    IndexFilterPlanner();
+
+    /// trains the IVF index
+    void train(idx_t n, const float* x) override;
+
+    /// adds to all the sub-indexes
+    void add(idx_t n, const float* x) override;
+
+    void reset() override;
+
+    void reconstruct(idx_t key, float* recons) const override;
+
+    /// params can only be a plain SearchParameters, the planner sets the
+    /// parameters of the sub-indexes
+    void search(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            const SearchParameters* params = nullptr) const override;
+
+    /// fraction of the vectors that are selected by sel (1 if null)
+    double estimate_selectivity(const IDSelector* sel) const;
+
+    /** cheapest strategy for a search with this selectivity
+     * @param cost  if non-null, the estimated cost per query in ms
+     */
+    Strategy plan(double selectivity, idx_t k, double* cost = nullptr) const;
+
+    /** measure the costs of the strategies by searching with each of them.
+     * @param n  nb of sample queries
+     * @param x  sample queries, size n * d
+     */
+    void calibrate(idx_t n, const float* x, idx_t k = 10);
+
+    ~IndexFilterPlanner() override;
+
+   private:
+    /// nprobe or efSearch scaled for the selectivity
+    size_t ivf_nprobe(double selectivity) const;
+    size_t hnsw_efSearch(double selectivity, idx_t k) const;
+};
+
+} // namespace faiss
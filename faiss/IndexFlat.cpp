@@ -31,17 +31,42 @@ void IndexFlat::search(
         idx_t* labels,
         const SearchParameters* params) const {
     IDSelector* sel = params ? params->sel : nullptr;
+    ApproxTopK_mode_t approx_topk_mode =
+            params ? params->approx_topk_mode : EXACT_TOPK;
+    bool use_radius = params && params->use_radius;
     FAISS_THROW_IF_NOT(k > 0);
 
-    // we see the distances and labels as heaps
     if (metric_type == METRIC_INNER_PRODUCT) {
-        float_minheap_array_t res = {size_t(n), size_t(k), labels, distances};
-        knn_inner_product(x, get_xb(), d, n, ntotal, &res, sel);
+        knn_inner_product(
+                x,
+                get_xb(),
+                d,
+                n,
+                ntotal,
+                k,
+                distances,
+                labels,
+                sel,
+                approx_topk_mode,
+                use_radius ? params->radius : -HUGE_VALF);
     } else if (metric_type == METRIC_L2) {
-        float_maxheap_array_t res = {size_t(n), size_t(k), labels, distances};
-        knn_L2sqr(x, get_xb(), d, n, ntotal, &res, nullptr, sel);
+        knn_L2sqr(
+                x,
+                get_xb(),
+                d,
+                n,
+                ntotal,
+                k,
+                distances,
+                labels,
+                nullptr,
+                sel,
+                approx_topk_mode,
+                use_radius ? params->radius : HUGE_VALF);
     } else {
         FAISS_THROW_IF_NOT(!sel); // TODO implement with selector
+        FAISS_THROW_IF_NOT_MSG(
+                !use_radius, "top-k within radius not supported for metric");
         knn_extra_metrics(
                 x,
                 get_xb(),
@@ -262,8 +262,22 @@ void IndexFlatCodes::search(
         const SearchParameters* params) const {
     Run_search_with_decompress_res r;
     const IDSelector* sel = params ? params->sel : nullptr;
-    dispatch_knn_ResultHandler(
-            n, distances, labels, k, metric_type, sel, r, this, x);
+    if (params && params->use_radius) {
+        dispatch_knn_radius_ResultHandler(
+                n,
+                distances,
+                labels,
+                k,
+                params->radius,
+                metric_type,
+                sel,
+                r,
+                this,
+                x);
+    } else {
+        dispatch_knn_ResultHandler(
+                n, distances, labels, k, metric_type, sel, r, this, x);
+    }
 }
 
 void IndexFlatCodes::range_search(
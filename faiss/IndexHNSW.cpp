@@ -28,6 +28,7 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/ResultHandler.h>
+#include <faiss/impl/ScratchArena.h>
 #include <faiss/utils/random.h>
 #include <faiss/utils/sorting.h>
 
@@ -261,7 +262,9 @@ void hnsw_search(
 
 #pragma omp parallel if (i1 - i0 > 1)
         {
-            VisitedTable vt(index->ntotal);
+            ScopedVisitedTable scoped_vt(
+                    index->ntotal, hnsw.use_visited_hashset(efSearch));
+            VisitedTable& vt = scoped_vt.get();
             typename BlockResultHandler::SingleResultHandler res(bres);
 
             std::unique_ptr<DistanceComputer> dis(
@@ -299,6 +302,12 @@ void IndexHNSW::search(
 
     using RH = HeapBlockResultHandler<HNSW::C>;
     RH bres(n, distances, labels, k);
+    if (params_in && params_in->use_radius) {
+        // the graph is still traversed through the vertices outside the
+        // radius, only the results are restricted
+        bres.radius = is_similarity_metric(metric_type) ? -params_in->radius
+                                                        : params_in->radius;
+    }
 
     hnsw_search(this, n, x, bres, params_in);
 
@@ -423,13 +432,21 @@ void IndexHNSW::search_level_0(
 
     using RH = HeapBlockResultHandler<HNSW::C>;
     RH bres(n, distances, labels, k);
+    if (params && params->use_radius) {
+        bres.radius = is_similarity_metric(metric_type) ? -params->radius
+                                                        : params->radius;
+    }
 
 #pragma omp parallel
     {
         std::unique_ptr<DistanceComputer> qdis(
                 storage_distance_computer(storage));
         HNSWStats search_stats;
-        VisitedTable vt(ntotal);
+        ScopedVisitedTable scoped_vt(
+                ntotal,
+                hnsw.use_visited_hashset(
+                        params ? params->efSearch : hnsw.efSearch));
+        VisitedTable& vt = scoped_vt.get();
         RH::SingleResultHandler res(bres);
 
 #pragma omp for
@@ -786,25 +803,27 @@ void IndexHNSW2Level::search(
 
         int nprobe = index_ivfpq->nprobe;
 
-        std::unique_ptr<idx_t[]> coarse_assign(new idx_t[n * nprobe]);
-        std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
+        ScratchArena& arena = get_thread_scratch_arena();
+        ScratchArena::Scope scope(arena);
+        idx_t* coarse_assign = arena.alloc<idx_t>(n * nprobe);
+        float* coarse_dis = arena.alloc<float>(n * nprobe);
 
-        index_ivfpq->quantizer->search(
-                n, x, nprobe, coarse_dis.get(), coarse_assign.get());
+        index_ivfpq->quantizer->search(n, x, nprobe, coarse_dis, coarse_assign);
 
         index_ivfpq->search_preassigned(
                 n,
                 x,
                 k,
-                coarse_assign.get(),
-                coarse_dis.get(),
+                coarse_assign,
+                coarse_dis,
                 distances,
                 labels,
                 false);
 
 #pragma omp parallel
         {
-            VisitedTable vt(ntotal);
+            ScopedVisitedTable scoped_vt(ntotal);
+            VisitedTable& vt = scoped_vt.get();
             std::unique_ptr<DistanceComputer> dis(
                     storage_distance_computer(storage));
 
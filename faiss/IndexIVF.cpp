@@ -16,9 +16,12 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <cmath>
 #include <cstdio>
 #include <limits>
+#include <typeinfo>
 
+#include <faiss/utils/distances.h>
 #include <faiss/utils/hamming.h>
 #include <faiss/utils/utils.h>
 
@@ -27,6 +30,34 @@
 #include <faiss/impl/CodePacker.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/IDSelector.h>
+#include <faiss/impl/ResultHandler.h>
+#include <faiss/impl/ScratchArena.h>
+#include <faiss/impl/SearchResultBounds.h>
+
+extern "C" {
+
+// this is to keep the clang syntax checker happy
+#ifndef FINTEGER
+#define FINTEGER int
+#endif
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_(
+        const char* transa,
+        const char* transb,
+        FINTEGER* m,
+        FINTEGER* n,
+        FINTEGER* k,
+        const float* alpha,
+        const float* a,
+        FINTEGER* lda,
+        const float* b,
+        FINTEGER* ldb,
+        float* beta,
+        float* c,
+        FINTEGER* ldc);
+}
 
 namespace faiss {
 
@@ -308,33 +339,36 @@ void IndexIVF::search(
     FAISS_THROW_IF_NOT(nprobe > 0);
 
     // search function for a subset of queries
-    auto sub_search_func = [this, k, nprobe, params](
+    auto sub_search_func = [this, k, nprobe](
                                    idx_t n,
                                    const float* x,
                                    float* distances,
                                    idx_t* labels,
+                                   const IVFSearchParameters* params,
                                    IndexIVFStats* ivf_stats) {
-        std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
-        std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
+        ScratchArena& arena = get_thread_scratch_arena();
+        ScratchArena::Scope scope(arena);
+        idx_t* idx = arena.alloc<idx_t>(n * nprobe);
+        float* coarse_dis = arena.alloc<float>(n * nprobe);
 
         double t0 = getmillisecs();
         quantizer->search(
                 n,
                 x,
                 nprobe,
-                coarse_dis.get(),
-                idx.get(),
+                coarse_dis,
+                idx,
                 params ? params->quantizer_params : nullptr);
 
         double t1 = getmillisecs();
-        invlists->prefetch_lists(idx.get(), n * nprobe);
+        invlists->prefetch_lists(idx, n * nprobe);
 
         search_preassigned(
                 n,
                 x,
                 k,
-                idx.get(),
-                coarse_dis.get(),
+                idx,
+                coarse_dis,
                 distances,
                 labels,
                 false,
@@ -351,6 +385,15 @@ void IndexIVF::search(
         std::mutex exception_mutex;
         std::string exception_string;
 
+        // the result bounds are indexed by query, so the slices get views on
+        // them, in a copy of the parameters
+        const SearchResultBounds* bounds =
+                params ? params->result_bounds : nullptr;
+        FAISS_THROW_IF_NOT_MSG(
+                !bounds || nt <= 1 ||
+                        typeid(*params) == typeid(SearchParametersIVF),
+                "result_bounds supported only with SearchParametersIVF");
+
 #pragma omp parallel for if (nt > 1)
         for (idx_t slice = 0; slice < nt; slice++) {
             IndexIVFStats local_stats;
@@ -358,11 +401,23 @@ void IndexIVF::search(
             idx_t i1 = n * (slice + 1) / nt;
             if (i1 > i0) {
                 try {
+                    const IVFSearchParameters* slice_params = params;
+                    std::unique_ptr<SearchResultBounds> slice_bounds;
+                    std::unique_ptr<SearchParametersIVF> slice_params_copy;
+                    if (bounds && i0 > 0) {
+                        slice_bounds = std::make_unique<SearchResultBounds>(
+                                *bounds, i0);
+                        slice_params_copy =
+                                std::make_unique<SearchParametersIVF>(*params);
+                        slice_params_copy->result_bounds = slice_bounds.get();
+                        slice_params = slice_params_copy.get();
+                    }
                     sub_search_func(
                             i1 - i0,
                             x + i0 * d,
                             distances + i0 * k,
                             labels + i0 * k,
+                            slice_params,
                             &stats[slice]);
                 } catch (const std::exception& e) {
                     std::lock_guard<std::mutex> lock(exception_mutex);
@@ -382,7 +437,7 @@ void IndexIVF::search(
     } else {
         // handle parallelization at level below (or don't run in parallel at
         // all)
-        sub_search_func(n, x, distances, labels, &indexIVF_stats);
+        sub_search_func(n, x, distances, labels, params, &indexIVF_stats);
     }
 }
 
@@ -452,11 +507,48 @@ void IndexIVF::search_preassigned(
     void* inverted_list_context =
             params ? params->inverted_list_context : nullptr;
 
+    // for approximate top-k or large k, collect results in a buffered
+    // handler rather than a heap
+    ApproxTopK_mode_t approx_topk_mode =
+            params ? params->approx_topk_mode : EXACT_TOPK;
+    // top-k within radius: the heaps are initialized with the radius, so
+    // that the scanners discard the codes beyond it
+    bool use_radius = params && params->use_radius;
+    bool can_buffer = (pmode == 0 || pmode == 3) && do_heap_init &&
+            !invlists->use_iterator && !use_radius;
+    bool use_approx = can_buffer && approx_topk_mode != EXACT_TOPK && k > 1;
+    bool use_reservoir =
+            can_buffer && !use_approx && k >= distance_compute_min_k_reservoir;
+    bool use_buffered = use_approx || use_reservoir;
+    size_t reservoir_capacity = (2 * k + 15) & ~15;
+    size_t approx_capacity = std::max(size_t(16 * k), size_t(4096));
+
+    // bounds shared with concurrent searches, used with the exact heaps
+    SearchResultBounds* bounds = params ? params->result_bounds : nullptr;
+    if (bounds) {
+        FAISS_THROW_IF_NOT_MSG(
+                bounds->is_similarity == (metric_type == METRIC_INNER_PRODUCT),
+                "result_bounds do not match the metric");
+        if (use_buffered || !do_heap_init || (pmode != 0 && pmode != 3)) {
+            bounds = nullptr;
+        }
+    }
+
 #pragma omp parallel if (do_parallel) reduction(+ : nlistv, ndis, nheap)
     {
         std::unique_ptr<InvertedListScanner> scanner(
                 get_InvertedListScanner(store_pairs, sel));
 
+        // buffered handler of the current query (pmodes 0 and 3 only)
+        std::vector<float> reservoir_dis;
+        std::vector<idx_t> reservoir_ids;
+        ReservoirTopN<HeapForIP> reservoir_ip;
+        ReservoirTopN<HeapForL2> reservoir_l2;
+        std::unique_ptr<ApproxTopN<HeapForIP>> approx_ip;
+        std::unique_ptr<ApproxTopN<HeapForL2>> approx_l2;
+        BufferedResultHandler<HeapForIP>* buffered_ip = nullptr;
+        BufferedResultHandler<HeapForL2>* buffered_l2 = nullptr;
+
         /*****************************************************
          * Depending on parallel_mode, there are two possible ways
          * to organize the search. Here we define local functions
@@ -473,6 +565,10 @@ void IndexIVF::search_preassigned(
             } else {
                 heap_heapify<HeapForL2>(k, simi, idxi);
             }
+            if (use_radius) {
+                // placeholders, removed by reorder_result
+                std::fill_n(simi, k, params->radius);
+            }
         };
 
         auto add_local_results = [&](const float* local_dis,
@@ -496,6 +592,22 @@ void IndexIVF::search_preassigned(
             }
         };
 
+        // results beyond the shared bound cannot enter the final result:
+        // replace them with placeholders (removed by reorder_result), so
+        // that the scanner's threshold is at least as tight as the bound
+        auto apply_bound = [&](idx_t i, float* simi, idx_t* idxi) {
+            float b = bounds->get(i);
+            if (metric_type == METRIC_INNER_PRODUCT) {
+                while (HeapForIP::cmp(simi[0], b)) {
+                    heap_replace_top<HeapForIP>(k, simi, idxi, b, -1);
+                }
+            } else {
+                while (HeapForL2::cmp(simi[0], b)) {
+                    heap_replace_top<HeapForL2>(k, simi, idxi, b, -1);
+                }
+            }
+        };
+
         // single list scan using the current scanner (with query
         // set porperly) and storing results in simi and idxi
         auto scan_one_list = [&](idx_t key,
@@ -564,8 +676,16 @@ void IndexIVF::search_preassigned(
                         ids += jmin;
                     }
 
-                    nheap += scanner->scan_codes(
-                            list_size, codes, ids, simi, idxi, k);
+                    if (!use_buffered) {
+                        nheap += scanner->scan_codes(
+                                list_size, codes, ids, simi, idxi, k);
+                    } else if (metric_type == METRIC_INNER_PRODUCT) {
+                        nheap += scanner->scan_codes_buffered(
+                                list_size, codes, ids, *buffered_ip);
+                    } else {
+                        nheap += scanner->scan_codes_buffered(
+                                list_size, codes, ids, *buffered_l2);
+                    }
 
                     return list_size;
                 }
@@ -583,6 +703,26 @@ void IndexIVF::search_preassigned(
          ****************************************************/
 
         if (pmode == 0 || pmode == 3) {
+            // only the handler of the metric is allocated
+            if (use_reservoir) {
+                reservoir_dis.resize(reservoir_capacity);
+                reservoir_ids.resize(reservoir_capacity);
+                if (metric_type == METRIC_INNER_PRODUCT) {
+                    buffered_ip = &reservoir_ip;
+                } else {
+                    buffered_l2 = &reservoir_l2;
+                }
+            } else if (use_approx) {
+                if (metric_type == METRIC_INNER_PRODUCT) {
+                    approx_ip.reset(new ApproxTopN<HeapForIP>(
+                            k, approx_topk_mode, approx_capacity));
+                    buffered_ip = approx_ip.get();
+                } else {
+                    approx_l2.reset(new ApproxTopN<HeapForL2>(
+                            k, approx_topk_mode, approx_capacity));
+                    buffered_l2 = approx_l2.get();
+                }
+            }
 #pragma omp for
             for (idx_t i = 0; i < n; i++) {
                 if (interrupt) {
@@ -594,25 +734,68 @@ void IndexIVF::search_preassigned(
                 float* simi = distances + i * k;
                 idx_t* idxi = labels + i * k;
 
-                init_result(simi, idxi);
+                if (use_reservoir) {
+                    if (metric_type == METRIC_INNER_PRODUCT) {
+                        reservoir_ip = ReservoirTopN<HeapForIP>(
+                                k,
+                                reservoir_capacity,
+                                reservoir_dis.data(),
+                                reservoir_ids.data());
+                    } else {
+                        reservoir_l2 = ReservoirTopN<HeapForL2>(
+                                k,
+                                reservoir_capacity,
+                                reservoir_dis.data(),
+                                reservoir_ids.data());
+                    }
+                } else if (use_approx) {
+                    if (metric_type == METRIC_INNER_PRODUCT) {
+                        approx_ip->begin(simi, idxi);
+                    } else {
+                        approx_l2->begin(simi, idxi);
+                    }
+                } else {
+                    init_result(simi, idxi);
+                }
 
                 idx_t nscan = 0;
 
                 // loop over probes
                 for (size_t ik = 0; ik < nprobe; ik++) {
+                    if (bounds) {
+                        apply_bound(i, simi, idxi);
+                    }
                     nscan += scan_one_list(
                             keys[i * nprobe + ik],
                             coarse_dis[i * nprobe + ik],
                             simi,
                             idxi,
                             max_codes - nscan);
+                    if (bounds) {
+                        // the heap top is the k-th result found so far
+                        bounds->tighten(i, simi[0]);
+                    }
                     if (nscan >= max_codes) {
                         break;
                     }
                 }
 
                 ndis += nscan;
-                reorder_result(simi, idxi);
+                if (use_reservoir) {
+                    if (metric_type == METRIC_INNER_PRODUCT) {
+                        reservoir_ip.to_result(simi, idxi);
+                    } else {
+                        reservoir_l2.to_result(simi, idxi);
+                    }
+                } else if (use_approx) {
+                    if (metric_type == METRIC_INNER_PRODUCT) {
+                        approx_ip->end();
+                    } else {
+                        approx_l2->end();
+                    }
+                } else {
+                    reorder_result(simi, idxi);
+                }
 
                 if (InterruptCallback::is_interrupted()) {
                     interrupt = true;
@@ -727,23 +910,24 @@ void IndexIVF::range_search(
     }
     const size_t nprobe =
             std::min(nlist, params ? params->nprobe : this->nprobe);
-    std::unique_ptr<idx_t[]> keys(new idx_t[nx * nprobe]);
-    std::unique_ptr<float[]> coarse_dis(new float[nx * nprobe]);
+    ScratchArena& arena = get_thread_scratch_arena();
+    ScratchArena::Scope scope(arena);
+    idx_t* keys = arena.alloc<idx_t>(nx * nprobe);
+    float* coarse_dis = arena.alloc<float>(nx * nprobe);
 
     double t0 = getmillisecs();
-    quantizer->search(
-            nx, x, nprobe, coarse_dis.get(), keys.get(), quantizer_params);
+    quantizer->search(nx, x, nprobe, coarse_dis, keys, quantizer_params);
     indexIVF_stats.quantization_time += getmillisecs() - t0;
 
     t0 = getmillisecs();
-    invlists->prefetch_lists(keys.get(), nx * nprobe);
+    invlists->prefetch_lists(keys, nx * nprobe);
 
     range_search_preassigned(
             nx,
             x,
             radius,
-            keys.get(),
-            coarse_dis.get(),
+            keys,
+            coarse_dis,
             result,
             false,
             params,
@@ -779,7 +963,9 @@ void IndexIVF::range_search_preassigned(
     std::mutex exception_mutex;
     std::string exception_string;
 
-    std::vector<RangeSearchPartialResult*> all_pres(omp_get_max_threads());
+    // partial results of the threads, merged after the parallel section
+    std::vector<std::unique_ptr<RangeSearchPartialResult>> all_pres(
+            omp_get_max_threads());
 
     int pmode = this->parallel_mode & ~PARALLEL_MODE_NO_HEAP_INIT;
     // don't start parallel section if single query
@@ -794,11 +980,12 @@ void IndexIVF::range_search_preassigned(
 
 #pragma omp parallel if (do_parallel) reduction(+ : nlistv, ndis)
     {
-        RangeSearchPartialResult pres(result);
+        all_pres[omp_get_thread_num()].reset(
+                new RangeSearchPartialResult(result));
+        RangeSearchPartialResult& pres = *all_pres[omp_get_thread_num()];
         std::unique_ptr<InvertedListScanner> scanner(
                 get_InvertedListScanner(store_pairs, sel));
         FAISS_THROW_IF_NOT(scanner.get());
-        all_pres[omp_get_thread_num()] = &pres;
 
         // prepare the list scanning function
 
@@ -884,15 +1071,19 @@ void IndexIVF::range_search_preassigned(
             FAISS_THROW_FMT("parallel_mode %d not supported\n", parallel_mode);
         }
         if (parallel_mode == 0) {
+            // the queries of the threads are disjoint
             pres.finalize();
-        } else {
-#pragma omp barrier
-#pragma omp single
-            RangeSearchPartialResult::merge(all_pres, false);
-#pragma omp barrier
         }
     }
 
+    if (parallel_mode != 0) {
+        std::vector<RangeSearchPartialResult*> pres_ptrs;
+        for (const auto& pres : all_pres) {
+            pres_ptrs.push_back(pres.get());
+        }
+        RangeSearchPartialResult::merge(pres_ptrs, false);
+    }
+
     if (interrupt) {
         if (!exception_string.empty()) {
             FAISS_THROW_FMT(
@@ -968,6 +1159,103 @@ void IndexIVF::sa_encode(idx_t n, const float* x, uint8_t* bytes) const {
     encode_vectors(n, x, idx.get(), bytes, true);
 }
 
+namespace {
+
+/* Assignment to the nearest centroid of a flat quantizer, with the
+ * temporary buffers taken from arena (the generic search path allocates
+ * its BLAS blocks). Returns false if the quantizer is not supported. */
+bool assign_flat_arena(
+        const Index* quantizer,
+        idx_t n,
+        const float* x,
+        idx_t* labels,
+        ScratchArena& arena) {
+    const IndexFlat* flat = dynamic_cast<const IndexFlat*>(quantizer);
+    if (!flat ||
+        (flat->metric_type != METRIC_L2 &&
+         flat->metric_type != METRIC_INNER_PRODUCT)) {
+        return false;
+    }
+    bool is_l2 = flat->metric_type == METRIC_L2;
+    size_t d = flat->d, nb = flat->ntotal;
+    const float* xb = flat->get_xb();
+    const size_t bs_y = 1024;
+
+    ScratchArena::Scope scope(arena);
+    float* best = arena.alloc<float>(n);
+    float* y_norms = arena.alloc<float>(bs_y);
+    float* ip = arena.alloc<float>(n * bs_y);
+    for (idx_t i = 0; i < n; i++) {
+        best[i] = is_l2 ? HUGE_VALF : -HUGE_VALF;
+        labels[i] = -1;
+    }
+
+    for (size_t j0 = 0; j0 < nb; j0 += bs_y) {
+        size_t j1 = std::min(nb, j0 + bs_y);
+        if (is_l2) {
+            fvec_norms_L2sqr(y_norms, xb + j0 * d, d, j1 - j0);
+        }
+        float one = 1, zero = 0;
+        FINTEGER nyi = j1 - j0, nxi = n, di = d;
+        sgemm_("Transpose",
+               "Not transpose",
+               &nyi,
+               &nxi,
+               &di,
+               &one,
+               xb + j0 * d,
+               &di,
+               x,
+               &di,
+               &zero,
+               ip,
+               &nyi);
+        for (idx_t i = 0; i < n; i++) {
+            const float* ip_i = ip + i * nyi;
+            for (size_t j = j0; j < j1; j++) {
+                if (is_l2) {
+                    // ||x||^2 is the same for all centroids
+                    float dis = y_norms[j - j0] - 2 * ip_i[j - j0];
+                    if (dis < best[i]) {
+                        best[i] = dis;
+                        labels[i] = j;
+                    }
+                } else if (ip_i[j - j0] > best[i]) {
+                    best[i] = ip_i[j - j0];
+                    labels[i] = j;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+void IndexIVF::encode_vectors_arena(
+        idx_t n,
+        const float* x,
+        const idx_t* list_nos,
+        uint8_t* codes,
+        bool include_listno,
+        ScratchArena&) const {
+    encode_vectors(n, x, list_nos, codes, include_listno);
+}
+
+void IndexIVF::sa_encode_arena(
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena& arena) const {
+    FAISS_THROW_IF_NOT(is_trained);
+    ScratchArena::Scope scope(arena);
+    idx_t* idx = arena.alloc<idx_t>(n);
+    if (!assign_flat_arena(quantizer, n, x, idx, arena)) {
+        quantizer->assign(n, x, idx);
+    }
+    encode_vectors_arena(n, x, idx, bytes, true, arena);
+}
+
 void IndexIVF::search_and_reconstruct(
         idx_t n,
         const float* x,
@@ -1110,7 +1398,8 @@ size_t IndexIVF::remove_ids(const IDSelector& sel) {
 }
 
 void IndexIVF::update_vectors(int n, const idx_t* new_ids, const float* x) {
-    if (direct_map.type == DirectMap::Hashtable) {
+    if (direct_map.type == DirectMap::Hashtable ||
+        direct_map.type == DirectMap::CompactHashtable) {
         // just remove then add
         IDSelectorArray sel(n, new_ids);
         size_t nremove = remove_ids(sel);
@@ -1345,6 +1634,57 @@ size_t InvertedListScanner::iterate_codes(
     return nup;
 }
 
+namespace {
+
+template <class C>
+size_t scan_codes_buffered_default(
+        const InvertedListScanner& scanner,
+        size_t list_size,
+        const uint8_t* codes,
+        const idx_t* ids,
+        BufferedResultHandler<C>& res) {
+    // compute the distances by blocks so that the threshold filtering
+    // runs on contiguous arrays
+    constexpr size_t bs = 64;
+    float dis[bs];
+    idx_t labels[bs];
+    size_t nadd = 0;
+    for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+        size_t j1 = std::min(j0 + bs, list_size);
+        for (size_t j = j0; j < j1; j++) {
+            if (scanner.sel && !scanner.sel->is_member(ids[j])) {
+                dis[j - j0] = C::neutral();
+            } else {
+                dis[j - j0] = scanner.distance_to_code(
+                        codes + j * scanner.code_size);
+            }
+            labels[j - j0] = scanner.store_pairs
+                    ? lo_build(scanner.list_no, j)
+                    : ids[j];
+        }
+        nadd += res.add_results(j1 - j0, dis, labels, 0);
+    }
+    return nadd;
+}
+
+} // anonymous namespace
+
+size_t InvertedListScanner::scan_codes_buffered(
+        size_t list_size,
+        const uint8_t* codes,
+        const idx_t* ids,
+        BufferedResultHandler<CMax<float, idx_t>>& res) const {
+    return scan_codes_buffered_default(*this, list_size, codes, ids, res);
+}
+
+size_t InvertedListScanner::scan_codes_buffered(
+        size_t list_size,
+        const uint8_t* codes,
+        const idx_t* ids,
+        BufferedResultHandler<CMin<float, idx_t>>& res) const {
+    return scan_codes_buffered_default(*this, list_size, codes, ids, res);
+}
+
 void InvertedListScanner::scan_codes_range(
         size_t list_size,
         const uint8_t* codes,
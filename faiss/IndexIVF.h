@@ -68,12 +68,18 @@ struct Level1Quantizer {
     ~Level1Quantizer();
 };
 
+struct SearchResultBounds;
+
 struct SearchParametersIVF : SearchParameters {
     size_t nprobe = 1;    ///< number of probes at query time
     size_t max_codes = 0; ///< max nb of codes to visit to do a query
     SearchParameters* quantizer_params = nullptr;
     /// context object to pass to InvertedLists
     void* inverted_list_context = nullptr;
+    /// bounds shared with concurrent searches (eg. by IndexShards), used to
+    /// prune the candidates. Only the exact-heap searches of parallel_mode
+    /// 0 and 3 use them.
+    SearchResultBounds* result_bounds = nullptr;
 
     virtual ~SearchParametersIVF() {}
 };
@@ -253,6 +259,16 @@ struct IndexIVF : Index, IndexIVFInterface {
             uint8_t* codes,
             bool include_listno = false) const = 0;
 
+    /** same as encode_vectors, with the temporary buffers taken from arena.
+     * The default implementation calls encode_vectors. */
+    virtual void encode_vectors_arena(
+            idx_t n,
+            const float* x,
+            const idx_t* list_nos,
+            uint8_t* codes,
+            bool include_listno,
+            ScratchArena& arena) const;
+
     /** Add vectors that are computed with the standalone codec
      *
      * @param codes  codes to add size n * sa_code_size()
@@ -444,11 +460,21 @@ struct IndexIVF : Index, IndexIVFInterface {
      */
     void sa_encode(idx_t n, const float* x, uint8_t* bytes) const override;
 
+    /// the assignment to a flat quantizer does not allocate
+    void sa_encode_arena(
+            idx_t n,
+            const float* x,
+            uint8_t* bytes,
+            ScratchArena& arena) const override;
+
     IndexIVF();
 };
 
 struct RangeQueryResult;
 
+template <class C>
+struct BufferedResultHandler;
+
 /** Object that handles a query. The inverted lists to scan are
  * provided externally. The object has a lot of state, but
  * distance_to_code and scan_codes can be called in multiple
@@ -507,6 +533,30 @@ struct InvertedListScanner {
             size_t k,
             size_t& list_size) const;
 
+    /** same as scan_codes, but the results are collected in a buffered
+     * handler (reservoir or approximate top-k) instead of a heap. This is
+     * used for large k, where the heap updates dominate the search time:
+     * search_preassigned calls it instead of scan_codes when k >=
+     * distance_compute_min_k_reservoir (100 by default) or when an
+     * approximate top-k mode is set, with parallel_mode 0 or 3. Only the
+     * overload of the comparator of the metric is called. Default
+     * implementation computes distances by blocks with distance_to_code and
+     * passes them to the handler.
+     *
+     * @return number of results stored in the handler
+     */
+    virtual size_t scan_codes_buffered(
+            size_t n,
+            const uint8_t* codes,
+            const idx_t* ids,
+            BufferedResultHandler<CMax<float, idx_t>>& res) const;
+
+    virtual size_t scan_codes_buffered(
+            size_t n,
+            const uint8_t* codes,
+            const idx_t* ids,
+            BufferedResultHandler<CMin<float, idx_t>>& res) const;
+
     /** scan a set of codes, compute distances to current query and
      * update results if distances are below radius
      *
@@ -9,6 +9,7 @@
 
 #include <cassert>
 #include <cinttypes>
+#include <cmath>
 #include <cstdio>
 #include <set>
 
@@ -20,9 +21,11 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/LookupTableScaler.h>
+#include <faiss/impl/ScratchArena.h>
 #include <faiss/impl/pq4_fast_scan.h>
 #include <faiss/impl/simd_result_handlers.h>
 #include <faiss/invlists/BlockInvertedLists.h>
+#include <faiss/invlists/DirectMap.h>
 #include <faiss/utils/hamming.h>
 #include <faiss/utils/quantize_lut.h>
 #include <faiss/utils/utils.h>
@@ -157,9 +160,31 @@ void IndexIVFFastScan::add_with_ids(
             continue;
         }
 
+        size_t list_size = bil->list_size(list_no);
+
+        // the slots of the removed entries are reused first
+        for (size_t ofs = 0;
+             ofs < list_size && bil->n_removed[list_no] > 0 && i0 < i1;
+             ofs++) {
+            if (bil->ids[list_no][ofs] >= 0) {
+                continue;
+            }
+            idx_t id = xids ? xids[order[i0]] : ntotal + order[i0];
+            dm_adder.add(order[i0], list_no, ofs);
+            bil->ids[list_no][ofs] = id;
+            bil->packer->pack_1(
+                    flat_codes.data() + order[i0] * code_size,
+                    ofs,
+                    bil->codes[list_no].data());
+            bil->n_removed[list_no]--;
+            i0++;
+        }
+        if (i0 == i1) {
+            continue;
+        }
+
         // make linear array
         AlignedTable<uint8_t> list_codes((i1 - i0) * code_size);
-        size_t list_size = bil->list_size(list_no);
 
         bil->resize(list_no, list_size + i1 - i0);
 
@@ -197,6 +222,13 @@ CodePacker* IndexIVFFastScan::get_CodePacker() const {
 
 namespace {
 
+/// whether the scan of a list must skip removed entries: only the
+/// BlockInvertedLists keep tombstones, and they count them per list
+bool list_has_removed(const InvertedLists* invlists, idx_t list_no) {
+    auto bil = dynamic_cast<const BlockInvertedLists*>(invlists);
+    return !bil || bil->n_removed[list_no] > 0;
+}
+
 template <class C, typename dis_t>
 void estimators_from_tables_generic(
         const IndexIVFFastScan& index,
@@ -255,7 +287,9 @@ void IndexIVFFastScan::compute_LUT_uint8(
     AlignedTable<float> dis_tables_float;
     AlignedTable<float> biases_float;
 
+    uint64_t t0 = get_cycles();
     compute_LUT(n, x, cq, dis_tables_float, biases_float);
+    uint64_t t1 = get_cycles();
     size_t nprobe = cq.nprobe;
     bool lut_is_3d = lookup_table_is_3d();
     size_t dim123 = ksub * M;
@@ -294,6 +328,8 @@ void IndexIVFFastScan::compute_LUT_uint8(
                 normalizers + 2 * i,
                 normalizers + 2 * i + 1);
     }
+    IVFFastScan_stats.t_compute_distance_tables += t1 - t0;
+    IVFFastScan_stats.t_round += get_cycles() - t1;
 }
 
 /*********************************************************
@@ -372,18 +408,30 @@ ResultHandlerCompare<C, true>* make_knn_handler_fixC(
         idx_t k,
         float* distances,
         idx_t* labels,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        const SearchParameters* params,
+        bool store_pairs) {
     using HeapHC = HeapHandler<C, true>;
     using ReservoirHC = ReservoirHandler<C, true>;
     using SingleResultHC = SingleResultHandler<C, true>;
 
-    if (k == 1) {
-        return new SingleResultHC(n, 0, distances, labels, sel);
+    ResultHandlerCompare<C, true>* handler;
+    // with reranking, the radius applies to the reranked distances
+    if (params && params->use_radius && !store_pairs) {
+        // top-k within radius is supported only by the heaps
+        HeapHC* heap_handler = new HeapHC(n, 0, k, distances, labels, sel);
+        heap_handler->use_radius = true;
+        heap_handler->radius = params->radius;
+        handler = heap_handler;
+    } else if (k == 1) {
+        handler = new SingleResultHC(n, 0, distances, labels, sel);
     } else if (impl % 2 == 0) {
-        return new HeapHC(n, 0, k, distances, labels, sel);
+        handler = new HeapHC(n, 0, k, distances, labels, sel);
     } else /* if (impl % 2 == 1) */ {
-        return new ReservoirHC(n, 0, k, 2 * k, distances, labels, sel);
+        handler = new ReservoirHC(n, 0, k, 2 * k, distances, labels, sel);
     }
+    handler->store_pairs = store_pairs;
+    return handler;
 }
 
 SIMDResultHandlerToFloat* make_knn_handler(
@@ -393,13 +441,15 @@ SIMDResultHandlerToFloat* make_knn_handler(
         idx_t k,
         float* distances,
         idx_t* labels,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        const SearchParameters* params,
+        bool store_pairs = false) {
     if (is_max) {
         return make_knn_handler_fixC<CMax<uint16_t, int64_t>>(
-                impl, n, k, distances, labels, sel);
+                impl, n, k, distances, labels, sel, params, store_pairs);
     } else {
         return make_knn_handler_fixC<CMin<uint16_t, int64_t>>(
-                impl, n, k, distances, labels, sel);
+                impl, n, k, distances, labels, sel, params, store_pairs);
     }
 }
 
@@ -453,6 +503,20 @@ struct CoarseQuantizedSlice : CoarseQuantizedWithBuffer {
     }
 };
 
+/// nb of codes in the lists visited by the n queries
+size_t count_codes_to_scan(
+        const InvertedLists* invlists,
+        const CoarseQuantized& cq,
+        size_t n) {
+    size_t ncode = 0;
+    for (size_t i = 0; i < n * cq.nprobe; i++) {
+        if (cq.ids[i] >= 0) {
+            ncode += invlists->list_size(cq.ids[i]);
+        }
+    }
+    return ncode;
+}
+
 int compute_search_nslice(
         const IndexIVFFastScan* index,
         size_t n,
@@ -499,6 +563,10 @@ void IndexIVFFastScan::search_dispatch_implem(
     if (n == 0) {
         return;
     }
+    FAISS_THROW_IF_NOT(min_codes_per_thread > 0);
+
+    CoarseQuantizedWithBuffer cq(cq_in);
+    cq.nprobe = nprobe;
 
     // actual implementation used
     int impl = implem;
@@ -506,6 +574,18 @@ void IndexIVFFastScan::search_dispatch_implem(
     if (impl == 0) {
         if (bbs == 32) {
             impl = 12;
+            // too few queries to use all the threads: if there are enough
+            // codes to scan, split the lists of each query over the threads
+            if (n < omp_get_max_threads()) {
+                if (!cq.done()) {
+                    cq.quantize(quantizer, n, x, quantizer_params);
+                    invlists->prefetch_lists(cq.ids, n * cq.nprobe);
+                }
+                if (count_codes_to_scan(invlists, cq, n) >=
+                    2 * min_codes_per_thread) {
+                    impl = 14;
+                }
+            }
         } else {
             impl = 10;
         }
@@ -521,9 +601,6 @@ void IndexIVFFastScan::search_dispatch_implem(
         impl -= 100;
     }
 
-    CoarseQuantizedWithBuffer cq(cq_in);
-    cq.nprobe = nprobe;
-
     if (!cq.done() && !multiple_threads) {
         // we do the coarse quantization here execpt when search is
         // sliced over threads (then it is more efficient to have each thread do
@@ -532,6 +609,33 @@ void IndexIVFFastScan::search_dispatch_implem(
         invlists->prefetch_lists(cq.ids, n * cq.nprobe);
     }
 
+    FAISS_THROW_IF_NOT_MSG(
+            !(params && params->use_radius) || impl >= 10,
+            "top-k within radius not supported by this implem");
+
+    // with reranking, the fast scan collects (list_no, offset) pairs of
+    // k_scan candidates per query, that are reranked at the end
+    bool rerank = rerank_k_factor > 1;
+    idx_t k_scan = k;
+    float* dis_scan = distances;
+    idx_t* lab_scan = labels;
+    std::vector<float> rerank_dis;
+    std::vector<idx_t> rerank_pairs_buf;
+    if (rerank) {
+        FAISS_THROW_IF_NOT_MSG(
+                impl >= 10, "reranking not supported by this implem");
+        k_scan = std::max(idx_t(k * rerank_k_factor), k);
+        rerank_dis.resize(n * k_scan);
+        rerank_pairs_buf.resize(n * k_scan);
+        dis_scan = rerank_dis.data();
+        lab_scan = rerank_pairs_buf.data();
+        // the reranking needs the coarse quantization results
+        if (!cq.done()) {
+            cq.quantize(quantizer, n, x, quantizer_params);
+            invlists->prefetch_lists(cq.ids, n * cq.nprobe);
+        }
+    }
+
     if (impl == 1) {
         if (is_max) {
             search_implem_1<CMax<float, int64_t>>(
@@ -559,9 +663,12 @@ void IndexIVFFastScan::search_dispatch_implem(
                         is_max, 
                         impl, 
                         n, 
-                        k, 
-                        distances, 
-                        labels, sel
+                        k_scan,
+                        dis_scan,
+                        lab_scan,
+                        sel,
+                        params,
+                        rerank
                     )
                 );
                 search_implem_12(
@@ -569,18 +676,20 @@ void IndexIVFFastScan::search_dispatch_implem(
                         cq, &ndis, &nlist_visited, scaler, params);
             } else if (impl == 14 || impl == 15) {
                 search_implem_14(
-                        n, x, k, distances, labels,
-                        cq, impl, scaler, params);
+                        n, x, k_scan, dis_scan, lab_scan,
+                        cq, impl, scaler, params, rerank);
             } else {
                 std::unique_ptr<RH> handler(
                     make_knn_handler(
                         is_max, 
                         impl, 
                         n, 
-                        k, 
-                        distances, 
-                        labels,
-                        sel
+                        k_scan,
+                        dis_scan,
+                        lab_scan,
+                        sel,
+                        params,
+                        rerank
                     )
                 );
                 search_implem_10(
@@ -595,20 +704,37 @@ void IndexIVFFastScan::search_dispatch_implem(
                 // this might require slicing if there are too
                 // many queries (for now we keep this simple)
                 search_implem_14(
-                        n, x, k, distances, labels, cq, impl, scaler, params);
+                        n,
+                        x,
+                        k_scan,
+                        dis_scan,
+                        lab_scan,
+                        cq,
+                        impl,
+                        scaler,
+                        params,
+                        rerank);
             } else {
 #pragma omp parallel for reduction(+ : ndis, nlist_visited)
                 for (int slice = 0; slice < nslice; slice++) {
                     idx_t i0 = n * slice / nslice;
                     idx_t i1 = n * (slice + 1) / nslice;
-                    float* dis_i = distances + i0 * k;
-                    idx_t* lab_i = labels + i0 * k;
+                    float* dis_i = dis_scan + i0 * k_scan;
+                    idx_t* lab_i = lab_scan + i0 * k_scan;
                     CoarseQuantizedSlice cq_i(cq, i0, i1);
                     if (!cq_i.done()) {
                         cq_i.quantize_slice(quantizer, x, quantizer_params);
                     }
                     std::unique_ptr<RH> handler(make_knn_handler(
-                            is_max, impl, i1 - i0, k, dis_i, lab_i, sel));
+                            is_max,
+                            impl,
+                            i1 - i0,
+                            k_scan,
+                            dis_i,
+                            lab_i,
+                            sel,
+                            params,
+                            rerank));
                     // clang-format off
                     if (impl == 12 || impl == 13) {
                         search_implem_12(
@@ -623,6 +749,19 @@ void IndexIVFFastScan::search_dispatch_implem(
                 }
             }
         }
+        if (rerank) {
+            rerank_pairs(
+                    n,
+                    x,
+                    k_scan,
+                    lab_scan,
+                    k,
+                    distances,
+                    labels,
+                    cq,
+                    scaler,
+                    params);
+        }
         indexIVF_stats.nq += n;
         indexIVF_stats.ndis += ndis;
         indexIVF_stats.nlist += nlist_visited;
@@ -835,9 +974,11 @@ void IndexIVFFastScan::search_implem_2(
     size_t dim12 = ksub * M2;
     AlignedTable<uint8_t> dis_tables;
     AlignedTable<uint16_t> biases;
-    std::unique_ptr<float[]> normalizers(new float[2 * n]);
+    ScratchArena& arena = get_thread_scratch_arena();
+    ScratchArena::Scope scope(arena);
+    float* normalizers = arena.alloc<float>(2 * n);
 
-    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers.get());
+    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers);
 
     bool single_LUT = !lookup_table_is_3d();
 
@@ -846,9 +987,10 @@ void IndexIVFFastScan::search_implem_2(
 
 #pragma omp parallel for reduction(+ : ndis, nlist_visited)
     for (idx_t i = 0; i < n; i++) {
-        std::vector<uint16_t> tmp_dis(k);
+        ScratchArena& thread_arena = get_thread_scratch_arena();
+        ScratchArena::Scope query_scope(thread_arena);
         int64_t* heap_ids = labels + i * k;
-        uint16_t* heap_dis = tmp_dis.data();
+        uint16_t* heap_dis = thread_arena.alloc<uint16_t>(k);
         heap_heapify<C>(k, heap_dis, heap_ids);
         const uint8_t* LUT = nullptr;
 
@@ -916,9 +1058,11 @@ void IndexIVFFastScan::search_implem_10(
     size_t dim12 = ksub * M2;
     AlignedTable<uint8_t> dis_tables;
     AlignedTable<uint16_t> biases;
-    std::unique_ptr<float[]> normalizers(new float[2 * n]);
+    ScratchArena& arena = get_thread_scratch_arena();
+    ScratchArena::Scope scope(arena);
+    float* normalizers = arena.alloc<float>(2 * n);
 
-    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers.get());
+    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers);
 
     bool single_LUT = !lookup_table_is_3d();
 
@@ -926,7 +1070,7 @@ void IndexIVFFastScan::search_implem_10(
     int qmap1[1];
 
     handler.q_map = qmap1;
-    handler.begin(skip & 16 ? nullptr : normalizers.get());
+    handler.begin(skip & 16 ? nullptr : normalizers);
     size_t nprobe = cq.nprobe;
 
     for (idx_t i = 0; i < n; i++) {
@@ -959,6 +1103,8 @@ void IndexIVFFastScan::search_implem_10(
 
             handler.ntotal = ls;
             handler.id_map = ids.get();
+            handler.has_removed = list_has_removed(invlists, list_no);
+            handler.list_no = list_no;
 
             pq4_accumulate_loop(
                     1,
@@ -996,11 +1142,13 @@ void IndexIVFFastScan::search_implem_12(
     size_t dim12 = ksub * M2;
     AlignedTable<uint8_t> dis_tables;
     AlignedTable<uint16_t> biases;
-    std::unique_ptr<float[]> normalizers(new float[2 * n]);
+    ScratchArena& arena = get_thread_scratch_arena();
+    ScratchArena::Scope scope(arena);
+    float* normalizers = arena.alloc<float>(2 * n);
 
-    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers.get());
+    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers);
 
-    handler.begin(skip & 16 ? nullptr : normalizers.get());
+    handler.begin(skip & 16 ? nullptr : normalizers);
 
     struct QC {
         int qno;     // sequence number of the query
@@ -1062,9 +1210,11 @@ void IndexIVFFastScan::search_implem_12(
         // re-organize LUTs and biases into the right order
         int nc = i1 - i0;
 
-        std::vector<int> q_map(nc), lut_entries(nc);
-        AlignedTable<uint8_t> LUT(nc * dim12);
-        memset(LUT.get(), -1, nc * dim12);
+        ScratchArena::Scope list_scope(arena);
+        int* q_map = arena.alloc<int>(nc);
+        int* lut_entries = arena.alloc<int>(nc);
+        uint8_t* LUT = arena.alloc<uint8_t>(nc * dim12);
+        memset(LUT, -1, nc * dim12);
         int qbs_for_list = pq4_preferred_qbs(nc);
 
         for (size_t i = i0; i < i1; i++) {
@@ -1080,8 +1230,8 @@ void IndexIVFFastScan::search_implem_12(
                 qbs_for_list,
                 M2,
                 dis_tables.get(),
-                lut_entries.data(),
-                LUT.get());
+                lut_entries,
+                LUT);
 
         // access the inverted list
 
@@ -1093,15 +1243,17 @@ void IndexIVFFastScan::search_implem_12(
         // prepare the handler
 
         handler.ntotal = list_size;
-        handler.q_map = q_map.data();
+        handler.q_map = q_map;
         handler.id_map = ids.get();
+        handler.has_removed = list_has_removed(invlists, list_no);
+        handler.list_no = list_no;
 
         pq4_accumulate_loop_qbs(
                 qbs_for_list,
                 list_size,
                 M2,
                 codes.get(),
-                LUT.get(),
+                LUT,
                 handler,
                 scaler);
         // prepare for next loop
@@ -1128,20 +1280,24 @@ void IndexIVFFastScan::search_implem_14(
         const CoarseQuantized& cq,
         int impl,
         const NormTableScaler* scaler,
-        const IVFSearchParameters* params) const {
+        const IVFSearchParameters* params,
+        bool store_pairs) const {
     if (n == 0) { // does not work well with reservoir
         return;
     }
     FAISS_THROW_IF_NOT(bbs == 32);
+    FAISS_THROW_IF_NOT(min_codes_per_thread > 0);
 
     const IDSelector* sel = params ? params->sel : nullptr;
 
     size_t dim12 = ksub * M2;
     AlignedTable<uint8_t> dis_tables;
     AlignedTable<uint16_t> biases;
-    std::unique_ptr<float[]> normalizers(new float[2 * n]);
+    ScratchArena& arena = get_thread_scratch_arena();
+    ScratchArena::Scope scope(arena);
+    float* normalizers = arena.alloc<float>(2 * n);
 
-    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers.get());
+    compute_LUT_uint8(n, x, cq, dis_tables, biases, normalizers);
 
     struct QC {
         int qno;     // sequence number of the query
@@ -1230,16 +1386,37 @@ void IndexIVFFastScan::search_implem_14(
     size_t ndis = 0;
     size_t nlist_visited = 0;
 
-#pragma omp parallel reduction(+ : ndis, nlist_visited)
+    // few codes are not worth waking up all the threads
+    size_t ncode = 0;
+    for (const SE& se : ses) {
+        ncode += (se.end - se.start) * se.list_size;
+    }
+    int nt = std::min(
+            size_t(omp_get_max_threads()),
+            std::min(ses.size(), ncode / min_codes_per_thread));
+    nt = std::max(nt, 1);
+    IVFFastScan_stats.n_implem_14++;
+    IVFFastScan_stats.n_implem_14_threads += nt;
+
+#pragma omp parallel num_threads(nt) reduction(+ : ndis, nlist_visited)
     {
         // storage for each thread
         std::vector<idx_t> local_idx(k * n);
         std::vector<float> local_dis(k * n);
+        ScratchArena& thread_arena = get_thread_scratch_arena();
 
         // prepare the result handlers
         std::unique_ptr<SIMDResultHandlerToFloat> handler(make_knn_handler(
-                is_max, impl, n, k, local_dis.data(), local_idx.data(), sel));
-        handler->begin(normalizers.get());
+                is_max,
+                impl,
+                n,
+                k,
+                local_dis.data(),
+                local_idx.data(),
+                sel,
+                params,
+                store_pairs));
+        handler->begin(normalizers);
 
         int actual_qbs2 = this->qbs2 ? this->qbs2 : 11;
 
@@ -1262,9 +1439,11 @@ void IndexIVFFastScan::search_implem_14(
             // re-organize LUTs and biases into the right order
             int nc = i1 - i0;
 
-            std::vector<int> q_map(nc), lut_entries(nc);
-            AlignedTable<uint8_t> LUT(nc * dim12);
-            memset(LUT.get(), -1, nc * dim12);
+            ScratchArena::Scope list_scope(thread_arena);
+            int* q_map = thread_arena.alloc<int>(nc);
+            int* lut_entries = thread_arena.alloc<int>(nc);
+            uint8_t* LUT = thread_arena.alloc<uint8_t>(nc * dim12);
+            memset(LUT, -1, nc * dim12);
             int qbs_for_list = pq4_preferred_qbs(nc);
 
             for (size_t i = i0; i < i1; i++) {
@@ -1281,8 +1460,8 @@ void IndexIVFFastScan::search_implem_14(
                     qbs_for_list,
                     M2,
                     dis_tables.get(),
-                    lut_entries.data(),
-                    LUT.get());
+                    lut_entries,
+                    LUT);
 
             // access the inverted list
 
@@ -1294,15 +1473,17 @@ void IndexIVFFastScan::search_implem_14(
             // prepare the handler
 
             handler->ntotal = list_size;
-            handler->q_map = q_map.data();
+            handler->q_map = q_map;
             handler->id_map = ids.get();
+            handler->has_removed = list_has_removed(invlists, list_no);
+            handler->list_no = list_no;
 
             pq4_accumulate_loop_qbs(
                     qbs_for_list,
                     list_size,
                     M2,
                     codes.get(),
-                    LUT.get(),
+                    LUT,
                     *handler.get(),
                     scaler);
         }
@@ -1348,6 +1529,158 @@ void IndexIVFFastScan::search_implem_14(
     indexIVF_stats.nlist += nlist_visited;
 }
 
+namespace {
+
+/// distance of the code at offset in a packed inverted list, computed with a
+/// float look-up table
+float packed_code_distance(
+        const IndexIVFFastScan& index,
+        const uint8_t* codes,
+        size_t offset,
+        const float* LUT,
+        float bias,
+        const NormTableScaler* scaler) {
+    size_t nscale = scaler ? scaler->nscale : 0;
+    float dis = bias;
+    for (size_t m = 0; m < index.M; m++) {
+        uint8_t c = pq4_get_packed_element(
+                codes, index.bbs, index.M2, offset, m);
+        float d = LUT[m * index.ksub + c];
+        dis += m < index.M - nscale ? d : scaler->scale_one(d);
+    }
+    return dis;
+}
+
+template <class C>
+void rerank_query(
+        const IndexIVFFastScan& index,
+        size_t k_in,
+        const idx_t* pairs,
+        size_t k,
+        float* heap_dis,
+        idx_t* heap_ids,
+        const idx_t* list_nos,
+        size_t nprobe,
+        const float* LUTs,
+        const float* biases,
+        const NormTableScaler* scaler) {
+    bool single_LUT = !index.lookup_table_is_3d();
+    size_t dim12 = index.ksub * index.M;
+    for (size_t j = 0; j < k_in; j++) {
+        if (pairs[j] < 0) {
+            continue;
+        }
+        idx_t list_no = lo_listno(pairs[j]);
+        size_t offset = lo_offset(pairs[j]);
+        // the rank of the list in the coarse quantization results
+        size_t rank = 0;
+        while (rank < nprobe && list_nos[rank] != list_no) {
+            rank++;
+        }
+        FAISS_ASSERT(rank < nprobe);
+
+        const float* LUT = single_LUT ? LUTs : LUTs + rank * dim12;
+        float bias = biases ? biases[rank] : 0;
+        // the codes were just scanned, so they should still be in cache
+        InvertedLists::ScopedCodes codes(index.invlists, list_no);
+        float dis = packed_code_distance(
+                index, codes.get(), offset, LUT, bias, scaler);
+        if (C::cmp(heap_dis[0], dis)) {
+            heap_replace_top<C>(
+                    k,
+                    heap_dis,
+                    heap_ids,
+                    dis,
+                    index.invlists->get_single_id(list_no, offset));
+        }
+    }
+    heap_reorder<C>(k, heap_dis, heap_ids);
+}
+
+} // anonymous namespace
+
+void IndexIVFFastScan::rerank_pairs(
+        idx_t n,
+        const float* x,
+        idx_t k_in,
+        const idx_t* pairs,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const CoarseQuantized& cq,
+        const NormTableScaler* scaler,
+        const IVFSearchParameters* params) const {
+    FAISS_THROW_IF_NOT(cq.ids);
+    bool is_max = !is_similarity_metric(metric_type);
+    float radius = is_max ? HUGE_VALF : -HUGE_VALF;
+    if (params && params->use_radius) {
+        radius = params->radius;
+    }
+    size_t nprobe = cq.nprobe;
+    size_t dim12 = ksub * M;
+    if (lookup_table_is_3d()) {
+        dim12 *= nprobe;
+    }
+
+    // the float LUTs are computed by blocks of queries to bound their size
+    idx_t bs = std::max(
+            idx_t(precomputed_table_max_bytes / (dim12 * sizeof(float))),
+            idx_t(1));
+
+    for (idx_t i0 = 0; i0 < n; i0 += bs) {
+        idx_t i1 = std::min(n, i0 + bs);
+        CoarseQuantized cq_i = {
+                nprobe,
+                cq.dis ? cq.dis + i0 * nprobe : nullptr,
+                cq.ids + i0 * nprobe};
+        AlignedTable<float> dis_tables;
+        AlignedTable<float> biases;
+        compute_LUT(i1 - i0, x + i0 * d, cq_i, dis_tables, biases);
+
+#pragma omp parallel for if (i1 - i0 > 1)
+        for (idx_t i = i0; i < i1; i++) {
+            float* heap_dis = distances + i * k;
+            idx_t* heap_ids = labels + i * k;
+            // the heap is initialized with the radius, that acts as a
+            // threshold on the reranked distances
+            for (idx_t j = 0; j < k; j++) {
+                heap_dis[j] = radius;
+                heap_ids[j] = -1;
+            }
+            const float* LUTs = dis_tables.get() + (i - i0) * dim12;
+            const float* b = biases.get() ? biases.get() + (i - i0) * nprobe
+                                          : nullptr;
+            if (is_max) {
+                rerank_query<CMax<float, idx_t>>(
+                        *this,
+                        k_in,
+                        pairs + i * k_in,
+                        k,
+                        heap_dis,
+                        heap_ids,
+                        cq.ids + i * nprobe,
+                        nprobe,
+                        LUTs,
+                        b,
+                        scaler);
+            } else {
+                rerank_query<CMin<float, idx_t>>(
+                        *this,
+                        k_in,
+                        pairs + i * k_in,
+                        k,
+                        heap_dis,
+                        heap_ids,
+                        cq.ids + i * nprobe,
+                        nprobe,
+                        LUTs,
+                        b,
+                        scaler);
+            }
+        }
+    }
+}
+
 void IndexIVFFastScan::reconstruct_from_offset(
         int64_t list_no,
         int64_t offset,
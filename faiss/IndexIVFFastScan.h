@@ -34,6 +34,10 @@ struct SIMDResultHandlerToFloat;
  * 14: internally multithreaded implem over nq * nprobe
  * 15: same with reservoir
  *
+ * The auto-selection uses 14 or 15 when there are fewer queries than
+ * threads and enough codes to scan, so that the lists of a single query
+ * are scanned in parallel.
+ *
  * For range search, only 10 and 12 are supported.
  * add 100 to the implem to force single-thread scanning (the coarse quantizer
  * may still use multiple threads).
@@ -59,6 +63,15 @@ struct IndexIVFFastScan : IndexIVF {
     int qbs = 0;
     size_t qbs2 = 0;
 
+    /// implem 14 and 15 use at most 1 thread per min_codes_per_thread
+    /// scanned codes (must be > 0)
+    size_t min_codes_per_thread = 32768;
+
+    /// if > 1, the fast scan collects k * rerank_k_factor candidates that
+    /// are reranked with distances from the float look-up tables (implem
+    /// >= 10 only)
+    float rerank_k_factor = 0;
+
     IndexIVFFastScan(
             Index* quantizer,
             size_t d,
@@ -103,7 +116,8 @@ struct IndexIVFFastScan : IndexIVF {
             AlignedTable<float>& dis_tables,
             AlignedTable<float>& biases) const = 0;
 
-    void compute_LUT_uint8(
+    /// compute the LUTs with compute_LUT and quantize them to 8 bits
+    virtual void compute_LUT_uint8(
             size_t n,
             const float* x,
             const CoarseQuantized& cq,
@@ -215,6 +229,25 @@ struct IndexIVFFastScan : IndexIVF {
             const CoarseQuantized& cq,
             int impl,
             const NormTableScaler* scaler,
+            const IVFSearchParameters* params = nullptr,
+            bool store_pairs = false) const;
+
+    /** compute the float distances of candidates given as (list_no, offset)
+     * pairs, and keep the k best of each query.
+     *
+     * @param k_in    nb of candidates per query, size n * k_in
+     * @param pairs   candidates, built with lo_build (-1 = no candidate)
+     */
+    void rerank_pairs(
+            idx_t n,
+            const float* x,
+            idx_t k_in,
+            const idx_t* pairs,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            const CoarseQuantized& cq,
+            const NormTableScaler* scaler,
             const IVFSearchParameters* params = nullptr) const;
 
     // reconstruct vectors from packed invlists
@@ -232,6 +265,8 @@ struct IVFFastScanStats {
     uint64_t t_compute_distance_tables, t_round;
     uint64_t t_copy_pack, t_scan, t_to_flat;
     uint64_t reservoir_times[4];
+    // number of implem 14 and 15 searches and threads they used
+    uint64_t n_implem_14, n_implem_14_threads;
     double t_aq_encode;
     double t_aq_norm_encode;
 
@@ -18,6 +18,7 @@
 
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/IDSelector.h>
+#include <faiss/impl/ResultHandler.h>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/distances.h>
@@ -133,6 +134,7 @@ struct IVFFlatScanner : InvertedListScanner {
     IVFFlatScanner(size_t d, bool store_pairs, const IDSelector* sel)
             : InvertedListScanner(store_pairs, sel), d(d) {
         keep_max = is_similarity_metric(metric);
+        code_size = sizeof(float) * d;
     }
 
     const float* xi;
@@ -178,6 +180,39 @@ struct IVFFlatScanner : InvertedListScanner {
         return nup;
     }
 
+    // the handler of the other comparator is never used for this metric, it
+    // is left to the default implementation
+    using InvertedListScanner::scan_codes_buffered;
+
+    size_t scan_codes_buffered(
+            size_t list_size,
+            const uint8_t* codes,
+            const idx_t* ids,
+            BufferedResultHandler<C>& res) const override {
+        const float* list_vecs = (const float*)codes;
+        constexpr size_t bs = 64;
+        float dis[bs];
+        idx_t labels[bs];
+        size_t nadd = 0;
+        for (size_t j0 = 0; j0 < list_size; j0 += bs) {
+            size_t j1 = std::min(j0 + bs, list_size);
+            if (metric == METRIC_INNER_PRODUCT) {
+                fvec_inner_products_ny(
+                        dis, xi, list_vecs + j0 * d, d, j1 - j0);
+            } else {
+                fvec_L2sqr_ny(dis, xi, list_vecs + j0 * d, d, j1 - j0);
+            }
+            for (size_t j = j0; j < j1; j++) {
+                if (use_sel && !sel->is_member(ids[j])) {
+                    dis[j - j0] = C::neutral();
+                }
+                labels[j - j0] = store_pairs ? lo_build(list_no, j) : ids[j];
+            }
+            nadd += res.add_results(j1 - j0, dis, labels, 0);
+        }
+        return nadd;
+    }
+
     void scan_codes_range(
             size_t list_size,
             const uint8_t* codes,
@@ -15,6 +15,8 @@
 #include <cstdint>
 #include <cstdio>
 
+#include <omp.h>
+
 #include <algorithm>
 
 #include <faiss/utils/Heap.h>
@@ -29,8 +31,10 @@
 
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/IDSelector.h>
+#include <faiss/impl/ResultHandler.h>
 
 #include <faiss/impl/ProductQuantizer.h>
+#include <faiss/impl/ScratchArena.h>
 
 #include <faiss/impl/code_distance/code_distance.h>
 
@@ -139,24 +143,48 @@ void IndexIVFPQ::add_core(
     add_core_o(n, x, xids, nullptr, coarse_idx, inverted_list_context);
 }
 
-static std::unique_ptr<float[]> compute_residuals(
+static void compute_residuals(
         const Index* quantizer,
         idx_t n,
         const float* x,
-        const idx_t* list_nos) {
+        const idx_t* list_nos,
+        float* residuals) {
     size_t d = quantizer->d;
-    std::unique_ptr<float[]> residuals(new float[n * d]);
     // TODO: parallelize?
     for (size_t i = 0; i < n; i++) {
         if (list_nos[i] < 0)
-            memset(residuals.get() + i * d, 0, sizeof(float) * d);
+            memset(residuals + i * d, 0, sizeof(float) * d);
         else
             quantizer->compute_residual(
-                    x + i * d, residuals.get() + i * d, list_nos[i]);
+                    x + i * d, residuals + i * d, list_nos[i]);
     }
+}
+
+static std::unique_ptr<float[]> compute_residuals(
+        const Index* quantizer,
+        idx_t n,
+        const float* x,
+        const idx_t* list_nos) {
+    std::unique_ptr<float[]> residuals(new float[n * quantizer->d]);
+    compute_residuals(quantizer, n, x, list_nos, residuals.get());
     return residuals;
 }
 
+/// in-place conversion of the PQ codes to codes prefixed with the list nos
+static void prepend_listnos(
+        const IndexIVFPQ& index,
+        idx_t n,
+        const idx_t* list_nos,
+        uint8_t* codes) {
+    size_t coarse_size = index.coarse_code_size();
+    size_t code_size = index.code_size;
+    for (idx_t i = n - 1; i >= 0; i--) {
+        uint8_t* code = codes + i * (coarse_size + code_size);
+        memmove(code + coarse_size, codes + i * code_size, code_size);
+        index.encode_listno(list_nos[i], code);
+    }
+}
+
 void IndexIVFPQ::encode_vectors(
         idx_t n,
         const float* x,
@@ -172,34 +200,81 @@ void IndexIVFPQ::encode_vectors(
     }
 
     if (include_listnos) {
-        size_t coarse_size = coarse_code_size();
-        for (idx_t i = n - 1; i >= 0; i--) {
-            uint8_t* code = codes + i * (coarse_size + code_size);
-            memmove(code + coarse_size, codes + i * code_size, code_size);
-            encode_listno(list_nos[i], code);
+        prepend_listnos(*this, n, list_nos, codes);
+    }
+}
+
+void IndexIVFPQ::encode_vectors_arena(
+        idx_t n,
+        const float* x,
+        const idx_t* list_nos,
+        uint8_t* codes,
+        bool include_listnos,
+        ScratchArena& arena) const {
+    ScratchArena::Scope scope(arena);
+    if (by_residual) {
+        float* to_encode = arena.alloc<float>(n * d);
+        compute_residuals(quantizer, n, x, list_nos, to_encode);
+        pq.compute_codes_arena(to_encode, codes, n, arena);
+    } else {
+        pq.compute_codes_arena(x, codes, n, arena);
+    }
+
+    if (include_listnos) {
+        prepend_listnos(*this, n, list_nos, codes);
+    }
+}
+
+namespace {
+
+void decode_with_buffer(
+        const IndexIVFPQ& index,
+        idx_t i,
+        const uint8_t* codes,
+        float* x,
+        float* residual) {
+    size_t coarse_size = index.coarse_code_size();
+    const uint8_t* code = codes + i * (index.code_size + coarse_size);
+    int64_t list_no = index.decode_listno(code);
+    float* xi = x + i * index.d;
+    index.pq.decode(code + coarse_size, xi);
+    if (index.by_residual) {
+        index.quantizer->reconstruct(list_no, residual);
+        for (size_t j = 0; j < index.d; j++) {
+            xi[j] += residual[j];
         }
     }
 }
 
-void IndexIVFPQ::sa_decode(idx_t n, const uint8_t* codes, float* x) const {
-    size_t coarse_size = coarse_code_size();
+} // namespace
 
+void IndexIVFPQ::sa_decode(idx_t n, const uint8_t* codes, float* x) const {
 #pragma omp parallel
     {
         std::vector<float> residual(d);
 
 #pragma omp for
         for (idx_t i = 0; i < n; i++) {
-            const uint8_t* code = codes + i * (code_size + coarse_size);
-            int64_t list_no = decode_listno(code);
-            float* xi = x + i * d;
-            pq.decode(code + coarse_size, xi);
-            if (by_residual) {
-                quantizer->reconstruct(list_no, residual.data());
-                for (size_t j = 0; j < d; j++) {
-                    xi[j] += residual[j];
-                }
-            }
+            decode_with_buffer(*this, i, codes, x, residual.data());
+        }
+    }
+}
+
+void IndexIVFPQ::sa_decode_arena(
+        idx_t n,
+        const uint8_t* codes,
+        float* x,
+        ScratchArena& arena) const {
+    ScratchArena::Scope scope(arena);
+    float* residuals = arena.alloc<float>(omp_get_max_threads() * d);
+
+#pragma omp parallel
+    {
+        float* residual = residuals + omp_get_thread_num() * d;
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            decode_with_buffer(*this, i, codes, x, residual);
         }
     }
 }
@@ -778,6 +853,30 @@ struct KnnSearchResults {
     }
 };
 
+template <class C, bool use_sel>
+struct BufferedSearchResults {
+    idx_t key;
+    const idx_t* ids;
+    const IDSelector* sel;
+
+    // wrapped result structure
+    BufferedResultHandler<C>& res;
+
+    size_t nup;
+
+    inline bool skip_entry(idx_t j) {
+        return use_sel && !sel->is_member(ids[j]);
+    }
+
+    inline void add(idx_t j, float dis) {
+        if (C::cmp(res.threshold, dis)) {
+            idx_t id = ids ? ids[j] : lo_build(key, j);
+            res.add_result(dis, id);
+            nup++;
+        }
+    }
+};
+
 template <class C, bool use_sel>
 struct RangeSearchResults {
     idx_t key;
@@ -1251,6 +1350,37 @@ struct IVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE, PQDecoder>,
         return res.nup;
     }
 
+    // the handler of the other comparator is never used for this metric, it
+    // is left to the default implementation
+    using InvertedListScanner::scan_codes_buffered;
+
+    size_t scan_codes_buffered(
+            size_t ncode,
+            const uint8_t* codes,
+            const idx_t* ids,
+            BufferedResultHandler<C>& rres) const override {
+        BufferedSearchResults<C, use_sel> res = {
+                /* key */ this->key,
+                /* ids */ this->store_pairs ? nullptr : ids,
+                /* sel */ this->sel,
+                /* res */ rres,
+                /* nup */ 0};
+
+        if (this->polysemous_ht > 0) {
+            assert(precompute_mode == 2);
+            this->scan_list_polysemous(ncode, codes, res);
+        } else if (precompute_mode == 2) {
+            this->scan_list_with_table(ncode, codes, res);
+        } else if (precompute_mode == 1) {
+            this->scan_list_with_pointer(ncode, codes, res);
+        } else if (precompute_mode == 0) {
+            this->scan_on_the_fly_dist(ncode, codes, res);
+        } else {
+            FAISS_THROW_MSG("bad precomp mode");
+        }
+        return res.nup;
+    }
+
     void scan_codes_range(
             size_t ncode,
             const uint8_t* codes,
@@ -65,8 +65,22 @@ struct IndexIVFPQ : IndexIVF {
             uint8_t* codes,
             bool include_listnos = false) const override;
 
+    void encode_vectors_arena(
+            idx_t n,
+            const float* x,
+            const idx_t* list_nos,
+            uint8_t* codes,
+            bool include_listnos,
+            ScratchArena& arena) const override;
+
     void sa_decode(idx_t n, const uint8_t* bytes, float* x) const override;
 
+    void sa_decode_arena(
+            idx_t n,
+            const uint8_t* bytes,
+            float* x,
+            ScratchArena& arena) const override;
+
     void add_core(
             idx_t n,
             const float* x,
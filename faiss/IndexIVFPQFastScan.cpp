@@ -16,7 +16,9 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/quantize_lut.h>
 #include <faiss/utils/simdlib.h>
+#include <faiss/utils/utils.h>
 
 #include <faiss/invlists/BlockInvertedLists.h>
 
@@ -203,7 +205,7 @@ void IndexIVFPQFastScan::compute_LUT(
         AlignedTable<float>& biases) const {
     size_t dim12 = pq.ksub * pq.M;
     size_t d = pq.d;
-    size_t nprobe = this->nprobe;
+    size_t nprobe = cq.nprobe;
 
     if (by_residual) {
         if (metric_type == METRIC_L2) {
@@ -282,6 +284,71 @@ void IndexIVFPQFastScan::compute_LUT(
     }
 }
 
+void IndexIVFPQFastScan::compute_LUT_uint8(
+        size_t n,
+        const float* x,
+        const CoarseQuantized& cq,
+        AlignedTable<uint8_t>& dis_tables,
+        AlignedTable<uint16_t>& biases,
+        float* normalizers) const {
+    if (!(by_residual && metric_type == METRIC_L2 &&
+          use_precomputed_table == 1)) {
+        IndexIVFFastScan::compute_LUT_uint8(
+                n, x, cq, dis_tables, biases, normalizers);
+        return;
+    }
+    uint64_t t0 = get_cycles();
+    size_t dim12 = pq.ksub * pq.M;
+    size_t dim12_2 = pq.ksub * M2;
+    size_t nprobe = cq.nprobe;
+    dis_tables.resize(n * nprobe * dim12_2);
+    biases.resize(n * nprobe);
+
+    // all the tables of the batch share the query-to-codebook inner
+    // products, the centroid terms come from the precomputed table
+    AlignedTable<float> ip_table(n * dim12);
+    pq.compute_inner_prod_tables(n, x, ip_table.get());
+
+#pragma omp parallel if (n > 1)
+    {
+        AlignedTable<float> LUT(nprobe * dim12);
+
+#pragma omp for
+        for (idx_t i = 0; i < n; i++) {
+            // for a single query, the probes are split over the threads
+#pragma omp parallel for if (n == 1 && nprobe * dim12 > 65536)
+            for (idx_t j = 0; j < nprobe; j++) {
+                float* tab = LUT.get() + j * dim12;
+                idx_t cij = cq.ids[i * nprobe + j];
+                if (cij >= 0) {
+                    fvec_madd_simd(
+                            dim12,
+                            precomputed_table.get() + cij * dim12,
+                            -2,
+                            ip_table.get() + i * dim12,
+                            tab);
+                } else {
+                    // NaNs are ignored by the quantization
+                    memset(tab, -1, sizeof(float) * dim12);
+                }
+            }
+            quantize_lut::quantize_LUT_and_bias(
+                    nprobe,
+                    pq.M,
+                    pq.ksub,
+                    true,
+                    LUT.get(),
+                    cq.dis + i * nprobe,
+                    dis_tables.get() + i * nprobe * dim12_2,
+                    M2,
+                    biases.get() + i * nprobe,
+                    normalizers + 2 * i,
+                    normalizers + 2 * i + 1);
+        }
+    }
+    IVFFastScan_stats.t_compute_distance_tables += get_cycles() - t0;
+}
+
 void IndexIVFPQFastScan::sa_decode(idx_t n, const uint8_t* codes, float* x)
         const {
     size_t coarse_size = coarse_code_size();
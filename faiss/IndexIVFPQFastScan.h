@@ -81,6 +81,17 @@ struct IndexIVFPQFastScan : IndexIVFFastScan {
             AlignedTable<float>& dis_tables,
             AlignedTable<float>& biases) const override;
 
+    /** with precomputed tables, the float LUTs of each query are quantized
+     * right after they are computed, while they are in cache, instead of
+     * materializing the float LUTs of all queries */
+    void compute_LUT_uint8(
+            size_t n,
+            const float* x,
+            const CoarseQuantized& cq,
+            AlignedTable<uint8_t>& dis_tables,
+            AlignedTable<uint16_t>& biases,
+            float* normalizers) const override;
+
     void sa_decode(idx_t n, const uint8_t* bytes, float* x) const override;
 };
 
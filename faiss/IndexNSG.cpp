@@ -68,13 +68,17 @@ void IndexNSG::search(
 
     int L = std::max(nsg.search_L, (int)k); // in case of search L = -1
     idx_t check_period = InterruptCallback::get_period_hint(d * L);
+    // a search expands about L nodes
+    bool use_hashset =
+            VisitedTable::hashset_preferred(ntotal, size_t(L) * nsg.R);
 
     for (idx_t i0 = 0; i0 < n; i0 += check_period) {
         idx_t i1 = std::min(i0 + check_period, n);
 
 #pragma omp parallel
         {
-            VisitedTable vt(ntotal);
+            ScopedVisitedTable scoped_vt(ntotal, use_hashset);
+            VisitedTable& vt = scoped_vt.get();
 
             std::unique_ptr<DistanceComputer> dis(
                     storage_distance_computer(storage));
@@ -18,6 +18,7 @@
 
 #include <faiss/impl/DistanceComputer.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/ScratchArena.h>
 #include <faiss/utils/hamming.h>
 
 #include <faiss/impl/code_distance/code_distance.h>
@@ -428,6 +429,14 @@ void IndexPQ::sa_encode(idx_t n, const float* x, uint8_t* bytes) const {
     pq.compute_codes(x, bytes, n);
 }
 
+void IndexPQ::sa_encode_arena(
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena& arena) const {
+    pq.compute_codes_arena(x, bytes, n, arena);
+}
+
 void IndexPQ::sa_decode(idx_t n, const uint8_t* bytes, float* x) const {
     pq.decode(bytes, x, n);
 }
@@ -48,6 +48,12 @@ struct IndexPQ : IndexFlatCodes {
     /* The standalone codec interface */
     void sa_encode(idx_t n, const float* x, uint8_t* bytes) const override;
 
+    void sa_encode_arena(
+            idx_t n,
+            const float* x,
+            uint8_t* bytes,
+            ScratchArena& arena) const override;
+
     void sa_decode(idx_t n, const uint8_t* bytes, float* x) const override;
 
     FlatCodesDistanceComputer* get_FlatCodesDistanceComputer() const override;
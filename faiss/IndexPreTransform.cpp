@@ -9,6 +9,7 @@
 
 #include <faiss/IndexPreTransform.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
@@ -17,6 +18,31 @@
 #include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/DistanceComputer.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/ScratchArena.h>
+#include <faiss/utils/distances.h>
+
+extern "C" {
+
+// this is to keep the clang syntax checker happy
+#ifndef FINTEGER
+#define FINTEGER int
+#endif
+
+int dgemm_(
+        const char* transa,
+        const char* transb,
+        FINTEGER* m,
+        FINTEGER* n,
+        FINTEGER* k,
+        const double* alpha,
+        const double* a,
+        FINTEGER* lda,
+        const double* b,
+        FINTEGER* ldb,
+        double* beta,
+        double* c,
+        FINTEGER* ldc);
+}
 
 namespace faiss {
 
@@ -44,6 +70,157 @@ void IndexPreTransform::prepend_transform(VectorTransform* ltrans) {
     is_trained = is_trained && ltrans->is_trained;
     chain.insert(chain.begin(), ltrans);
     d = ltrans->d_in;
+    prepare_chain();
+}
+
+namespace {
+
+/// affine map y = M x + c accumulated in double precision
+struct AffineMap {
+    int d_in, d_out;
+    std::vector<double> M; // size d_out * d_in
+    std::vector<double> c; // size d_out
+    int ncomposed = 0;     // nb of transforms composed so far
+    size_t cost = 0;       // flops of applying them separately
+
+    explicit AffineMap(int d) : d_in(d), d_out(d), M(d * d), c(d) {
+        for (int i = 0; i < d; i++) {
+            M[i * d + i] = 1;
+        }
+    }
+
+    /// cost of applying the composed transform
+    size_t fused_cost() const {
+        return size_t(d_out) * d_in;
+    }
+
+    void compose(const LinearTransform& lt) {
+        FINTEGER di = d_in, dk = d_out, dj = lt.d_out;
+        std::vector<double> A(lt.A.begin(), lt.A.end());
+        std::vector<double> M2(size_t(dj) * di);
+        double one = 1, zero = 0;
+        // M2 = A * M in row-major order
+        dgemm_("N",
+               "N",
+               &di,
+               &dj,
+               &dk,
+               &one,
+               M.data(),
+               &di,
+               A.data(),
+               &dk,
+               &zero,
+               M2.data(),
+               &di);
+        std::vector<double> c2(dj);
+        for (int j = 0; j < dj; j++) {
+            double accu = lt.have_bias ? lt.b[j] : 0;
+            for (int k = 0; k < dk; k++) {
+                accu += A[size_t(j) * dk + k] * c[k];
+            }
+            c2[j] = accu;
+        }
+        M.swap(M2);
+        c.swap(c2);
+        d_out = dj;
+        cost += size_t(lt.d_out) * lt.d_in;
+        ncomposed++;
+    }
+
+    void compose(const CenteringTransform& ct) {
+        for (int j = 0; j < d_out; j++) {
+            c[j] -= ct.mean[j];
+        }
+        cost += d_out;
+        ncomposed++;
+    }
+
+    std::shared_ptr<const LinearTransform> to_linear_transform() const {
+        auto lt = std::make_shared<LinearTransform>(d_in, d_out, true);
+        lt->A.assign(M.begin(), M.end());
+        lt->b.assign(c.begin(), c.end());
+        lt->is_trained = true;
+        return lt;
+    }
+};
+
+bool is_affine(const VectorTransform* vt) {
+    return dynamic_cast<const LinearTransform*>(vt) ||
+            dynamic_cast<const CenteringTransform*>(vt);
+}
+
+/// cost of vt if it is composed with an affine map
+size_t affine_cost(const VectorTransform* vt) {
+    if (dynamic_cast<const LinearTransform*>(vt)) {
+        return size_t(vt->d_out) * vt->d_in;
+    }
+    return vt->d_out;
+}
+
+void compose_affine(AffineMap& map, const VectorTransform* vt) {
+    if (auto lt = dynamic_cast<const LinearTransform*>(vt)) {
+        map.compose(*lt);
+    } else {
+        map.compose(*dynamic_cast<const CenteringTransform*>(vt));
+    }
+}
+
+bool is_L2_normalization(const VectorTransform* vt) {
+    auto nt = dynamic_cast<const NormalizationTransform*>(vt);
+    return nt && nt->norm == 2.0;
+}
+
+} // namespace
+
+void IndexPreTransform::prepare_chain() {
+    fused_chain.clear();
+    fused_chain_size = 0;
+    for (const VectorTransform* vt : chain) {
+        if (!vt->is_trained) {
+            return;
+        }
+    }
+
+    std::vector<FusedStep> steps;
+    size_t i = 0;
+    while (i < chain.size()) {
+        FusedStep step;
+        if (is_affine(chain[i])) {
+            // extend the run of affine transforms as long as the collapsed
+            // matrix is not more expensive to apply than the separate ones
+            AffineMap map(chain[i]->d_in);
+            size_t i1 = i;
+            while (i1 < chain.size() && is_affine(chain[i1])) {
+                const VectorTransform* vt = chain[i1];
+                if (map.ncomposed > 0 &&
+                    size_t(vt->d_out) * map.d_in >
+                            map.cost + affine_cost(vt)) {
+                    break;
+                }
+                compose_affine(map, vt);
+                i1++;
+            }
+            if (i1 == i + 1) {
+                // nothing to collapse, keep the original
+                step.chain_no = i;
+            } else {
+                step.lt = map.to_linear_transform();
+            }
+            i = i1;
+        } else {
+            step.chain_no = i;
+            i++;
+        }
+        if (i < chain.size() && is_L2_normalization(chain[i]) &&
+            !is_L2_normalization(chain[i - 1])) {
+            step.normalize = true;
+            i++;
+        }
+        steps.push_back(step);
+    }
+    fused_chain.swap(steps);
+    fused_chain_size = chain.size();
 }
 
 IndexPreTransform::~IndexPreTransform() {
@@ -111,20 +288,127 @@ void IndexPreTransform::train(idx_t n, const float* x) {
     }
 
     is_trained = true;
+    prepare_chain();
 }
 
-const float* IndexPreTransform::apply_chain(idx_t n, const float* x) const {
-    const float* prev_x = x;
-    std::unique_ptr<const float[]> del;
+namespace {
 
-    for (int i = 0; i < chain.size(); i++) {
-        float* xt = chain[i]->apply(n, prev_x);
-        std::unique_ptr<const float[]> del2(xt);
-        del2.swap(del);
-        prev_x = xt;
+/* Intermediate results are allocated in the scratch arena of the thread so
+ * that small batches do not go through the allocator. The buffers are
+ * released in stack order, which supports nested IndexPreTransforms. */
+struct ScratchBuffer {
+    ScratchArena::Scope scope;
+    float* data;
+
+    explicit ScratchBuffer(size_t size)
+            : scope(get_thread_scratch_arena()),
+              data(scope.arena.alloc<float>(size)) {}
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+};
+
+/// below this number of vectors, a matrix-vector product per vector is
+/// faster than calling sgemm
+const idx_t min_n_sgemm = 16;
+
+void apply_linear(
+        const LinearTransform& lt,
+        bool normalize,
+        idx_t n,
+        const float* x,
+        float* xt) {
+    if (n >= min_n_sgemm) {
+        lt.apply_noalloc(n, x, xt);
+        if (normalize) {
+            fvec_renorm_L2(lt.d_out, n, xt);
+        }
+        return;
+    }
+    FAISS_THROW_IF_NOT_MSG(lt.is_trained, "Transformation not trained yet");
+    FAISS_THROW_IF_NOT_MSG(
+            lt.A.size() == size_t(lt.d_out) * lt.d_in,
+            "Transformation matrix not initialized");
+    for (idx_t i = 0; i < n; i++) {
+        const float* xi = x + i * lt.d_in;
+        float* yi = xt + i * lt.d_out;
+        fvec_inner_products_ny(yi, xi, lt.A.data(), lt.d_in, lt.d_out);
+        if (lt.have_bias) {
+            for (int j = 0; j < lt.d_out; j++) {
+                yi[j] += lt.b[j];
+            }
+        }
+        if (normalize) {
+            fvec_renorm_L2(lt.d_out, 1, yi);
+        }
     }
+}
+
+} // namespace
+
+const float* IndexPreTransform::apply_chain(idx_t n, const float* x) const {
+    if (chain.empty()) {
+        return x;
+    }
+    float* xt = new float[n * chain.back()->d_out];
+    std::unique_ptr<float[]> del(xt);
+    apply_chain_noalloc(n, x, xt);
     del.release();
-    return prev_x;
+    return xt;
+}
+
+void IndexPreTransform::apply_chain_noalloc(idx_t n, const float* x, float* xt)
+        const {
+    if (chain.empty()) {
+        memcpy(xt, x, sizeof(*x) * n * d);
+        return;
+    }
+
+    if (fused_chain.empty() || fused_chain_size != chain.size()) {
+        // chain not prepared, apply transforms one by one
+        const float* prev_x = x;
+        std::unique_ptr<const float[]> del;
+        for (int i = 0; i + 1 < chain.size(); i++) {
+            float* xi = chain[i]->apply(n, prev_x);
+            del.reset(xi);
+            prev_x = xi;
+        }
+        chain.back()->apply_noalloc(n, prev_x, xt);
+        return;
+    }
+
+    size_t max_d = 0;
+    for (const VectorTransform* vt : chain) {
+        max_d = std::max(max_d, size_t(vt->d_out));
+    }
+    // ping-pong between two buffers, the last step writes to xt
+    std::unique_ptr<ScratchBuffer> bufs[2];
+    const float* prev_x = x;
+    for (size_t i = 0; i < fused_chain.size(); i++) {
+        const FusedStep& step = fused_chain[i];
+        float* out;
+        if (i + 1 == fused_chain.size()) {
+            out = xt;
+        } else {
+            std::unique_ptr<ScratchBuffer>& buf = bufs[i % 2];
+            if (!buf) {
+                buf.reset(new ScratchBuffer(n * max_d));
+            }
+            out = buf->data;
+        }
+        const VectorTransform* vt = step.lt.get();
+        if (!vt) {
+            vt = chain[step.chain_no];
+        }
+        if (auto lt = dynamic_cast<const LinearTransform*>(vt)) {
+            apply_linear(*lt, step.normalize, n, prev_x, out);
+        } else {
+            vt->apply_noalloc(n, prev_x, out);
+            if (step.normalize) {
+                fvec_renorm_L2(vt->d_out, n, out);
+            }
+        }
+        prev_x = out;
+    }
 }
 
 void IndexPreTransform::reverse_chain(idx_t n, const float* xt, float* x)
@@ -177,10 +461,20 @@ void IndexPreTransform::search(
         const SearchParameters* params) const {
     FAISS_THROW_IF_NOT(k > 0);
     FAISS_THROW_IF_NOT(is_trained);
-    const float* xt = apply_chain(n, x);
-    std::unique_ptr<const float[]> del(xt == x ? nullptr : xt);
+    if (chain.empty()) {
+        index->search(
+                n, x, k, distances, labels, extract_index_search_params(params));
+        return;
+    }
+    ScratchBuffer xt(n * index->d);
+    apply_chain_noalloc(n, x, xt.data);
     index->search(
-            n, xt, k, distances, labels, extract_index_search_params(params));
+            n,
+            xt.data,
+            k,
+            distances,
+            labels,
+            extract_index_search_params(params));
 }
 
 void IndexPreTransform::range_search(
@@ -190,9 +484,15 @@ void IndexPreTransform::range_search(
         RangeSearchResult* result,
         const SearchParameters* params) const {
     FAISS_THROW_IF_NOT(is_trained);
-    TransformedVectors tv(x, apply_chain(n, x));
+    if (chain.empty()) {
+        index->range_search(
+                n, x, radius, result, extract_index_search_params(params));
+        return;
+    }
+    ScratchBuffer xt(n * index->d);
+    apply_chain_noalloc(n, x, xt.data);
     index->range_search(
-            n, tv.x, radius, result, extract_index_search_params(params));
+            n, xt.data, radius, result, extract_index_search_params(params));
 }
 
 void IndexPreTransform::reset() {
@@ -277,6 +577,37 @@ void IndexPreTransform::sa_decode(idx_t n, const uint8_t* bytes, float* x)
     }
 }
 
+void IndexPreTransform::sa_encode_arena(
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena& arena) const {
+    ScratchArena::Scope scope(arena);
+    float* xt = arena.alloc<float>(n * index->d);
+    apply_chain_noalloc(n, x, xt);
+    index->sa_encode_arena(n, xt, bytes, arena);
+}
+
+void IndexPreTransform::sa_decode_arena(
+        idx_t n,
+        const uint8_t* bytes,
+        float* x,
+        ScratchArena& arena) const {
+    if (chain.empty()) {
+        index->sa_decode_arena(n, bytes, x, arena);
+        return;
+    }
+    ScratchArena::Scope scope(arena);
+    float* next_x = arena.alloc<float>(n * index->d);
+    index->sa_decode_arena(n, bytes, next_x, arena);
+    // Revert transformations from last to first
+    for (int i = chain.size() - 1; i >= 0; i--) {
+        float* prev_x = i == 0 ? x : arena.alloc<float>(n * chain[i]->d_in);
+        chain[i]->reverse_transform(n, next_x, prev_x);
+        next_x = prev_x;
+    }
+}
+
 void IndexPreTransform::merge_from(Index& otherIndex, idx_t add_id) {
     check_compatible_for_merge(otherIndex);
     auto other = static_cast<const IndexPreTransform*>(&otherIndex);
@@ -300,19 +631,16 @@ namespace {
 struct PreTransformDistanceComputer : DistanceComputer {
     const IndexPreTransform* index;
     std::unique_ptr<DistanceComputer> sub_dc;
-    std::unique_ptr<const float[]> query;
+    std::vector<float> query;
 
     explicit PreTransformDistanceComputer(const IndexPreTransform* index)
-            : index(index), sub_dc(index->index->get_distance_computer()) {}
+            : index(index),
+              sub_dc(index->index->get_distance_computer()),
+              query(index->index->d) {}
 
     void set_query(const float* x) override {
-        const float* xt = index->apply_chain(1, x);
-        if (xt == x) {
-            sub_dc->set_query(x);
-        } else {
-            query.reset(xt);
-            sub_dc->set_query(xt);
-        }
+        index->apply_chain_noalloc(1, x, query.data());
+        sub_dc->set_query(query.data());
     }
 
     float symmetric_dis(idx_t i, idx_t j) override {
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include <faiss/Index.h>
 #include <faiss/VectorTransform.h>
 
@@ -28,6 +30,25 @@ struct IndexPreTransform : Index {
 
     bool own_fields; ///! whether pointers are deleted in destructor
 
+    /// one step of the simplified chain used at search time
+    struct FusedStep {
+        /// transform of the chain to apply as is, or -1 if fused
+        int chain_no = -1;
+        /// affine transform that replaces a sequence of transforms
+        std::shared_ptr<const LinearTransform> lt;
+        /// L2-normalize the output of the step
+        bool normalize = false;
+    };
+
+    /** Simplified version of the chain: consecutive linear transforms
+     * (and centerings) are collapsed into a single matrix and
+     * L2-normalizations are applied in the same pass. Built by
+     * prepare_chain, not serialized. Empty if the chain is not trained. */
+    std::vector<FusedStep> fused_chain;
+
+    /// size of the chain when fused_chain was built
+    size_t fused_chain_size = 0;
+
     explicit IndexPreTransform(Index* index);
 
     IndexPreTransform();
@@ -37,6 +58,11 @@ struct IndexPreTransform : Index {
 
     void prepend_transform(VectorTransform* ltrans);
 
+    /** Build fused_chain from the chain. Called automatically by train,
+     * prepend_transform and when the index is loaded or cloned. It must be
+     * called again if the transforms are modified in place afterwards. */
+    void prepare_chain();
+
     void train(idx_t n, const float* x) override;
 
     void add(idx_t n, const float* x) override;
@@ -82,6 +108,9 @@ struct IndexPreTransform : Index {
     /// equal to x, otherwise it should be deallocated.
     const float* apply_chain(idx_t n, const float* x) const;
 
+    /// same as apply_chain, output in xt (size n * index->d)
+    void apply_chain_noalloc(idx_t n, const float* x, float* xt) const;
+
     /// Reverse the transforms in the chain. May not be implemented for
     /// all transforms in the chain or may return approximate results.
     void reverse_chain(idx_t n, const float* xt, float* x) const;
@@ -93,6 +122,19 @@ struct IndexPreTransform : Index {
     void sa_encode(idx_t n, const float* x, uint8_t* bytes) const override;
     void sa_decode(idx_t n, const uint8_t* bytes, float* x) const override;
 
+    /// the transformed vectors are stored in the arena
+    void sa_encode_arena(
+            idx_t n,
+            const float* x,
+            uint8_t* bytes,
+            ScratchArena& arena) const override;
+
+    void sa_decode_arena(
+            idx_t n,
+            const uint8_t* bytes,
+            float* x,
+            ScratchArena& arena) const override;
+
     void merge_from(Index& otherIndex, idx_t add_id = 0) override;
     void check_compatible_for_merge(const Index& otherIndex) const override;
 
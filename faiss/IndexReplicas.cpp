@@ -5,13 +5,45 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cinttypes>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
 
 #include <faiss/IndexReplicas.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/utils.h>
 
 namespace faiss {
 
+struct ReplicaLoad {
+    std::mutex mutex;
+
+    /// nb of searches queued or running on each replica, replicas without
+    /// outstanding searches have no entry
+    std::unordered_map<const void*, idx_t> outstanding;
+
+    /// nb of slices that were hedged
+    size_t n_hedged = 0;
+
+    void update(const void* index, idx_t delta) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = outstanding.emplace(index, 0).first;
+        it->second += delta;
+        if (it->second == 0) {
+            outstanding.erase(it);
+        }
+    }
+
+    idx_t get_outstanding(const void* index) const {
+        auto it = outstanding.find(index);
+        return it == outstanding.end() ? 0 : it->second;
+    }
+};
+
 namespace {
 
 // IndexBinary needs to update the code_size when d is set...
@@ -27,17 +59,17 @@ void sync_d(IndexBinary* index) {
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(bool threaded)
-        : ThreadedIndex<IndexT>(threaded) {}
+        : ThreadedIndex<IndexT>(threaded), load(new ReplicaLoad()) {}
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(idx_t d, bool threaded)
-        : ThreadedIndex<IndexT>(d, threaded) {
+        : ThreadedIndex<IndexT>(d, threaded), load(new ReplicaLoad()) {
     sync_d(this);
 }
 
 template <typename IndexT>
 IndexReplicasTemplate<IndexT>::IndexReplicasTemplate(int d, bool threaded)
-        : ThreadedIndex<IndexT>(d, threaded) {
+        : ThreadedIndex<IndexT>(d, threaded), load(new ReplicaLoad()) {
     sync_d(this);
 }
 
@@ -136,6 +168,11 @@ void IndexReplicasTemplate<IndexT>::search(
         return;
     }
 
+    if (dispatch_mode == DISPATCH_BALANCED && this->isThreaded_) {
+        search_balanced(n, x, k, distances, labels);
+        return;
+    }
+
     auto dim = this->d;
     size_t componentsPerVec = sizeof(component_t) == 1 ? (dim + 7) / 8 : dim;
 
@@ -173,6 +210,235 @@ void IndexReplicasTemplate<IndexT>::search(
     this->runOnIndex(fn);
 }
 
+namespace {
+
+/// state of a search in DISPATCH_BALANCED mode, shared by the caller and
+/// the replica threads
+template <typename IndexT>
+struct BalancedSearch {
+    using component_t = typename IndexT::component_t;
+    using distance_t = typename IndexT::distance_t;
+
+    enum SliceState { FREE, RUNNING, DONE };
+
+    idx_t n, k;
+    size_t componentsPerVec;
+    const component_t* x;
+    /// copy of the queries when a hedged search may outlive the call
+    std::vector<component_t> x_copy;
+    distance_t* distances;
+    idx_t* labels;
+    idx_t slice_size;
+    double hedge_delay_ms;
+    ReplicaLoad* load;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<SliceState> state;
+    std::vector<double> t_start;
+    std::vector<int> n_runs; ///< nb of replicas that searched each slice
+    size_t n_done = 0;
+    int n_idle = 0; ///< nb of replica threads waiting for a slice to hedge
+    int n_joining = 0; ///< nb of replicas enrolled that did not start yet
+    std::exception_ptr error;
+
+    size_t nslice() const {
+        return state.size();
+    }
+
+    /// earliest time a running slice can be hedged
+    double next_hedge_time() const {
+        double t = std::numeric_limits<double>::infinity();
+        for (size_t s = 0; s < nslice(); s++) {
+            if (state[s] == RUNNING && n_runs[s] == 1) {
+                t = std::min(t, t_start[s] + hedge_delay_ms);
+            }
+        }
+        return t;
+    }
+
+    /// loop of a replica thread: search free slices, then hedge the late
+    /// ones
+    void run(const IndexT* index) {
+        std::vector<distance_t> D;
+        std::vector<idx_t> I;
+        std::unique_lock<std::mutex> lock(mutex);
+        n_joining--;
+        while (n_done < nslice()) {
+            double now = getmillisecs();
+            size_t s = std::find(state.begin(), state.end(), FREE) -
+                    state.begin();
+            if (s < nslice()) {
+                state[s] = RUNNING;
+                t_start[s] = now;
+                n_runs[s] = 1;
+                if (hedge_delay_ms >= 0) {
+                    // the caller may have to enroll a replica to hedge it
+                    cv.notify_all();
+                }
+            } else if (hedge_delay_ms >= 0) {
+                for (s = 0; s < nslice(); s++) {
+                    if (state[s] == RUNNING && n_runs[s] == 1 &&
+                        t_start[s] + hedge_delay_ms <= now) {
+                        break;
+                    }
+                }
+                if (s == nslice()) {
+                    double t = next_hedge_time();
+                    if (t == std::numeric_limits<double>::infinity()) {
+                        break;
+                    }
+                    n_idle++;
+                    cv.wait_for(
+                            lock,
+                            std::chrono::microseconds(
+                                    int64_t((t - now) * 1000) + 1));
+                    n_idle--;
+                    continue;
+                }
+                n_runs[s]++;
+                {
+                    std::lock_guard<std::mutex> lock2(load->mutex);
+                    load->n_hedged++;
+                }
+            } else {
+                break;
+            }
+            lock.unlock();
+
+            idx_t i0 = s * slice_size;
+            idx_t ni = std::min(slice_size, n - i0);
+            // a slice searched by several replicas goes through buffers
+            bool buffered = hedge_delay_ms >= 0;
+            if (buffered) {
+                D.resize(ni * k);
+                I.resize(ni * k);
+            }
+            std::exception_ptr err;
+            try {
+                index->search(
+                        ni,
+                        x + i0 * componentsPerVec,
+                        k,
+                        buffered ? D.data() : distances + i0 * k,
+                        buffered ? I.data() : labels + i0 * k);
+            } catch (...) {
+                err = std::current_exception();
+            }
+
+            lock.lock();
+            if (state[s] != DONE) {
+                if (err) {
+                    error = err;
+                } else if (buffered) {
+                    std::copy(D.begin(), D.end(), distances + i0 * k);
+                    std::copy(I.begin(), I.end(), labels + i0 * k);
+                }
+                state[s] = DONE;
+                n_done++;
+                cv.notify_all();
+            }
+        }
+    }
+};
+
+} // namespace
+
+template <typename IndexT>
+void IndexReplicasTemplate<IndexT>::search_balanced(
+        idx_t n,
+        const component_t* x,
+        idx_t k,
+        distance_t* distances,
+        idx_t* labels) const {
+    FAISS_THROW_IF_NOT(slice_size > 0);
+    using Search = BalancedSearch<IndexT>;
+    auto search = std::make_shared<Search>();
+    search->n = n;
+    search->k = k;
+    search->componentsPerVec =
+            sizeof(component_t) == 1 ? (this->d + 7) / 8 : this->d;
+    search->x = x;
+    if (hedge_delay_ms >= 0) {
+        search->x_copy.assign(x, x + n * search->componentsPerVec);
+        search->x = search->x_copy.data();
+    }
+    search->distances = distances;
+    search->labels = labels;
+    search->slice_size = slice_size;
+    search->hedge_delay_ms = hedge_delay_ms;
+    search->load = load.get();
+    size_t nslice = (n + slice_size - 1) / slice_size;
+    search->state.resize(nslice, Search::FREE);
+    search->t_start.resize(nslice);
+    search->n_runs.resize(nslice);
+
+    // replicas by increasing outstanding work
+    int nrep = this->count();
+    std::vector<std::pair<idx_t, int>> by_load(nrep);
+    {
+        std::lock_guard<std::mutex> lock(load->mutex);
+        for (int i = 0; i < nrep; i++) {
+            by_load[i] = {load->get_outstanding(this->at(i)), i};
+        }
+    }
+    std::sort(by_load.begin(), by_load.end());
+
+    std::shared_ptr<ReplicaLoad> load_ref = load;
+    size_t n_started = 0;
+    auto start_replica = [&]() {
+        int i = by_load[n_started++].second;
+        const IndexT* index = this->at(i);
+        search->n_joining++;
+        // the future is not needed: completion is tracked by the search
+        load->update(index, 1);
+        this->indices_[i].second->add([search, index, load_ref]() {
+            search->run(index);
+            load_ref->update(index, -1);
+        });
+    };
+    std::unique_lock<std::mutex> lock(search->mutex);
+    for (size_t i = 0; i < std::min(size_t(nrep), nslice); i++) {
+        start_replica();
+    }
+
+    while (search->n_done < nslice) {
+        if (hedge_delay_ms >= 0 && n_started < nrep && search->n_idle == 0 &&
+            search->n_joining == 0) {
+            // no replica is available to hedge, enroll a new one
+            double t = search->next_hedge_time();
+            double now = getmillisecs();
+            if (t <= now) {
+                start_replica();
+                continue;
+            }
+            if (t != std::numeric_limits<double>::infinity()) {
+                search->cv.wait_for(
+                        lock,
+                        std::chrono::microseconds(
+                                int64_t((t - now) * 1000) + 1));
+                continue;
+            }
+        }
+        search->cv.wait(lock);
+    }
+    if (search->error) {
+        std::rethrow_exception(search->error);
+    }
+}
+
+template <typename IndexT>
+size_t IndexReplicasTemplate<IndexT>::get_n_hedged() const {
+    std::lock_guard<std::mutex> lock(load->mutex);
+    return load->n_hedged;
+}
+
+template <typename IndexT>
+size_t IndexReplicasTemplate<IndexT>::get_n_busy_replicas() const {
+    std::lock_guard<std::mutex> lock(load->mutex);
+    return load->outstanding.size();
+}
+
 // FIXME: assumes that nothing is currently running on the sub-indexes, which is
 // true with the normal API, but should use the runOnIndex API instead
 template <typename IndexT>
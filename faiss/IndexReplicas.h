@@ -7,12 +7,16 @@
 
 #pragma once
 
+#include <memory>
+
 #include <faiss/Index.h>
 #include <faiss/IndexBinary.h>
 #include <faiss/impl/ThreadedIndex.h>
 
 namespace faiss {
 
+struct ReplicaLoad;
+
 /// Takes individual faiss::Index instances, and splits queries for
 /// sending to each Index instance, and joins the results together
 /// when done.
@@ -23,6 +27,28 @@ class IndexReplicasTemplate : public ThreadedIndex<IndexT> {
     using component_t = typename IndexT::component_t;
     using distance_t = typename IndexT::distance_t;
 
+    /// how the queries of a search are distributed over the replicas
+    enum DispatchMode {
+        /// split the queries in one slice per replica
+        DISPATCH_SPLIT_EVEN,
+        /** split the queries in slices of slice_size that the replicas take
+         * as they become idle. The search starts on the replicas with the
+         * least outstanding work (so a small batch runs on one replica,
+         * not always the same), and slices that are still running after
+         * hedge_delay_ms are duplicated on an idle replica. Requires the
+         * threaded mode. */
+        DISPATCH_BALANCED,
+    };
+
+    DispatchMode dispatch_mode = DISPATCH_SPLIT_EVEN;
+
+    /// nb of queries per slice in DISPATCH_BALANCED mode
+    idx_t slice_size = 64;
+
+    /// a slice still running after this delay is searched again by an
+    /// idle replica, the first result is kept (< 0: no hedging)
+    double hedge_delay_ms = -1;
+
     /// The dimension that all sub-indices must share will be the dimension of
     /// the first sub-index added
     /// @param threaded do we use one thread per sub-index or do queries
@@ -67,6 +93,13 @@ class IndexReplicasTemplate : public ThreadedIndex<IndexT> {
             idx_t* labels,
             const SearchParameters* params = nullptr) const override;
 
+    /// nb of slices that were hedged since the creation of the index
+    size_t get_n_hedged() const;
+
+    /// nb of replicas with queued or running searches (the straggler of a
+    /// hedged slice keeps running after the search returns)
+    size_t get_n_busy_replicas() const;
+
     /// reconstructs from the first index
     void reconstruct(idx_t, component_t* v) const override;
 
@@ -78,6 +111,18 @@ class IndexReplicasTemplate : public ThreadedIndex<IndexT> {
     /// Called just after an index is added
     void onAfterAddIndex(IndexT* index) override;
 
+    /// search in DISPATCH_BALANCED mode
+    void search_balanced(
+            idx_t n,
+            const component_t* x,
+            idx_t k,
+            distance_t* distances,
+            idx_t* labels) const;
+
+    /// nb of searches running or queued on each replica, shared with the
+    /// searches that outlive a hedged search call
+    std::shared_ptr<ReplicaLoad> load;
+
     /// Called just after an index is removed
     void onAfterRemoveIndex(IndexT* index) override;
 };
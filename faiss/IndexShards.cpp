@@ -7,11 +7,23 @@
 
 #include <faiss/IndexShards.h>
 
+#include <algorithm>
 #include <cinttypes>
+#include <condition_variable>
 #include <cstdio>
 #include <functional>
-
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <typeinfo>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/IndexIVFAdditiveQuantizer.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/SearchResultBounds.h>
 #include <faiss/utils/Heap.h>
 #include <faiss/utils/WorkerThread.h>
 
@@ -40,6 +52,55 @@ void translate_labels(int64_t n, idx_t* labels, int64_t translation) {
     }
 }
 
+// IVF types whose search_preassigned collects the final results of the
+// search in its heaps, so that they can be pruned with the k-th distance of
+// the merged results. Subclasses are excluded: they may collect a larger
+// shortlist (IndexIVFPQR) or not accept the parameters (fast-scan).
+const IndexIVF* ivf_with_result_bounds(const Index* index) {
+    const std::type_info& t = typeid(*index);
+    if (t == typeid(IndexIVFFlat) || t == typeid(IndexIVFScalarQuantizer) ||
+        t == typeid(IndexIVFPQ) || t == typeid(IndexIVFResidualQuantizer) ||
+        t == typeid(IndexIVFLocalSearchQuantizer) ||
+        t == typeid(IndexIVFProductResidualQuantizer) ||
+        t == typeid(IndexIVFProductLocalSearchQuantizer)) {
+        return static_cast<const IndexIVF*>(index);
+    }
+    return nullptr;
+}
+
+// search a shard, with the shared bounds on the results if it can use them
+void search_shard(
+        const Index* index,
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        SearchResultBounds* bounds) {
+    const IndexIVF* index_ivf =
+            bounds ? ivf_with_result_bounds(index) : nullptr;
+    if (index_ivf) {
+        SearchParametersIVF params;
+        params.nprobe = index_ivf->nprobe;
+        params.max_codes = index_ivf->max_codes;
+        params.result_bounds = bounds;
+        index->search(n, x, k, distances, labels, &params);
+    } else {
+        index->search(n, x, k, distances, labels);
+    }
+}
+
+void search_shard(
+        const IndexBinary* index,
+        idx_t n,
+        const uint8_t* x,
+        idx_t k,
+        int32_t* distances,
+        idx_t* labels,
+        SearchResultBounds*) {
+    index->search(n, x, k, distances, labels);
+}
+
 } // anonymous namespace
 
 template <typename IndexT>
@@ -205,8 +266,6 @@ void IndexShardsTemplate<IndexT>::search(
 
     int64_t nshard = this->count();
 
-    std::vector<distance_t> all_distances(nshard * k * n);
-    std::vector<idx_t> all_labels(nshard * k * n);
     std::vector<int64_t> translations(nshard, 0);
 
     // Because we just called runOnIndex above, it is safe to access the
@@ -219,21 +278,118 @@ void IndexShardsTemplate<IndexT>::search(
         }
     }
 
-    auto fn = [n, k, x, &all_distances, &all_labels, &translations](
-                      int no, const IndexT* index) {
+    bool is_similarity = is_similarity_metric(this->metric_type);
+    size_t components_per_vec =
+            sizeof(component_t) == 1 ? (this->d + 7) / 8 : this->d;
+
+    // the shards search the queries by blocks, and merge the results of
+    // each block into the output as soon as they are available. The merges
+    // of a block are done in shard order, so that ties are resolved like in
+    // merge_knn_results (the lowest shard first).
+    idx_t bs = std::max(n, idx_t(1));
+    if (merge_block_size > 0) {
+        bs = std::max(idx_t(1), std::min(n, merge_block_size / k));
+    }
+    idx_t nblock = (n + bs - 1) / bs;
+    std::mutex merge_mutex;
+    std::condition_variable merge_cv;
+    std::vector<int> merge_turn(nblock, 0); ///< next shard to merge a block
+
+    for (idx_t i = 0; i < n * k; i++) {
+        labels[i] = -1;
+        distances[i] = is_similarity
+                ? CMax<distance_t, int>::Crev::neutral()
+                : CMin<distance_t, int>::Crev::neutral();
+    }
+
+    std::unique_ptr<SearchResultBounds> bounds;
+    if (share_result_bounds && std::is_same<IndexT, Index>::value) {
+        bounds = std::make_unique<SearchResultBounds>(n, is_similarity);
+    }
+
+    auto fn = [&](int no, const IndexT* index) {
         if (index->verbose) {
             printf("begin query shard %d on %" PRId64 " points\n", no, n);
         }
 
-        index->search(
-                n,
-                x,
-                k,
-                all_distances.data() + no * k * n,
-                all_labels.data() + no * k * n);
-
-        translate_labels(
-                n * k, all_labels.data() + no * k * n, translations[no]);
+        std::vector<distance_t> block_distances(bs * k);
+        std::vector<idx_t> block_labels(bs * k);
+        std::vector<distance_t> merge_distances(k);
+        std::vector<idx_t> merge_labels(k);
+
+        // wait for the turn of this shard to merge block b
+        auto wait_turn = [&](idx_t b) {
+            std::unique_lock<std::mutex> lock(merge_mutex);
+            merge_cv.wait(lock, [&] { return merge_turn[b] == no; });
+        };
+        auto pass_turn = [&](idx_t b) {
+            {
+                std::lock_guard<std::mutex> lock(merge_mutex);
+                merge_turn[b]++;
+            }
+            merge_cv.notify_all();
+        };
+
+        idx_t b = 0;
+        try {
+            for (; b < nblock; b++) {
+                idx_t i0 = b * bs;
+                idx_t i1 = std::min(i0 + bs, n);
+                std::unique_ptr<SearchResultBounds> block_bounds;
+                if (bounds) {
+                    block_bounds =
+                            std::make_unique<SearchResultBounds>(*bounds, i0);
+                }
+                search_shard(
+                        index,
+                        i1 - i0,
+                        x + i0 * components_per_vec,
+                        k,
+                        block_distances.data(),
+                        block_labels.data(),
+                        block_bounds.get());
+
+                translate_labels(
+                        (i1 - i0) * k, block_labels.data(), translations[no]);
+
+                wait_turn(b);
+                for (idx_t i = i0; i < i1; i++) {
+                    const distance_t* D_in =
+                            block_distances.data() + (i - i0) * k;
+                    const idx_t* I_in = block_labels.data() + (i - i0) * k;
+                    if (is_similarity) {
+                        merge_knn_result_into<idx_t, CMax<distance_t, int>>(
+                                k,
+                                D_in,
+                                I_in,
+                                distances + i * k,
+                                labels + i * k,
+                                merge_distances.data(),
+                                merge_labels.data());
+                    } else {
+                        merge_knn_result_into<idx_t, CMin<distance_t, int>>(
+                                k,
+                                D_in,
+                                I_in,
+                                distances + i * k,
+                                labels + i * k,
+                                merge_distances.data(),
+                                merge_labels.data());
+                    }
+                    if (bounds && labels[i * k + k - 1] >= 0) {
+                        bounds->tighten(i, distances[i * k + k - 1]);
+                    }
+                }
+                pass_turn(b);
+            }
+        } catch (...) {
+            // let the next shards merge the remaining blocks
+            for (; b < nblock; b++) {
+                wait_turn(b);
+                pass_turn(b);
+            }
+            throw;
+        }
 
         if (index->verbose) {
             printf("end query shard %d\n", no);
@@ -241,26 +397,6 @@ void IndexShardsTemplate<IndexT>::search(
     };
 
     this->runOnIndex(fn);
-
-    if (this->metric_type == METRIC_L2) {
-        merge_knn_results<idx_t, CMin<distance_t, int>>(
-                n,
-                k,
-                nshard,
-                all_distances.data(),
-                all_labels.data(),
-                distances,
-                labels);
-    } else {
-        merge_knn_results<idx_t, CMax<distance_t, int>>(
-                n,
-                k,
-                nshard,
-                all_distances.data(),
-                all_labels.data(),
-                distances,
-                labels);
-    }
 }
 
 // explicit instanciations
@@ -93,6 +93,21 @@ struct IndexShardsTemplate : public ThreadedIndex<IndexT> {
 
     bool successive_ids;
 
+    /// if > 0, the shards search the queries by blocks of about this many
+    /// results (queries * k). The results of a block are merged into the
+    /// output once the shard has computed them and the previous shards have
+    /// merged theirs, so the temporary results of each shard are at most
+    /// this size. 0 = all queries in one call per shard.
+    idx_t merge_block_size = 0;
+
+    /// Share the k-th distance of the merged results with the shards that
+    /// are still searching, so that they skip the candidates that cannot
+    /// enter the result. Used by the shards of the IVF types that collect
+    /// their final results in heaps (IndexIVFFlat, IndexIVFScalarQuantizer,
+    /// IndexIVFPQ and the IVF additive quantizers, with the default
+    /// parallel_mode), the other shards are searched without bounds.
+    bool share_result_bounds = false;
+
     /// Synchronize the top-level index (IndexShards) with data in the
     /// sub-indices
     virtual void syncWithSubIndexes();
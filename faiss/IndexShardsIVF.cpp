@@ -11,7 +11,10 @@
 
 #include <cinttypes>
 #include <cstdio>
+#include <cstring>
 #include <functional>
+#include <limits>
+#include <mutex>
 
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/utils/Heap.h>
@@ -52,6 +55,15 @@ IndexShardsIVF::IndexShardsIVF(
     is_trained = quantizer->is_trained && quantizer->ntotal == nlist;
 }
 
+void IndexShardsIVF::assign_lists_by_range() {
+    int nshard = count();
+    FAISS_THROW_IF_NOT(nshard > 0);
+    list_shard.resize(nlist);
+    for (size_t l = 0; l < nlist; l++) {
+        list_shard[l] = l * nshard / nlist;
+    }
+}
+
 void IndexShardsIVF::addIndex(Index* index) {
     auto index_ivf = dynamic_cast<IndexIVFInterface*>(index);
     FAISS_THROW_IF_NOT_MSG(index_ivf, "can only add IndexIVFs");
@@ -95,6 +107,12 @@ void IndexShardsIVF::add_with_ids(
         Index* index = indices_[i].first;
         all_index_ivf = all_index_ivf && dynamic_cast<IndexIVF*>(index);
     }
+    if (!list_shard.empty()) {
+        FAISS_THROW_IF_NOT_MSG(
+                all_index_ivf, "list_shard requires IndexIVF shards");
+        add_to_list_shards(n, x, xids);
+        return;
+    }
     if (!all_index_ivf) {
         IndexShardsTemplate<Index>::add_with_ids(n, x, xids);
         return;
@@ -155,6 +173,55 @@ void IndexShardsIVF::add_with_ids(
     syncWithSubIndexes();
 }
 
+void IndexShardsIVF::add_to_list_shards(
+        idx_t n,
+        const float* x,
+        const idx_t* xids) {
+    FAISS_THROW_IF_NOT(list_shard.size() == nlist);
+    int nshard = count();
+
+    std::vector<idx_t> Iq(n);
+    std::vector<float> Dq(n);
+    quantizer->search(n, x, 1, Dq.data(), Iq.data());
+
+    // vectors to add to each shard
+    std::vector<std::vector<idx_t>> shard_vectors(nshard);
+    for (idx_t i = 0; i < n; i++) {
+        int s = Iq[i] >= 0 ? list_shard[Iq[i]] : 0;
+        FAISS_THROW_IF_NOT_FMT(
+                s >= 0 && s < nshard, "invalid list_shard entry %d", s);
+        shard_vectors[s].push_back(i);
+    }
+
+    idx_t ntotal0 = ntotal;
+    auto fn = [&](int no, Index* index) {
+        const std::vector<idx_t>& subset = shard_vectors[no];
+        idx_t ns = subset.size();
+        if (ns == 0) {
+            return;
+        }
+        if (index->verbose) {
+            printf("begin add shard %d on %" PRId64 " points\n", no, ns);
+        }
+        std::vector<float> xs(ns * d);
+        std::vector<idx_t> ids(ns), keys(ns);
+        for (idx_t j = 0; j < ns; j++) {
+            idx_t i = subset[j];
+            memcpy(xs.data() + j * d, x + i * d, sizeof(float) * d);
+            ids[j] = xids ? xids[i] : ntotal0 + i;
+            keys[j] = Iq[i];
+        }
+        auto index_ivf = dynamic_cast<IndexIVF*>(index);
+        index_ivf->add_core(ns, xs.data(), ids.data(), keys.data());
+        if (index->verbose) {
+            printf("end add shard %d\n", no);
+        }
+    };
+
+    this->runOnIndex(fn);
+    syncWithSubIndexes();
+}
+
 void IndexShardsIVF::search(
         idx_t n,
         const component_t* x,
@@ -179,6 +246,20 @@ void IndexShardsIVF::search(
 
     quantizer->search(n, x, nprobe, Dq.data(), Iq.data());
 
+    if (!list_shard.empty()) {
+        search_list_shards(
+                n,
+                x,
+                k,
+                nprobe,
+                Iq.data(),
+                Dq.data(),
+                distances,
+                labels,
+                params);
+        return;
+    }
+
     int64_t nshard = this->count();
 
     std::vector<distance_t> all_distances(nshard * k * n);
@@ -242,4 +323,120 @@ void IndexShardsIVF::search(
     }
 }
 
+void IndexShardsIVF::search_list_shards(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        idx_t nprobe,
+        const idx_t* Iq,
+        const float* Dq,
+        float* distances,
+        idx_t* labels,
+        const IVFSearchParameters* params) const {
+    FAISS_THROW_IF_NOT(list_shard.size() == nlist);
+    int nshard = count();
+
+    // queries that probe at least one list of each shard
+    std::vector<std::vector<idx_t>> shard_queries(nshard);
+    for (idx_t i = 0; i < n; i++) {
+        for (idx_t j = 0; j < nprobe; j++) {
+            idx_t list_no = Iq[i * nprobe + j];
+            if (list_no < 0) {
+                continue;
+            }
+            std::vector<idx_t>& queries = shard_queries[list_shard[list_no]];
+            if (queries.empty() || queries.back() != i) {
+                queries.push_back(i);
+            }
+        }
+    }
+
+    bool is_similarity = is_similarity_metric(metric_type);
+    for (idx_t i = 0; i < n * k; i++) {
+        labels[i] = -1;
+        distances[i] = is_similarity ? -std::numeric_limits<float>::infinity()
+                                     : std::numeric_limits<float>::infinity();
+    }
+    std::mutex merge_mutex;
+
+    auto fn = [&](int no, const Index* indexIn) {
+        const std::vector<idx_t>& queries = shard_queries[no];
+        idx_t nq = queries.size();
+        if (nq == 0) {
+            return;
+        }
+        if (indexIn->verbose) {
+            printf("begin query shard %d on %" PRId64 " points\n", no, nq);
+        }
+        auto index = dynamic_cast<const IndexIVFInterface*>(indexIn);
+
+        // the queries, with the probes of the lists of the other shards
+        // disabled
+        std::vector<float> xs(nq * d);
+        std::vector<idx_t> Iqs(nq * nprobe);
+        std::vector<float> Dqs(nq * nprobe);
+        for (idx_t q = 0; q < nq; q++) {
+            idx_t i = queries[q];
+            memcpy(xs.data() + q * d, x + i * d, sizeof(float) * d);
+            for (idx_t j = 0; j < nprobe; j++) {
+                idx_t list_no = Iq[i * nprobe + j];
+                Iqs[q * nprobe + j] =
+                        list_no >= 0 && list_shard[list_no] == no ? list_no
+                                                                  : -1;
+                Dqs[q * nprobe + j] = Dq[i * nprobe + j];
+            }
+        }
+
+        SearchParametersIVF sub_params;
+        sub_params.nprobe = nprobe;
+        sub_params.max_codes = params ? params->max_codes : index->max_codes;
+        sub_params.sel = params ? params->sel : nullptr;
+
+        std::vector<float> Ds(nq * k);
+        std::vector<idx_t> Is(nq * k);
+        index->search_preassigned(
+                nq,
+                xs.data(),
+                k,
+                Iqs.data(),
+                Dqs.data(),
+                Ds.data(),
+                Is.data(),
+                false,
+                &sub_params);
+
+        std::vector<float> merge_distances(k);
+        std::vector<idx_t> merge_labels(k);
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (idx_t q = 0; q < nq; q++) {
+            idx_t i = queries[q];
+            if (is_similarity) {
+                merge_knn_result_into<idx_t, CMax<float, int>>(
+                        k,
+                        Ds.data() + q * k,
+                        Is.data() + q * k,
+                        distances + i * k,
+                        labels + i * k,
+                        merge_distances.data(),
+                        merge_labels.data());
+            } else {
+                merge_knn_result_into<idx_t, CMin<float, int>>(
+                        k,
+                        Ds.data() + q * k,
+                        Is.data() + q * k,
+                        distances + i * k,
+                        labels + i * k,
+                        merge_distances.data(),
+                        merge_labels.data());
+            }
+        }
+
+        if (indexIn->verbose) {
+            printf("end query shard %d\n", no);
+        }
+    };
+
+    this->runOnIndex(fn);
+}
+
 } // namespace faiss
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include <faiss/IndexIVF.h>
 #include <faiss/IndexShards.h>
 
@@ -15,14 +17,28 @@ namespace faiss {
 /**
  * IndexShards with a common coarse quantizer. All the indexes added should be
  * IndexIVFInterface indexes so that the search_precomputed can be called.
+ *
+ * The shards can also own disjoint sets of inverted lists (see list_shard).
+ * Then the coarse quantization of a query is used to send it only to the
+ * shards that hold some of its nprobe lists.
  */
 struct IndexShardsIVF : public IndexShards, Level1Quantizer {
+    /** If non-empty (size nlist), inverted list l is held by shard
+     * list_shard[l]. The vectors are added to the shard of their list, with
+     * global ids (successive_ids is ignored), and the searches are routed
+     * to the shards that hold the probed lists. The shards should be
+     * IndexIVFs. */
+    std::vector<int> list_shard;
+
     explicit IndexShardsIVF(
             Index* quantizer,
             size_t nlist,
             bool threaded = false,
             bool successive_ids = true);
 
+    /// set list_shard so that each shard holds a contiguous range of lists
+    void assign_lists_by_range();
+
     void addIndex(Index* index) override;
 
     void add_with_ids(idx_t n, const component_t* x, const idx_t* xids)
@@ -37,6 +53,22 @@ struct IndexShardsIVF : public IndexShards, Level1Quantizer {
             distance_t* distances,
             idx_t* labels,
             const SearchParameters* params = nullptr) const override;
+
+   protected:
+    /// add to the shards that hold the lists of the vectors
+    void add_to_list_shards(idx_t n, const float* x, const idx_t* xids);
+
+    /// search only on the shards that hold the probed lists
+    void search_list_shards(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            idx_t nprobe,
+            const idx_t* Iq,
+            const float* Dq,
+            float* distances,
+            idx_t* labels,
+            const IVFSearchParameters* params) const;
 };
 
 } // namespace faiss
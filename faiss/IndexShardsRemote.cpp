@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/IndexShardsRemote.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <poll.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+IndexShardsRemote::IndexShardsRemote() : Index(0, METRIC_L2) {}
+
+void IndexShardsRemote::add_shard(
+        const std::vector<std::string>& replica_endpoints) {
+    FAISS_THROW_IF_NOT(!replica_endpoints.empty());
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Replica> replicas(replica_endpoints.size());
+    const SearchClient* first = nullptr;
+    std::string error;
+    for (size_t i = 0; i < replicas.size(); i++) {
+        replicas[i].endpoint = replica_endpoints[i];
+        try {
+            replicas[i].client.reset(
+                    new SearchClient(replica_endpoints[i], shard_timeout_ms));
+        } catch (const FaissException& e) {
+            error = e.what();
+            replicas[i].latency_ms = std::numeric_limits<double>::infinity();
+            continue;
+        }
+        const SearchClient* c = replicas[i].client.get();
+        if (first) {
+            FAISS_THROW_IF_NOT_FMT(
+                    c->d == first->d && c->ntotal == first->ntotal,
+                    "replica %s differs from %s",
+                    c->endpoint.c_str(),
+                    first->endpoint.c_str());
+        } else {
+            first = c;
+        }
+    }
+    FAISS_THROW_IF_NOT_FMT(
+            first, "no replica of the shard is reachable: %s", error.c_str());
+    if (shards.empty()) {
+        d = first->d;
+        metric_type = first->metric_type;
+    } else {
+        FAISS_THROW_IF_NOT_MSG(
+                first->d == d && first->metric_type == metric_type,
+                "shard has a different dimension or metric");
+    }
+    shards.push_back(std::move(replicas));
+    shard_ntotal.push_back(first->ntotal);
+    ntotal += first->ntotal;
+}
+
+void IndexShardsRemote::add(idx_t, const float*) {
+    FAISS_THROW_MSG("vectors should be added on the shard servers");
+}
+
+void IndexShardsRemote::reset() {
+    FAISS_THROW_MSG("vectors should be removed on the shard servers");
+}
+
+namespace {
+
+struct PendingRequest {
+    size_t shard;
+    size_t replica;
+    uint64_t request_id;
+    double t_sent;
+};
+
+} // namespace
+
+void IndexShardsRemote::search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        const SearchParameters* params) const {
+    FAISS_THROW_IF_NOT_MSG(
+            !params, "search parameters are not supported for remote shards");
+    FAISS_THROW_IF_NOT(k > 0);
+    FAISS_THROW_IF_NOT(!shards.empty());
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t nshard = shards.size();
+    std::vector<float> all_distances(nshard * n * k);
+    std::vector<idx_t> all_labels(nshard * n * k);
+
+    enum ShardState { PENDING, DONE, FAILED };
+    std::vector<ShardState> state(nshard, PENDING);
+    std::vector<std::vector<bool>> tried(nshard);
+    std::vector<double> t_last_sent(nshard);
+    std::vector<PendingRequest> pending;
+    double t0 = getmillisecs();
+    // connections and sends are bounded by the shard deadline
+    double deadline = shard_timeout_ms < 0 ? -1 : t0 + shard_timeout_ms;
+
+    // send the request of shard s to the fastest replica not tried yet
+    auto send_to_next_replica = [&](size_t s) {
+        std::vector<Replica>& replicas = shards[s];
+        tried[s].resize(replicas.size(), false);
+        for (;;) {
+            size_t best = replicas.size();
+            for (size_t r = 0; r < replicas.size(); r++) {
+                if (!tried[s][r] &&
+                    (best == replicas.size() ||
+                     replicas[r].latency_ms < replicas[best].latency_ms)) {
+                    best = r;
+                }
+            }
+            if (best == replicas.size()) {
+                return false;
+            }
+            tried[s][best] = true;
+            Replica& rep = replicas[best];
+            try {
+                if (!rep.client) {
+                    // the other shards wait during the connection, so a
+                    // hung replica is given up at the hedging delay
+                    double timeout = hedge_delay_ms;
+                    if (deadline >= 0) {
+                        double remaining = deadline - getmillisecs();
+                        timeout = timeout < 0
+                                ? std::max(remaining, 0.0)
+                                : std::min(timeout, std::max(remaining, 0.0));
+                    }
+                    rep.client.reset(new SearchClient(rep.endpoint, timeout));
+                    rep.latency_ms = 0;
+                }
+                uint64_t rid = rep.client->send_search(n, x, k, deadline);
+                double now = getmillisecs();
+                pending.push_back({s, best, rid, now});
+                t_last_sent[s] = now;
+                return true;
+            } catch (const FaissException&) {
+                // try the replica last in the next searches
+                rep.client.reset();
+                rep.latency_ms = std::numeric_limits<double>::infinity();
+            }
+        }
+    };
+
+    auto shard_has_pending = [&](size_t s) {
+        for (const PendingRequest& p : pending) {
+            if (p.shard == s) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (size_t s = 0; s < nshard; s++) {
+        if (!send_to_next_replica(s)) {
+            state[s] = FAILED;
+        }
+    }
+
+    std::vector<pollfd> pfds;
+    for (;;) {
+        // collect the responses that arrived
+        for (size_t i = 0; i < pending.size(); i++) {
+            PendingRequest& p = pending[i];
+            if (state[p.shard] != PENDING) {
+                continue;
+            }
+            Replica& rep = shards[p.shard][p.replica];
+            try {
+                if (rep.client->receive_search(
+                            p.request_id,
+                            n,
+                            k,
+                            all_distances.data() + p.shard * n * k,
+                            all_labels.data() + p.shard * n * k,
+                            0)) {
+                    state[p.shard] = DONE;
+                    double dt = getmillisecs() - p.t_sent;
+                    rep.latency_ms = rep.latency_ms == 0
+                            ? dt
+                            : 0.8 * rep.latency_ms + 0.2 * dt;
+                }
+            } catch (const FaissException&) {
+                // the server reported an error or the connection broke
+                rep.client.reset();
+                rep.latency_ms = std::numeric_limits<double>::infinity();
+                p.request_id = 0; // marks the request as dead
+            }
+        }
+        std::vector<PendingRequest> still_pending;
+        for (const PendingRequest& p : pending) {
+            if (p.request_id == 0) {
+                continue;
+            }
+            if (state[p.shard] == PENDING) {
+                still_pending.push_back(p);
+            } else {
+                // another replica was faster
+                Replica& rep = shards[p.shard][p.replica];
+                rep.latency_ms =
+                        std::max(rep.latency_ms, getmillisecs() - p.t_sent);
+            }
+        }
+        pending.swap(still_pending);
+
+        // failovers, hedges and timeouts
+        double now = getmillisecs();
+        double next_event = std::numeric_limits<double>::infinity();
+        bool any_pending = false;
+        for (size_t s = 0; s < nshard; s++) {
+            if (state[s] != PENDING) {
+                continue;
+            }
+            if (!shard_has_pending(s) && !send_to_next_replica(s)) {
+                state[s] = FAILED;
+                continue;
+            }
+            if (shard_timeout_ms >= 0) {
+                if (now >= t0 + shard_timeout_ms) {
+                    state[s] = FAILED;
+                    continue;
+                }
+                next_event = std::min(next_event, t0 + shard_timeout_ms);
+            }
+            if (hedge_delay_ms >= 0) {
+                double t_hedge = t_last_sent[s] + hedge_delay_ms;
+                if (now >= t_hedge) {
+                    if (send_to_next_replica(s)) {
+                        n_hedged++;
+                        t_hedge = t_last_sent[s] + hedge_delay_ms;
+                    } else {
+                        t_hedge = std::numeric_limits<double>::infinity();
+                    }
+                }
+                next_event = std::min(next_event, t_hedge);
+            }
+            any_pending = true;
+        }
+        if (!any_pending) {
+            break;
+        }
+
+        pfds.clear();
+        for (const PendingRequest& p : pending) {
+            if (state[p.shard] == PENDING) {
+                int fd = shards[p.shard][p.replica].client->get_fd();
+                pfds.push_back({fd, POLLIN, 0});
+            }
+        }
+        int timeout = -1;
+        if (std::isfinite(next_event)) {
+            timeout = std::max(0, int(next_event - getmillisecs()) + 1);
+        }
+        poll(pfds.data(), pfds.size(), timeout);
+    }
+
+    n_failed_shards = 0;
+    for (size_t s = 0; s < nshard; s++) {
+        if (state[s] == FAILED) {
+            FAISS_THROW_IF_NOT_FMT(
+                    allow_partial_results,
+                    "shard %zu (%s) failed or timed out",
+                    s,
+                    shards[s][0].endpoint.c_str());
+            n_failed_shards++;
+            std::fill_n(all_labels.data() + s * n * k, n * k, -1);
+        }
+    }
+
+    if (successive_ids) {
+        idx_t ofs = 0;
+        for (size_t s = 0; s < nshard; s++) {
+            idx_t* I = all_labels.data() + s * n * k;
+            for (idx_t i = 0; ofs > 0 && i < n * k; i++) {
+                if (I[i] >= 0) {
+                    I[i] += ofs;
+                }
+            }
+            ofs += shard_ntotal[s];
+        }
+    }
+
+    if (metric_type == METRIC_L2) {
+        merge_knn_results<idx_t, CMin<float, int>>(
+                n,
+                k,
+                nshard,
+                all_distances.data(),
+                all_labels.data(),
+                distances,
+                labels);
+    } else {
+        merge_knn_results<idx_t, CMax<float, int>>(
+                n,
+                k,
+                nshard,
+                all_distances.data(),
+                all_labels.data(),
+                distances,
+                labels);
+    }
+}
+
+} // namespace faiss
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <faiss/Index.h>
+#include <faiss/SearchServer.h>
+
+namespace faiss {
+
+/** Index whose shards are served by remote SearchServers.
+ *
+ * This is the remote counterpart of IndexShards: a search is sent to all
+ * the shards concurrently and the partial results are merged with
+ * merge_knn_results. Each shard can be served by several replicas:
+ *
+ * - the request is first sent to the replica with the lowest recent
+ *   latency,
+ * - if it has not answered after hedge_delay_ms, the request is also sent
+ *   to another replica and the first response is used (hedged request),
+ * - a replica that fails is dropped from the search and reconnected at the
+ *   next one, where it is tried last.
+ *
+ * A shard that did not answer within shard_timeout_ms, or whose replicas
+ * all failed, either makes the search throw, or is ignored if
+ * allow_partial_results is set.
+ *
+ * The index is read-only: vectors are added to the shards on the server
+ * side. Concurrent searches are serialized.
+ */
+struct IndexShardsRemote : Index {
+    struct Replica {
+        std::string endpoint;
+        std::unique_ptr<SearchClient> client;
+        double latency_ms = 0; ///< moving average of the response times
+    };
+
+    /// replicas of each shard (the connections are updated by the searches)
+    mutable std::vector<std::vector<Replica>> shards;
+
+    /// delay before a request is sent to another replica (< 0: never). It
+    /// also bounds the reconnections to the replicas at search time.
+    double hedge_delay_ms = -1;
+
+    /// time after which a shard is given up (< 0: no timeout). It also
+    /// bounds the connections to the replicas and the sending of the
+    /// requests.
+    double shard_timeout_ms = -1;
+
+    /// ignore the shards that fail instead of throwing
+    bool allow_partial_results = false;
+
+    /// if true, the ids of shard i are shifted by the ntotal of the previous
+    /// shards (like IndexShards). Otherwise the shard ids are kept, which
+    /// assumes they were added with add_with_ids.
+    bool successive_ids = false;
+
+    /// nb of shards that failed in the last search
+    mutable int n_failed_shards = 0;
+
+    /// nb of hedged requests sent in total
+    mutable size_t n_hedged = 0;
+
+    /// the dimension and metric are those of the first shard
+    IndexShardsRemote();
+
+    /** Connect to the replicas of a new shard. Replicas that cannot be
+     * reached are retried at search time, but at least one should be up. */
+    void add_shard(const std::vector<std::string>& replica_endpoints);
+
+    void add_shard(const std::string& endpoint) {
+        add_shard(std::vector<std::string>{endpoint});
+    }
+
+    void add(idx_t n, const float* x) override;
+
+    void reset() override;
+
+    void search(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            const SearchParameters* params = nullptr) const override;
+
+   private:
+    /// ntotal of each shard, at connection time
+    std::vector<idx_t> shard_ntotal;
+
+    /// the replica clients are modified by the searches
+    mutable std::mutex mutex;
+};
+
+} // namespace faiss
@@ -0,0 +1,1072 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/SearchServer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/utils.h>
+
+/* Wire protocol
+ *
+ * Each message is a MessageHeader followed by header.size bytes of payload.
+ * All integers and floats are in the native byte order of the machines
+ * (which are assumed to be the same).
+ *
+ *   MSG_INFO    client -> server: empty
+ *               server -> client: int32 d, int32 metric_type, int64 ntotal
+ *   MSG_SEARCH  client -> server: int64 n, int64 k, float x[n * d]
+ *   MSG_RESULT  server -> client: int64 n, int64 k,
+ *                                 float distances[n * k], int64 labels[n * k]
+ *   MSG_ERROR   server -> client: error message (not null-terminated)
+ *
+ * The response has the request_id of the request.
+ */
+
+namespace faiss {
+
+namespace {
+
+const uint32_t message_magic = 0x71737366; // "fssq"
+
+enum MessageType : uint32_t {
+    MSG_INFO = 1,
+    MSG_SEARCH = 2,
+    MSG_RESULT = 3,
+    MSG_ERROR = 4,
+};
+
+struct MessageHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t request_id;
+    uint64_t size; ///< size of the payload
+};
+
+static_assert(sizeof(MessageHeader) == 24, "unexpected header padding");
+
+/// larger responses are considered as a protocol error by the client (the
+/// server bounds the requests from its limits)
+const uint64_t max_message_size = uint64_t(1) << 36;
+
+#ifdef MSG_NOSIGNAL
+const int send_flags = MSG_NOSIGNAL;
+#else
+const int send_flags = 0;
+#endif
+
+void set_socket_options(int fd, bool nonblocking) {
+    if (nonblocking) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    int one = 1;
+    // fails harmlessly on Unix domain sockets
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+void fill_unix_address(sockaddr_un& addr, const char* path) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    FAISS_THROW_IF_NOT_FMT(
+            strlen(path) < sizeof(addr.sun_path),
+            "socket path %s too long",
+            path);
+    strcpy(addr.sun_path, path);
+}
+
+/// poll timeout until deadline (getmillisecs() time, < 0: none)
+int poll_timeout(double deadline) {
+    if (deadline < 0) {
+        return -1;
+    }
+    double remaining = deadline - getmillisecs();
+    return remaining > 0 ? int(remaining) + 1 : 0;
+}
+
+/// connect a blocking socket before the deadline, returns 0 or an errno
+int connect_before(
+        int fd,
+        const sockaddr* addr,
+        socklen_t addrlen,
+        double deadline) {
+    if (deadline < 0) {
+        return connect(fd, addr, addrlen) == 0 ? 0 : errno;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int err = 0;
+    if (connect(fd, addr, addrlen) != 0) {
+        err = errno;
+    }
+    if (err == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        int ret;
+        do {
+            ret = poll(&pfd, 1, poll_timeout(deadline));
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            err = errno;
+        } else if (ret == 0) {
+            err = ETIMEDOUT;
+        } else {
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        }
+    }
+    fcntl(fd, F_SETFL, flags);
+    return err;
+}
+
+/** connected socket for "host:port" or "unix:path"
+ * @param deadline  of the connection, in getmillisecs() time (< 0: none)
+ */
+int connect_endpoint(const std::string& endpoint, double deadline) {
+    if (endpoint.compare(0, 5, "unix:") == 0) {
+        sockaddr_un addr;
+        fill_unix_address(addr, endpoint.c_str() + 5);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        FAISS_THROW_IF_NOT_FMT(fd >= 0, "socket: %s", strerror(errno));
+        int err = connect_before(fd, (sockaddr*)&addr, sizeof(addr), deadline);
+        if (err != 0) {
+            close(fd);
+            FAISS_THROW_FMT(
+                    "could not connect to %s: %s",
+                    endpoint.c_str(),
+                    strerror(err));
+        }
+        set_socket_options(fd, false);
+        return fd;
+    }
+
+    size_t colon = endpoint.rfind(':');
+    FAISS_THROW_IF_NOT_FMT(
+            colon != std::string::npos,
+            "endpoint %s should be host:port or unix:path",
+            endpoint.c_str());
+    std::string host = endpoint.substr(0, colon);
+    std::string port = endpoint.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    FAISS_THROW_IF_NOT_FMT(
+            ret == 0,
+            "could not resolve %s: %s",
+            endpoint.c_str(),
+            gai_strerror(ret));
+    int fd = -1;
+    int err = 0;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        err = connect_before(fd, ai->ai_addr, ai->ai_addrlen, deadline);
+        if (err == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    FAISS_THROW_IF_NOT_FMT(
+            fd >= 0,
+            "could not connect to %s: %s",
+            endpoint.c_str(),
+            strerror(err));
+    set_socket_options(fd, false);
+    return fd;
+}
+
+/// write all the bytes on a blocking socket before the deadline
+/// (getmillisecs() time, < 0: none)
+void send_all(int fd, const void* data, size_t size, double deadline) {
+    const uint8_t* p = (const uint8_t*)data;
+    int flags = send_flags;
+    if (deadline >= 0) {
+        flags |= MSG_DONTWAIT;
+    }
+    while (size > 0) {
+        if (deadline >= 0) {
+            pollfd pfd = {fd, POLLOUT, 0};
+            int ret = poll(&pfd, 1, poll_timeout(deadline));
+            if (ret < 0) {
+                FAISS_THROW_IF_NOT_FMT(
+                        errno == EINTR, "poll: %s", strerror(errno));
+                continue;
+            }
+            FAISS_THROW_IF_NOT_MSG(ret > 0, "send timed out");
+        }
+        ssize_t ret = send(fd, p, size, flags);
+        if (ret < 0) {
+            FAISS_THROW_IF_NOT_FMT(
+                    errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK,
+                    "send: %s",
+                    strerror(errno));
+            continue;
+        }
+        p += ret;
+        size -= ret;
+    }
+}
+
+void append_message(
+        std::vector<uint8_t>& buf,
+        uint32_t type,
+        uint64_t request_id,
+        const void* payload1,
+        size_t size1,
+        const void* payload2 = nullptr,
+        size_t size2 = 0) {
+    MessageHeader header = {message_magic, type, request_id, size1 + size2};
+    size_t ofs = buf.size();
+    buf.resize(ofs + sizeof(header) + size1 + size2);
+    memcpy(buf.data() + ofs, &header, sizeof(header));
+    if (size1 > 0) {
+        memcpy(buf.data() + ofs + sizeof(header), payload1, size1);
+    }
+    if (size2 > 0) {
+        memcpy(buf.data() + ofs + sizeof(header) + size1, payload2, size2);
+    }
+}
+
+} // namespace
+
+/***************************************************************
+ * Server
+ ***************************************************************/
+
+namespace {
+
+struct Connection {
+    int fd;
+    size_t io_thread;
+
+    /// received bytes, only accessed by the I/O thread
+    std::vector<uint8_t> inbuf;
+
+    std::mutex mutex; ///< protects outbuf and out_pos
+    std::vector<uint8_t> outbuf;
+    size_t out_pos = 0;
+
+    Connection(int fd, size_t io_thread) : fd(fd), io_thread(io_thread) {}
+};
+
+struct SearchRequest {
+    std::shared_ptr<Connection> conn;
+    uint64_t request_id;
+    idx_t n;
+    idx_t k;
+    std::vector<float> x;
+    double t_arrival; ///< getmillisecs() time
+};
+
+struct IOThread {
+    std::thread thread;
+    int wake_fds[2] = {-1, -1};
+
+    std::mutex mutex; ///< protects new_conns
+    std::vector<std::shared_ptr<Connection>> new_conns;
+
+    /// only accessed by the thread
+    std::vector<std::shared_ptr<Connection>> conns;
+
+    void wake() {
+        char c = 0;
+        // if the pipe is full, the thread will wake up anyways
+        ssize_t ret = write(wake_fds[1], &c, 1);
+        (void)ret;
+    }
+};
+
+} // namespace
+
+struct SearchServerState {
+    SearchServer* server;
+
+    std::vector<int> listen_fds;
+    std::vector<std::string> unix_paths;
+    bool started = false;
+
+    std::vector<std::unique_ptr<IOThread>> io_threads;
+    std::atomic<bool> stop_io{false};
+    size_t next_io_thread = 0;
+
+    std::vector<std::thread> search_threads;
+    std::mutex mutex; ///< protects queue and stopping
+    std::condition_variable cv;
+    std::deque<SearchRequest> queue;
+    bool stopping = false;
+
+    explicit SearchServerState(SearchServer* server) : server(server) {}
+
+    void send_response(
+            Connection& conn,
+            uint32_t type,
+            uint64_t request_id,
+            const void* payload1,
+            size_t size1,
+            const void* payload2 = nullptr,
+            size_t size2 = 0) {
+        {
+            std::lock_guard<std::mutex> lock(conn.mutex);
+            append_message(
+                    conn.outbuf,
+                    type,
+                    request_id,
+                    payload1,
+                    size1,
+                    payload2,
+                    size2);
+        }
+        io_threads[conn.io_thread]->wake();
+    }
+
+    void send_error(Connection& conn, uint64_t request_id, const char* msg) {
+        send_response(conn, MSG_ERROR, request_id, msg, strlen(msg));
+    }
+
+    /// handle a complete message received on a connection
+    void handle_message(
+            const std::shared_ptr<Connection>& conn,
+            const MessageHeader& header,
+            const uint8_t* payload) {
+        const Index* index = server->index;
+        if (header.type == MSG_INFO) {
+            uint8_t info[16];
+            int32_t d = index->d;
+            int32_t metric = index->metric_type;
+            int64_t ntotal = index->ntotal;
+            memcpy(info, &d, 4);
+            memcpy(info + 4, &metric, 4);
+            memcpy(info + 8, &ntotal, 8);
+            send_response(
+                    *conn, MSG_INFO, header.request_id, info, sizeof(info));
+        } else if (header.type == MSG_SEARCH) {
+            int64_t nk[2] = {-1, -1};
+            if (header.size >= sizeof(nk)) {
+                memcpy(nk, payload, sizeof(nk));
+            }
+            // n and k are bounded before computing sizes from them, so
+            // that the products cannot overflow
+            if (nk[0] < 0 || nk[1] <= 0 ||
+                nk[0] > server->max_request_queries ||
+                header.size - sizeof(nk) !=
+                        uint64_t(nk[0]) * index->d * sizeof(float)) {
+                send_error(*conn, header.request_id, "invalid search request");
+                return;
+            }
+            if (nk[1] > server->max_k ||
+                nk[0] * nk[1] > server->max_request_results) {
+                send_error(
+                        *conn,
+                        header.request_id,
+                        "search request exceeds the server limits");
+                return;
+            }
+            SearchRequest req;
+            req.conn = conn;
+            req.request_id = header.request_id;
+            req.n = nk[0];
+            req.k = nk[1];
+            req.x.resize(req.n * index->d);
+            memcpy(req.x.data(),
+                   payload + sizeof(nk),
+                   sizeof(float) * req.x.size());
+            req.t_arrival = getmillisecs();
+            server->n_requests++;
+            server->n_queries += req.n;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(req));
+            }
+            cv.notify_one();
+        } else {
+            send_error(*conn, header.request_id, "unknown message type");
+        }
+    }
+
+    /// payload size of the largest valid request (a search request with
+    /// max_request_queries queries)
+    uint64_t max_request_size() const {
+        return 2 * sizeof(int64_t) +
+                uint64_t(server->max_request_queries) * server->index->d *
+                sizeof(float);
+    }
+
+    /// handle the complete messages in the input buffer, returns false on
+    /// a protocol error
+    bool handle_messages(const std::shared_ptr<Connection>& conn) {
+        std::vector<uint8_t>& buf = conn->inbuf;
+        size_t pos = 0;
+        bool ok = true;
+        while (buf.size() - pos >= sizeof(MessageHeader)) {
+            MessageHeader header;
+            memcpy(&header, buf.data() + pos, sizeof(header));
+            // the header is checked before its payload is buffered
+            if (header.magic != message_magic ||
+                header.size > max_request_size()) {
+                ok = false;
+                break;
+            }
+            if (buf.size() - pos - sizeof(header) < header.size) {
+                break;
+            }
+            handle_message(conn, header, buf.data() + pos + sizeof(header));
+            pos += sizeof(header) + header.size;
+        }
+        buf.erase(buf.begin(), buf.begin() + pos);
+        return ok;
+    }
+
+    /// read the available data, returns false if the connection should be
+    /// closed
+    bool receive(const std::shared_ptr<Connection>& conn) {
+        std::vector<uint8_t>& buf = conn->inbuf;
+        for (;;) {
+            size_t ofs = buf.size();
+            buf.resize(ofs + 65536);
+            ssize_t ret = recv(conn->fd, buf.data() + ofs, 65536, 0);
+            buf.resize(ofs + std::max(ret, ssize_t(0)));
+            if (ret > 0) {
+                // parse as the data arrives, so that the buffer never
+                // holds more than one request plus one read
+                if (!handle_messages(conn)) {
+                    return false;
+                }
+                continue;
+            }
+            if (ret == 0) {
+                return false; // eof
+            } else if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+    /// write the pending responses, returns false on error
+    bool flush(Connection& conn) {
+        std::lock_guard<std::mutex> lock(conn.mutex);
+        while (conn.out_pos < conn.outbuf.size()) {
+            ssize_t ret = send(
+                    conn.fd,
+                    conn.outbuf.data() + conn.out_pos,
+                    conn.outbuf.size() - conn.out_pos,
+                    send_flags);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            conn.out_pos += ret;
+        }
+        conn.outbuf.clear();
+        conn.out_pos = 0;
+        return true;
+    }
+
+    void accept_connections(int listen_fd) {
+        for (;;) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break; // EAGAIN or transient error
+            }
+            set_socket_options(fd, true);
+            size_t t = next_io_thread++ % io_threads.size();
+            IOThread& io = *io_threads[t];
+            {
+                std::lock_guard<std::mutex> lock(io.mutex);
+                io.new_conns.push_back(std::make_shared<Connection>(fd, t));
+            }
+            io.wake();
+        }
+    }
+
+    void io_loop(size_t t) {
+        IOThread& io = *io_threads[t];
+        // the first thread also accepts the connections
+        size_t n_listen = t == 0 ? listen_fds.size() : 0;
+        std::vector<pollfd> pfds;
+
+        while (!stop_io) {
+            {
+                std::lock_guard<std::mutex> lock(io.mutex);
+                for (auto& conn : io.new_conns) {
+                    io.conns.push_back(std::move(conn));
+                }
+                io.new_conns.clear();
+            }
+            pfds.clear();
+            pfds.push_back({io.wake_fds[0], POLLIN, 0});
+            for (size_t i = 0; i < n_listen; i++) {
+                pfds.push_back({listen_fds[i], POLLIN, 0});
+            }
+            for (auto& conn : io.conns) {
+                short events = POLLIN;
+                {
+                    std::lock_guard<std::mutex> lock(conn->mutex);
+                    if (conn->out_pos < conn->outbuf.size()) {
+                        events |= POLLOUT;
+                    }
+                }
+                pfds.push_back({conn->fd, events, 0});
+            }
+
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                FAISS_ASSERT_FMT(errno == EINTR, "poll: %s", strerror(errno));
+                continue;
+            }
+
+            if (pfds[0].revents) {
+                char tmp[256];
+                while (read(io.wake_fds[0], tmp, sizeof(tmp)) > 0) {
+                }
+            }
+            for (size_t i = 0; i < n_listen; i++) {
+                if (pfds[1 + i].revents) {
+                    accept_connections(listen_fds[i]);
+                }
+            }
+
+            size_t j = 0;
+            for (size_t i = 0; i < io.conns.size(); i++) {
+                std::shared_ptr<Connection>& conn = io.conns[i];
+                short revents = pfds[1 + n_listen + i].revents;
+                bool ok = true;
+                if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ok = receive(conn);
+                }
+                // also flush the responses that were queued in the meantime
+                ok = ok && flush(*conn);
+                if (ok) {
+                    io.conns[j++] = std::move(conn);
+                } else {
+                    // the pending searches keep the object alive, their
+                    // responses are dropped
+                    close(conn->fd);
+                    conn->fd = -1;
+                }
+            }
+            io.conns.resize(j);
+        }
+
+        for (auto& conn : io.conns) {
+            close(conn->fd);
+        }
+        io.conns.clear();
+        io.new_conns.clear();
+    }
+
+    void run_batch(std::vector<SearchRequest>& batch, idx_t k) {
+        const Index* index = server->index;
+        size_t d = index->d;
+        idx_t nq = 0;
+        for (const SearchRequest& req : batch) {
+            nq += req.n;
+        }
+        // allocation failures are reported to the clients as well
+        std::vector<float> D;
+        std::vector<idx_t> I;
+        std::string error;
+        try {
+            std::vector<float> xbatch;
+            const float* x = batch[0].x.data();
+            if (batch.size() > 1) {
+                xbatch.resize(nq * d);
+                idx_t i0 = 0;
+                for (const SearchRequest& req : batch) {
+                    memcpy(xbatch.data() + i0 * d,
+                           req.x.data(),
+                           sizeof(float) * req.x.size());
+                    i0 += req.n;
+                }
+                x = xbatch.data();
+            }
+            D.resize(nq * k);
+            I.resize(nq * k);
+            index->search(nq, x, k, D.data(), I.data());
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        server->n_batches++;
+
+        idx_t i0 = 0;
+        for (SearchRequest& req : batch) {
+            if (!error.empty()) {
+                send_error(*req.conn, req.request_id, error.c_str());
+                continue;
+            }
+            // contiguous payload: n, k, distances, labels
+            std::vector<uint8_t> payload;
+            try {
+                payload.resize(
+                        16 + req.n * k * (sizeof(float) + sizeof(idx_t)));
+            } catch (const std::bad_alloc&) {
+                send_error(*req.conn, req.request_id, "out of memory");
+                i0 += req.n;
+                continue;
+            }
+            int64_t nk[2] = {req.n, k};
+            memcpy(payload.data(), nk, 16);
+            memcpy(payload.data() + 16,
+                   D.data() + i0 * k,
+                   sizeof(float) * req.n * k);
+            memcpy(payload.data() + 16 + sizeof(float) * req.n * k,
+                   I.data() + i0 * k,
+                   sizeof(idx_t) * req.n * k);
+            send_response(
+                    *req.conn,
+                    MSG_RESULT,
+                    req.request_id,
+                    payload.data(),
+                    payload.size());
+            i0 += req.n;
+        }
+    }
+
+    void search_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (queue.empty()) {
+                cv.wait(lock);
+                continue;
+            }
+            // batch the oldest request with the next ones that have the
+            // same k
+            idx_t k = queue.front().k;
+            idx_t nq = 0;
+            for (const SearchRequest& req : queue) {
+                if (req.k == k) {
+                    nq += req.n;
+                    if (nq >= server->max_batch_size) {
+                        break;
+                    }
+                }
+            }
+            double wait_ms =
+                    queue.front().t_arrival + server->max_delay_ms -
+                    getmillisecs();
+            if (nq < server->max_batch_size && wait_ms > 0) {
+                cv.wait_for(
+                        lock,
+                        std::chrono::microseconds(int64_t(wait_ms * 1000) + 1));
+                continue;
+            }
+            std::vector<SearchRequest> batch;
+            nq = 0;
+            for (auto it = queue.begin();
+                 it != queue.end() && nq < server->max_batch_size;) {
+                if (it->k == k) {
+                    nq += it->n;
+                    batch.push_back(std::move(*it));
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            lock.unlock();
+            run_batch(batch, k);
+            lock.lock();
+        }
+    }
+};
+
+SearchServer::SearchServer(const Index* index)
+        : index(index), state(new SearchServerState(this)) {}
+
+int SearchServer::listen_tcp(int port, const char* host) {
+    FAISS_THROW_IF_NOT_MSG(!state->started, "server already started");
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* res = nullptr;
+    std::string port_str = std::to_string(port);
+    int ret = getaddrinfo(host, port_str.c_str(), &hints, &res);
+    FAISS_THROW_IF_NOT_FMT(
+            ret == 0, "could not resolve %s: %s", host, gai_strerror(ret));
+    std::unique_ptr<addrinfo, void (*)(addrinfo*)> del(res, freeaddrinfo);
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    FAISS_THROW_IF_NOT_FMT(fd >= 0, "socket: %s", strerror(errno));
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        close(fd);
+        FAISS_THROW_FMT(
+                "could not listen on %s:%d: %s", host, port, strerror(err));
+    }
+    set_socket_options(fd, true);
+    state->listen_fds.push_back(fd);
+
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    if (addr.ss_family == AF_INET6) {
+        return ntohs(((sockaddr_in6*)&addr)->sin6_port);
+    }
+    return ntohs(((sockaddr_in*)&addr)->sin_port);
+}
+
+void SearchServer::listen_unix(const char* path) {
+    FAISS_THROW_IF_NOT_MSG(!state->started, "server already started");
+    sockaddr_un addr;
+    fill_unix_address(addr, path);
+    unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    FAISS_THROW_IF_NOT_FMT(fd >= 0, "socket: %s", strerror(errno));
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        close(fd);
+        FAISS_THROW_FMT("could not listen on %s: %s", path, strerror(err));
+    }
+    set_socket_options(fd, true);
+    state->listen_fds.push_back(fd);
+    state->unix_paths.push_back(path);
+}
+
+void SearchServer::start() {
+    SearchServerState& st = *state;
+    FAISS_THROW_IF_NOT_MSG(!st.started, "server already started");
+    FAISS_THROW_IF_NOT_MSG(!st.listen_fds.empty(), "server listens nowhere");
+    FAISS_THROW_IF_NOT(n_search_threads > 0 && max_batch_size > 0);
+    st.started = true;
+
+    int nio = n_io_threads > 0
+            ? n_io_threads
+            : std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 0; t < nio; t++) {
+        st.io_threads.emplace_back(new IOThread());
+        IOThread& io = *st.io_threads.back();
+        FAISS_THROW_IF_NOT_FMT(
+                pipe(io.wake_fds) == 0, "pipe: %s", strerror(errno));
+        for (int fd : io.wake_fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+    }
+    for (int t = 0; t < nio; t++) {
+        st.io_threads[t]->thread = std::thread([&st, t] { st.io_loop(t); });
+    }
+    for (int t = 0; t < n_search_threads; t++) {
+        st.search_threads.emplace_back([&st] { st.search_loop(); });
+    }
+}
+
+void SearchServer::stop() {
+    SearchServerState& st = *state;
+    {
+        std::lock_guard<std::mutex> lock(st.mutex);
+        st.stopping = true;
+        st.queue.clear();
+    }
+    st.cv.notify_all();
+    for (std::thread& t : st.search_threads) {
+        t.join();
+    }
+    st.search_threads.clear();
+
+    st.stop_io = true;
+    for (auto& io : st.io_threads) {
+        io->wake();
+    }
+    for (auto& io : st.io_threads) {
+        io->thread.join();
+        close(io->wake_fds[0]);
+        close(io->wake_fds[1]);
+    }
+    st.io_threads.clear();
+
+    for (int fd : st.listen_fds) {
+        close(fd);
+    }
+    st.listen_fds.clear();
+    for (const std::string& path : st.unix_paths) {
+        unlink(path.c_str());
+    }
+    st.unix_paths.clear();
+}
+
+SearchServer::~SearchServer() {
+    stop();
+}
+
+/***************************************************************
+ * Client
+ ***************************************************************/
+
+SearchClient::SearchClient(const std::string& endpoint, double timeout_ms)
+        : endpoint(endpoint) {
+    double deadline = timeout_ms < 0 ? -1 : getmillisecs() + timeout_ms;
+    fd = connect_endpoint(endpoint, deadline);
+    uint64_t request_id;
+    try {
+        request_id =
+                send_message(MSG_INFO, nullptr, 0, nullptr, 0, deadline);
+    } catch (const FaissException&) {
+        close(fd);
+        throw;
+    }
+    uint32_t type;
+    uint64_t rid;
+    std::vector<uint8_t> payload;
+    bool ok = receive_message(type, rid, payload, deadline);
+    if (!ok || type != MSG_INFO || rid != request_id || payload.size() != 16) {
+        close(fd);
+        FAISS_THROW_FMT("no valid response from %s", endpoint.c_str());
+    }
+    int32_t d_in, metric;
+    int64_t ntotal_in;
+    memcpy(&d_in, payload.data(), 4);
+    memcpy(&metric, payload.data() + 4, 4);
+    memcpy(&ntotal_in, payload.data() + 8, 8);
+    d = d_in;
+    metric_type = MetricType(metric);
+    ntotal = ntotal_in;
+}
+
+uint64_t SearchClient::send_message(
+        uint32_t type,
+        const void* payload1,
+        size_t size1,
+        const void* payload2,
+        size_t size2,
+        double deadline) {
+    uint64_t request_id = next_request_id++;
+    MessageHeader header = {message_magic, type, request_id, size1 + size2};
+    try {
+        send_all(fd, &header, sizeof(header), deadline);
+        send_all(fd, payload1, size1, deadline);
+        send_all(fd, payload2, size2, deadline);
+    } catch (const FaissException&) {
+        // a partial message would desynchronize the stream
+        shutdown(fd, SHUT_RDWR);
+        throw;
+    }
+    return request_id;
+}
+
+bool SearchClient::receive_message(
+        uint32_t& type,
+        uint64_t& request_id,
+        std::vector<uint8_t>& payload,
+        double deadline) {
+    for (;;) {
+        if (rbuf.size() >= sizeof(MessageHeader)) {
+            MessageHeader header;
+            memcpy(&header, rbuf.data(), sizeof(header));
+            FAISS_THROW_IF_NOT_FMT(
+                    header.magic == message_magic &&
+                            header.size <= max_message_size,
+                    "invalid message from %s",
+                    endpoint.c_str());
+            size_t total = sizeof(header) + header.size;
+            if (rbuf.size() >= total) {
+                type = header.type;
+                request_id = header.request_id;
+                payload.assign(
+                        rbuf.begin() + sizeof(header), rbuf.begin() + total);
+                rbuf.erase(rbuf.begin(), rbuf.begin() + total);
+                return true;
+            }
+        }
+
+        // a deadline in the past still reads the available data
+        int timeout = -1;
+        if (deadline >= 0) {
+            double remaining = deadline - getmillisecs();
+            timeout = remaining > 0 ? int(remaining) + 1 : 0;
+        }
+        pollfd pfd = {fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeout);
+        if (ret < 0) {
+            FAISS_THROW_IF_NOT_FMT(errno == EINTR, "poll: %s", strerror(errno));
+            continue;
+        }
+        if (ret == 0) {
+            if (getmillisecs() >= deadline) {
+                return false;
+            }
+            continue;
+        }
+        size_t ofs = rbuf.size();
+        rbuf.resize(ofs + 65536);
+        ssize_t nr = recv(fd, rbuf.data() + ofs, 65536, 0);
+        rbuf.resize(ofs + std::max(nr, ssize_t(0)));
+        if (nr < 0) {
+            FAISS_THROW_IF_NOT_FMT(errno == EINTR, "recv: %s", strerror(errno));
+        }
+        FAISS_THROW_IF_NOT_FMT(
+                nr != 0, "connection to %s closed", endpoint.c_str());
+    }
+}
+
+uint64_t SearchClient::send_search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        double deadline) {
+    FAISS_THROW_IF_NOT(n >= 0 && k > 0);
+    int64_t nk[2] = {n, k};
+    return send_message(
+            MSG_SEARCH, nk, sizeof(nk), x, sizeof(float) * n * d, deadline);
+}
+
+bool SearchClient::receive_search(
+        uint64_t request_id,
+        idx_t n,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        double deadline) {
+    uint32_t type;
+    uint64_t rid;
+    std::vector<uint8_t> payload;
+    for (;;) {
+        if (!receive_message(type, rid, payload, deadline)) {
+            return false;
+        }
+        if (rid == request_id) {
+            break;
+        }
+        // stale response
+    }
+    if (type == MSG_ERROR) {
+        FAISS_THROW_FMT(
+                "error from %s: %s",
+                endpoint.c_str(),
+                std::string(payload.begin(), payload.end()).c_str());
+    }
+    FAISS_THROW_IF_NOT_FMT(
+            type == MSG_RESULT &&
+                    payload.size() ==
+                            16 + n * k * (sizeof(float) + sizeof(idx_t)),
+            "invalid result from %s",
+            endpoint.c_str());
+    memcpy(distances, payload.data() + 16, sizeof(float) * n * k);
+    memcpy(labels,
+           payload.data() + 16 + sizeof(float) * n * k,
+           sizeof(idx_t) * n * k);
+    return true;
+}
+
+void SearchClient::search(
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        double timeout_ms) {
+    double deadline = timeout_ms < 0 ? -1 : getmillisecs() + timeout_ms;
+    uint64_t request_id = send_search(n, x, k, deadline);
+    FAISS_THROW_IF_NOT_FMT(
+            receive_search(request_id, n, k, distances, labels, deadline),
+            "search on %s timed out",
+            endpoint.c_str());
+}
+
+SearchClient::~SearchClient() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void search_remote_shards(
+        const std::vector<SearchClient*>& shards,
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        double timeout_ms) {
+    FAISS_THROW_IF_NOT(!shards.empty());
+    int nshard = shards.size();
+    for (const SearchClient* shard : shards) {
+        FAISS_THROW_IF_NOT(
+                shard->d == shards[0]->d &&
+                shard->metric_type == shards[0]->metric_type);
+    }
+    double deadline = timeout_ms < 0 ? -1 : getmillisecs() + timeout_ms;
+
+    std::vector<uint64_t> request_ids(nshard);
+    for (int i = 0; i < nshard; i++) {
+        request_ids[i] = shards[i]->send_search(n, x, k, deadline);
+    }
+    std::vector<float> all_distances(nshard * n * k);
+    std::vector<idx_t> all_labels(nshard * n * k);
+    for (int i = 0; i < nshard; i++) {
+        FAISS_THROW_IF_NOT_FMT(
+                shards[i]->receive_search(
+                        request_ids[i],
+                        n,
+                        k,
+                        all_distances.data() + i * n * k,
+                        all_labels.data() + i * n * k,
+                        deadline),
+                "search on %s timed out",
+                shards[i]->endpoint.c_str());
+    }
+
+    if (shards[0]->metric_type == METRIC_L2) {
+        merge_knn_results<idx_t, CMin<float, int>>(
+                n,
+                k,
+                nshard,
+                all_distances.data(),
+                all_labels.data(),
+                distances,
+                labels);
+    } else {
+        merge_knn_results<idx_t, CMax<float, int>>(
+                n,
+                k,
+                nshard,
+                all_distances.data(),
+                all_labels.data(),
+                distances,
+                labels);
+    }
+}
+
+} // namespace faiss
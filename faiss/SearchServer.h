@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <faiss/Index.h>
+
+namespace faiss {
+
+struct SearchServerState;
+
+/** Serves the searches of an index over TCP or Unix domain sockets.
+ *
+ * The protocol is a sequence of binary messages (a fixed-size header
+ * followed by a payload in native byte order), see SearchServer.cpp.
+ * Several requests can be in flight on one connection; the responses are
+ * matched by request id.
+ *
+ * Each I/O thread runs an event loop over a subset of the connections.
+ * The search requests of all connections are queued, and the search
+ * threads group the queued queries in batches for index->search: a batch
+ * is run when it reaches max_batch_size queries, or when its oldest query
+ * has waited for max_delay_ms. Concurrent single-query requests are thus
+ * served at the throughput of batched searches.
+ *
+ * The index must not be modified while the server is running.
+ */
+struct SearchServer {
+    const Index* index;
+
+    /// nb of event loop threads (0 = nb of cores)
+    int n_io_threads = 0;
+
+    /// nb of threads that run the searches. index->search is itself
+    /// parallelized with OpenMP, so one thread is usually enough.
+    int n_search_threads = 1;
+
+    /// a batch is searched as soon as it has this many queries
+    idx_t max_batch_size = 256;
+
+    /// maximum time a query waits for its batch to fill up
+    double max_delay_ms = 1.0;
+
+    /// limits of a search request, larger requests are rejected with an
+    /// error. They bound the memory that a single client can make the
+    /// server allocate: a message larger than max_request_queries
+    /// queries closes the connection before its payload is buffered.
+    idx_t max_k = 16384;
+    idx_t max_request_queries = 65536;
+    idx_t max_request_results = idx_t(1) << 26; ///< n * k
+
+    /// statistics
+    std::atomic<size_t> n_requests{0};
+    std::atomic<size_t> n_queries{0};
+    std::atomic<size_t> n_batches{0};
+
+    explicit SearchServer(const Index* index);
+
+    /** Listen on a TCP address (before start).
+     * @param port  0 to choose a free port
+     * @return      the port that is listened on
+     */
+    int listen_tcp(int port, const char* host = "127.0.0.1");
+
+    /// Listen on a Unix domain socket (before start)
+    void listen_unix(const char* path);
+
+    /// start the event loops and the search threads
+    void start();
+
+    /// stop the threads and close the connections. Pending requests are
+    /// dropped.
+    void stop();
+
+    ~SearchServer();
+
+   private:
+    std::unique_ptr<SearchServerState> state;
+};
+
+/** Client of a SearchServer.
+ *
+ * The endpoint is either "host:port" or "unix:path". The client holds one
+ * connection and should not be called from several threads concurrently:
+ * use one client per thread, the server batches the queries of all its
+ * connections.
+ */
+struct SearchClient {
+    std::string endpoint;
+
+    /// properties of the remote index, fetched at connection time
+    int d = 0;
+    idx_t ntotal = 0;
+    MetricType metric_type = METRIC_L2;
+
+    /// @param timeout_ms  timeout of the connection and of the initial
+    ///                    info request (-1 = none)
+    explicit SearchClient(const std::string& endpoint, double timeout_ms = -1);
+
+    SearchClient(const SearchClient&) = delete;
+    SearchClient& operator=(const SearchClient&) = delete;
+
+    /// search on the remote index, throws on errors and timeouts
+    void search(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            double timeout_ms = -1);
+
+    /** send a search request without waiting for the result
+     *
+     * @param deadline  for sending the request, in getmillisecs() time
+     *                  (< 0: none). If it passes, the connection is shut
+     *                  down and an exception is thrown.
+     * @return the request id
+     */
+    uint64_t send_search(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            double deadline = -1);
+
+    /** Wait for the result of a request sent by send_search. Responses to
+     * other requests (eg. that timed out before) are discarded.
+     *
+     * @param deadline  in getmillisecs() time, < 0 to wait indefinitely.
+     *                  With 0, only the data already received is used.
+     * @return          false if the deadline passed
+     */
+    bool receive_search(
+            uint64_t request_id,
+            idx_t n,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            double deadline = -1);
+
+    /// socket of the connection, to wait on several clients with poll
+    int get_fd() const {
+        return fd;
+    }
+
+    ~SearchClient();
+
+   private:
+    int fd = -1;
+    uint64_t next_request_id = 1;
+    std::vector<uint8_t> rbuf; ///< received bytes not consumed yet
+
+    uint64_t send_message(
+            uint32_t type,
+            const void* payload1,
+            size_t size1,
+            const void* payload2,
+            size_t size2,
+            double deadline = -1);
+
+    bool receive_message(
+            uint32_t& type,
+            uint64_t& request_id,
+            std::vector<uint8_t>& payload,
+            double deadline);
+};
+
+/** Search several servers that each hold a shard of the database, and
+ * merge their results with merge_knn_results. The requests are sent to
+ * all the shards before waiting for the results, so the shards search in
+ * parallel. The labels are the ones returned by the shards, so the shards
+ * should be built with add_with_ids. Throws on errors and timeouts.
+ */
+void search_remote_shards(
+        const std::vector<SearchClient*>& shards,
+        idx_t n,
+        const float* x,
+        idx_t k,
+        float* distances,
+        idx_t* labels,
+        double timeout_ms = -1);
+
+} // namespace faiss
@@ -9,6 +9,7 @@
 
 #include <faiss/VectorTransform.h>
 
+#include <algorithm>
 #include <cinttypes>
 #include <cmath>
 #include <cstdio>
@@ -129,8 +130,137 @@ int dgesvd_(
         double* work,
         FINTEGER* lwork,
         FINTEGER* info);
+
+int sgesdd_(
+        const char* jobz,
+        FINTEGER* m,
+        FINTEGER* n,
+        float* a,
+        FINTEGER* lda,
+        float* s,
+        float* u,
+        FINTEGER* ldu,
+        float* vt,
+        FINTEGER* ldvt,
+        float* work,
+        FINTEGER* lwork,
+        FINTEGER* iwork,
+        FINTEGER* info);
+
+int dgesdd_(
+        const char* jobz,
+        FINTEGER* m,
+        FINTEGER* n,
+        double* a,
+        FINTEGER* lda,
+        double* s,
+        double* u,
+        FINTEGER* ldu,
+        double* vt,
+        FINTEGER* ldvt,
+        double* work,
+        FINTEGER* lwork,
+        FINTEGER* iwork,
+        FINTEGER* info);
+}
+
+namespace {
+
+/* Full SVD of the m * n column-major matrix a (destroyed). The
+ * divide-and-conquer driver ?gesdd is several times faster than ?gesvd on
+ * the square matrices of the Procrustes problems solved by OPQ and ITQ, and
+ * its BLAS-3 updates run on all the BLAS threads. Falls back to ?gesvd in
+ * the rare cases where it does not converge. */
+
+template <typename T, class Gesdd, class Gesvd>
+void svd_all(
+        FINTEGER m,
+        FINTEGER n,
+        T* a,
+        T* s,
+        T* u,
+        T* vt,
+        Gesdd gesdd,
+        Gesvd gesvd) {
+    std::vector<T> a_copy(a, a + size_t(m) * n);
+    std::vector<FINTEGER> iwork(8 * size_t(std::min(m, n)));
+    FINTEGER lwork = -1, info = -1;
+    T worksz;
+    // workspace query
+    gesdd("A",
+          &m,
+          &n,
+          a,
+          &m,
+          s,
+          u,
+          &m,
+          vt,
+          &n,
+          &worksz,
+          &lwork,
+          iwork.data(),
+          &info);
+    if (info == 0) {
+        lwork = FINTEGER(worksz);
+        std::vector<T> work(lwork);
+        gesdd("A",
+              &m,
+              &n,
+              a,
+              &m,
+              s,
+              u,
+              &m,
+              vt,
+              &n,
+              work.data(),
+              &lwork,
+              iwork.data(),
+              &info);
+    }
+    if (info == 0) {
+        return;
+    }
+
+    memcpy(a, a_copy.data(), sizeof(T) * a_copy.size());
+    lwork = -1;
+    gesvd("A",
+          "A",
+          &m,
+          &n,
+          a,
+          &m,
+          s,
+          u,
+          &m,
+          vt,
+          &n,
+          &worksz,
+          &lwork,
+          &info);
+    FAISS_THROW_IF_NOT(info == 0);
+    lwork = FINTEGER(worksz);
+    std::vector<T> work(lwork);
+    gesvd("A",
+          "A",
+          &m,
+          &n,
+          a,
+          &m,
+          s,
+          u,
+          &m,
+          vt,
+          &n,
+          work.data(),
+          &lwork,
+          &info);
+    FAISS_THROW_IF_NOT_FMT(info == 0, "?gesvd returned info=%d", int(info));
 }
 
+} // namespace
+
 /*********************************************
  * VectorTransform
  *********************************************/
@@ -798,46 +928,15 @@ void ITQMatrix::train(idx_t n, const float* xf) {
         }
         print_if_verbose("cov_mat", cov_mat, d, d);
         // SVD
-        {
-            FINTEGER di = d;
-            FINTEGER lwork = -1, info;
-            double lwork1;
-
-            // workspace query
-            dgesvd_("A",
-                    "A",
-                    &di,
-                    &di,
-                    cov_mat.data(),
-                    &di,
-                    singvals.data(),
-                    u.data(),
-                    &di,
-                    vt.data(),
-                    &di,
-                    &lwork1,
-                    &lwork,
-                    &info);
-
-            FAISS_THROW_IF_NOT(info == 0);
-            lwork = size_t(lwork1);
-            std::vector<double> work(lwork);
-            dgesvd_("A",
-                    "A",
-                    &di,
-                    &di,
-                    cov_mat.data(),
-                    &di,
-                    singvals.data(),
-                    u.data(),
-                    &di,
-                    vt.data(),
-                    &di,
-                    work.data(),
-                    &lwork,
-                    &info);
-            FAISS_THROW_IF_NOT_FMT(info == 0, "sgesvd returned info=%d", info);
-        }
+        svd_all<double>(
+                d,
+                d,
+                cov_mat.data(),
+                singvals.data(),
+                u.data(),
+                vt.data(),
+                dgesdd_,
+                dgesvd_);
         print_if_verbose("u", u, d, d);
         print_if_verbose("vt", vt, d, d);
         // update rotation
@@ -1036,9 +1135,16 @@ void OPQMatrix::train(idx_t n, const float* x_in) {
         }
         for (int i = 0; i < d; i++)
             sum[i] /= n;
+        // when a sampling schedule is used, shuffle the vectors so that
+        // the subsets are random
+        std::vector<int> perm;
+        if (n_train_sample_0 > 0 && n_train_sample_0 < n) {
+            perm.resize(n);
+            rand_perm(perm.data(), n, 1234);
+        }
         float* yi = xtrain.data();
-        xi = x;
         for (size_t i = 0; i < n; i++) {
+            xi = x + (perm.empty() ? i : perm[i]) * d_in;
             for (int j = 0; j < d_in; j++)
                 *yi++ = *xi++ - sum[j];
             yi += d - d_in;
@@ -1070,9 +1176,14 @@ void OPQMatrix::train(idx_t n, const float* x_in) {
     std::vector<uint8_t> codes(pq_regular.code_size * n);
 
     double t0 = getmillisecs();
+    size_t n_sample = n_train_sample_0 > 0 ? n_train_sample_0 : n;
     for (int iter = 0; iter < niter; iter++) {
+        // nb of training vectors used at this iteration (a prefix of xtrain)
+        size_t ni_train = std::min(n_sample, size_t(n));
+        n_sample *= 2;
+
         { // torch.mm(xtrain, rotation:t())
-            FINTEGER di = d, d2i = d2, ni = n;
+            FINTEGER di = d, d2i = d2, ni = ni_train;
             float zero = 0, one = 1;
             sgemm_("Transposed",
                    "Not transposed",
@@ -1092,33 +1203,38 @@ void OPQMatrix::train(idx_t n, const float* x_in) {
         pq_regular.cp.max_points_per_centroid = 1000;
         pq_regular.cp.niter = iter == 0 ? niter_pq_0 : niter_pq;
         pq_regular.verbose = verbose;
-        pq_regular.train(n, xproj.data());
+        pq_regular.train(ni_train, xproj.data());
 
         if (verbose) {
             printf("    encode / decode\n");
         }
         if (pq_regular.assign_index) {
             pq_regular.compute_codes_with_assign_index(
-                    xproj.data(), codes.data(), n);
+                    xproj.data(), codes.data(), ni_train);
         } else {
-            pq_regular.compute_codes(xproj.data(), codes.data(), n);
+            pq_regular.compute_codes(xproj.data(), codes.data(), ni_train);
         }
-        pq_regular.decode(codes.data(), pq_recons.data(), n);
-
-        float pq_err = fvec_L2sqr(pq_recons.data(), xproj.data(), n * d2) / n;
+        pq_regular.decode(codes.data(), pq_recons.data(), ni_train);
 
-        if (verbose)
-            printf("    Iteration %d (%d PQ iterations):"
+        if (verbose) {
+            float pq_err = fvec_L2sqr(
+                                   pq_recons.data(),
+                                   xproj.data(),
+                                   ni_train * d2) /
+                    ni_train;
+            printf("    Iteration %d (%d PQ iterations, %zu vectors):"
                    "%.3f s, obj=%g\n",
                    iter,
                    pq_regular.cp.niter,
+                   ni_train,
                    (getmillisecs() - t0) / 1000.0,
                    pq_err);
+        }
 
         {
             float *u = tmp.data(), *vt = &tmp[d * d];
             float* sing_val = &tmp[2 * d * d];
-            FINTEGER di = d, d2i = d2, ni = n;
+            FINTEGER di = d, d2i = d2, ni = ni_train;
             float one = 1, zero = 0;
 
             if (verbose) {
@@ -1139,41 +1255,9 @@ void OPQMatrix::train(idx_t n, const float* x_in) {
                    xxr.data(),
                    &d2i);
 
-            FINTEGER lwork = -1, info = -1;
-            float worksz;
-            // workspace query
-            sgesvd_("All",
-                    "All",
-                    &d2i,
-                    &di,
-                    xxr.data(),
-                    &d2i,
-                    sing_val,
-                    vt,
-                    &d2i,
-                    u,
-                    &di,
-                    &worksz,
-                    &lwork,
-                    &info);
-
-            lwork = int(worksz);
-            std::vector<float> work(lwork);
             // u and vt swapped
-            sgesvd_("All",
-                    "All",
-                    &d2i,
-                    &di,
-                    xxr.data(),
-                    &d2i,
-                    sing_val,
-                    vt,
-                    &d2i,
-                    u,
-                    &di,
-                    work.data(),
-                    &lwork,
-                    &info);
+            svd_all<float>(
+                    d2, d, xxr.data(), sing_val, vt, u, sgesdd_, sgesvd_);
 
             sgemm_("Transposed",
                    "Transposed",
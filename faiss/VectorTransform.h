@@ -239,6 +239,11 @@ struct OPQMatrix : LinearTransform {
     size_t max_train_points = 256 * 256;
     bool verbose = false;
 
+    /// sampling schedule: if > 0, the first iteration runs on a random
+    /// subset of this many training points, whose size is doubled at each
+    /// iteration until all the training points are used
+    size_t n_train_sample_0 = 0;
+
     /// if non-NULL, use this product quantizer for training
     /// should be constructed with (d_out, M, _)
     ProductQuantizer* pq = nullptr;
@@ -75,6 +75,8 @@ VectorTransform* Cloner::clone_VectorTransform(const VectorTransform* vt) {
     TRYCLONE(PCAMatrix, vt)
     TRYCLONE(ITQMatrix, vt)
     TRYCLONE(RandomRotationMatrix, vt)
+    TRYCLONE(NormalizationTransform, vt)
+    TRYCLONE(CenteringTransform, vt)
     TRYCLONE(LinearTransform, vt) {
         FAISS_THROW_MSG("clone not supported for this type of VectorTransform");
     }
@@ -305,6 +307,7 @@ Index* Cloner::clone_Index(const Index* index) {
         res->index = clone_Index(ipt->index);
         for (int i = 0; i < ipt->chain.size(); i++)
             res->chain.push_back(clone_VectorTransform(ipt->chain[i]));
+        res->prepare_chain();
         res->own_fields = true;
         return res;
     } else if (
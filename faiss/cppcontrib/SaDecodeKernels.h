@@ -42,6 +42,9 @@
 //   * IVF[2^9-2^16 bit],PQ[1]x10 (such as IVF1024,PQ16x10np)
 //   * IVF[2^9-2^16 bit],PQ[1]x12 (such as IVF1024,PQ16x12np)
 //   * IVF[2^9-2^16 bit],PQ[1]x16 (such as IVF1024,PQ16x16np)
+// And the additive quantizers with 8, 10, 12 or 16 bits per codebook:
+//   * RQ[1]x[2] and LSQ[1]x[2] (such as RQ8x8 or LSQ4x10)
+//   * PRQ[1]x[2]x[3] and PLSQ[1]x[2]x[3] (such as PRQ2x4x8)
 //
 // The goal was to achieve the maximum performance, so the template version it
 // is. The provided index families share the same code for sa_decode.
@@ -97,6 +100,29 @@
 // For example, "PQ8np" for 160-dim data translates into
 //   IndexPQDecoder<160,20>
 //
+// Third one, for the additive quantizers:
+//   {
+//     template <
+//        intptr_t DIM,
+//        intptr_t M,
+//        intptr_t NBITS = 8,
+//        intptr_t NSPLITS = 1>
+//     struct IndexAdditiveDecoder { /*...*/ };
+//   }
+// * DIM is the dimensionality of data
+// * M is the total number of codebooks
+// * NBITS is the number of bits per codebook entry (8, 10, 12 or 16)
+// * NSPLITS is the number of subspaces of a product additive quantizer
+// The centroids table is AdditiveQuantizer::codebooks, for instance
+//   IndexResidualQuantizer::rq.codebooks.data().
+// For example, "RQ8x8" or "LSQ8x8" for 128-dim data translates into
+//   IndexAdditiveDecoder<128,8>
+// For example, "RQ4x12_Nqint8" for 128-dim data translates into
+//   IndexAdditiveDecoder<128,4,12>, the encoded norm is ignored.
+// For example, "PRQ2x4x8" for 128-dim data translates into
+//   IndexAdditiveDecoder<128,8,8,2>
+// IndexAdditiveDecoder provides the same functions as IndexPQDecoder.
+//
 // Unlike the general purpose version in faiss::Index::sa_decode(),
 //   this version provides the following functions (please note that
 //   pqCoarseCentroids params are not available for IndexPQDecoder,
@@ -311,12 +337,15 @@
 #include <faiss/cppcontrib/sa_decode/MinMaxFP16-inl.h>
 
 #ifdef __AVX2__
+#include <faiss/cppcontrib/sa_decode/Additive-avx2-inl.h>
 #include <faiss/cppcontrib/sa_decode/Level2-avx2-inl.h>
 #include <faiss/cppcontrib/sa_decode/PQ-avx2-inl.h>
 #elif defined(__ARM_NEON)
+#include <faiss/cppcontrib/sa_decode/Additive-inl.h>
 #include <faiss/cppcontrib/sa_decode/Level2-neon-inl.h>
 #include <faiss/cppcontrib/sa_decode/PQ-neon-inl.h>
 #else
+#include <faiss/cppcontrib/sa_decode/Additive-inl.h>
 #include <faiss/cppcontrib/sa_decode/Level2-inl.h>
 #include <faiss/cppcontrib/sa_decode/PQ-inl.h>
 #endif
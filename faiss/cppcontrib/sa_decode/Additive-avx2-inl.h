@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef ADDITIVE_AVX2_INL_H
+#define ADDITIVE_AVX2_INL_H
+
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <faiss/cppcontrib/detail/UintReader.h>
+
+namespace faiss {
+namespace cppcontrib {
+
+////////////////////////////////////////////////////////////////////////////////////
+/// IndexAdditiveDecoder
+////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Reads the M codebook entries of a code, using template-based for-loop
+//   unrolling, because UintReader needs a compile-time position.
+template <
+        intptr_t M,
+        intptr_t NBITS,
+        intptr_t CPOS,
+        bool CPOS_EQ_M = CPOS == M>
+struct AdditiveCodeReader {
+    static void get(
+            const uint8_t* const __restrict code,
+            intptr_t* const __restrict codes) {
+        codes[CPOS] = detail::UintReaderRaw<M, NBITS, CPOS>::get(code);
+        AdditiveCodeReader<M, NBITS, CPOS + 1>::get(code, codes);
+    }
+};
+
+template <intptr_t M, intptr_t NBITS, intptr_t CPOS>
+struct AdditiveCodeReader<M, NBITS, CPOS, true> {
+    static void get(
+            const uint8_t* const __restrict,
+            intptr_t* const __restrict) {}
+};
+
+// Processes 8 float values.
+// Returns {
+//   [0..7] = *entries[0][0..7] + ... + *entries[N_ENTRIES - 1][0..7];
+// }
+template <intptr_t N_ENTRIES>
+inline __m256 additiveBlock8(
+        const float* const* const __restrict entries,
+        const intptr_t offset) {
+    __m256 sum = _mm256_loadu_ps(entries[0] + offset);
+    for (intptr_t m = 1; m < N_ENTRIES; m++) {
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(entries[m] + offset));
+    }
+    return sum;
+}
+
+// Processes 4 float values.
+template <intptr_t N_ENTRIES>
+inline __m128 additiveBlock4(
+        const float* const* const __restrict entries,
+        const intptr_t offset) {
+    __m128 sum = _mm_loadu_ps(entries[0] + offset);
+    for (intptr_t m = 1; m < N_ENTRIES; m++) {
+        sum = _mm_add_ps(sum, _mm_loadu_ps(entries[m] + offset));
+    }
+    return sum;
+}
+
+// Processes 1 float value.
+template <intptr_t N_ENTRIES>
+inline float additiveBlock1(
+        const float* const* const __restrict entries,
+        const intptr_t offset) {
+    float sum = entries[0][offset];
+    for (intptr_t m = 1; m < N_ENTRIES; m++) {
+        sum += entries[m][offset];
+    }
+    return sum;
+}
+
+} // namespace
+
+// Suitable for RQ[M]x[NBITS], LSQ[M]x[NBITS] (NSPLITS = 1) and
+//   PRQ[NSPLITS]x[M / NSPLITS]x[NBITS], PLSQ[NSPLITS]x[M / NSPLITS]x[NBITS].
+// The centroids table is AdditiveQuantizer::codebooks, the trailing norm
+//   of the code, if any, is ignored.
+//
+// Each block of 8 output values is accumulated over the M codebooks in a
+//   register, so the output is written once per sample. The summation order
+//   is the one of AdditiveQuantizer::decode, so ::store() is exact.
+template <
+        intptr_t DIM,
+        intptr_t M,
+        intptr_t NBITS = 8,
+        intptr_t NSPLITS = 1>
+struct IndexAdditiveDecoder {
+    static_assert(
+            NBITS == 8 || NBITS == 10 || NBITS == 12 || NBITS == 16,
+            "Only 8, 10, 12 or 16 bits are currently supported for NBITS");
+    static_assert(DIM % NSPLITS == 0, "NSPLITS should divide DIM");
+    static_assert(M % NSPLITS == 0, "NSPLITS should divide M");
+
+    static constexpr intptr_t dim = DIM;
+    static constexpr intptr_t nCodebooks = M;
+    static constexpr intptr_t nBits = NBITS;
+    static constexpr intptr_t nSplits = NSPLITS;
+
+    static constexpr intptr_t SUB_DIM = DIM / NSPLITS;
+    static constexpr intptr_t M_PER_SPLIT = M / NSPLITS;
+    static constexpr intptr_t CODEBOOK_SIZE = (1 << NBITS);
+
+    // 8-float, 4-float and 1-float blocks of a split
+    static constexpr intptr_t SUB_DIM_8 = SUB_DIM - SUB_DIM % 8;
+    static constexpr intptr_t SUB_DIM_4 = SUB_DIM - SUB_DIM % 4;
+
+    // Process 1 sample.
+    // Performs outputStore = decoded(code)
+    static void store(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code,
+            float* const __restrict outputStore) {
+        const float* entries[M];
+        getEntries(codebooks, code, entries);
+
+        for (intptr_t s = 0; s < NSPLITS; s++) {
+            const float* const* const e = entries + s * M_PER_SPLIT;
+            float* const __restrict out = outputStore + s * SUB_DIM;
+
+#pragma unroll
+            for (intptr_t i = 0; i < SUB_DIM_8; i += 8) {
+                _mm256_storeu_ps(out + i, additiveBlock8<M_PER_SPLIT>(e, i));
+            }
+            if (SUB_DIM_4 > SUB_DIM_8) {
+                _mm_storeu_ps(
+                        out + SUB_DIM_8,
+                        additiveBlock4<M_PER_SPLIT>(e, SUB_DIM_8));
+            }
+            for (intptr_t i = SUB_DIM_4; i < SUB_DIM; i++) {
+                out[i] = additiveBlock1<M_PER_SPLIT>(e, i);
+            }
+        }
+    }
+
+    // Process 1 sample.
+    // Performs outputAccum += weight * decoded(code)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code,
+            const float weight,
+            float* const __restrict outputAccum) {
+        const float* entries[M];
+        getEntries(codebooks, code, entries);
+
+        const __m256 weightAvx2 = _mm256_set1_ps(weight);
+        const __m128 weightAvx = _mm_set1_ps(weight);
+
+        for (intptr_t s = 0; s < NSPLITS; s++) {
+            const float* const* const e = entries + s * M_PER_SPLIT;
+            float* const __restrict out = outputAccum + s * SUB_DIM;
+
+#pragma unroll
+            for (intptr_t i = 0; i < SUB_DIM_8; i += 8) {
+                __m256 existingValue = _mm256_loadu_ps(out + i);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e, i),
+                        weightAvx2,
+                        existingValue);
+                _mm256_storeu_ps(out + i, existingValue);
+            }
+            if (SUB_DIM_4 > SUB_DIM_8) {
+                __m128 existingValue = _mm_loadu_ps(out + SUB_DIM_8);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e, SUB_DIM_8),
+                        weightAvx,
+                        existingValue);
+                _mm_storeu_ps(out + SUB_DIM_8, existingValue);
+            }
+            for (intptr_t i = SUB_DIM_4; i < SUB_DIM; i++) {
+                out[i] += weight * additiveBlock1<M_PER_SPLIT>(e, i);
+            }
+        }
+    }
+
+    // Process 2 samples.
+    // Each code uses its own codebooks.
+    //
+    // Performs
+    //  outputAccum += weight0 * decoded(code0) + weight1 * decoded(code1)
+    static void accum(
+            const float* const __restrict codebooks0,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const float* const __restrict codebooks1,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            float* const __restrict outputAccum) {
+        const float* entries0[M];
+        const float* entries1[M];
+        getEntries(codebooks0, code0, entries0);
+        getEntries(codebooks1, code1, entries1);
+
+        const __m256 weight0Avx2 = _mm256_set1_ps(weight0);
+        const __m256 weight1Avx2 = _mm256_set1_ps(weight1);
+        const __m128 weight0Avx = _mm_set1_ps(weight0);
+        const __m128 weight1Avx = _mm_set1_ps(weight1);
+
+        for (intptr_t s = 0; s < NSPLITS; s++) {
+            const float* const* const e0 = entries0 + s * M_PER_SPLIT;
+            const float* const* const e1 = entries1 + s * M_PER_SPLIT;
+            float* const __restrict out = outputAccum + s * SUB_DIM;
+
+#pragma unroll
+            for (intptr_t i = 0; i < SUB_DIM_8; i += 8) {
+                __m256 existingValue = _mm256_loadu_ps(out + i);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e0, i),
+                        weight0Avx2,
+                        existingValue);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e1, i),
+                        weight1Avx2,
+                        existingValue);
+                _mm256_storeu_ps(out + i, existingValue);
+            }
+            if (SUB_DIM_4 > SUB_DIM_8) {
+                __m128 existingValue = _mm_loadu_ps(out + SUB_DIM_8);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e0, SUB_DIM_8),
+                        weight0Avx,
+                        existingValue);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e1, SUB_DIM_8),
+                        weight1Avx,
+                        existingValue);
+                _mm_storeu_ps(out + SUB_DIM_8, existingValue);
+            }
+            for (intptr_t i = SUB_DIM_4; i < SUB_DIM; i++) {
+                out[i] += weight0 * additiveBlock1<M_PER_SPLIT>(e0, i) +
+                        weight1 * additiveBlock1<M_PER_SPLIT>(e1, i);
+            }
+        }
+    }
+
+    // Process 2 samples.
+    // Codebooks are shared among codes.
+    //
+    // Performs
+    //  outputAccum += weight0 * decoded(code0) + weight1 * decoded(code1)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            float* const __restrict outputAccum) {
+        accum(codebooks,
+              code0,
+              weight0,
+              codebooks,
+              code1,
+              weight1,
+              outputAccum);
+    }
+
+    // Process 3 samples.
+    // Each code uses its own codebooks.
+    //
+    // Performs outputAccum += weight0 * decoded(code0) + weight1 *
+    //   decoded(code1) + weight2 * decoded(code2)
+    static void accum(
+            const float* const __restrict codebooks0,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const float* const __restrict codebooks1,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            const float* const __restrict codebooks2,
+            const uint8_t* const __restrict code2,
+            const float weight2,
+            float* const __restrict outputAccum) {
+        const float* entries0[M];
+        const float* entries1[M];
+        const float* entries2[M];
+        getEntries(codebooks0, code0, entries0);
+        getEntries(codebooks1, code1, entries1);
+        getEntries(codebooks2, code2, entries2);
+
+        const __m256 weight0Avx2 = _mm256_set1_ps(weight0);
+        const __m256 weight1Avx2 = _mm256_set1_ps(weight1);
+        const __m256 weight2Avx2 = _mm256_set1_ps(weight2);
+        const __m128 weight0Avx = _mm_set1_ps(weight0);
+        const __m128 weight1Avx = _mm_set1_ps(weight1);
+        const __m128 weight2Avx = _mm_set1_ps(weight2);
+
+        for (intptr_t s = 0; s < NSPLITS; s++) {
+            const float* const* const e0 = entries0 + s * M_PER_SPLIT;
+            const float* const* const e1 = entries1 + s * M_PER_SPLIT;
+            const float* const* const e2 = entries2 + s * M_PER_SPLIT;
+            float* const __restrict out = outputAccum + s * SUB_DIM;
+
+#pragma unroll
+            for (intptr_t i = 0; i < SUB_DIM_8; i += 8) {
+                __m256 existingValue = _mm256_loadu_ps(out + i);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e0, i),
+                        weight0Avx2,
+                        existingValue);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e1, i),
+                        weight1Avx2,
+                        existingValue);
+                existingValue = _mm256_fmadd_ps(
+                        additiveBlock8<M_PER_SPLIT>(e2, i),
+                        weight2Avx2,
+                        existingValue);
+                _mm256_storeu_ps(out + i, existingValue);
+            }
+            if (SUB_DIM_4 > SUB_DIM_8) {
+                __m128 existingValue = _mm_loadu_ps(out + SUB_DIM_8);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e0, SUB_DIM_8),
+                        weight0Avx,
+                        existingValue);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e1, SUB_DIM_8),
+                        weight1Avx,
+                        existingValue);
+                existingValue = _mm_fmadd_ps(
+                        additiveBlock4<M_PER_SPLIT>(e2, SUB_DIM_8),
+                        weight2Avx,
+                        existingValue);
+                _mm_storeu_ps(out + SUB_DIM_8, existingValue);
+            }
+            for (intptr_t i = SUB_DIM_4; i < SUB_DIM; i++) {
+                out[i] += weight0 * additiveBlock1<M_PER_SPLIT>(e0, i) +
+                        weight1 * additiveBlock1<M_PER_SPLIT>(e1, i) +
+                        weight2 * additiveBlock1<M_PER_SPLIT>(e2, i);
+            }
+        }
+    }
+
+    // Process 3 samples.
+    // Codebooks are shared among codes.
+    //
+    // Performs outputAccum += weight0 * decoded(code0) + weight1 *
+    //   decoded(code1) + weight2 * decoded(code2)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            const uint8_t* const __restrict code2,
+            const float weight2,
+            float* const __restrict outputAccum) {
+        accum(codebooks,
+              code0,
+              weight0,
+              codebooks,
+              code1,
+              weight1,
+              codebooks,
+              code2,
+              weight2,
+              outputAccum);
+    }
+
+   private:
+    // the entries of the M codebooks selected by the code
+    static void getEntries(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code,
+            const float** const __restrict entries) {
+        intptr_t codes[M];
+        AdditiveCodeReader<M, NBITS, 0>::get(code, codes);
+#pragma unroll
+        for (intptr_t m = 0; m < M; m++) {
+            entries[m] = codebooks + (m * CODEBOOK_SIZE + codes[m]) * SUB_DIM;
+        }
+    }
+};
+
+} // namespace cppcontrib
+} // namespace faiss
+#endif // ADDITIVE_AVX2_INL_H
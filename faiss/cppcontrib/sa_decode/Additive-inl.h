@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef ADDITIVE_INL_H
+#define ADDITIVE_INL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <faiss/cppcontrib/detail/UintReader.h>
+
+namespace faiss {
+namespace cppcontrib {
+
+////////////////////////////////////////////////////////////////////////////////////
+/// IndexAdditiveDecoder
+////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Reads the M codebook entries of a code, using template-based for-loop
+//   unrolling, because UintReader needs a compile-time position.
+template <
+        intptr_t M,
+        intptr_t NBITS,
+        intptr_t CPOS,
+        bool CPOS_EQ_M = CPOS == M>
+struct AdditiveCodeReader {
+    static void get(
+            const uint8_t* const __restrict code,
+            intptr_t* const __restrict codes) {
+        codes[CPOS] = detail::UintReaderRaw<M, NBITS, CPOS>::get(code);
+        AdditiveCodeReader<M, NBITS, CPOS + 1>::get(code, codes);
+    }
+};
+
+template <intptr_t M, intptr_t NBITS, intptr_t CPOS>
+struct AdditiveCodeReader<M, NBITS, CPOS, true> {
+    static void get(
+            const uint8_t* const __restrict,
+            intptr_t* const __restrict) {}
+};
+
+} // namespace
+
+// Suitable for RQ[M]x[NBITS], LSQ[M]x[NBITS] (NSPLITS = 1) and
+//   PRQ[NSPLITS]x[M / NSPLITS]x[NBITS], PLSQ[NSPLITS]x[M / NSPLITS]x[NBITS].
+// The centroids table is AdditiveQuantizer::codebooks, the trailing norm
+//   of the code, if any, is ignored.
+template <
+        intptr_t DIM,
+        intptr_t M,
+        intptr_t NBITS = 8,
+        intptr_t NSPLITS = 1>
+struct IndexAdditiveDecoder {
+    static_assert(
+            NBITS == 8 || NBITS == 10 || NBITS == 12 || NBITS == 16,
+            "Only 8, 10, 12 or 16 bits are currently supported for NBITS");
+    static_assert(DIM % NSPLITS == 0, "NSPLITS should divide DIM");
+    static_assert(M % NSPLITS == 0, "NSPLITS should divide M");
+
+    static constexpr intptr_t dim = DIM;
+    static constexpr intptr_t nCodebooks = M;
+    static constexpr intptr_t nBits = NBITS;
+    static constexpr intptr_t nSplits = NSPLITS;
+
+    static constexpr intptr_t SUB_DIM = DIM / NSPLITS;
+    static constexpr intptr_t M_PER_SPLIT = M / NSPLITS;
+    static constexpr intptr_t CODEBOOK_SIZE = (1 << NBITS);
+
+    // Process 1 sample.
+    // Performs outputStore = decoded(code)
+    static void store(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code,
+            float* const __restrict outputStore) {
+        intptr_t codes[M];
+        AdditiveCodeReader<M, NBITS, 0>::get(code, codes);
+
+        // same summation order as AdditiveQuantizer::decode
+        for (intptr_t s = 0; s < NSPLITS; s++) {
+            float* const __restrict out = outputStore + s * SUB_DIM;
+            const float* const __restrict c0 =
+                    entry(codebooks, s * M_PER_SPLIT, codes);
+#pragma unroll
+            for (intptr_t i = 0; i < SUB_DIM; i++) {
+                out[i] = c0[i];
+            }
+            for (intptr_t m = 1; m < M_PER_SPLIT; m++) {
+                const float* const __restrict c =
+                        entry(codebooks, s * M_PER_SPLIT + m, codes);
+#pragma unroll
+                for (intptr_t i = 0; i < SUB_DIM; i++) {
+                    out[i] += c[i];
+                }
+            }
+        }
+    }
+
+    // Process 1 sample.
+    // Performs outputAccum += weight * decoded(code)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code,
+            const float weight,
+            float* const __restrict outputAccum) {
+        float decoded[DIM];
+        store(codebooks, code, decoded);
+
+#pragma unroll
+        for (intptr_t i = 0; i < DIM; i++) {
+            outputAccum[i] += weight * decoded[i];
+        }
+    }
+
+    // Process 2 samples.
+    // Each code uses its own codebooks.
+    //
+    // Performs
+    //  outputAccum += weight0 * decoded(code0) + weight1 * decoded(code1)
+    static void accum(
+            const float* const __restrict codebooks0,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const float* const __restrict codebooks1,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            float* const __restrict outputAccum) {
+        float decoded0[DIM];
+        float decoded1[DIM];
+        store(codebooks0, code0, decoded0);
+        store(codebooks1, code1, decoded1);
+
+#pragma unroll
+        for (intptr_t i = 0; i < DIM; i++) {
+            outputAccum[i] += weight0 * decoded0[i] + weight1 * decoded1[i];
+        }
+    }
+
+    // Process 2 samples.
+    // Codebooks are shared among codes.
+    //
+    // Performs
+    //  outputAccum += weight0 * decoded(code0) + weight1 * decoded(code1)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            float* const __restrict outputAccum) {
+        accum(codebooks,
+              code0,
+              weight0,
+              codebooks,
+              code1,
+              weight1,
+              outputAccum);
+    }
+
+    // Process 3 samples.
+    // Each code uses its own codebooks.
+    //
+    // Performs outputAccum += weight0 * decoded(code0) + weight1 *
+    //   decoded(code1) + weight2 * decoded(code2)
+    static void accum(
+            const float* const __restrict codebooks0,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const float* const __restrict codebooks1,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            const float* const __restrict codebooks2,
+            const uint8_t* const __restrict code2,
+            const float weight2,
+            float* const __restrict outputAccum) {
+        float decoded0[DIM];
+        float decoded1[DIM];
+        float decoded2[DIM];
+        store(codebooks0, code0, decoded0);
+        store(codebooks1, code1, decoded1);
+        store(codebooks2, code2, decoded2);
+
+#pragma unroll
+        for (intptr_t i = 0; i < DIM; i++) {
+            outputAccum[i] += weight0 * decoded0[i] + weight1 * decoded1[i] +
+                    weight2 * decoded2[i];
+        }
+    }
+
+    // Process 3 samples.
+    // Codebooks are shared among codes.
+    //
+    // Performs outputAccum += weight0 * decoded(code0) + weight1 *
+    //   decoded(code1) + weight2 * decoded(code2)
+    static void accum(
+            const float* const __restrict codebooks,
+            const uint8_t* const __restrict code0,
+            const float weight0,
+            const uint8_t* const __restrict code1,
+            const float weight1,
+            const uint8_t* const __restrict code2,
+            const float weight2,
+            float* const __restrict outputAccum) {
+        accum(codebooks,
+              code0,
+              weight0,
+              codebooks,
+              code1,
+              weight1,
+              codebooks,
+              code2,
+              weight2,
+              outputAccum);
+    }
+
+   private:
+    // entry of codebook m for the code read from the sample
+    static const float* entry(
+            const float* const __restrict codebooks,
+            const intptr_t m,
+            const intptr_t* const __restrict codes) {
+        return codebooks + (m * CODEBOOK_SIZE + codes[m]) * SUB_DIM;
+    }
+};
+
+} // namespace cppcontrib
+} // namespace faiss
+#endif // ADDITIVE_INL_H
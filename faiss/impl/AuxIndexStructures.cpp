@@ -13,6 +13,7 @@
 #include <faiss/impl/AuxIndexStructures.h>
 
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/ScratchArena.h>
 
 namespace faiss {
 
@@ -55,6 +56,15 @@ RangeSearchResult::~RangeSearchResult() {
     delete[] lims;
 }
 
+RangeSearchResultCallback::RangeSearchResultCallback(size_t nq)
+        : RangeSearchResult(nq) {}
+
+void RangeSearchResultCallback::do_allocation() {
+    FAISS_THROW_MSG(
+            "the results of a RangeSearchResultCallback are streamed, "
+            "this range search does not support it");
+}
+
 /***********************************************************************
  * BufferList
  ***********************************************************************/
@@ -113,12 +123,19 @@ void BufferList::copy_range(
  ***********************************************************************/
 
 void RangeQueryResult::add(float dis, idx_t id) {
+    if (pres->stream && pres->wp == pres->buffer_size &&
+        !pres->buffers.empty()) {
+        // reuse the buffer rather than appending a new one
+        pres->flush();
+    }
     nres++;
     pres->add(id, dis);
 }
 
 RangeSearchPartialResult::RangeSearchPartialResult(RangeSearchResult* res_in)
-        : BufferList(res_in->buffer_size), res(res_in) {}
+        : BufferList(res_in->buffer_size),
+          res(res_in),
+          stream(dynamic_cast<RangeSearchResultCallback*>(res_in)) {}
 
 /// begin a new result
 RangeQueryResult& RangeSearchPartialResult::new_result(idx_t qno) {
@@ -128,6 +145,11 @@ RangeQueryResult& RangeSearchPartialResult::new_result(idx_t qno) {
 }
 
 void RangeSearchPartialResult::finalize() {
+    if (stream) {
+        // all the threads take this branch, so skipping the barriers is ok
+        flush();
+        return;
+    }
     set_lims();
 #pragma omp barrier
 
@@ -138,6 +160,31 @@ void RangeSearchPartialResult::finalize() {
     copy_result();
 }
 
+void RangeSearchPartialResult::flush() {
+    FAISS_THROW_IF_NOT(stream);
+    if (buffers.empty()) {
+        return;
+    }
+    FAISS_THROW_IF_NOT(buffers.size() == 1);
+    const Buffer& buf = buffers[0];
+    size_t ofs = 0;
+    while (ofs < wp) {
+        FAISS_ASSERT(flush_query < queries.size());
+        const RangeQueryResult& qres = queries[flush_query];
+        size_t n = std::min(qres.nres - flush_nres, wp - ofs);
+        if (n > 0) {
+            stream->consume(qres.qno, n, buf.ids + ofs, buf.dis + ofs);
+        }
+        ofs += n;
+        flush_nres += n;
+        if (flush_nres == qres.nres && flush_query + 1 < queries.size()) {
+            flush_query++;
+            flush_nres = 0;
+        }
+    }
+    wp = 0;
+}
+
 /// called by range_search before do_allocation
 void RangeSearchPartialResult::set_lims() {
     for (int i = 0; i < queries.size(); i++) {
@@ -170,7 +217,35 @@ void RangeSearchPartialResult::merge(
     int npres = partial_results.size();
     if (npres == 0)
         return;
-    RangeSearchResult* result = partial_results[0]->res;
+    const RangeSearchPartialResult* first = nullptr;
+    for (const RangeSearchPartialResult* pres : partial_results) {
+        if (pres) {
+            first = pres;
+            break;
+        }
+    }
+    if (!first)
+        return;
+    RangeSearchResult* result = first->res;
+
+    auto delete_partial_results = [&]() {
+        if (do_delete) {
+            for (RangeSearchPartialResult*& pres : partial_results) {
+                delete pres;
+                pres = nullptr;
+            }
+        }
+    };
+
+    if (first->stream) {
+        for (RangeSearchPartialResult* pres : partial_results) {
+            if (pres) {
+                pres->flush();
+            }
+        }
+        delete_partial_results();
+        return;
+    }
     size_t nx = result->nq;
 
     // count
@@ -182,15 +257,42 @@ void RangeSearchPartialResult::merge(
         }
     }
     result->do_allocation();
-    for (int j = 0; j < npres; j++) {
-        if (!partial_results[j])
+
+    // source and destination of each (partial result, query) pair. The
+    // results of the partial results are stored in that order for each
+    // query.
+    struct CopyTask {
+        RangeSearchPartialResult* pres;
+        size_t src_ofs;
+        size_t n;
+        size_t dest_ofs;
+    };
+    std::vector<CopyTask> tasks;
+    for (RangeSearchPartialResult* pres : partial_results) {
+        if (!pres)
             continue;
-        partial_results[j]->copy_result(true);
-        if (do_delete) {
-            delete partial_results[j];
-            partial_results[j] = nullptr;
+        size_t src_ofs = 0;
+        for (const RangeQueryResult& qres : pres->queries) {
+            if (qres.nres > 0) {
+                size_t& dest_ofs = result->lims[qres.qno];
+                tasks.push_back({pres, src_ofs, qres.nres, dest_ofs});
+                dest_ofs += qres.nres;
+                src_ofs += qres.nres;
+            }
         }
     }
+    size_t ntot = result->lims[nx];
+
+#pragma omp parallel for schedule(dynamic, 64) if (ntot > (1 << 16))
+    for (int64_t t = 0; t < tasks.size(); t++) {
+        const CopyTask& task = tasks[t];
+        task.pres->copy_range(
+                task.src_ofs,
+                task.n,
+                result->labels + task.dest_ofs,
+                result->distances + task.dest_ofs);
+    }
+    delete_partial_results();
 
     // reset the limits
     for (size_t i = nx; i > 0; i--) {
@@ -261,4 +363,86 @@ void TimeoutCallback::reset(double timeout_in_seconds) {
     tc->set_timeout(timeout_in_seconds);
 }
 
+/***********************************************************************
+ * VisitedTable
+ ***********************************************************************/
+
+void VisitedTable::grow_hashset() {
+    std::vector<int> old;
+    old.swap(hashset);
+    hashset_bits = std::max(hashset_bits + 1, 10);
+    hashset.resize(size_t(1) << hashset_bits, -1);
+    hashset_count = 0;
+    for (int no : old) {
+        if (no != -1) {
+            hashset_insert(no);
+        }
+    }
+}
+
+/***********************************************************************
+ * ScopedVisitedTable
+ ***********************************************************************/
+
+namespace {
+
+thread_local std::vector<std::unique_ptr<VisitedTable>> visited_table_pool;
+
+size_t visited_table_bytes(const VisitedTable& vt) {
+    return vt.visited.capacity() + vt.hashset.capacity() * sizeof(int);
+}
+
+} // namespace
+
+size_t visited_table_max_pooled_bytes = size_t(16) << 20;
+
+ScopedVisitedTable::ScopedVisitedTable(size_t size, bool use_hashset) {
+    if (visited_table_pool.empty()) {
+        vt.reset(new VisitedTable(size, use_hashset));
+        return;
+    }
+    vt = std::move(visited_table_pool.back());
+    visited_table_pool.pop_back();
+    vt->use_hashset = use_hashset;
+    if (use_hashset) {
+        vt->advance();
+        return;
+    }
+    if (vt->visited.size() < size) {
+        // the new flags are 0, which is never a valid visno
+        vt->visited.resize(size);
+    }
+    // some searches also use visno + 1
+    vt->advance();
+    vt->advance();
+}
+
+ScopedVisitedTable::~ScopedVisitedTable() {
+    if (visited_table_bytes(*vt) <= visited_table_max_pooled_bytes) {
+        visited_table_pool.push_back(std::move(vt));
+    }
+}
+
+size_t ScopedVisitedTable::pool_bytes() {
+    size_t nbytes = 0;
+    for (const auto& vt : visited_table_pool) {
+        nbytes += visited_table_bytes(*vt);
+    }
+    return nbytes;
+}
+
+void ScopedVisitedTable::release_pool() {
+    visited_table_pool.clear();
+}
+
+void release_thread_search_buffers() {
+    ScopedVisitedTable::release_pool();
+    get_thread_scratch_arena().release();
+#pragma omp parallel
+    {
+        ScopedVisitedTable::release_pool();
+        get_thread_scratch_arena().release();
+    }
+}
+
 } // namespace faiss
@@ -13,6 +13,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <mutex>
@@ -20,6 +21,7 @@
 
 #include <faiss/MetricType.h>
 #include <faiss/impl/platform_macros.h>
+#include <faiss/utils/prefetch.h>
 
 namespace faiss {
 
@@ -46,6 +48,33 @@ struct RangeSearchResult {
     virtual ~RangeSearchResult();
 };
 
+/** RangeSearchResult that hands the results over to a callback instead of
+ * storing them.
+ *
+ * The results are passed to consume() in chunks of at most buffer_size
+ * entries as soon as the search produced them, so the memory used by the
+ * search does not depend on the number of results. The results of a query
+ * can be split over several calls, and consume() is called concurrently
+ * from the search threads, possibly for the same query.
+ *
+ * lims, labels and distances are not filled in. This works with the range
+ * searches that collect their results with RangeSearchPartialResult (eg.
+ * IndexFlat, IndexIVF), the other ones throw in do_allocation().
+ */
+struct RangeSearchResultCallback : RangeSearchResult {
+    explicit RangeSearchResultCallback(size_t nq);
+
+    /// called with n results of query qno
+    virtual void consume(
+            idx_t qno,
+            size_t n,
+            const idx_t* labels,
+            const float* distances) = 0;
+
+    /// throws: the results are not stored
+    void do_allocation() override;
+};
+
 /****************************************************************
  * Result structures for range search.
  *
@@ -101,6 +130,10 @@ struct RangeQueryResult {
 struct RangeSearchPartialResult : BufferList {
     RangeSearchResult* res;
 
+    /// res if it is a RangeSearchResultCallback, otherwise nullptr. In that
+    /// case the results are streamed to it each time the buffer is full.
+    RangeSearchResultCallback* stream;
+
     /// eventually the result will be stored in res_in
     explicit RangeSearchPartialResult(RangeSearchResult* res_in);
 
@@ -115,17 +148,30 @@ struct RangeSearchPartialResult : BufferList {
      * lists */
     void finalize();
 
+    /// pass the results that are in the buffer to the stream
+    void flush();
+
     /// called by range_search before do_allocation
     void set_lims();
 
     /// called by range_search after do_allocation
     void copy_result(bool incremental = false);
 
-    /// merge a set of PartialResult's into one RangeSearchResult
-    /// on output the partialresults are empty!
+    /** merge a set of PartialResult's into one RangeSearchResult
+     * on output the partialresults are empty!
+     *
+     * The results are counted, the offsets of each partial result in the
+     * output are computed with a prefix sum, and the results are copied in
+     * parallel. Should not be called from a parallel region. */
     static void merge(
             std::vector<RangeSearchPartialResult*>& partial_results,
             bool do_delete = true);
+
+   private:
+    /// first query of queries whose results are not all flushed, and nb of
+    /// its results that are flushed already (stream mode only)
+    size_t flush_query = 0;
+    size_t flush_nres = 0;
 };
 
 /***********************************************************
@@ -169,25 +215,66 @@ struct TimeoutCallback : InterruptCallback {
     static void reset(double timeout_in_seconds);
 };
 
-/// set implementation optimized for fast access.
+/** set implementation optimized for fast access.
+ *
+ * By default, the flags are stored in a table of size entries. For large
+ * graphs, when a search visits few of the nodes, the visited ids can
+ * instead be stored in an open-addressing hash set (use_hashset), that
+ * uses memory in proportion to the nb of visited ids.
+ */
 struct VisitedTable {
     std::vector<uint8_t> visited;
     uint8_t visno;
 
-    explicit VisitedTable(int size) : visited(size), visno(1) {}
+    /// store the visited ids in hashset rather than in visited
+    bool use_hashset = false;
+
+    /// hash set of the visited ids, -1 = empty slot. Its size is
+    /// 1 << hashset_bits.
+    std::vector<int> hashset;
+    int hashset_bits = 0;
+    size_t hashset_count = 0;
+
+    explicit VisitedTable(int size, bool use_hashset = false)
+            : visited(use_hashset ? 0 : size),
+              visno(1),
+              use_hashset(use_hashset) {}
 
     /// set flag #no to true
     void set(int no) {
-        visited[no] = visno;
+        if (use_hashset) {
+            hashset_insert(no);
+        } else {
+            visited[no] = visno;
+        }
     }
 
     /// get flag #no
     bool get(int no) const {
+        if (use_hashset) {
+            return hashset_contains(no);
+        }
         return visited[no] == visno;
     }
 
+    /// prefetch the flag #no
+    void prefetch(int no) const {
+        if (use_hashset) {
+            if (!hashset.empty()) {
+                prefetch_L2(hashset.data() + hashset_slot(no));
+            }
+        } else {
+            prefetch_L2(visited.data() + no);
+        }
+    }
+
     /// reset all flags to false
     void advance() {
+        if (use_hashset) {
+            std::fill(hashset.begin(), hashset.end(), -1);
+            hashset_count = 0;
+            return;
+        }
         visno++;
         if (visno == 250) {
             // 250 rather than 255 because sometimes we use visno and visno+1
@@ -195,8 +282,94 @@ struct VisitedTable {
             visno = 1;
         }
     }
+
+    /** Should the hash set be used for a table of size entries, when about
+     * nvisit of them are visited between two calls to advance()? This is
+     * the case when the table is larger than the caches and much larger
+     * than the hash set. */
+    static bool hashset_preferred(size_t size, size_t nvisit) {
+        return size >= (1 << 20) && size > 64 * nvisit;
+    }
+
+   private:
+    size_t hashset_slot(int no) const {
+        return (uint32_t(no) * 0x9e3779b1U) >> (32 - hashset_bits);
+    }
+
+    void hashset_insert(int no) {
+        if (2 * (hashset_count + 1) > hashset.size()) {
+            grow_hashset();
+        }
+        size_t mask = hashset.size() - 1;
+        for (size_t i = hashset_slot(no);; i = (i + 1) & mask) {
+            if (hashset[i] == no) {
+                return;
+            }
+            if (hashset[i] == -1) {
+                hashset[i] = no;
+                hashset_count++;
+                return;
+            }
+        }
+    }
+
+    bool hashset_contains(int no) const {
+        if (hashset.empty()) {
+            return false;
+        }
+        size_t mask = hashset.size() - 1;
+        for (size_t i = hashset_slot(no);; i = (i + 1) & mask) {
+            if (hashset[i] == no) {
+                return true;
+            }
+            if (hashset[i] == -1) {
+                return false;
+            }
+        }
+    }
+
+    void grow_hashset();
+};
+
+/** VisitedTable borrowed from a pool of the calling thread.
+ *
+ * Allocating and clearing a table of ntotal flags for each search is
+ * expensive for small batches. The pooled tables are only advanced when
+ * they are reused, and grown if needed. They are kept until the thread
+ * exits or release_pool is called, except the tables larger than
+ * visited_table_max_pooled_bytes that are freed when they are returned.
+ */
+struct ScopedVisitedTable {
+    explicit ScopedVisitedTable(size_t size, bool use_hashset = false);
+
+    ScopedVisitedTable(const ScopedVisitedTable&) = delete;
+    ScopedVisitedTable& operator=(const ScopedVisitedTable&) = delete;
+
+    VisitedTable& get() {
+        return *vt;
+    }
+
+    ~ScopedVisitedTable();
+
+    /// memory used by the pool of the calling thread (bytes)
+    static size_t pool_bytes();
+
+    /// free the pool of the calling thread
+    static void release_pool();
+
+   private:
+    std::unique_ptr<VisitedTable> vt;
 };
 
+/// larger visited tables are not pooled (bytes, default 16 MiB)
+FAISS_API extern size_t visited_table_max_pooled_bytes;
+
+/** Free the pooled visited tables and the scratch arena blocks (see
+ * get_thread_scratch_arena) of the calling thread and of the threads of
+ * the OpenMP thread pool. The arenas in use by a search are kept.
+ */
+void release_thread_search_buffers();
+
 } // namespace faiss
 
 #endif
@@ -36,6 +36,12 @@ int HNSW::nb_neighbors(int layer_no) const {
             cum_nneighbor_per_level[layer_no];
 }
 
+bool HNSW::use_visited_hashset(int efSearch) const {
+    // a search expands about efSearch to 2 * efSearch nodes of level 0
+    size_t nvisit = size_t(2) * efSearch * nb_neighbors(0);
+    return VisitedTable::hashset_preferred(levels.size(), nvisit);
+}
+
 void HNSW::set_nb_neighbors(int level_no, int n) {
     FAISS_THROW_IF_NOT(levels.size() == 0);
     int cur_n = nb_neighbors(level_no);
@@ -643,7 +649,7 @@ int search_from_candidates(
             if (v1 < 0)
                 break;
 
-            prefetch_L2(vt.visited.data() + v1);
+            vt.prefetch(v1);
             jmax += 1;
         }
 
@@ -757,7 +763,7 @@ std::priority_queue<HNSW::Node> search_from_candidate_unbounded(
             if (v1 < 0)
                 break;
 
-            prefetch_L2(vt->visited.data() + v1);
+            vt->prefetch(v1);
             jmax += 1;
         }
 
@@ -166,6 +166,10 @@ struct HNSW {
     void neighbor_range(idx_t no, int layer_no, size_t* begin, size_t* end)
             const;
 
+    /// should the visited nodes of a search with this efSearch be stored
+    /// in a hash set (see VisitedTable)
+    bool use_visited_hashset(int efSearch) const;
+
     /// only mandatory parameter: nb of neighbors
     explicit HNSW(int M = 32);
 
@@ -8,6 +8,8 @@
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/IDSelector.h>
 
+#include <algorithm>
+
 namespace faiss {
 
 /***********************************************************************
@@ -21,6 +23,11 @@ bool IDSelectorRange::is_member(idx_t id) const {
     return id >= imin && id < imax;
 }
 
+idx_t IDSelectorRange::cardinality(idx_t ntotal) const {
+    return std::max(
+            std::min(imax, ntotal) - std::max(imin, idx_t(0)), idx_t(0));
+}
+
 void IDSelectorRange::find_sorted_ids_bounds(
         size_t list_size,
         const idx_t* ids,
@@ -77,6 +84,14 @@ bool IDSelectorArray::is_member(idx_t id) const {
     return false;
 }
 
+idx_t IDSelectorArray::cardinality(idx_t ntotal) const {
+    idx_t c = 0;
+    for (size_t i = 0; i < n; i++) {
+        c += ids[i] >= 0 && ids[i] < ntotal;
+    }
+    return c;
+}
+
 /***********************************************************************
  * IDSelectorBatch
  ***********************************************************************/
@@ -107,6 +122,14 @@ bool IDSelectorBatch::is_member(idx_t i) const {
     return set.count(i);
 }
 
+idx_t IDSelectorBatch::cardinality(idx_t ntotal) const {
+    idx_t c = 0;
+    for (idx_t id : set) {
+        c += id >= 0 && id < ntotal;
+    }
+    return c;
+}
+
 /***********************************************************************
  * IDSelectorBitmap
  ***********************************************************************/
@@ -122,4 +145,17 @@ bool IDSelectorBitmap::is_member(idx_t ii) const {
     return (bitmap[i >> 3] >> (i & 7)) & 1;
 }
 
+idx_t IDSelectorBitmap::cardinality(idx_t ntotal) const {
+    size_t nbyte = std::min(n, size_t(ntotal >> 3));
+    idx_t c = 0;
+    for (size_t i = 0; i < nbyte; i++) {
+        c += __builtin_popcount(bitmap[i]);
+    }
+    // partial last byte
+    for (idx_t i = nbyte * 8; i < std::min(ntotal, idx_t(n * 8)); i++) {
+        c += is_member(i);
+    }
+    return c;
+}
+
 } // namespace faiss
@@ -20,6 +20,13 @@ namespace faiss {
 /** Encapsulates a set of ids to handle. */
 struct IDSelector {
     virtual bool is_member(idx_t id) const = 0;
+
+    /// nb of selected ids in [0, ntotal), if the selector can compute it
+    /// cheaply (eg. to plan a filtered search), otherwise -1
+    virtual idx_t cardinality(idx_t ntotal) const {
+        return -1;
+    }
+
     virtual ~IDSelector() {}
 };
 
@@ -34,6 +41,7 @@ struct IDSelectorRange : IDSelector {
     IDSelectorRange(idx_t imin, idx_t imax, bool assume_sorted = false);
 
     bool is_member(idx_t id) const final;
+    idx_t cardinality(idx_t ntotal) const override;
 
     /// for sorted ids, find the range of list indices where the valid ids are
     /// stored
@@ -63,6 +71,8 @@ struct IDSelectorArray : IDSelector {
      */
     IDSelectorArray(size_t n, const idx_t* ids);
     bool is_member(idx_t id) const final;
+    /// assumes there are no duplicate ids
+    idx_t cardinality(idx_t ntotal) const override;
     ~IDSelectorArray() override {}
 };
 
@@ -93,6 +103,7 @@ struct IDSelectorBatch : IDSelector {
      */
     IDSelectorBatch(size_t n, const idx_t* indices);
     bool is_member(idx_t id) const final;
+    idx_t cardinality(idx_t ntotal) const override;
     ~IDSelectorBatch() override {}
 };
 
@@ -110,6 +121,7 @@ struct IDSelectorBitmap : IDSelector {
      */
     IDSelectorBitmap(size_t n, const uint8_t* bitmap);
     bool is_member(idx_t id) const final;
+    idx_t cardinality(idx_t ntotal) const override;
     ~IDSelectorBitmap() override {}
 };
 
@@ -120,6 +132,10 @@ struct IDSelectorNot : IDSelector {
     bool is_member(idx_t id) const final {
         return !sel->is_member(id);
     }
+    idx_t cardinality(idx_t ntotal) const override {
+        idx_t c = sel->cardinality(ntotal);
+        return c < 0 ? -1 : ntotal - c;
+    }
     virtual ~IDSelectorNot() {}
 };
 
@@ -128,6 +144,9 @@ struct IDSelectorAll : IDSelector {
     bool is_member(idx_t id) const final {
         return true;
     }
+    idx_t cardinality(idx_t ntotal) const override {
+        return ntotal;
+    }
     virtual ~IDSelectorAll() {}
 };
 
@@ -804,6 +804,220 @@ void IcmEncoder::encode(
     lsq->icm_encode_impl(codes, x, binaries.data(), gen, n, ils_iters, verbose);
 }
 
+namespace {
+
+/* objective of the codes of one vector, up to the squared norm of the
+ * vector. Unaries are stored as [M, K] for the vector, binaries as
+ * [M, M, K, K] with the cross terms counted twice */
+float icm_objective(
+        const int32_t* codes,
+        const float* unaries,
+        const float* binaries,
+        size_t M,
+        size_t K) {
+    float obj = 0;
+    for (size_t m = 0; m < M; m++) {
+        obj += unaries[m * K + codes[m]];
+        const float* bin = binaries + m * M * K * K + codes[m] * K;
+        for (size_t m2 = m + 1; m2 < M; m2++) {
+            obj += bin[m2 * K * K + codes[m2]];
+        }
+    }
+    return obj;
+}
+
+/* Returns the argmin over the K codes of unaries + the sum of the nrow
+ * rows. The sums and the per-lane minima are kept in registers over slices
+ * of the K codes, which the compiler vectorizes. */
+int32_t icm_argmin(
+        size_t K,
+        size_t nrow,
+        const float* unaries,
+        const float* const* rows) {
+    constexpr size_t W = 16;
+    float minv[W];
+    int32_t mini[W];
+    for (size_t j = 0; j < W; j++) {
+        minv[j] = HUGE_VALF;
+        mini[j] = 0;
+    }
+    size_t k0 = 0;
+    for (; k0 + W <= K; k0 += W) {
+        float accu[W];
+        for (size_t j = 0; j < W; j++) {
+            accu[j] = unaries[k0 + j];
+        }
+        for (size_t r = 0; r < nrow; r++) {
+            const float* row = rows[r] + k0;
+            for (size_t j = 0; j < W; j++) {
+                accu[j] += row[j];
+            }
+        }
+        for (size_t j = 0; j < W; j++) {
+            bool lt = accu[j] < minv[j];
+            minv[j] = lt ? accu[j] : minv[j];
+            mini[j] = lt ? int32_t(k0 + j) : mini[j];
+        }
+    }
+    float best_obj = HUGE_VALF;
+    int32_t best_code = 0;
+    for (size_t j = 0; j < W; j++) {
+        if (minv[j] < best_obj ||
+            (minv[j] == best_obj && mini[j] < best_code)) {
+            best_obj = minv[j];
+            best_code = mini[j];
+        }
+    }
+    for (; k0 < K; k0++) {
+        float accu = unaries[k0];
+        for (size_t r = 0; r < nrow; r++) {
+            accu += rows[r][k0];
+        }
+        if (accu < best_obj) {
+            best_obj = accu;
+            best_code = k0;
+        }
+    }
+    return best_code;
+}
+
+} // namespace
+
+IcmEncoderBlocked::IcmEncoderBlocked(const LocalSearchQuantizer* lsq)
+        : IcmEncoder(lsq) {}
+
+void IcmEncoderBlocked::encode(
+        int32_t* codes,
+        const float* x,
+        std::mt19937& gen,
+        size_t n,
+        size_t ils_iters) const {
+    LSQTimerScope scope(&lsq_timer, "icm_encode_blocked");
+
+    const size_t M = lsq->M;
+    const size_t K = lsq->K;
+    const size_t d = lsq->d;
+    const size_t nperts = lsq->nperts;
+    const size_t icm_iters = lsq->icm_iters;
+    const float* codebooks = lsq->codebooks.data();
+    FAISS_THROW_IF_NOT(M != 0 && K != 0);
+    FAISS_THROW_IF_NOT(binaries.size() == M * M * K * K);
+    FAISS_THROW_IF_NOT(nperts <= M);
+
+    size_t bs = block_size;
+    if (bs == 0) {
+        bs = std::max(size_t(1), (size_t(1) << 16) / (M * K));
+    }
+    size_t nblock = (n + bs - 1) / bs;
+
+    std::vector<float> norms(M * K);
+    fvec_norms_L2sqr(norms.data(), codebooks, d, M * K);
+
+    // one generator per block, so that the result is deterministic
+    uint32_t seed0 = gen();
+    float total_obj = 0;
+
+#pragma omp parallel reduction(+ : total_obj)
+    {
+        std::vector<float> unaries(bs * M * K); // [bs, M, K]
+        std::vector<int32_t> best_codes(bs * M);
+        std::vector<float> best_objs(bs);
+        std::vector<const float*> rows(M);
+
+#pragma omp for schedule(dynamic)
+        for (int64_t b = 0; b < nblock; b++) {
+            size_t i0 = b * bs;
+            size_t ni = std::min(bs, n - i0);
+            int32_t* codes_b = codes + i0 * M;
+            std::mt19937 rng(seed0 + b);
+            std::uniform_int_distribution<size_t> m_distrib(0, M - 1);
+            std::uniform_int_distribution<int32_t> k_distrib(0, K - 1);
+
+            // unary terms: ||c||^2 - 2 <x, c>
+            for (size_t i = 0; i < ni; i++) {
+                const float* xi = x + (i0 + i) * d;
+                for (size_t m = 0; m < M; m++) {
+                    float* u = unaries.data() + (i * M + m) * K;
+                    fvec_inner_products_ny(
+                            u, xi, codebooks + m * K * d, d, K);
+                    for (size_t k = 0; k < K; k++) {
+                        u[k] = norms[m * K + k] - 2 * u[k];
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < ni; i++) {
+                best_objs[i] = icm_objective(
+                        codes_b + i * M,
+                        unaries.data() + i * M * K,
+                        binaries.data(),
+                        M,
+                        K);
+            }
+            memcpy(best_codes.data(), codes_b, sizeof(int32_t) * ni * M);
+
+            for (size_t iter1 = 0; iter1 < ils_iters; iter1++) {
+                for (size_t i = 0; i < ni; i++) {
+                    int32_t* ci = codes_b + i * M;
+                    const float* ui = unaries.data() + i * M * K;
+
+                    for (size_t j = 0; j < nperts; j++) {
+                        size_t m = m_distrib(rng);
+                        ci[m] = k_distrib(rng);
+                    }
+
+                    for (size_t iter = 0; iter < icm_iters; iter++) {
+                        // condition on the m-th subcode
+                        for (size_t m = 0; m < M; m++) {
+                            size_t nrow = 0;
+                            for (size_t m2 = 0; m2 < M; m2++) {
+                                if (m2 != m) {
+                                    // binaries[m2, m, ci[m2], :]
+                                    rows[nrow++] = binaries.data() +
+                                            (m2 * M + m) * K * K + ci[m2] * K;
+                                }
+                            }
+                            ci[m] = icm_argmin(
+                                    K, nrow, ui + m * K, rows.data());
+                        }
+                    }
+
+                    // keep the best codes
+                    float obj = icm_objective(ci, ui, binaries.data(), M, K);
+                    if (obj < best_objs[i]) {
+                        best_objs[i] = obj;
+                        memcpy(best_codes.data() + i * M,
+                               ci,
+                               sizeof(int32_t) * M);
+                    } else {
+                        memcpy(ci,
+                               best_codes.data() + i * M,
+                               sizeof(int32_t) * M);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < ni; i++) {
+                total_obj += best_objs[i] +
+                        fvec_norm_L2sqr(x + (i0 + i) * d, d);
+            }
+        }
+    }
+
+    if (verbose) {
+        printf("\tblocked icm: %zd blocks of %zd vectors, obj = %g\n",
+               nblock,
+               bs,
+               total_obj / n);
+    }
+}
+
+IcmEncoder* IcmEncoderBlockedFactory::get(const LocalSearchQuantizer* lsq) {
+    IcmEncoderBlocked* encoder = new IcmEncoderBlocked(lsq);
+    encoder->block_size = block_size;
+    return encoder;
+}
+
 double LSQTimer::get(const std::string& name) {
     if (t.count(name) == 0) {
         return 0.0;
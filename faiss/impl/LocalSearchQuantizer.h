@@ -213,6 +213,37 @@ struct IcmEncoderFactory {
     virtual ~IcmEncoderFactory() {}
 };
 
+/** ICM encoder that processes the vectors by blocks. All the iterative
+ * local search iterations of a block are run by one thread with the unary
+ * terms of the block, laid out per vector, kept in cache. The blocks are
+ * processed in parallel and the objective is evaluated from the unary and
+ * binary terms instead of decoding the vectors.
+ *
+ * Each block uses its own random generator seeded from gen, so the result
+ * does not depend on the number of threads (but differs from the one of
+ * IcmEncoder).
+ */
+struct IcmEncoderBlocked : IcmEncoder {
+    /// nb of vectors per block, 0 = choose it so that the unary terms of
+    /// a block fit in 256 kiB
+    size_t block_size = 0;
+
+    explicit IcmEncoderBlocked(const LocalSearchQuantizer* lsq);
+
+    void encode(
+            int32_t* codes,
+            const float* x,
+            std::mt19937& gen,
+            size_t n,
+            size_t ils_iters) const override;
+};
+
+struct IcmEncoderBlockedFactory : IcmEncoderFactory {
+    size_t block_size = 0;
+
+    IcmEncoder* get(const LocalSearchQuantizer* lsq) override;
+};
+
 /** A helper struct to count consuming time during training.
  *  It is NOT thread-safe.
  */
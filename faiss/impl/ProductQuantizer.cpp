@@ -19,7 +19,10 @@
 #include <faiss/IndexFlat.h>
 #include <faiss/VectorTransform.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/ScratchArena.h>
 #include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
 
 extern "C" {
 
@@ -122,7 +125,54 @@ static void init_hypercube_pca(
     }
 }
 
+/// k-means++ initialization: each centroid is sampled with a probability
+/// proportional to its squared distance to the nearest previous centroid
+static void init_kmeanspp(
+        size_t d,
+        size_t k,
+        size_t n,
+        const float* x,
+        float* centroids,
+        int64_t seed) {
+    FAISS_THROW_IF_NOT(n >= k);
+    RandomGenerator rng(seed);
+    std::vector<float> min_dis(n, HUGE_VALF);
+    memcpy(centroids, x + rng.rand_int64() % n * d, sizeof(float) * d);
+    for (size_t c = 1; c < k; c++) {
+        const float* prev = centroids + (c - 1) * d;
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            float dis = fvec_L2sqr(x + i * d, prev, d);
+            if (dis < min_dis[i]) {
+                min_dis[i] = dis;
+            }
+            sum += min_dis[i];
+        }
+        size_t chosen = n - 1;
+        if (sum > 0) {
+            double r = rng.rand_double() * sum;
+            for (size_t i = 0; i < n; i++) {
+                r -= min_dis[i];
+                if (r < 0) {
+                    chosen = i;
+                    break;
+                }
+            }
+        } else {
+            // all points are on the centroids already
+            chosen = rng.rand_int64() % n;
+        }
+        memcpy(centroids + c * d, x + chosen * d, sizeof(float) * d);
+    }
+}
+
 void ProductQuantizer::train(size_t n, const float* x) {
+    if (concurrent_train &&
+        (train_type == Train_default || train_type == Train_kmeanspp ||
+         train_type == Train_hot_start)) {
+        train_concurrent(n, x);
+        return;
+    }
     if (train_type != Train_shared) {
         train_type_t final_train_type;
         final_train_type = train_type;
@@ -136,6 +186,19 @@ void ProductQuantizer::train(size_t n, const float* x) {
             }
         }
 
+        // k-means++ costs O(n * ksub) per subspace: initialize from a
+        // subsample of the training set, as train_concurrent does
+        size_t n_init = n;
+        std::vector<int> perm_init;
+        std::vector<float> xinit;
+        if (final_train_type == Train_kmeanspp &&
+            n > ksub * cp.max_points_per_centroid) {
+            n_init = ksub * cp.max_points_per_centroid;
+            perm_init.resize(n);
+            rand_perm(perm_init.data(), n, cp.seed);
+            xinit.resize(n_init * dsub);
+        }
+
         std::unique_ptr<float[]> xslice(new float[n * dsub]);
         for (int m = 0; m < M; m++) {
             for (int j = 0; j < n; j++)
@@ -172,6 +235,22 @@ void ProductQuantizer::train(size_t n, const float* x) {
                            get_centroids(m, 0),
                            dsub * ksub * sizeof(float));
                     break;
+                case Train_kmeanspp:
+                    if (n_init < n) {
+                        for (size_t i = 0; i < n_init; i++) {
+                            memcpy(xinit.data() + i * dsub,
+                                   xslice.get() + size_t(perm_init[i]) * dsub,
+                                   dsub * sizeof(float));
+                        }
+                    }
+                    init_kmeanspp(
+                            dsub,
+                            ksub,
+                            n_init,
+                            n_init < n ? xinit.data() : xslice.get(),
+                            clus.centroids.data(),
+                            cp.seed + m);
+                    break;
                 default:;
             }
 
@@ -201,11 +280,293 @@ void ProductQuantizer::train(size_t n, const float* x) {
     }
 }
 
+/* Nearest centroid of x, with centroids stored as (d, k) and their
+ * squared norms precomputed. The returned distance does not include the
+ * squared norm of x. The distances to W centroids at a time are
+ * accumulated in registers, which the compiler vectorizes. D is the
+ * dimension if known at compile time, 0 otherwise. */
+template <size_t D>
+static int32_t nearest_centroid_transposed(
+        size_t d_in,
+        size_t k,
+        const float* x,
+        const float* cent_t,
+        const float* cent_norms,
+        float* dis_out) {
+    constexpr size_t W = 8;
+    const size_t d = D == 0 ? d_in : D;
+    float minv[W];
+    int32_t mini[W];
+    for (size_t l = 0; l < W; l++) {
+        minv[l] = HUGE_VALF;
+        mini[l] = 0;
+    }
+    size_t c0 = 0;
+    for (; c0 + W <= k; c0 += W) {
+        float accu[W];
+        for (size_t l = 0; l < W; l++) {
+            accu[l] = cent_norms[c0 + l];
+        }
+        for (size_t j = 0; j < d; j++) {
+            float xj = -2 * x[j];
+            const float* ct = cent_t + j * k + c0;
+            for (size_t l = 0; l < W; l++) {
+                accu[l] += xj * ct[l];
+            }
+        }
+        for (size_t l = 0; l < W; l++) {
+            bool lt = accu[l] < minv[l];
+            minv[l] = lt ? accu[l] : minv[l];
+            mini[l] = lt ? int32_t(c0 + l) : mini[l];
+        }
+    }
+    float best = HUGE_VALF;
+    int32_t best_c = 0;
+    for (size_t l = 0; l < W; l++) {
+        if (minv[l] < best || (minv[l] == best && mini[l] < best_c)) {
+            best = minv[l];
+            best_c = mini[l];
+        }
+    }
+    for (; c0 < k; c0++) {
+        float accu = cent_norms[c0];
+        for (size_t j = 0; j < d; j++) {
+            accu -= 2 * x[j] * cent_t[j * k + c0];
+        }
+        if (accu < best) {
+            best = accu;
+            best_c = c0;
+        }
+    }
+    *dis_out = best;
+    return best_c;
+}
+
+/// assign the n vectors x (stride d) to the nearest centroid of each of the
+/// M subspaces, returns the objective up to the squared norms of x
+template <size_t D>
+static double assign_all_subspaces(
+        const ProductQuantizer& pq,
+        size_t n,
+        const float* x,
+        const float* cent_t,
+        const float* cent_norms,
+        int32_t* assign) {
+    size_t M = pq.M, dsub = pq.dsub, ksub = pq.ksub, d = pq.d;
+    // blocks of vectors are processed one subspace at a time, so that the
+    // centroids of the subspace stay in L1 cache
+    const size_t bs = 256;
+    int64_t nblock = (n + bs - 1) / bs;
+    double obj = 0;
+#pragma omp parallel for reduction(+ : obj)
+    for (int64_t b = 0; b < nblock; b++) {
+        size_t i0 = b * bs, i1 = std::min(n, i0 + bs);
+        for (size_t m = 0; m < M; m++) {
+            for (size_t i = i0; i < i1; i++) {
+                float dis;
+                assign[i * M + m] = nearest_centroid_transposed<D>(
+                        dsub,
+                        ksub,
+                        x + i * d + m * dsub,
+                        cent_t + m * dsub * ksub,
+                        cent_norms + m * ksub,
+                        &dis);
+                obj += dis;
+            }
+        }
+    }
+    return obj;
+}
+
+void ProductQuantizer::train_concurrent(size_t n_in, const float* x_in) {
+    FAISS_THROW_IF_NOT_MSG(
+            n_in >= ksub, "need at least as many training points as ksub");
+    double t0 = getmillisecs();
+
+    // subsample the training set, as Clustering does
+    size_t n = n_in;
+    const float* x = x_in;
+    std::vector<float> x_sub;
+    if (n_in > ksub * cp.max_points_per_centroid) {
+        n = ksub * cp.max_points_per_centroid;
+        std::vector<int> perm(n_in);
+        rand_perm(perm.data(), n_in, cp.seed);
+        x_sub.resize(n * d);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(x_sub.data() + i * d,
+                   x_in + size_t(perm[i]) * d,
+                   sizeof(float) * d);
+        }
+        x = x_sub.data();
+    }
+
+    if (verbose) {
+        printf("Training %zu PQ sub-quantizers concurrently on %zu "
+               "vectors\n",
+               M,
+               n);
+    }
+
+    // initialization, one subspace per thread
+    if (train_type != Train_hot_start) {
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t m = 0; m < M; m++) {
+            std::vector<float> xslice(n * dsub);
+            for (size_t i = 0; i < n; i++) {
+                memcpy(xslice.data() + i * dsub,
+                       x + i * d + m * dsub,
+                       sizeof(float) * dsub);
+            }
+            float* cent = get_centroids(m, 0);
+            if (train_type == Train_kmeanspp) {
+                init_kmeanspp(
+                        dsub, ksub, n, xslice.data(), cent, cp.seed + m);
+            } else {
+                // random training points
+                std::vector<int> perm(n);
+                rand_perm(perm.data(), n, cp.seed + m);
+                for (size_t c = 0; c < ksub; c++) {
+                    memcpy(cent + c * dsub,
+                           xslice.data() + size_t(perm[c]) * dsub,
+                           sizeof(float) * dsub);
+                }
+            }
+        }
+    }
+
+    std::vector<int32_t> assign(n * M); // (n, M)
+    std::vector<float> hassign(M * ksub);
+    double x_norms = 0;
+    if (verbose) {
+        std::vector<float> norms(n);
+        fvec_norms_L2sqr(norms.data(), x, d, n);
+        for (size_t i = 0; i < n; i++) {
+            x_norms += norms[i];
+        }
+    }
+    // centroids in (M, dsub, ksub) layout and their squared norms
+    std::vector<float> cent_t(M * dsub * ksub), cent_norms(M * ksub);
+
+    for (int iter = 0; iter < cp.niter; iter++) {
+        for (size_t m = 0; m < M; m++) {
+            for (size_t c = 0; c < ksub; c++) {
+                const float* cent = get_centroids(m, c);
+                for (size_t j = 0; j < dsub; j++) {
+                    cent_t[(m * dsub + j) * ksub + c] = cent[j];
+                }
+            }
+        }
+        fvec_norms_L2sqr(cent_norms.data(), centroids.data(), dsub, M * ksub);
+
+        // fused assignment over all the subspaces
+        double obj;
+#define DISPATCH_D(D)                                 \
+    case D:                                           \
+        obj = assign_all_subspaces<D>(                \
+                *this,                                \
+                n,                                    \
+                x,                                    \
+                cent_t.data(),                        \
+                cent_norms.data(),                    \
+                assign.data());                       \
+        break;
+        switch (dsub) {
+            DISPATCH_D(2)
+            DISPATCH_D(4)
+            DISPATCH_D(8)
+            DISPATCH_D(16)
+            default:
+                obj = assign_all_subspaces<0>(
+                        *this,
+                        n,
+                        x,
+                        cent_t.data(),
+                        cent_norms.data(),
+                        assign.data());
+        }
+#undef DISPATCH_D
+
+        // centroid update, one subspace per thread
+        int nsplit = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+ : nsplit)
+        for (int64_t m = 0; m < M; m++) {
+            float* cent = get_centroids(m, 0);
+            float* hass = hassign.data() + m * ksub;
+            std::vector<double> sums(ksub * dsub);
+            std::fill(hass, hass + ksub, 0);
+            for (size_t i = 0; i < n; i++) {
+                size_t c = assign[i * M + m];
+                const float* xi = x + i * d + m * dsub;
+                double* s = sums.data() + c * dsub;
+                for (size_t j = 0; j < dsub; j++) {
+                    s[j] += xi[j];
+                }
+                hass[c] += 1;
+            }
+            for (size_t c = 0; c < ksub; c++) {
+                if (hass[c] == 0) {
+                    continue;
+                }
+                for (size_t j = 0; j < dsub; j++) {
+                    cent[c * dsub + j] = sums[c * dsub + j] / hass[c];
+                }
+            }
+
+            // split the large clusters to fill the empty ones
+            RandomGenerator rng(cp.seed + iter * M + m);
+            const float eps = 1.0 / 1024;
+            for (size_t ci = 0; ci < ksub; ci++) {
+                if (hass[ci] != 0) {
+                    continue;
+                }
+                size_t cj;
+                for (cj = 0; true; cj = (cj + 1) % ksub) {
+                    float p = (hass[cj] - 1.0) / (float)(n - ksub);
+                    if (rng.rand_float() < p) {
+                        break;
+                    }
+                }
+                memcpy(cent + ci * dsub,
+                       cent + cj * dsub,
+                       sizeof(float) * dsub);
+                for (size_t j = 0; j < dsub; j++) {
+                    float f = j % 2 == 0 ? eps : -eps;
+                    cent[ci * dsub + j] *= 1 + f;
+                    cent[cj * dsub + j] *= 1 - f;
+                }
+                hass[ci] = hass[cj] / 2;
+                hass[cj] -= hass[ci];
+                nsplit++;
+            }
+        }
+
+        if (verbose) {
+            printf("  Iteration %d (%.2f s): objective=%g nsplit=%d\r",
+                   iter,
+                   (getmillisecs() - t0) / 1000.0,
+                   obj + x_norms,
+                   nsplit);
+            fflush(stdout);
+        }
+    }
+    if (verbose) {
+        printf("\n");
+    }
+}
+
 template <class PQEncoder>
 void compute_code(const ProductQuantizer& pq, const float* x, uint8_t* code) {
-    std::vector<float> distances(pq.ksub);
+    // this is called for each vector, so the common table sizes are on the
+    // stack to stay out of the allocator
+    float distances_stack[256];
+    std::vector<float> distances_heap;
+    float* distances = distances_stack;
+    if (pq.ksub > 256) {
+        distances_heap.resize(pq.ksub);
+        distances = distances_heap.data();
+    }
 
-    // It seems to be meaningless to allocate std::vector<float> distances.
+    // It seems to be meaningless to compute the distances in a buffer.
     // But it is done in order to cope the ineffectiveness of the way
     // the compiler generates the code. Basically, doing something like
     //
@@ -237,9 +598,8 @@ void compute_code(const ProductQuantizer& pq, const float* x, uint8_t* code) {
     //
     // So, the baseline is faster. This is because of the vectorization.
     // I suppose that the branch predictor might affect the performance as well.
-    // So, the buffer is allocated, but it might be unused in
-    // manually optimized code. Let's hope that the compiler is smart enough to
-    // get rid of std::vector allocation in such a case.
+    // So, the buffer is provided, but it might be unused in
+    // manually optimized code.
 
     PQEncoder encoder(code, pq.nbits);
     for (size_t m = 0; m < pq.M; m++) {
@@ -249,7 +609,7 @@ void compute_code(const ProductQuantizer& pq, const float* x, uint8_t* code) {
         if (pq.transposed_centroids.empty()) {
             // the regular version
             idxm = fvec_L2sqr_ny_nearest(
-                    distances.data(),
+                    distances,
                     xsub,
                     pq.get_centroids(m, 0),
                     pq.dsub,
@@ -257,7 +617,7 @@ void compute_code(const ProductQuantizer& pq, const float* x, uint8_t* code) {
         } else {
             // transposed centroids are available, use'em
             idxm = fvec_L2sqr_ny_nearest_y_transposed(
-                    distances.data(),
+                    distances,
                     xsub,
                     pq.transposed_centroids.data() + m * pq.ksub,
                     pq.centroids_sq_lengths.data() + m * pq.ksub,
@@ -426,6 +786,30 @@ void ProductQuantizer::compute_codes(const float* x, uint8_t* codes, size_t n)
     }
 }
 
+void ProductQuantizer::compute_codes_arena(
+        const float* x,
+        uint8_t* codes,
+        size_t n,
+        ScratchArena& arena) const {
+    if (dsub < 16) {
+        compute_codes(x, codes, n); // does not allocate
+        return;
+    }
+    size_t bs = product_quantizer_compute_codes_bs;
+    for (size_t i0 = 0; i0 < n; i0 += bs) {
+        size_t i1 = std::min(i0 + bs, n);
+        ScratchArena::Scope scope(arena);
+        float* dis_tables = arena.alloc<float>((i1 - i0) * ksub * M);
+        compute_distance_tables(i1 - i0, x + d * i0, dis_tables);
+
+#pragma omp parallel for if (i1 - i0 > 1000)
+        for (int64_t i = i0; i < i1; i++) {
+            compute_code_from_distance_table(
+                    dis_tables + (i - i0) * ksub * M, codes + i * code_size);
+        }
+    }
+}
+
 void ProductQuantizer::compute_distance_table(const float* x, float* dis_table)
         const {
     if (transposed_centroids.empty()) {
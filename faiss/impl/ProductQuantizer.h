@@ -21,6 +21,8 @@
 
 namespace faiss {
 
+struct ScratchArena;
+
 /** Product Quantizer.
  * PQ is trained using k-means, minimizing the L2 distance to centroids.
  * PQ supports L2 and Inner Product search, however the quantization error is
@@ -42,9 +44,13 @@ struct ProductQuantizer : Quantizer {
         Train_shared,        ///< share dictionary across PQ segments
         Train_hypercube,     ///< initialize centroids with nbits-D hypercube
         Train_hypercube_pca, ///< initialize centroids with nbits-D hypercube
+        Train_kmeanspp,      ///< initialize centroids with k-means++
     };
     train_type_t train_type;
 
+    /// train the M sub-quantizers concurrently (see train_concurrent)
+    bool concurrent_train = false;
+
     ClusteringParameters cp; ///< parameters used during clustering
 
     /// if non-NULL, use this index for assignment (should be of size
@@ -75,6 +81,17 @@ struct ProductQuantizer : Quantizer {
     // can be set on input to define non-default clustering parameters
     void train(size_t n, const float* x) override;
 
+    /** Train the M sub-quantizers at once with a k-means that runs the M
+     * subspaces in lockstep: each training vector is assigned to its M
+     * sub-centroids in one pass over the data, and the centroid updates
+     * are parallelized over sub-quantizers. This scales better than
+     * training M Clusterings in sequence when dsub is small. Uses
+     * cp.niter, cp.seed and cp.max_points_per_centroid, supports the
+     * Train_default, Train_kmeanspp and Train_hot_start initializations
+     * and ignores assign_index.
+     */
+    void train_concurrent(size_t n, const float* x);
+
     ProductQuantizer(
             size_t d,      /* dimensionality of the input vectors */
             size_t M,      /* number of subquantizers */
@@ -94,6 +111,13 @@ struct ProductQuantizer : Quantizer {
     /// same as compute_code for several vectors
     void compute_codes(const float* x, uint8_t* codes, size_t n) const override;
 
+    /// same as compute_codes, with the distance tables taken from arena
+    void compute_codes_arena(
+            const float* x,
+            uint8_t* codes,
+            size_t n,
+            ScratchArena& arena) const;
+
     /// speed up code assignment using assign_index
     /// (non-const because the index is changed)
     void compute_codes_with_assign_index(
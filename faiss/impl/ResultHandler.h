@@ -15,10 +15,13 @@
 #include <faiss/impl/FaissException.h>
 #include <faiss/impl/IDSelector.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/approx_topk/approx_topk.h>
 #include <faiss/utils/partitioning.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 namespace faiss {
 
@@ -79,6 +82,24 @@ struct ResultHandler {
     virtual ~ResultHandler() {}
 };
 
+/// handler for a single query that also accepts blocks of results
+template <class C>
+struct BufferedResultHandler : ResultHandler<C> {
+    /** add a block of results, only the ones that pass the threshold are
+     * stored
+     *
+     * @param n     number of results to add
+     * @param vals  values (size n)
+     * @param ids   ids (size n), if nullptr ids are id0..id0+n-1
+     * @return number of results stored
+     */
+    virtual size_t add_results(
+            size_t n,
+            const typename C::T* vals,
+            const typename C::TI* ids,
+            typename C::TI id0) = 0;
+};
+
 /*****************************************************************
  * Single best result handler.
  * Tracks the only best result, thus avoiding storing
@@ -195,6 +216,10 @@ struct HeapBlockResultHandler : BlockResultHandler<C, use_sel> {
 
     int64_t k; // number of results to keep
 
+    /// initial threshold of the heaps. Only the results strictly better than
+    /// the radius are collected, which gives the top-k within radius.
+    T radius = C::neutral();
+
     HeapBlockResultHandler(
             size_t nq,
             T* heap_dis_tab,
@@ -206,6 +231,14 @@ struct HeapBlockResultHandler : BlockResultHandler<C, use_sel> {
               heap_ids_tab(heap_ids_tab),
               k(k) {}
 
+    /// the placeholders at the radius are removed by heap_reorder
+    void init_heap(T* heap_dis, TI* heap_ids) const {
+        heap_heapify<C>(k, heap_dis, heap_ids);
+        if (radius != C::neutral()) {
+            std::fill_n(heap_dis, k, radius);
+        }
+    }
+
     /******************************************************
      * API for 1 result at a time (each SingleResultHandler is
      * called from 1 thread)
@@ -226,7 +259,7 @@ struct HeapBlockResultHandler : BlockResultHandler<C, use_sel> {
         void begin(size_t i) {
             heap_dis = hr.heap_dis_tab + i * k;
             heap_ids = hr.heap_ids_tab + i * k;
-            heap_heapify<C>(k, heap_dis, heap_ids);
+            hr.init_heap(heap_dis, heap_ids);
             threshold = heap_dis[0];
         }
 
@@ -255,7 +288,7 @@ struct HeapBlockResultHandler : BlockResultHandler<C, use_sel> {
         this->i0 = i0_2;
         this->i1 = i1_2;
         for (size_t i = i0; i < i1; i++) {
-            heap_heapify<C>(k, heap_dis_tab + i * k, heap_ids_tab + i * k);
+            init_heap(heap_dis_tab + i * k, heap_ids_tab + i * k);
         }
     }
 
@@ -297,7 +330,7 @@ struct HeapBlockResultHandler : BlockResultHandler<C, use_sel> {
 
 /// Reservoir for a single query
 template <class C>
-struct ReservoirTopN : ResultHandler<C> {
+struct ReservoirTopN : BufferedResultHandler<C> {
     using T = typename C::T;
     using TI = typename C::TI;
     using ResultHandler<C>::threshold;
@@ -335,6 +368,45 @@ struct ReservoirTopN : ResultHandler<C> {
         add_result(val, id);
     }
 
+    /** The comparison with the threshold is branchless: every value is
+     * written to the reservoir and the write position is advanced only if it
+     * passes the threshold. The loop runs on chunks that are guaranteed to
+     * fit in the remaining storage.
+     */
+    size_t add_results(
+            size_t nin,
+            const T* vals_in,
+            const TI* ids_in,
+            TI id0) final {
+        size_t nadd = 0;
+        size_t j = 0;
+        while (j < nin) {
+            if (i == capacity) {
+                shrink_fuzzy();
+            }
+            size_t j1 = std::min(nin, j + capacity - i);
+            size_t i_start = i;
+            size_t wp = i;
+            T thresh = threshold;
+            if (ids_in) {
+                for (; j < j1; j++) {
+                    vals[wp] = vals_in[j];
+                    ids[wp] = ids_in[j];
+                    wp += C::cmp(thresh, vals_in[j]) ? 1 : 0;
+                }
+            } else {
+                for (; j < j1; j++) {
+                    vals[wp] = vals_in[j];
+                    ids[wp] = id0 + j;
+                    wp += C::cmp(thresh, vals_in[j]) ? 1 : 0;
+                }
+            }
+            i = wp;
+            nadd += wp - i_start;
+        }
+        return nadd;
+    }
+
     // reduce storage from capacity to anything
     // between n and (capacity + n) / 2
     void shrink_fuzzy() {
@@ -458,11 +530,8 @@ struct ReservoirBlockResultHandler : BlockResultHandler<C, use_sel> {
 #pragma omp parallel for
         for (int64_t i = i0; i < i1; i++) {
             ReservoirTopN<C>& reservoir = reservoirs[i - i0];
-            const T* dis_tab_i = dis_tab + (j1 - j0) * (i - i0) - j0;
-            for (size_t j = j0; j < j1; j++) {
-                T dis = dis_tab_i[j];
-                reservoir.add_result(dis, j);
-            }
+            const T* dis_tab_i = dis_tab + (j1 - j0) * (i - i0);
+            reservoir.add_results(j1 - j0, dis_tab_i, nullptr, j0);
         }
     }
 
@@ -476,6 +545,292 @@ struct ReservoirBlockResultHandler : BlockResultHandler<C, use_sel> {
     }
 };
 
+/*****************************************************************
+ * Approximate top-k result handler
+ *
+ * Results that pass the threshold are appended to a buffer. When the
+ * buffer is full, it is split into beams and HeapWithBuckets (see
+ * utils/approx_topk/approx_topk.h) keeps only the best D results of each of
+ * the B buckets of a beam. These are merged into the result heap. There are
+ * enough beams so that at least k results are merged per flush. The
+ * distances are exact, but some of the true top-k may be missed.
+ *****************************************************************/
+
+/// Approximate top-k for a single query, the heap is provided by the caller
+template <class C>
+struct ApproxTopN : BufferedResultHandler<C> {
+    using T = typename C::T;
+    using TI = typename C::TI;
+    using ResultHandler<C>::threshold;
+
+    ApproxTopK_mode_t mode;
+    size_t k;
+
+    // result heap (size k)
+    T* heap_dis = nullptr;
+    TI* heap_ids = nullptr;
+
+    // buffered results, the values are negated for min-heaps because
+    // HeapWithBuckets supports only CMax<float, int>
+    size_t capacity;
+    size_t nbuf = 0;
+    std::vector<float> buf_dis;
+    std::vector<TI> buf_ids;
+
+    // temporary heap that references the buffer entries
+    std::vector<float> bh_dis;
+    std::vector<int32_t> bh_ids;
+
+    ApproxTopN(size_t k, ApproxTopK_mode_t mode, size_t capacity)
+            : mode(mode),
+              k(k),
+              capacity(capacity),
+              buf_dis(capacity),
+              buf_ids(capacity),
+              bh_dis(k),
+              bh_ids(k) {
+        FAISS_THROW_IF_NOT(capacity <= size_t(INT32_MAX));
+    }
+
+    /// start collecting results in the heap (heap_dis, heap_ids)
+    void begin(T* heap_dis_2, TI* heap_ids_2, bool init_heap = true) {
+        heap_dis = heap_dis_2;
+        heap_ids = heap_ids_2;
+        if (init_heap) {
+            heap_heapify<C>(k, heap_dis, heap_ids);
+        }
+        threshold = heap_dis[0];
+        nbuf = 0;
+    }
+
+    bool add_result(T dis, TI idx) final {
+        if (!C::cmp(threshold, dis)) {
+            return false;
+        }
+        buf_dis[nbuf] = C::is_max ? dis : -dis;
+        buf_ids[nbuf] = idx;
+        nbuf++;
+        if (nbuf == capacity) {
+            flush();
+            return true;
+        }
+        return false;
+    }
+
+    size_t add_results(size_t n, const T* vals, const TI* ids, TI id0)
+            final {
+        size_t nadd = 0;
+        size_t j = 0;
+        while (j < n) {
+            if (nbuf == capacity) {
+                flush();
+            }
+            size_t j1 = std::min(n, j + capacity - nbuf);
+            size_t wp = nbuf;
+            T thresh = threshold;
+            for (; j < j1; j++) {
+                buf_dis[wp] = C::is_max ? vals[j] : -vals[j];
+                buf_ids[wp] = ids ? ids[j] : id0 + j;
+                wp += C::cmp(thresh, vals[j]) ? 1 : 0;
+            }
+            nadd += wp - nbuf;
+            nbuf = wp;
+        }
+        return nadd;
+    }
+
+    /// number of buckets and bucket depth of the mode (0 for exact)
+    static void get_buckets(
+            ApproxTopK_mode_t mode,
+            uint32_t& nb,
+            uint32_t& nd) {
+        switch (mode) {
+            case APPROX_TOPK_BUCKETS_B32_D2:
+                nb = 32, nd = 2;
+                break;
+            case APPROX_TOPK_BUCKETS_B8_D3:
+                nb = 8, nd = 3;
+                break;
+            case APPROX_TOPK_BUCKETS_B16_D2:
+                nb = 16, nd = 2;
+                break;
+            case APPROX_TOPK_BUCKETS_B8_D2:
+                nb = 8, nd = 2;
+                break;
+            default:
+                nb = nd = 0;
+        }
+    }
+
+    /// smallest capacity for which flush() uses the buckets when the
+    /// buffer is full (at most 2 * k + 2 * NB * D)
+    static size_t min_capacity(size_t k, ApproxTopK_mode_t mode) {
+        uint32_t nb, nd;
+        get_buckets(mode, nb, nd);
+        if (nb == 0) {
+            return 2 * k;
+        }
+        size_t nbeam = (k + nb * nd - 1) / (nb * nd);
+        return nbeam * 2 * nb * nd;
+    }
+
+    /// reduce the buffer and merge the result into the heap
+    void flush() {
+        if (nbuf == 0) {
+            return;
+        }
+        using CB = CMax<float, int32_t>;
+        uint32_t nb, nd;
+        get_buckets(mode, nb, nd);
+        size_t nbeam = 1, n_per_beam = 0;
+        if (nb > 0) {
+            nbeam = (k + nb * nd - 1) / (nb * nd);
+            n_per_beam = nbuf / nbeam / nb * nb;
+        }
+        heap_heapify<CB>(k, bh_dis.data(), bh_ids.data());
+        size_t n_bucketed = 0;
+        // bucketing is useful only if the beams are much larger than what
+        // they output
+        if (n_per_beam >= 2 * nb * nd) {
+            n_bucketed = nbeam * n_per_beam;
+#define HANDLE_APPROX(NB, BD)                                  \
+    case ApproxTopK_mode_t::APPROX_TOPK_BUCKETS_B##NB##_D##BD: \
+        HeapWithBuckets<CB, NB, BD>::bs_addn(                  \
+                nbeam,                                         \
+                n_per_beam,                                    \
+                buf_dis.data(),                                \
+                k,                                             \
+                bh_dis.data(),                                 \
+                bh_ids.data());                                \
+        break;
+            switch (mode) {
+                HANDLE_APPROX(8, 3)
+                HANDLE_APPROX(8, 2)
+                HANDLE_APPROX(16, 2)
+                HANDLE_APPROX(32, 2)
+                default:
+                    FAISS_THROW_MSG("unexpected approx_topk mode");
+            }
+#undef HANDLE_APPROX
+        }
+        // leftovers are added exactly
+        for (size_t j = n_bucketed; j < nbuf; j++) {
+            if (CB::cmp(bh_dis[0], buf_dis[j])) {
+                heap_replace_top<CB>(
+                        k, bh_dis.data(), bh_ids.data(), buf_dis[j], j);
+            }
+        }
+        for (size_t j = 0; j < k; j++) {
+            if (bh_ids[j] < 0) {
+                continue;
+            }
+            T dis = C::is_max ? bh_dis[j] : -bh_dis[j];
+            if (C::cmp(heap_dis[0], dis)) {
+                heap_replace_top<C>(
+                        k, heap_dis, heap_ids, dis, buf_ids[bh_ids[j]]);
+            }
+        }
+        threshold = heap_dis[0];
+        nbuf = 0;
+    }
+
+    /// flush and sort the result heap
+    void end() {
+        flush();
+        heap_reorder<C>(k, heap_dis, heap_ids);
+    }
+};
+
+template <class C, bool use_sel = false>
+struct ApproxTopKBlockResultHandler : BlockResultHandler<C, use_sel> {
+    using T = typename C::T;
+    using TI = typename C::TI;
+    using BlockResultHandler<C, use_sel>::i0;
+    using BlockResultHandler<C, use_sel>::i1;
+
+    T* heap_dis_tab;
+    TI* heap_ids_tab;
+
+    int64_t k; // number of results to keep
+    ApproxTopK_mode_t mode;
+    size_t capacity; // capacity of the buffers (1 result at a time API)
+
+    ApproxTopKBlockResultHandler(
+            size_t nq,
+            T* heap_dis_tab,
+            TI* heap_ids_tab,
+            size_t k,
+            ApproxTopK_mode_t mode,
+            const IDSelector* sel = nullptr)
+            : BlockResultHandler<C, use_sel>(nq, sel),
+              heap_dis_tab(heap_dis_tab),
+              heap_ids_tab(heap_ids_tab),
+              k(k),
+              mode(mode) {
+        capacity = std::max(size_t(16 * k), size_t(4096));
+    }
+
+    /******************************************************
+     * API for 1 result at a time (each SingleResultHandler is
+     * called from 1 thread)
+     */
+
+    struct SingleResultHandler : ApproxTopN<C> {
+        ApproxTopKBlockResultHandler& hr;
+
+        explicit SingleResultHandler(ApproxTopKBlockResultHandler& hr)
+                : ApproxTopN<C>(hr.k, hr.mode, hr.capacity), hr(hr) {}
+
+        /// begin results for query # i
+        void begin(size_t i) {
+            ApproxTopN<C>::begin(
+                    hr.heap_dis_tab + i * hr.k, hr.heap_ids_tab + i * hr.k);
+        }
+    };
+
+    /******************************************************
+     * API for multiple results (called from 1 thread)
+     */
+
+    /// one buffer per query, kept across the database blocks so that the
+    /// approximate reduction sees enough results even for large k
+    std::vector<ApproxTopN<C>> topns;
+
+    /// begin
+    void begin_multiple(size_t i0_2, size_t i1_2) final {
+        this->i0 = i0_2;
+        this->i1 = i1_2;
+        // the buffers are kept for the whole query block: use the
+        // smallest capacity that still allows bucketing in flush(), so
+        // that the block needs O(k) memory per query
+        size_t capacity_multiple = ApproxTopN<C>::min_capacity(k, mode);
+        topns.clear();
+        topns.reserve(i1 - i0);
+        for (size_t i = i0; i < i1; i++) {
+            topns.emplace_back(k, mode, capacity_multiple);
+            topns.back().begin(heap_dis_tab + i * k, heap_ids_tab + i * k);
+        }
+    }
+
+    /// add results for query i0..i1 and j0..j1
+    void add_results(size_t j0, size_t j1, const T* dis_tab) final {
+#pragma omp parallel for
+        for (int64_t i = i0; i < i1; i++) {
+            topns[i - i0].add_results(
+                    j1 - j0, dis_tab + (j1 - j0) * (i - i0), nullptr, j0);
+        }
+    }
+
+    /// series of results for queries i0..i1 is done
+    void end_multiple() final {
+#pragma omp parallel for
+        for (int64_t i = i0; i < i1; i++) {
+            topns[i - i0].end();
+        }
+        topns.clear();
+    }
+};
+
 /*****************************************************************
  * Result handler for range searches
  *****************************************************************/
@@ -654,6 +1009,76 @@ typename Consumer::T dispatch_knn_ResultHandler(
 #undef DISPATCH_C_SEL
 }
 
+// same for a top-k within radius search, that always uses heaps
+template <class Consumer, class... Types>
+typename Consumer::T dispatch_knn_radius_ResultHandler(
+        size_t nx,
+        float* vals,
+        int64_t* ids,
+        size_t k,
+        float radius,
+        MetricType metric,
+        const IDSelector* sel,
+        Consumer& consumer,
+        Types... args) {
+#define DISPATCH_C_SEL(C, use_sel)                                 \
+    HeapBlockResultHandler<C, use_sel> res(nx, vals, ids, k, sel); \
+    res.radius = radius;                                           \
+    return consumer.template f<>(res, args...);
+
+    if (is_similarity_metric(metric)) {
+        using C = CMin<float, int64_t>;
+        if (sel) {
+            DISPATCH_C_SEL(C, true);
+        } else {
+            DISPATCH_C_SEL(C, false);
+        }
+    } else {
+        using C = CMax<float, int64_t>;
+        if (sel) {
+            DISPATCH_C_SEL(C, true);
+        } else {
+            DISPATCH_C_SEL(C, false);
+        }
+    }
+#undef DISPATCH_C_SEL
+}
+
+// same for approximate top-k with one of the APPROX_TOPK_BUCKETS modes
+template <class Consumer, class... Types>
+typename Consumer::T dispatch_approx_topk_ResultHandler(
+        size_t nx,
+        float* vals,
+        int64_t* ids,
+        size_t k,
+        ApproxTopK_mode_t mode,
+        MetricType metric,
+        const IDSelector* sel,
+        Consumer& consumer,
+        Types... args) {
+#define DISPATCH_C_SEL(C, use_sel)                        \
+    ApproxTopKBlockResultHandler<C, use_sel> res(         \
+            nx, vals, ids, k, mode, sel);                 \
+    return consumer.template f<>(res, args...);
+
+    if (is_similarity_metric(metric)) {
+        using C = CMin<float, int64_t>;
+        if (sel) {
+            DISPATCH_C_SEL(C, true);
+        } else {
+            DISPATCH_C_SEL(C, false);
+        }
+    } else {
+        using C = CMax<float, int64_t>;
+        if (sel) {
+            DISPATCH_C_SEL(C, true);
+        } else {
+            DISPATCH_C_SEL(C, false);
+        }
+    }
+#undef DISPATCH_C_SEL
+}
+
 template <class Consumer, class... Types>
 typename Consumer::T dispatch_range_ResultHandler(
         RangeSearchResult* res,
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/impl/ScratchArena.h>
+
+#include <algorithm>
+
+#include <faiss/Index.h>
+#include <faiss/impl/FaissAssert.h>
+
+namespace faiss {
+
+namespace {
+
+size_t round_up(size_t nbytes) {
+    return (nbytes + ScratchArena::alignment - 1) &
+            ~(ScratchArena::alignment - 1);
+}
+
+uint8_t* align_ptr(uint8_t* p) {
+    return (uint8_t*)round_up((uintptr_t)p);
+}
+
+} // namespace
+
+ScratchArena::ScratchArena(size_t capacity) {
+    reserve(capacity);
+}
+
+void ScratchArena::reserve(size_t capacity) {
+    capacity = round_up(capacity);
+    if (capacity <= cap) {
+        return;
+    }
+    FAISS_THROW_IF_NOT(used == 0 && overflow.empty());
+    block.reset(new uint8_t[capacity + alignment]);
+    base = align_ptr(block.get());
+    cap = capacity;
+    n_heap_alloc++;
+}
+
+void ScratchArena::release() {
+    if (used != 0 || !overflow.empty()) {
+        return;
+    }
+    block.reset();
+    base = nullptr;
+    cap = 0;
+    peak = 0;
+}
+
+void* ScratchArena::allocate(size_t nbytes) {
+    nbytes = round_up(nbytes);
+    void* p;
+    if (used + nbytes <= cap) {
+        p = base + used;
+        used += nbytes;
+    } else {
+        overflow.emplace_back(new uint8_t[nbytes + alignment]);
+        p = align_ptr(overflow.back().get());
+        overflow_bytes += nbytes;
+        n_heap_alloc++;
+    }
+    peak = std::max(peak, used + overflow_bytes);
+    return p;
+}
+
+ScratchArena::Scope::Scope(ScratchArena& arena)
+        : arena(arena),
+          used(arena.used),
+          n_overflow(arena.overflow.size()),
+          overflow_bytes(arena.overflow_bytes) {}
+
+ScratchArena::Scope::~Scope() {
+    arena.used = used;
+    arena.overflow.resize(n_overflow);
+    arena.overflow_bytes = overflow_bytes;
+    if (arena.overflow.empty()) {
+        size_t target = std::min(arena.peak, arena.max_capacity);
+        if (arena.used == 0 && target > arena.cap) {
+            // all allocations are released: grow the block to the peak
+            // usage so that the next batches fit
+            try {
+                arena.reserve(target);
+            } catch (...) {
+                // keep the current block, the next batches will overflow
+            }
+        }
+    }
+}
+
+namespace {
+
+struct ThreadScratchArena : ScratchArena {
+    ThreadScratchArena() {
+        max_capacity = size_t(64) << 20;
+    }
+};
+
+} // namespace
+
+ScratchArena& get_thread_scratch_arena() {
+    thread_local ThreadScratchArena arena;
+    return arena;
+}
+
+void sa_encode_chunked(
+        const Index* index,
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena& arena,
+        idx_t chunk_size) {
+    FAISS_THROW_IF_NOT(chunk_size > 0);
+    size_t code_size = index->sa_code_size();
+    for (idx_t i0 = 0; i0 < n; i0 += chunk_size) {
+        idx_t i1 = std::min(n, i0 + chunk_size);
+        ScratchArena::Scope scope(arena);
+        index->sa_encode_arena(
+                i1 - i0, x + i0 * index->d, bytes + i0 * code_size, arena);
+    }
+}
+
+void sa_decode_chunked(
+        const Index* index,
+        idx_t n,
+        const uint8_t* bytes,
+        float* x,
+        ScratchArena& arena,
+        idx_t chunk_size) {
+    FAISS_THROW_IF_NOT(chunk_size > 0);
+    size_t code_size = index->sa_code_size();
+    for (idx_t i0 = 0; i0 < n; i0 += chunk_size) {
+        idx_t i1 = std::min(n, i0 + chunk_size);
+        ScratchArena::Scope scope(arena);
+        index->sa_decode_arena(
+                i1 - i0, bytes + i0 * code_size, x + i0 * index->d, arena);
+    }
+}
+
+} // namespace faiss
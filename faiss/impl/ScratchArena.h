@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <faiss/MetricType.h>
+
+namespace faiss {
+
+struct Index;
+
+/** Caller-owned scratch memory for temporary buffers.
+ *
+ * Allocations are carved out of a single block in stack order and released
+ * when the enclosing Scope is destroyed. When the block is too small, the
+ * allocation falls back to the heap and the block is enlarged to the peak
+ * usage once all allocations are released. Therefore, processing batches of
+ * the same size does not touch the heap after the first batch.
+ *
+ * An arena must not be used concurrently by several threads.
+ */
+struct ScratchArena {
+    /// all allocations are aligned to this
+    static constexpr size_t alignment = 64;
+
+    explicit ScratchArena(size_t capacity = 0);
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    /// allocate nbytes, valid until the enclosing Scope is destroyed
+    void* allocate(size_t nbytes);
+
+    template <typename T>
+    T* alloc(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T)));
+    }
+
+    /// releases the allocations made during its lifetime
+    struct Scope {
+        ScratchArena& arena;
+        size_t used;
+        size_t n_overflow;
+        size_t overflow_bytes;
+
+        explicit Scope(ScratchArena& arena);
+        Scope(const Scope&) = delete;
+        ~Scope();
+    };
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    /// free the block (no-op if allocations are in use)
+    void release();
+
+    /// the block is not enlarged beyond this size
+    size_t max_capacity = SIZE_MAX;
+
+    /// nb of heap allocations made (including the growth of the block)
+    size_t n_heap_alloc = 0;
+
+   private:
+    std::unique_ptr<uint8_t[]> block;
+    uint8_t* base = nullptr; ///< block aligned
+    size_t cap = 0;          ///< usable size of the block
+    size_t used = 0;         ///< bytes of the block in use
+
+    /// allocations that did not fit in the block
+    std::vector<std::unique_ptr<uint8_t[]>> overflow;
+    size_t overflow_bytes = 0;
+    size_t peak = 0; ///< peak of used + overflow_bytes
+
+    void reserve(size_t capacity);
+};
+
+/** Arena of the calling thread, for the temporary buffers of the searches.
+ * The allocations should be made within a Scope, nested uses by the
+ * functions called are fine. The block of the arena is limited to 64 MiB,
+ * larger buffers are allocated on the heap. It is kept until the thread
+ * exits, see release_thread_search_buffers to free it earlier.
+ */
+ScratchArena& get_thread_scratch_arena();
+
+/** Encode n vectors with index->sa_encode_arena, by chunks of chunk_size
+ * vectors, so that the scratch memory does not depend on n.
+ */
+void sa_encode_chunked(
+        const Index* index,
+        idx_t n,
+        const float* x,
+        uint8_t* bytes,
+        ScratchArena& arena,
+        idx_t chunk_size = 1024);
+
+/// decoding counterpart of sa_encode_chunked
+void sa_decode_chunked(
+        const Index* index,
+        idx_t n,
+        const uint8_t* bytes,
+        float* x,
+        ScratchArena& arena,
+        idx_t chunk_size = 1024);
+
+} // namespace faiss
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+#include <faiss/MetricType.h>
+
+namespace faiss {
+
+/** Per-query bounds on the distances of the results that can still enter
+ * the final top-k of a search.
+ *
+ * The bounds are shared by concurrent searches over parts of a database,
+ * eg. the shards of an IndexShards. The bound of a query can be tightened
+ * to a distance as soon as k results at least as good are known, and the
+ * searches can then ignore the candidates beyond it. The bounds only
+ * decrease (increase for similarities), so they can be read and updated
+ * concurrently without locking.
+ */
+struct SearchResultBounds {
+    /// if true, larger is better and the bounds are lower bounds
+    bool is_similarity;
+
+    SearchResultBounds(idx_t n, bool is_similarity)
+            : is_similarity(is_similarity),
+              storage(new std::atomic<float>[n]),
+              bounds(storage.get()) {
+        float neutral = is_similarity ? -std::numeric_limits<float>::infinity()
+                                      : std::numeric_limits<float>::infinity();
+        for (idx_t i = 0; i < n; i++) {
+            bounds[i].store(neutral, std::memory_order_relaxed);
+        }
+    }
+
+    /// view on the queries i0.. of other, that shares its bounds
+    SearchResultBounds(const SearchResultBounds& other, idx_t i0)
+            : is_similarity(other.is_similarity),
+              storage(other.storage),
+              bounds(other.bounds + i0) {}
+
+    float get(idx_t i) const {
+        return bounds[i].load(std::memory_order_relaxed);
+    }
+
+    /// tighten the bound of query i to dis, if dis is better
+    void tighten(idx_t i, float dis) {
+        std::atomic<float>& b = bounds[i];
+        float cur = b.load(std::memory_order_relaxed);
+        while (is_similarity ? dis > cur : dis < cur) {
+            if (b.compare_exchange_weak(
+                        cur, dis, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+
+   private:
+    std::shared_ptr<std::atomic<float>[]> storage;
+    std::atomic<float>* bounds;
+};
+
+} // namespace faiss
@@ -11,6 +11,7 @@
 #include <faiss/impl/io_macros.h>
 
 #include <cstdio>
+#include <algorithm>
 #include <cstdlib>
 
 #include <faiss/impl/FaissAssert.h>
@@ -452,6 +453,18 @@ void read_direct_map(DirectMap* dm, IOReader* f) {
         for (auto it : v) {
             map[it.first] = it.second;
         }
+    } else if (dm->type == DirectMap::CompactHashtable) {
+        std::vector<std::pair<idx_t, idx_t>> v;
+        READVECTOR(v);
+        size_t nlist = 0, max_offset = 0;
+        for (auto it : v) {
+            nlist = std::max(nlist, size_t(lo_listno(it.second)) + 1);
+            max_offset = std::max(max_offset, size_t(lo_offset(it.second)));
+        }
+        dm->compact_map.reserve(v.size(), nlist, max_offset);
+        for (auto it : v) {
+            dm->compact_map.set(it.first, it.second);
+        }
     }
 }
 
@@ -904,6 +917,7 @@ Index* read_index(IOReader* f, int io_flags) {
             ixpt->chain.push_back(read_VectorTransform(f));
         }
         ixpt->index = read_index(f, io_flags);
+        ixpt->prepare_chain();
         idx = ixpt;
     } else if (h == fourcc("Imiq")) {
         MultiIndexQuantizer* imiq = new MultiIndexQuantizer();
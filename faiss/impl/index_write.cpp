@@ -375,6 +375,11 @@ static void write_direct_map(const DirectMap* dm, IOWriter* f) {
         v.resize(map.size());
         std::copy(map.begin(), map.end(), v.begin());
         WRITEVECTOR(v);
+    } else if (dm->type == DirectMap::CompactHashtable) {
+        // same format as the Hashtable
+        std::vector<std::pair<idx_t, idx_t>> v;
+        dm->compact_map.get_all(v);
+        WRITEVECTOR(v);
     }
 }
 
@@ -8,6 +8,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cmath>
 #include <type_traits>
 #include <vector>
 
@@ -18,6 +19,7 @@
 #include <faiss/impl/IDSelector.h>
 #include <faiss/impl/ResultHandler.h>
 #include <faiss/impl/platform_macros.h>
+#include <faiss/invlists/DirectMap.h>
 #include <faiss/utils/AlignedTable.h>
 #include <faiss/utils/partitioning.h>
 
@@ -53,11 +55,18 @@ struct SIMDResultHandlerToFloat : SIMDResultHandler {
 
     /// these fields are used mainly for the IVF variants (with_id_map=true)
     const idx_t* id_map = nullptr; // map offset in invlist to vector id
+    /// id_map may contain removed entries (id -1) that must be skipped
+    bool has_removed = true;
     const int* q_map = nullptr;    // map q to global query
     const uint16_t* dbias =
             nullptr; // table of biases to add to each query (for IVF L2 search)
     const float* normalizers = nullptr; // size 2 * nq, to convert
 
+    /// IVF only: store (list_no, offset) pairs built with lo_build as
+    /// labels instead of the ids, eg. to rerank the results
+    bool store_pairs = false;
+    idx_t list_no = -1; // inverted list being scanned
+
     SIMDResultHandlerToFloat(size_t nq, size_t ntotal)
             : nq(nq), ntotal(ntotal) {}
 
@@ -190,6 +199,14 @@ struct ResultHandlerCompare : SIMDResultHandlerToFloat {
         return idx;
     }
 
+    /// label to store for a result with this id
+    int64_t result_label(size_t b, size_t j, int64_t id) const {
+        if (with_id_map && this->store_pairs) {
+            return lo_build(this->list_no, j0 + 32 * b + j);
+        }
+        return id;
+    }
+
     /// return binary mask of elements below thr in (d0, d1)
     /// inverse_test returns elements above
     uint32_t get_lt_mask(
@@ -218,6 +235,17 @@ struct ResultHandlerCompare : SIMDResultHandlerToFloat {
             int nbit = (ntotal - idx);
             lt_mask &= (uint32_t(1) << nbit) - 1;
         }
+        if (with_id_map && this->has_removed) {
+            // skip the entries removed from the inverted list (id -1)
+            uint32_t m = lt_mask;
+            while (m) {
+                int j = __builtin_ctz(m);
+                m &= m - 1;
+                if (id_map[idx + j] < 0) {
+                    lt_mask &= ~(uint32_t(1) << j);
+                }
+            }
+        }
         return lt_mask;
     }
 
@@ -275,7 +303,7 @@ struct SingleResultHandler : ResultHandlerCompare<C, with_id_map> {
                     T d = d32tab[j];
                     if (C::cmp(idis[q], d)) {
                         idis[q] = d;
-                        ids[q] = real_idx;
+                        ids[q] = this->result_label(b, j, real_idx);
                     }
                 }
             }
@@ -287,7 +315,7 @@ struct SingleResultHandler : ResultHandlerCompare<C, with_id_map> {
                 T d = d32tab[j];
                 if (C::cmp(idis[q], d)) {
                     idis[q] = d;
-                    ids[q] = this->adjust_id(b, j);
+                    ids[q] = this->result_label(b, j, this->adjust_id(b, j));
                 }
             }
         }
@@ -321,6 +349,11 @@ struct HeapHandler : ResultHandlerCompare<C, with_id_map> {
 
     int64_t k; // number of results to keep
 
+    /// top-k within radius: the heaps are initialized with the radius
+    /// converted to quantized distances, when the normalizers are known
+    bool use_radius = false;
+    float radius = 0;
+
     HeapHandler(
             size_t nq,
             size_t ntotal,
@@ -337,6 +370,24 @@ struct HeapHandler : ResultHandlerCompare<C, with_id_map> {
         heap_heapify<C>(k * nq, idis.data(), iids.data());
     }
 
+    void begin(const float* norms) override {
+        normalizers = norms;
+        if (!use_radius) {
+            return;
+        }
+        for (size_t q = 0; q < this->nq; q++) {
+            float t = radius;
+            if (normalizers) {
+                t = normalizers[2 * q] * (radius - normalizers[2 * q + 1]);
+            }
+            // the quantized distances strictly better than the threshold
+            // are exactly those strictly within the radius
+            t = C::is_max ? std::ceil(t) : std::floor(t);
+            T thresh = t <= 0 ? 0 : t >= 65535 ? 65535 : T(t);
+            std::fill_n(idis.data() + q * k, k, thresh);
+        }
+    }
+
     void handle(size_t q, size_t b, simd16uint16 d0, simd16uint16 d1) final {
         if (this->disable) {
             return;
@@ -371,7 +422,11 @@ struct HeapHandler : ResultHandlerCompare<C, with_id_map> {
                     T dis_2 = d32tab[j];
                     if (C::cmp(heap_dis[0], dis_2)) {
                         heap_replace_top<C>(
-                                k, heap_dis, heap_ids, dis_2, real_idx);
+                                k,
+                                heap_dis,
+                                heap_ids,
+                                dis_2,
+                                this->result_label(b, j, real_idx));
                     }
                 }
             }
@@ -382,7 +437,8 @@ struct HeapHandler : ResultHandlerCompare<C, with_id_map> {
                 lt_mask -= 1 << j;
                 T dis_2 = d32tab[j];
                 if (C::cmp(heap_dis[0], dis_2)) {
-                    int64_t idx = this->adjust_id(b, j);
+                    int64_t idx =
+                            this->result_label(b, j, this->adjust_id(b, j));
                     heap_replace_top<C>(k, heap_dis, heap_ids, dis_2, idx);
                 }
             }
@@ -481,7 +537,7 @@ struct ReservoirHandler : ResultHandlerCompare<C, with_id_map> {
                 lt_mask -= 1 << j;
                 if (this->sel->is_member(real_idx)) {
                     T dis_2 = d32tab[j];
-                    res.add(dis_2, real_idx);
+                    res.add(dis_2, this->result_label(b, j, real_idx));
                 }
             }
         } else {
@@ -490,7 +546,8 @@ struct ReservoirHandler : ResultHandlerCompare<C, with_id_map> {
                 int j = __builtin_ctz(lt_mask);
                 lt_mask -= 1 << j;
                 T dis_2 = d32tab[j];
-                res.add(dis_2, this->adjust_id(b, j));
+                res.add(dis_2,
+                        this->result_label(b, j, this->adjust_id(b, j)));
             }
         }
     }
@@ -7,6 +7,8 @@
 
 #include <faiss/invlists/BlockInvertedLists.h>
 
+#include <algorithm>
+
 #include <faiss/impl/CodePacker.h>
 #include <faiss/impl/FaissAssert.h>
 #include <faiss/impl/IDSelector.h>
@@ -25,6 +27,7 @@ BlockInvertedLists::BlockInvertedLists(
           block_size(block_size) {
     ids.resize(nlist);
     codes.resize(nlist);
+    n_removed.resize(nlist);
 }
 
 BlockInvertedLists::BlockInvertedLists(size_t nlist, const CodePacker* packer)
@@ -34,6 +37,7 @@ BlockInvertedLists::BlockInvertedLists(size_t nlist, const CodePacker* packer)
           packer(packer) {
     ids.resize(nlist);
     codes.resize(nlist);
+    n_removed.resize(nlist);
 }
 
 BlockInvertedLists::BlockInvertedLists()
@@ -51,6 +55,7 @@ size_t BlockInvertedLists::add_entries(
     size_t o = ids[list_no].size();
     ids[list_no].resize(o + n_entry);
     memcpy(&ids[list_no][o], ids_in, sizeof(ids_in[0]) * n_entry);
+    n_removed[list_no] += std::count(ids_in, ids_in + n_entry, idx_t(-1));
     size_t n_block = (o + n_entry + n_per_block - 1) / n_per_block;
     codes[list_no].resize(n_block * block_size);
     if (o % block_size == 0) {
@@ -80,35 +85,77 @@ const uint8_t* BlockInvertedLists::get_codes(size_t list_no) const {
 }
 
 size_t BlockInvertedLists::remove_ids(const IDSelector& sel) {
-    idx_t nremove = 0;
-#pragma omp parallel for
+    size_t nremove = 0;
+#pragma omp parallel for reduction(+ : nremove)
     for (idx_t i = 0; i < nlist; i++) {
-        std::vector<uint8_t> buffer(packer->code_size);
-        idx_t l = ids[i].size(), j = 0;
-        while (j < l) {
-            if (sel.is_member(ids[i][j])) {
-                l--;
-                ids[i][j] = ids[i][l];
-                packer->unpack_1(codes[i].data(), l, buffer.data());
-                packer->pack_1(buffer.data(), j, codes[i].data());
-            } else {
-                j++;
+        std::vector<idx_t>& list_ids = ids[i];
+        size_t nremove_i = 0;
+        for (idx_t& id : list_ids) {
+            if (id >= 0 && sel.is_member(id)) {
+                id = -1;
+                nremove_i++;
             }
         }
-        resize(i, l);
-        nremove += ids[i].size() - l;
+        if (nremove_i == 0) {
+            continue;
+        }
+        n_removed[i] += nremove_i;
+        nremove += nremove_i;
+
+        // the tombstones at the end of the list are dropped directly
+        size_t l = list_ids.size();
+        while (l > 0 && list_ids[l - 1] < 0) {
+            l--;
+        }
+        if (l < list_ids.size()) {
+            resize(i, l);
+        }
+        if (n_removed[i] > max_removed_ratio * list_ids.size()) {
+            compact(i);
+        }
     }
 
     return nremove;
 }
 
+void BlockInvertedLists::compact(size_t list_no) {
+    if (n_removed[list_no] == 0) {
+        return;
+    }
+    FAISS_THROW_IF_NOT_MSG(packer, "missing code packer");
+    std::vector<idx_t>& list_ids = ids[list_no];
+    uint8_t* list_codes = codes[list_no].data();
+    std::vector<uint8_t> buffer(packer->code_size);
+    size_t j = 0;
+    for (size_t i = 0; i < list_ids.size(); i++) {
+        if (list_ids[i] < 0) {
+            continue;
+        }
+        if (i != j) {
+            list_ids[j] = list_ids[i];
+            packer->unpack_1(list_codes, i, buffer.data());
+            packer->pack_1(buffer.data(), j, list_codes);
+        }
+        j++;
+    }
+    // the entries beyond j were moved, so they are counted as removed
+    std::fill(list_ids.begin() + j, list_ids.end(), idx_t(-1));
+    resize(list_no, j);
+}
+
 const idx_t* BlockInvertedLists::get_ids(size_t list_no) const {
     assert(list_no < nlist);
     return ids[list_no].data();
 }
 
 void BlockInvertedLists::resize(size_t list_no, size_t new_size) {
-    ids[list_no].resize(new_size);
+    std::vector<idx_t>& list_ids = ids[list_no];
+    size_t prev_size = list_ids.size();
+    if (new_size < prev_size) {
+        n_removed[list_no] -= std::count(
+                list_ids.begin() + new_size, list_ids.end(), idx_t(-1));
+    }
+    list_ids.resize(new_size);
     size_t prev_nbytes = codes[list_no].size();
     size_t n_block = (new_size + n_per_block - 1) / n_per_block;
     size_t new_nbytes = n_block * block_size;
@@ -119,6 +166,14 @@ void BlockInvertedLists::resize(size_t list_no, size_t new_size) {
                0,
                new_nbytes - prev_nbytes);
     }
+    if (new_size < prev_size && new_size % n_per_block != 0 && packer) {
+        // the codes are added by OR-ing them into the blocks, so the
+        // end of the last block should be cleared
+        std::vector<uint8_t> zero_code(packer->code_size);
+        for (size_t i = new_size; i < n_block * n_per_block; i++) {
+            packer->pack_1(zero_code.data(), i, codes[list_no].data());
+        }
+    }
 }
 
 void BlockInvertedLists::update_entries(
@@ -168,10 +223,13 @@ InvertedLists* BlockInvertedListsIOHook::read(IOReader* f, int /* io_flags */)
 
     il->ids.resize(il->nlist);
     il->codes.resize(il->nlist);
+    il->n_removed.resize(il->nlist);
 
     for (size_t i = 0; i < il->nlist; i++) {
         READVECTOR(il->ids[i]);
         READVECTOR(il->codes[i]);
+        il->n_removed[i] =
+                std::count(il->ids[i].begin(), il->ids[i].end(), idx_t(-1));
     }
 
     return il;
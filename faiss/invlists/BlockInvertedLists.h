@@ -29,6 +29,12 @@ struct IDSelector;
  *
  * The writing functions add_entries and update_entries operate on block-aligned
  * data.
+ *
+ * Removing entries from the middle of a block would require re-packing the
+ * rest of the list, so remove_ids only sets their ids to -1 (tombstones)
+ * and leaves their codes in place. The scanners skip the tombstones, the
+ * adds reuse their slots, and a list is compacted when it contains too many
+ * of them. list_size includes the tombstones.
  */
 struct BlockInvertedLists : InvertedLists {
     size_t n_per_block = 0; // nb of vectors stored per block
@@ -40,6 +46,13 @@ struct BlockInvertedLists : InvertedLists {
     std::vector<AlignedTable<uint8_t>> codes;
     std::vector<std::vector<idx_t>> ids;
 
+    /// nb of removed entries (with id -1) in each list
+    std::vector<size_t> n_removed;
+
+    /// a list is compacted when more than this fraction of its entries are
+    /// removed
+    float max_removed_ratio = 0.25;
+
     BlockInvertedLists(size_t nlist, size_t vec_per_block, size_t block_size);
     BlockInvertedLists(size_t nlist, const CodePacker* packer);
 
@@ -48,9 +61,13 @@ struct BlockInvertedLists : InvertedLists {
     size_t list_size(size_t list_no) const override;
     const uint8_t* get_codes(size_t list_no) const override;
     const idx_t* get_ids(size_t list_no) const override;
-    /// remove ids from the InvertedLists
+    /// remove ids from the InvertedLists, returns the nb of removed ids
     size_t remove_ids(const IDSelector& sel);
 
+    /// move the entries that are not removed to the start of the list,
+    /// without changing their order
+    void compact(size_t list_no);
+
     // works only on empty BlockInvertedLists
     // the codes should be of size ceil(n_entry / n_per_block) * block_size
     // and padded with 0s
@@ -68,7 +85,7 @@ struct BlockInvertedLists : InvertedLists {
             const idx_t* ids,
             const uint8_t* code) override;
 
-    // also pads new data with 0s
+    // also pads new data with 0s, and clears the codes beyond new_size
     void resize(size_t list_no, size_t new_size) override;
 
     ~BlockInvertedLists() override;
@@ -9,6 +9,7 @@
 
 #include <faiss/invlists/DirectMap.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 
@@ -19,6 +20,321 @@
 
 namespace faiss {
 
+/********************* CompactIdMap implementation */
+
+namespace {
+
+const int dbits = 7; // bits for the displacement + 1
+const uint64_t max_displacement = (1 << dbits) - 2;
+
+const uint64_t mix_c1 = 0x9E3779B97F4A7C15ULL;
+const uint64_t mix_c2 = 0xBF58476D1CE4E5B9ULL;
+
+uint64_t mod_inverse(uint64_t c) {
+    uint64_t inv = c; // correct on 3 bits, each iteration doubles that
+    for (int i = 0; i < 5; i++) {
+        inv *= 2 - c * inv;
+    }
+    return inv;
+}
+
+const uint64_t mix_c1_inv = mod_inverse(mix_c1);
+const uint64_t mix_c2_inv = mod_inverse(mix_c2);
+
+/// for nbits < 64
+uint64_t low_mask(int nbits) {
+    return (uint64_t(1) << nbits) - 1;
+}
+
+/// nb of bits needed to represent x
+int nbits_for(uint64_t x) {
+    int nb = 0;
+    while (x >> nb) {
+        nb++;
+    }
+    return nb;
+}
+
+/// bijection over [0, 2^kbits)
+uint64_t mix_key(uint64_t x, int kbits) {
+    uint64_t mask = low_mask(kbits);
+    x = (x * mix_c1) & mask;
+    x ^= x >> ((kbits + 1) / 2);
+    return (x * mix_c2) & mask;
+}
+
+uint64_t unmix_key(uint64_t h, int kbits) {
+    uint64_t mask = low_mask(kbits);
+    int s = (kbits + 1) / 2;
+    uint64_t y = (h * mix_c2_inv) & mask;
+    uint64_t x = y;
+    for (int sh = s; sh < kbits; sh += s) {
+        x = y ^ (x >> s);
+    }
+    return (x * mix_c1_inv) & mask;
+}
+
+/// fixed-width fields in an array of words. The arrays have one
+/// extra word so that a field can always be read from 2 words.
+uint64_t packed_get(const uint64_t* data, size_t bit, int nbits) {
+    const uint64_t* w = data + (bit >> 6);
+    int sh = bit & 63;
+    // branchless: (w[1] << 1) << (63 - sh) is 0 when sh == 0
+    uint64_t v = (w[0] >> sh) | ((w[1] << 1) << (63 - sh));
+    return v & (~uint64_t(0) >> (64 - nbits));
+}
+
+void packed_set(uint64_t* data, size_t bit, int nbits, uint64_t v) {
+    uint64_t* w = data + (bit >> 6);
+    int sh = bit & 63;
+    uint64_t mask = ~uint64_t(0) >> (64 - nbits);
+    w[0] = (w[0] & ~(mask << sh)) | (v << sh);
+    if (sh + nbits > 64) {
+        int sh2 = 64 - sh;
+        w[1] = (w[1] & ~(mask >> sh2)) | (v >> sh2);
+    }
+}
+
+/// the meta and LO fields of a slot are contiguous, so that a lookup
+/// touches a single cache line most of the time
+struct SlotArray {
+    uint64_t* data;
+    int mbits;  // meta field
+    int lobits; // LO field
+
+    SlotArray(const std::vector<uint64_t>& slots, int mbits, int lobits)
+            : data(const_cast<uint64_t*>(slots.data())),
+              mbits(mbits),
+              lobits(lobits) {}
+
+    uint64_t meta(size_t i) const {
+        return packed_get(data, i * (mbits + lobits), mbits);
+    }
+    uint64_t lo(size_t i) const {
+        return packed_get(data, i * (mbits + lobits) + mbits, lobits);
+    }
+    void set_meta(size_t i, uint64_t v) {
+        packed_set(data, i * (mbits + lobits), mbits, v);
+    }
+    void set_lo(size_t i, uint64_t v) {
+        packed_set(data, i * (mbits + lobits) + mbits, lobits, v);
+    }
+};
+
+} // namespace
+
+bool CompactIdMap::find(idx_t key, idx_t& lo) const {
+    if (count == 0 || key < 0 || (uint64_t(key) >> kbits) != 0) {
+        return false;
+    }
+    int rbits = kbits - qbits;
+    int mbits = rbits + dbits;
+    size_t slot_mask = (size_t(1) << qbits) - 1;
+    uint64_t h = mix_key(key, kbits);
+    size_t home = h >> rbits;
+    uint64_t rem = h & low_mask(rbits);
+    SlotArray sa(slots, mbits, lbits + obits);
+
+    // meta field of the key at displacement d is (d + 1) << rbits | rem
+    uint64_t step = uint64_t(1) << rbits;
+    uint64_t m_d = step; // (d + 1) << rbits
+    for (uint64_t d = 0; d <= max_displacement; d++, m_d += step) {
+        size_t slot = (home + d) & slot_mask;
+        uint64_t m = sa.meta(slot);
+        if (m == (m_d | rem)) {
+            uint64_t plo = sa.lo(slot);
+            lo = lo_build(plo >> obits, plo & low_mask(obits));
+            return true;
+        }
+        if (m < m_d) {
+            // empty slot or richer entry: Robin Hood invariant says the key
+            // is not in the table
+            return false;
+        }
+    }
+    return false;
+}
+
+void CompactIdMap::set(idx_t key, idx_t lo) {
+    FAISS_THROW_IF_NOT_MSG(key >= 0, "compact direct map requires ids >= 0");
+    uint64_t list_no = lo_listno(lo), offset = lo_offset(lo);
+
+    // grow the fields or the table if needed
+    int new_lbits = std::max(lbits, std::max(nbits_for(list_no), 1));
+    int new_obits = std::max(obits, std::max(nbits_for(offset), 1));
+    int new_qbits = std::max(qbits, 6);
+    if ((count + 1) * 8 > (size_t(7) << new_qbits)) {
+        new_qbits++;
+    }
+    int new_kbits = std::max(std::max(kbits, nbits_for(key)), new_qbits);
+    if (new_lbits != lbits || new_obits != obits || new_qbits != qbits ||
+        new_kbits != kbits) {
+        rebuild(new_qbits, new_kbits, new_lbits, new_obits);
+    }
+
+    int rbits = kbits - qbits;
+    int mbits = rbits + dbits;
+    size_t slot_mask = (size_t(1) << qbits) - 1;
+    uint64_t h = mix_key(key, kbits);
+    size_t home = h >> rbits;
+    uint64_t rem = h & low_mask(rbits);
+    uint64_t plo = list_no << obits | offset;
+    SlotArray sa(slots, mbits, lbits + obits);
+
+    // Robin Hood insertion: the entry that is carried is swapped with
+    // entries that are closer to their home slot
+    uint64_t d = 0;
+    bool carrying_new = true;
+    for (size_t slot = home;; slot = (slot + 1) & slot_mask) {
+        uint64_t m = sa.meta(slot);
+        if (m == 0) {
+            sa.set_meta(slot, (d + 1) << rbits | rem);
+            sa.set_lo(slot, plo);
+            if (carrying_new) {
+                count++;
+            }
+            return;
+        }
+        uint64_t md = (m >> rbits) - 1;
+        if (carrying_new && md == d && (m & low_mask(rbits)) == rem) {
+            // update existing entry
+            sa.set_lo(slot, plo);
+            return;
+        }
+        if (md < d) {
+            uint64_t mplo = sa.lo(slot);
+            sa.set_meta(slot, (d + 1) << rbits | rem);
+            sa.set_lo(slot, plo);
+            d = md;
+            rem = m & low_mask(rbits);
+            plo = mplo;
+            if (carrying_new) {
+                count++;
+                carrying_new = false;
+            }
+        }
+        d++;
+        if (d > max_displacement) {
+            // re-insert the carried entry in a larger table
+            uint64_t carried_home = (slot + 1 - d) & slot_mask;
+            idx_t carried_key =
+                    unmix_key(uint64_t(carried_home) << rbits | rem, kbits);
+            idx_t carried_lo = lo_build(plo >> obits, plo & low_mask(obits));
+            rebuild(qbits + 1, std::max(kbits, qbits + 1), lbits, obits);
+            set(carried_key, carried_lo);
+            return;
+        }
+    }
+}
+
+bool CompactIdMap::erase(idx_t key) {
+    if (count == 0 || key < 0 || (uint64_t(key) >> kbits) != 0) {
+        return false;
+    }
+    int rbits = kbits - qbits;
+    int mbits = rbits + dbits;
+    size_t slot_mask = (size_t(1) << qbits) - 1;
+    uint64_t h = mix_key(key, kbits);
+    size_t home = h >> rbits;
+    uint64_t rem = h & low_mask(rbits);
+    SlotArray sa(slots, mbits, lbits + obits);
+
+    for (uint64_t d = 0; d <= max_displacement; d++) {
+        size_t slot = (home + d) & slot_mask;
+        uint64_t m = sa.meta(slot);
+        if (m == 0 || (m >> rbits) - 1 < d) {
+            return false;
+        }
+        if ((m >> rbits) - 1 == d && (m & low_mask(rbits)) == rem) {
+            // backward shift deletion
+            for (;;) {
+                size_t next = (slot + 1) & slot_mask;
+                uint64_t mn = sa.meta(next);
+                if (mn == 0 || (mn >> rbits) == 1) {
+                    sa.set_meta(slot, 0);
+                    break;
+                }
+                sa.set_meta(slot, mn - (uint64_t(1) << rbits));
+                sa.set_lo(slot, sa.lo(next));
+                slot = next;
+            }
+            count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CompactIdMap::clear() {
+    count = 0;
+    qbits = kbits = lbits = obits = 0;
+    slots.clear();
+}
+
+void CompactIdMap::reserve(size_t n, size_t nlist, size_t max_offset) {
+    int new_qbits = std::max(qbits, 6);
+    while (n * 8 > (size_t(7) << new_qbits)) {
+        new_qbits++;
+    }
+    rebuild(new_qbits,
+            std::max(kbits, new_qbits),
+            std::max(lbits, std::max(nbits_for(nlist > 0 ? nlist - 1 : 0), 1)),
+            std::max(obits, std::max(nbits_for(max_offset), 1)));
+}
+
+void CompactIdMap::get_all(std::vector<std::pair<idx_t, idx_t>>& pairs) const {
+    pairs.clear();
+    pairs.reserve(count);
+    if (count == 0) {
+        return;
+    }
+    int rbits = kbits - qbits;
+    int mbits = rbits + dbits;
+    size_t nslot = size_t(1) << qbits;
+    SlotArray sa(slots, mbits, lbits + obits);
+    for (size_t slot = 0; slot < nslot; slot++) {
+        uint64_t m = sa.meta(slot);
+        if (m == 0) {
+            continue;
+        }
+        size_t home = (slot - ((m >> rbits) - 1)) & (nslot - 1);
+        uint64_t h = uint64_t(home) << rbits | (m & low_mask(rbits));
+        idx_t key = unmix_key(h, kbits);
+        uint64_t plo = sa.lo(slot);
+        pairs.emplace_back(key, lo_build(plo >> obits, plo & low_mask(obits)));
+    }
+}
+
+size_t CompactIdMap::memory_usage() const {
+    return slots.size() * sizeof(uint64_t);
+}
+
+void CompactIdMap::rebuild(
+        int new_qbits,
+        int new_kbits,
+        int new_lbits,
+        int new_obits) {
+    FAISS_THROW_IF_NOT(new_kbits <= 63 && new_qbits <= new_kbits);
+    FAISS_THROW_IF_NOT(new_lbits <= 32 && new_obits <= 32);
+    std::vector<std::pair<idx_t, idx_t>> pairs;
+    get_all(pairs);
+
+    qbits = new_qbits;
+    kbits = new_kbits;
+    lbits = new_lbits;
+    obits = new_obits;
+    size_t nslot = size_t(1) << qbits;
+    count = 0;
+    size_t slot_bits = kbits - qbits + dbits + lbits + obits;
+    // one extra word for packed_get
+    slots.assign((nslot * slot_bits + 63) / 64 + 1, 0);
+    for (const auto& p : pairs) {
+        set(p.first, p.second);
+    }
+}
+
+/********************* DirectMap implementation */
+
 DirectMap::DirectMap() : type(NoMap) {}
 
 void DirectMap::set_type(
@@ -26,15 +342,15 @@ void DirectMap::set_type(
         const InvertedLists* invlists,
         size_t ntotal) {
     FAISS_THROW_IF_NOT(
-            new_type == NoMap || new_type == Array || new_type == Hashtable);
+            new_type == NoMap || new_type == Array || new_type == Hashtable ||
+            new_type == CompactHashtable);
 
     if (new_type == type) {
         // nothing to do
         return;
     }
 
-    array.clear();
-    hashtable.clear();
+    clear();
     type = new_type;
 
     if (new_type == NoMap) {
@@ -43,6 +359,12 @@ void DirectMap::set_type(
         array.resize(ntotal, -1);
     } else if (new_type == Hashtable) {
         hashtable.reserve(ntotal);
+    } else if (new_type == CompactHashtable) {
+        size_t max_size = 0;
+        for (size_t key = 0; key < invlists->nlist; key++) {
+            max_size = std::max(max_size, invlists->list_size(key));
+        }
+        compact_map.reserve(ntotal, invlists->nlist, max_size);
     }
 
     for (size_t key = 0; key < invlists->nlist; key++) {
@@ -60,6 +382,10 @@ void DirectMap::set_type(
             for (long ofs = 0; ofs < list_size; ofs++) {
                 hashtable[idlist[ofs]] = lo_build(key, ofs);
             }
+        } else if (new_type == CompactHashtable) {
+            for (long ofs = 0; ofs < list_size; ofs++) {
+                compact_map.set(idlist[ofs], lo_build(key, ofs));
+            }
         }
     }
 }
@@ -67,6 +393,7 @@ void DirectMap::set_type(
 void DirectMap::clear() {
     array.clear();
     hashtable.clear();
+    compact_map.clear();
 }
 
 idx_t DirectMap::get(idx_t key) const {
@@ -79,6 +406,10 @@ idx_t DirectMap::get(idx_t key) const {
         auto res = hashtable.find(key);
         FAISS_THROW_IF_NOT_MSG(res != hashtable.end(), "key not found");
         return res->second;
+    } else if (type == CompactHashtable) {
+        idx_t lo;
+        FAISS_THROW_IF_NOT_MSG(compact_map.find(key, lo), "key not found");
+        return lo;
     } else {
         FAISS_THROW_MSG("direct map not initialized");
     }
@@ -99,6 +430,10 @@ void DirectMap::add_single_id(idx_t id, idx_t list_no, size_t offset) {
         if (list_no >= 0) {
             hashtable[id] = lo_build(list_no, offset);
         }
+    } else if (type == CompactHashtable) {
+        if (list_no >= 0) {
+            compact_map.set(id, lo_build(list_no, offset));
+        }
     }
 }
 
@@ -116,7 +451,9 @@ DirectMapAdd::DirectMapAdd(DirectMap& direct_map, size_t n, const idx_t* xids)
         FAISS_THROW_IF_NOT(xids == nullptr);
         ntotal = direct_map.array.size();
         direct_map.array.resize(ntotal + n, -1);
-    } else if (type == DirectMap::Hashtable) {
+    } else if (
+            type == DirectMap::Hashtable ||
+            type == DirectMap::CompactHashtable) {
         // can't parallel update hashtable so use temp array
         all_ofs.resize(n, -1);
     }
@@ -125,7 +462,9 @@ DirectMapAdd::DirectMapAdd(DirectMap& direct_map, size_t n, const idx_t* xids)
 void DirectMapAdd::add(size_t i, idx_t list_no, size_t ofs) {
     if (type == DirectMap::Array) {
         direct_map.array[ntotal + i] = lo_build(list_no, ofs);
-    } else if (type == DirectMap::Hashtable) {
+    } else if (
+            type == DirectMap::Hashtable ||
+            type == DirectMap::CompactHashtable) {
         all_ofs[i] = lo_build(list_no, ofs);
     }
 }
@@ -136,6 +475,13 @@ DirectMapAdd::~DirectMapAdd() {
             idx_t id = xids ? xids[i] : ntotal + i;
             direct_map.hashtable[id] = all_ofs[i];
         }
+    } else if (type == DirectMap::CompactHashtable) {
+        for (int i = 0; i < n; i++) {
+            if (all_ofs[i] >= 0) {
+                idx_t id = xids ? xids[i] : ntotal + i;
+                direct_map.compact_map.set(id, all_ofs[i]);
+            }
+        }
     }
 }
 
@@ -214,6 +560,37 @@ size_t DirectMap::remove_ids(const IDSelector& sel, InvertedLists* invlists) {
             }
         }
 
+    } else if (type == CompactHashtable) {
+        FAISS_THROW_IF_MSG(
+                block_invlists,
+                "remove with hashtable is not supported with BlockInvertedLists");
+        const IDSelectorArray* sela =
+                dynamic_cast<const IDSelectorArray*>(&sel);
+        FAISS_THROW_IF_NOT_MSG(
+                sela, "remove with hashtable works only with IDSelectorArray");
+
+        for (idx_t i = 0; i < sela->n; i++) {
+            idx_t id = sela->ids[i];
+            idx_t lo;
+            if (compact_map.find(id, lo)) {
+                size_t list_no = lo_listno(lo);
+                size_t offset = lo_offset(lo);
+                idx_t last = invlists->list_size(list_no) - 1;
+                compact_map.erase(id);
+                if (offset < last) {
+                    idx_t last_id = invlists->get_single_id(list_no, last);
+                    invlists->update_entry(
+                            list_no,
+                            offset,
+                            last_id,
+                            ScopedCodes(invlists, list_no, last).get());
+                    compact_map.set(last_id, lo_build(list_no, offset));
+                }
+                invlists->resize(list_no, last);
+                nremove++;
+            }
+        }
+
     } else {
         FAISS_THROW_MSG("remove not supported with this direct_map format");
     }
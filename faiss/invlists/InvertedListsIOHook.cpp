@@ -14,6 +14,7 @@
 #include <faiss/invlists/BlockInvertedLists.h>
 
 #ifndef _MSC_VER
+#include <faiss/invlists/LoggingInvertedLists.h>
 #include <faiss/invlists/OnDiskInvertedLists.h>
 #endif // !_MSC_VER
 
@@ -35,6 +36,7 @@ struct IOHookTable : std::vector<InvertedListsIOHook*> {
     IOHookTable() {
 #ifndef _MSC_VER
         push_back(new OnDiskInvertedListsIOHook());
+        push_back(new LoggingInvertedListsIOHook());
 #endif
         push_back(new BlockInvertedListsIOHook());
     }
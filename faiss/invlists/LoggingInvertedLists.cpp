@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#include <faiss/invlists/LoggingInvertedLists.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/io.h>
+#include <faiss/impl/io_macros.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/utils.h>
+
+namespace faiss {
+
+/*******************************************************
+ * Log format
+ *
+ * header: fourcc "FWAL", uint32 version, uint64 nlist, uint64 code_size
+ * then a sequence of records:
+ *   uint64 body_size
+ *   body: RecordHeader, ids[n_entry], codes[n_entry * code_size]
+ *   uint64 hash_bytes(body)
+ *******************************************************/
+
+namespace {
+
+const uint32_t log_version = 1;
+
+enum RecordType : uint32_t {
+    REC_ADD = 1,
+    REC_UPDATE = 2,
+    REC_RESIZE = 3,
+};
+
+struct LogHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t nlist;
+    uint64_t code_size;
+};
+
+struct RecordHeader {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t seq;
+    uint64_t list_no;
+    uint64_t offset;
+    uint64_t n_entry; // for REC_RESIZE: the new size
+};
+
+bool record_has_payload(uint32_t type) {
+    return type == REC_ADD || type == REC_UPDATE;
+}
+
+void write_log_header(FILE* f, const InvertedLists* il, const char* fname) {
+    LogHeader h = {fourcc("FWAL"), log_version, il->nlist, il->code_size};
+    FAISS_THROW_IF_NOT_FMT(
+            fwrite(&h, sizeof(h), 1, f) == 1,
+            "write error on %s: %s",
+            fname,
+            strerror(errno));
+}
+
+void sync_file(FILE* f, const char* fname) {
+    FAISS_THROW_IF_NOT_FMT(
+            fflush(f) == 0 && fsync(fileno(f)) == 0,
+            "could not sync %s: %s",
+            fname,
+            strerror(errno));
+}
+
+const char* checkpoint_trailer = "WALs";
+
+} // namespace
+
+/*******************************************************
+ * LoggingInvertedLists
+ *******************************************************/
+
+LoggingInvertedLists::LoggingInvertedLists(
+        InvertedLists* il,
+        const char* log_fname,
+        uint64_t seq)
+        : InvertedLists(il->nlist, il->code_size),
+          il(il),
+          log_fname(log_fname),
+          seq(seq) {
+    use_iterator = il->use_iterator;
+    FAISS_THROW_IF_NOT_MSG(
+            code_size != INVALID_CODE_SIZE,
+            "logging requires a fixed code size");
+
+    // check the header of an existing log
+    {
+        FILE* f = fopen(log_fname, "r");
+        if (f) {
+            LogHeader h;
+            size_t nr = fread(&h, sizeof(h), 1, f);
+            fclose(f);
+            FAISS_THROW_IF_NOT_FMT(
+                    nr == 0 ||
+                            (h.magic == fourcc("FWAL") &&
+                             h.version == log_version && h.nlist == nlist &&
+                             h.code_size == code_size),
+                    "%s is not a compatible log",
+                    log_fname);
+        }
+    }
+
+    log = fopen(log_fname, "a");
+    FAISS_THROW_IF_NOT_FMT(
+            log,
+            "could not open %s for appending: %s",
+            log_fname,
+            strerror(errno));
+    if (ftell(log) == 0) {
+        write_log_header(log, this, log_fname);
+        sync_file(log, log_fname);
+    }
+}
+
+size_t LoggingInvertedLists::list_size(size_t list_no) const {
+    return il->list_size(list_no);
+}
+
+const uint8_t* LoggingInvertedLists::get_codes(size_t list_no) const {
+    return il->get_codes(list_no);
+}
+
+const idx_t* LoggingInvertedLists::get_ids(size_t list_no) const {
+    return il->get_ids(list_no);
+}
+
+void LoggingInvertedLists::release_codes(size_t list_no, const uint8_t* codes)
+        const {
+    il->release_codes(list_no, codes);
+}
+
+void LoggingInvertedLists::release_ids(size_t list_no, const idx_t* ids)
+        const {
+    il->release_ids(list_no, ids);
+}
+
+idx_t LoggingInvertedLists::get_single_id(size_t list_no, size_t offset)
+        const {
+    return il->get_single_id(list_no, offset);
+}
+
+const uint8_t* LoggingInvertedLists::get_single_code(
+        size_t list_no,
+        size_t offset) const {
+    return il->get_single_code(list_no, offset);
+}
+
+void LoggingInvertedLists::prefetch_lists(const idx_t* list_nos, int nlist)
+        const {
+    il->prefetch_lists(list_nos, nlist);
+}
+
+bool LoggingInvertedLists::is_empty(
+        size_t list_no,
+        void* inverted_list_context) const {
+    return il->is_empty(list_no, inverted_list_context);
+}
+
+InvertedListsIterator* LoggingInvertedLists::get_iterator(
+        size_t list_no,
+        void* inverted_list_context) const {
+    return il->get_iterator(list_no, inverted_list_context);
+}
+
+void LoggingInvertedLists::append_record(
+        int type,
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const idx_t* ids,
+        const uint8_t* codes) {
+    size_t payload_size =
+            record_has_payload(type) ? n_entry * (sizeof(idx_t) + code_size) : 0;
+    uint64_t body_size = sizeof(RecordHeader) + payload_size;
+
+    // the record is assembled in memory so that the checksum is computed on
+    // contiguous data and the record is written with a single call
+    rec_buf.resize(sizeof(uint64_t) + body_size + sizeof(uint64_t));
+    uint8_t* p = rec_buf.data();
+    memcpy(p, &body_size, sizeof(body_size));
+    uint8_t* body = p + sizeof(uint64_t);
+    RecordHeader rh = {uint32_t(type), 0, seq + 1, list_no, offset, n_entry};
+    memcpy(body, &rh, sizeof(rh));
+    if (payload_size > 0) {
+        memcpy(body + sizeof(rh), ids, n_entry * sizeof(idx_t));
+        memcpy(body + sizeof(rh) + n_entry * sizeof(idx_t),
+               codes,
+               n_entry * code_size);
+    }
+    uint64_t checksum = hash_bytes(body, body_size);
+    memcpy(body + body_size, &checksum, sizeof(checksum));
+
+    FAISS_THROW_IF_NOT_FMT(
+            fwrite(p, rec_buf.size(), 1, log) == 1,
+            "write error on %s: %s",
+            log_fname.c_str(),
+            strerror(errno));
+    seq++;
+}
+
+void LoggingInvertedLists::flush() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (sync) {
+        sync_file(log, log_fname.c_str());
+    } else {
+        FAISS_THROW_IF_NOT_FMT(
+                fflush(log) == 0,
+                "could not flush %s: %s",
+                log_fname.c_str(),
+                strerror(errno));
+    }
+}
+
+size_t LoggingInvertedLists::add_entries(
+        size_t list_no,
+        size_t n_entry,
+        const idx_t* ids,
+        const uint8_t* code) {
+    std::lock_guard<std::mutex> guard(mutex);
+    append_record(REC_ADD, list_no, 0, n_entry, ids, code);
+    return il->add_entries(list_no, n_entry, ids, code);
+}
+
+void LoggingInvertedLists::update_entries(
+        size_t list_no,
+        size_t offset,
+        size_t n_entry,
+        const idx_t* ids,
+        const uint8_t* code) {
+    std::lock_guard<std::mutex> guard(mutex);
+    append_record(REC_UPDATE, list_no, offset, n_entry, ids, code);
+    il->update_entries(list_no, offset, n_entry, ids, code);
+}
+
+void LoggingInvertedLists::resize(size_t list_no, size_t new_size) {
+    std::lock_guard<std::mutex> guard(mutex);
+    append_record(REC_RESIZE, list_no, 0, new_size, nullptr, nullptr);
+    il->resize(list_no, new_size);
+}
+
+void LoggingInvertedLists::rotate_log(const char* prev_fname) {
+    if (sync) {
+        sync_file(log, log_fname.c_str());
+    }
+    // the open log follows the rename, so it is still usable on failure
+    FAISS_THROW_IF_NOT_FMT(
+            rename(log_fname.c_str(), prev_fname) == 0,
+            "could not rename %s to %s: %s",
+            log_fname.c_str(),
+            prev_fname,
+            strerror(errno));
+    fclose(log);
+    log = fopen(log_fname.c_str(), "w");
+    FAISS_THROW_IF_NOT_FMT(
+            log,
+            "could not open %s for writing: %s",
+            log_fname.c_str(),
+            strerror(errno));
+    write_log_header(log, this, log_fname.c_str());
+    sync_file(log, log_fname.c_str());
+}
+
+LoggingInvertedLists::~LoggingInvertedLists() {
+    if (log) {
+        if (fflush(log) != 0 || (sync && fsync(fileno(log)) != 0)) {
+            fprintf(stderr,
+                    "could not flush %s: %s\n",
+                    log_fname.c_str(),
+                    strerror(errno));
+        }
+        fclose(log);
+    }
+    if (own_il) {
+        delete il;
+    }
+}
+
+/*******************************************************
+ * Replay
+ *******************************************************/
+
+size_t replay_invlists_log(
+        const char* log_fname,
+        InvertedLists* il,
+        uint64_t min_seq,
+        uint64_t* last_seq,
+        size_t* valid_size) {
+    if (last_seq) {
+        *last_seq = min_seq;
+    }
+    if (valid_size) {
+        *valid_size = 0;
+    }
+    FILE* f = fopen(log_fname, "r");
+    if (!f) {
+        FAISS_THROW_IF_NOT_FMT(
+                errno == ENOENT,
+                "could not open %s for reading: %s",
+                log_fname,
+                strerror(errno));
+        return 0; // no log
+    }
+    std::unique_ptr<FILE, decltype(&fclose)> del(f, &fclose);
+
+    FAISS_THROW_IF_NOT(fseek(f, 0, SEEK_END) == 0);
+    size_t file_size = ftell(f);
+    FAISS_THROW_IF_NOT(fseek(f, 0, SEEK_SET) == 0);
+
+    LogHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1) {
+        return 0; // crash while writing the header
+    }
+    FAISS_THROW_IF_NOT_FMT(
+            h.magic == fourcc("FWAL") && h.version == log_version,
+            "%s is not a log file",
+            log_fname);
+    FAISS_THROW_IF_NOT_FMT(
+            h.nlist == il->nlist && h.code_size == il->code_size,
+            "log %s does not match the inverted lists",
+            log_fname);
+    size_t code_size = il->code_size;
+    size_t pos = sizeof(h);
+    if (valid_size) {
+        *valid_size = pos;
+    }
+
+    size_t napplied = 0;
+    std::vector<uint8_t> body;
+    for (;;) {
+        uint64_t body_size, checksum;
+        if (fread(&body_size, sizeof(body_size), 1, f) != 1 ||
+            body_size < sizeof(RecordHeader)) {
+            break;
+        }
+        // protects the allocation against a corrupted size
+        if (body_size + 2 * sizeof(uint64_t) > file_size - pos) {
+            break;
+        }
+        body.resize(body_size);
+        if (fread(body.data(), body_size, 1, f) != 1 ||
+            fread(&checksum, sizeof(checksum), 1, f) != 1 ||
+            checksum != hash_bytes(body.data(), body_size)) {
+            break;
+        }
+        RecordHeader rh;
+        memcpy(&rh, body.data(), sizeof(rh));
+        size_t payload_size = record_has_payload(rh.type)
+                ? rh.n_entry * (sizeof(idx_t) + code_size)
+                : 0;
+        FAISS_THROW_IF_NOT_FMT(
+                rh.list_no < il->nlist &&
+                        body_size == sizeof(rh) + payload_size,
+                "inconsistent record %" PRIu64 " in %s",
+                rh.seq,
+                log_fname);
+
+        if (rh.seq > min_seq) {
+            const idx_t* ids = (const idx_t*)(body.data() + sizeof(rh));
+            const uint8_t* codes =
+                    body.data() + sizeof(rh) + rh.n_entry * sizeof(idx_t);
+            switch (rh.type) {
+                case REC_ADD:
+                    il->add_entries(rh.list_no, rh.n_entry, ids, codes);
+                    break;
+                case REC_UPDATE:
+                    il->update_entries(
+                            rh.list_no, rh.offset, rh.n_entry, ids, codes);
+                    break;
+                case REC_RESIZE:
+                    il->resize(rh.list_no, rh.n_entry);
+                    break;
+                default:
+                    FAISS_THROW_FMT(
+                            "unknown record type %d in %s", rh.type, log_fname);
+            }
+            napplied++;
+            if (last_seq) {
+                *last_seq = rh.seq;
+            }
+        }
+        pos += sizeof(body_size) + body_size + sizeof(checksum);
+        if (valid_size) {
+            *valid_size = pos;
+        }
+    }
+    return napplied;
+}
+
+/*******************************************************
+ * Checkpoints
+ *******************************************************/
+
+LoggingInvertedLists* attach_ivf_log(
+        IndexIVF* index,
+        const char* log_fname,
+        uint64_t seq) {
+    LoggingInvertedLists* lil =
+            new LoggingInvertedLists(index->invlists, log_fname, seq);
+    lil->own_il = index->own_invlists;
+    index->own_invlists = false;
+    index->replace_invlists(lil, true);
+    return lil;
+}
+
+void write_index_ivf_checkpoint(const IndexIVF* index, const char* fname) {
+    LoggingInvertedLists* lil =
+            dynamic_cast<LoggingInvertedLists*>(index->invlists);
+    FAISS_THROW_IF_NOT_MSG(lil, "the index has no log attached");
+    std::lock_guard<std::mutex> checkpoint_guard(lil->checkpoint_mutex);
+    std::string prev_fname = lil->log_fname + ".prev";
+
+    // snapshot of the index, the mutations are blocked only during the
+    // serialization in memory, not during the file I/O
+    VectorIOWriter snapshot;
+    {
+        std::lock_guard<std::mutex> index_guard(lil->index_mutex);
+        std::lock_guard<std::mutex> guard(lil->mutex);
+        write_index(index, &snapshot);
+        IOWriter* f = &snapshot;
+        uint32_t h = fourcc(checkpoint_trailer);
+        WRITE1(h);
+        uint64_t seq = lil->seq;
+        WRITE1(seq);
+        // if a previous checkpoint failed, its ".prev" log is still needed
+        // by the previous checkpoint and the log is not rotated (this
+        // checkpoint makes both of them obsolete)
+        if (access(prev_fname.c_str(), F_OK) != 0) {
+            lil->rotate_log(prev_fname.c_str());
+        }
+    }
+
+    std::string tmp_fname = std::string(fname) + ".tmp";
+    {
+        FileIOWriter writer(tmp_fname.c_str());
+        IOWriter* f = &writer;
+        WRITEANDCHECK(snapshot.data.data(), snapshot.data.size());
+        sync_file(writer.f, tmp_fname.c_str());
+    }
+    FAISS_THROW_IF_NOT_FMT(
+            rename(tmp_fname.c_str(), fname) == 0,
+            "could not rename %s to %s: %s",
+            tmp_fname.c_str(),
+            fname,
+            strerror(errno));
+    FAISS_THROW_IF_NOT_FMT(
+            unlink(prev_fname.c_str()) == 0 || errno == ENOENT,
+            "could not remove %s: %s",
+            prev_fname.c_str(),
+            strerror(errno));
+}
+
+IndexIVF* read_index_ivf_with_log(
+        const char* fname,
+        const char* log_fname,
+        int io_flags) {
+    std::unique_ptr<Index> index;
+    uint64_t seq = 0;
+    {
+        FileIOReader reader(fname);
+        index.reset(read_index(&reader, io_flags));
+        uint32_t h;
+        if (reader(&h, sizeof(h), 1) == 1 && h == fourcc(checkpoint_trailer)) {
+            IOReader* f = &reader;
+            READ1(seq);
+        }
+    }
+    IndexIVF* ivf = dynamic_cast<IndexIVF*>(index.get());
+    FAISS_THROW_IF_NOT_MSG(ivf, "checkpoint is not an IndexIVF");
+
+    // records of an interrupted checkpoint, then of the current log
+    std::string prev_fname = std::string(log_fname) + ".prev";
+    uint64_t last_seq;
+    size_t valid_size;
+    replay_invlists_log(prev_fname.c_str(), ivf->invlists, seq, &last_seq);
+    replay_invlists_log(
+            log_fname, ivf->invlists, last_seq, &last_seq, &valid_size);
+
+    // remove the record that was being written when the process crashed
+    struct stat st;
+    if (stat(log_fname, &st) == 0 && size_t(st.st_size) > valid_size) {
+        FAISS_THROW_IF_NOT_FMT(
+                truncate(log_fname, valid_size) == 0,
+                "could not truncate %s: %s",
+                log_fname,
+                strerror(errno));
+    }
+
+    // also without replayed records: the checkpoint may have been written
+    // during an add or remove_ids that did not hold index_mutex
+    ivf->ntotal = ivf->invlists->compute_ntotal();
+    DirectMap::Type dm_type = ivf->direct_map.type;
+    if (dm_type != DirectMap::NoMap) {
+        ivf->set_direct_map_type(DirectMap::NoMap);
+        ivf->set_direct_map_type(dm_type);
+    }
+    attach_ivf_log(ivf, log_fname, last_seq);
+    index.release();
+    return ivf;
+}
+
+/*******************************************************
+ * I/O support via callbacks
+ *******************************************************/
+
+LoggingInvertedListsIOHook::LoggingInvertedListsIOHook()
+        : InvertedListsIOHook("illg", typeid(LoggingInvertedLists).name()) {}
+
+void LoggingInvertedListsIOHook::write(const InvertedLists* ils, IOWriter* f)
+        const {
+    const LoggingInvertedLists* lil =
+            dynamic_cast<const LoggingInvertedLists*>(ils);
+    FAISS_THROW_IF_NOT(lil);
+    write_InvertedLists(lil->il, f);
+}
+
+InvertedLists* LoggingInvertedListsIOHook::read(IOReader*, int) const {
+    FAISS_THROW_MSG("LoggingInvertedLists are never stored as such");
+}
+
+} // namespace faiss
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// -*- c++ -*-
+
+#pragma once
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include <faiss/IndexIVF.h>
+#include <faiss/invlists/InvertedListsIOHook.h>
+
+namespace faiss {
+
+/** Inverted lists that append all mutations of the lists they wrap to a
+ * write-ahead log file.
+ *
+ * Each mutation (add_entries, update_entries, resize) is written as one
+ * record containing the encoded codes and ids before it is applied to the
+ * wrapped lists, so remove_ids is logged as the resulting updates and
+ * resizes. Records carry a sequence number and a checksum, so that a
+ * record truncated by a crash is detected and ignored at replay.
+ *
+ * The log is meant to be combined with periodic checkpoints, see
+ * write_index_ivf_checkpoint and read_index_ivf_with_log: the cost of
+ * persisting the index between checkpoints is proportional to the
+ * mutations, not to the size of the index.
+ *
+ * Mutations and checkpoints are serialized by a mutex. When written with
+ * write_index, the object is stored as the wrapped inverted lists.
+ */
+struct LoggingInvertedLists : InvertedLists {
+    InvertedLists* il;   ///< the wrapped inverted lists
+    bool own_il = false; ///< whether il should be deleted in the destructor
+
+    std::string log_fname;
+    FILE* log = nullptr;
+
+    /// sequence number of the last logged mutation
+    uint64_t seq = 0;
+
+    /// whether flush() also fsyncs the log. Otherwise the records are only
+    /// handed to the OS, which survives a crash of the process but not of
+    /// the machine.
+    bool sync = false;
+
+    /// serializes the mutations and the checkpoints
+    std::mutex mutex;
+
+    /// held by write_index_ivf_checkpoint while the index is serialized
+    /// in memory. The lists are only locked per mutation, so the callers
+    /// that add to or remove from the index concurrently with checkpoints
+    /// should hold it for the whole add / remove_ids call: otherwise the
+    /// checkpoint may contain the lists of a partial add with the previous
+    /// ntotal.
+    std::mutex index_mutex;
+
+    /// serializes the checkpoints
+    std::mutex checkpoint_mutex;
+
+    /** @param log_fname  log file. If it exists, new records are appended
+     *                    to it (it should have been replayed on il before).
+     * @param seq         sequence number of the last record already in il
+     */
+    LoggingInvertedLists(
+            InvertedLists* il,
+            const char* log_fname,
+            uint64_t seq = 0);
+
+    /* read functions, forwarded to il */
+    size_t list_size(size_t list_no) const override;
+    const uint8_t* get_codes(size_t list_no) const override;
+    const idx_t* get_ids(size_t list_no) const override;
+    void release_codes(size_t list_no, const uint8_t* codes) const override;
+    void release_ids(size_t list_no, const idx_t* ids) const override;
+    idx_t get_single_id(size_t list_no, size_t offset) const override;
+    const uint8_t* get_single_code(size_t list_no, size_t offset)
+            const override;
+    void prefetch_lists(const idx_t* list_nos, int nlist) const override;
+    bool is_empty(size_t list_no, void* inverted_list_context = nullptr)
+            const override;
+    InvertedListsIterator* get_iterator(
+            size_t list_no,
+            void* inverted_list_context = nullptr) const override;
+
+    /* write functions, logged then forwarded to il */
+    size_t add_entries(
+            size_t list_no,
+            size_t n_entry,
+            const idx_t* ids,
+            const uint8_t* code) override;
+
+    void update_entries(
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const idx_t* ids,
+            const uint8_t* code) override;
+
+    void resize(size_t list_no, size_t new_size) override;
+
+    /** Make the logged mutations durable. Records are buffered, so
+     * mutations after the last flush may be lost in a crash (the ones
+     * before are always replayed in order). Typically called after each
+     * add or remove_ids call of the index. */
+    void flush();
+
+    /** Rename the log to prev_fname and continue with an empty one (the
+     * mutex should be held). */
+    void rotate_log(const char* prev_fname);
+
+    ~LoggingInvertedLists() override;
+
+   private:
+    std::vector<uint8_t> rec_buf;
+
+    /// append a record to the log (the mutex should be held)
+    void append_record(
+            int type,
+            size_t list_no,
+            size_t offset,
+            size_t n_entry,
+            const idx_t* ids,
+            const uint8_t* codes);
+};
+
+/** Apply the records of a log written by LoggingInvertedLists to il.
+ *
+ * Records with a sequence number <= min_seq are skipped (they are already
+ * in il). Replay stops at the first incomplete or corrupted record.
+ *
+ * @param last_seq    if non-null, sequence number of the last valid record
+ * @param valid_size  if non-null, size of the valid prefix of the log
+ *                    (bytes)
+ * @return nb of records applied
+ */
+size_t replay_invlists_log(
+        const char* log_fname,
+        InvertedLists* il,
+        uint64_t min_seq = 0,
+        uint64_t* last_seq = nullptr,
+        size_t* valid_size = nullptr);
+
+/** Attach a write-ahead log to an IndexIVF: its inverted lists are wrapped
+ * in a LoggingInvertedLists that takes over their ownership.
+ */
+LoggingInvertedLists* attach_ivf_log(
+        IndexIVF* index,
+        const char* log_fname,
+        uint64_t seq = 0);
+
+/** Write a checkpoint of an IndexIVF whose inverted lists are a
+ * LoggingInvertedLists, and empty the log.
+ *
+ * Mutations and the holders of LoggingInvertedLists::index_mutex are
+ * blocked only while the index is serialized in memory (so the checkpoint
+ * temporarily needs as much memory as the index). At that point, the log
+ * is renamed to log_fname + ".prev" and new mutations go to an empty log.
+ * The serialized index is then written to a temporary file that is synced
+ * and renamed to fname, so that fname always contains a complete
+ * checkpoint, and the ".prev" log is removed.
+ *
+ * The checkpoint is followed by the sequence number of the last mutation
+ * it contains, so that the records of the ".prev" log are not applied
+ * twice after a crash between the rename and the removal.
+ */
+void write_index_ivf_checkpoint(const IndexIVF* index, const char* fname);
+
+/** Read a checkpoint written by write_index_ivf_checkpoint (or a plain
+ * IndexIVF written by write_index) and replay the log on top of it,
+ * preceded by the ".prev" log of an interrupted checkpoint if any.
+ * A truncated record at the end of the log is removed. ntotal and the
+ * direct map are recomputed from the inverted lists. The log is attached
+ * to the returned index, so that new mutations are appended to it.
+ */
+IndexIVF* read_index_ivf_with_log(
+        const char* fname,
+        const char* log_fname,
+        int io_flags = 0);
+
+/// LoggingInvertedLists are stored as the inverted lists they wrap
+struct LoggingInvertedListsIOHook : InvertedListsIOHook {
+    LoggingInvertedListsIOHook();
+    void write(const InvertedLists* ils, IOWriter* f) const override;
+    InvertedLists* read(IOReader* f, int io_flags) const override;
+};
+
+} // namespace faiss
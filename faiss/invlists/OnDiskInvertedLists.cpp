@@ -11,6 +11,9 @@
 
 #include <pthread.h>
 
+#include <exception>
+#include <memory>
+#include <thread>
 #include <unordered_set>
 
 #include <sys/mman.h>
@@ -675,6 +678,289 @@ void OnDiskInvertedLists::set_all_lists_sizes(const size_t* sizes) {
     }
 }
 
+/*******************************************************
+ * OnDiskInvertedListsBuilder
+ *******************************************************/
+
+OnDiskInvertedListsBuilder::OnDiskInvertedListsBuilder(
+        const IndexIVF* index,
+        const char* tmp_prefix,
+        size_t max_run_size)
+        : index(index), tmp_prefix(tmp_prefix), max_run_size(max_run_size) {
+    FAISS_THROW_IF_NOT(index->is_trained);
+    FAISS_THROW_IF_NOT(max_run_size > 0);
+}
+
+void OnDiskInvertedListsBuilder::add(
+        idx_t n,
+        const float* x,
+        const idx_t* xids) {
+    size_t code_size = index->code_size;
+    // process by blocks that fit in the remaining space of the run
+    for (idx_t i0 = 0; i0 < n;) {
+        if (run_ids.size() >= max_run_size) {
+            spill_run();
+        }
+        idx_t i1 = std::min(n, idx_t(i0 + max_run_size - run_ids.size()));
+        idx_t ni = i1 - i0;
+        const float* xi = x + i0 * index->d;
+
+        std::vector<idx_t> list_nos(ni);
+        index->quantizer->assign(ni, xi, list_nos.data());
+        size_t r0 = run_ids.size();
+        run_codes.resize((r0 + ni) * code_size);
+        index->encode_vectors(
+                ni, xi, list_nos.data(), run_codes.data() + r0 * code_size);
+
+        size_t nadd = 0;
+        for (idx_t i = 0; i < ni; i++) {
+            if (list_nos[i] < 0) {
+                continue; // not assigned, as in IndexIVF::add_core
+            }
+            if (r0 + nadd != r0 + i) {
+                memmove(run_codes.data() + (r0 + nadd) * code_size,
+                        run_codes.data() + (r0 + i) * code_size,
+                        code_size);
+            }
+            run_list_nos.push_back(list_nos[i]);
+            run_ids.push_back(xids ? xids[i0 + i] : ntotal + i0 + i);
+            nadd++;
+        }
+        run_codes.resize((r0 + nadd) * code_size);
+        i0 = i1;
+    }
+    ntotal += n;
+}
+
+namespace {
+
+/// read up to n vectors from a .fvecs file, returns the nb of vectors read
+size_t read_fvecs_batch(FILE* f, size_t d, size_t n, float* x) {
+    for (size_t i = 0; i < n; i++) {
+        int32_t di;
+        if (fread(&di, sizeof(di), 1, f) != 1) {
+            return i;
+        }
+        FAISS_THROW_IF_NOT_FMT(
+                di == d, "unexpected vector dimension %d (expected %zu)",
+                di, d);
+        size_t nread = fread(x + i * d, sizeof(float), d, f);
+        FAISS_THROW_IF_NOT_MSG(nread == d, "truncated fvecs file");
+    }
+    return n;
+}
+
+} // namespace
+
+size_t OnDiskInvertedListsBuilder::add_fvecs(const char* fname) {
+    FILE* f = fopen(fname, "r");
+    FAISS_THROW_IF_NOT_FMT(
+            f, "could not open %s for reading: %s", fname, strerror(errno));
+    std::unique_ptr<FILE, decltype(&fclose)> del(f, &fclose);
+
+    size_t d = index->d;
+    std::vector<float> buf[2] = {
+            std::vector<float>(batch_size * d),
+            std::vector<float>(batch_size * d)};
+    size_t nread = read_fvecs_batch(f, d, batch_size, buf[0].data());
+    size_t ntot = 0;
+    double t0 = getmillisecs();
+    for (int b = 0; nread > 0; b = 1 - b) {
+        // read the next batch while this one is processed
+        size_t nnext = 0;
+        std::exception_ptr read_error;
+        std::thread reader([&]() {
+            try {
+                nnext = read_fvecs_batch(f, d, batch_size, buf[1 - b].data());
+            } catch (...) {
+                read_error = std::current_exception();
+            }
+        });
+        try {
+            add(nread, buf[b].data());
+        } catch (...) {
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (read_error) {
+            std::rethrow_exception(read_error);
+        }
+        ntot += nread;
+        nread = nnext;
+        if (verbose) {
+            printf("\radded %zu vectors from %s (%.3f s)",
+                   ntot,
+                   fname,
+                   (getmillisecs() - t0) / 1000.0);
+            fflush(stdout);
+        }
+    }
+    if (verbose) {
+        printf("\n");
+    }
+    return ntot;
+}
+
+void OnDiskInvertedListsBuilder::spill_run() {
+    size_t n = run_ids.size();
+    if (n == 0) {
+        return;
+    }
+    size_t nlist = index->nlist;
+    size_t code_size = index->code_size;
+
+    // stable counting sort by list number
+    std::vector<size_t> sizes(nlist), offsets(nlist + 1);
+    for (idx_t list_no : run_list_nos) {
+        sizes[list_no]++;
+    }
+    for (size_t j = 0; j < nlist; j++) {
+        offsets[j + 1] = offsets[j] + sizes[j];
+    }
+    std::vector<idx_t> sorted_ids(n);
+    std::vector<uint8_t> sorted_codes(n * code_size);
+    {
+        std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            size_t o = pos[run_list_nos[i]]++;
+            sorted_ids[o] = run_ids[i];
+            memcpy(sorted_codes.data() + o * code_size,
+                   run_codes.data() + i * code_size,
+                   code_size);
+        }
+    }
+
+    // each non-empty list is stored as ids followed by codes
+    char fname[1024];
+    snprintf(
+            fname,
+            sizeof(fname),
+            "%s.run%zu",
+            tmp_prefix.c_str(),
+            run_files.size());
+    FILE* f = fopen(fname, "w");
+    FAISS_THROW_IF_NOT_FMT(
+            f, "could not open %s for writing: %s", fname, strerror(errno));
+    std::unique_ptr<FILE, decltype(&fclose)> del(f, &fclose);
+    run_files.push_back(fname);
+    for (size_t j = 0; j < nlist; j++) {
+        size_t nj = sizes[j];
+        if (nj == 0) {
+            continue;
+        }
+        size_t o = offsets[j];
+        bool ok = fwrite(sorted_ids.data() + o, sizeof(idx_t), nj, f) == nj &&
+                fwrite(sorted_codes.data() + o * code_size,
+                       code_size,
+                       nj,
+                       f) == nj;
+        FAISS_THROW_IF_NOT_FMT(
+                ok, "write error on %s: %s", fname, strerror(errno));
+    }
+    FAISS_THROW_IF_NOT_FMT(
+            fflush(f) == 0, "write error on %s: %s", fname, strerror(errno));
+    run_list_sizes.insert(run_list_sizes.end(), sizes.begin(), sizes.end());
+
+    if (verbose) {
+        printf("\nspilled run %zu with %zu entries to %s\n",
+               run_files.size() - 1,
+               n,
+               fname);
+    }
+
+    run_list_nos.clear();
+    run_ids.clear();
+    run_codes.clear();
+}
+
+OnDiskInvertedLists* OnDiskInvertedListsBuilder::finish(const char* filename) {
+    spill_run();
+    size_t nlist = index->nlist;
+    size_t code_size = index->code_size;
+    size_t nrun = run_files.size();
+
+    std::vector<FILE*> runs;
+    auto close_runs = [&]() {
+        for (FILE* f : runs) {
+            fclose(f);
+        }
+        runs.clear();
+    };
+    std::unique_ptr<OnDiskInvertedLists> il(
+            new OnDiskInvertedLists(nlist, code_size, filename));
+    try {
+        for (const std::string& fname : run_files) {
+            FILE* f = fopen(fname.c_str(), "r");
+            FAISS_THROW_IF_NOT_FMT(
+                    f,
+                    "could not open %s for reading: %s",
+                    fname.c_str(),
+                    strerror(errno));
+            runs.push_back(f);
+        }
+
+        // compact layout, as in merge_from_multiple
+        size_t cums = 0;
+        for (size_t j = 0; j < nlist; j++) {
+            size_t size = 0;
+            for (size_t r = 0; r < nrun; r++) {
+                size += run_list_sizes[r * nlist + j];
+            }
+            OnDiskOneList& l = il->lists[j];
+            l.size = l.capacity = size;
+            l.offset = cums;
+            cums += size * (sizeof(idx_t) + code_size);
+        }
+        if (cums > 0) {
+            il->update_totsize(cums);
+            // the whole file is used by the lists
+            il->slots.clear();
+        }
+
+        // k-way merge, list by list: the runs are read sequentially and the
+        // output is written sequentially
+        for (size_t j = 0; j < nlist; j++) {
+            const OnDiskOneList& l = il->lists[j];
+            uint8_t* codes = il->ptr + l.offset;
+            idx_t* ids = (idx_t*)(codes + l.capacity * code_size);
+            for (size_t r = 0; r < nrun; r++) {
+                size_t nj = run_list_sizes[r * nlist + j];
+                if (nj == 0) {
+                    continue;
+                }
+                bool ok = fread(ids, sizeof(idx_t), nj, runs[r]) == nj &&
+                        fread(codes, code_size, nj, runs[r]) == nj;
+                FAISS_THROW_IF_NOT_FMT(
+                        ok,
+                        "read error on %s: %s",
+                        run_files[r].c_str(),
+                        strerror(errno));
+                ids += nj;
+                codes += nj * code_size;
+            }
+        }
+    } catch (...) {
+        close_runs();
+        throw;
+    }
+    close_runs();
+    remove_runs();
+    return il.release();
+}
+
+void OnDiskInvertedListsBuilder::remove_runs() {
+    for (const std::string& fname : run_files) {
+        unlink(fname.c_str());
+    }
+    run_files.clear();
+    run_list_sizes.clear();
+}
+
+OnDiskInvertedListsBuilder::~OnDiskInvertedListsBuilder() {
+    remove_runs();
+}
+
 /*******************************************************
  * I/O support via callbacks
  *******************************************************/
@@ -139,6 +139,70 @@ struct OnDiskInvertedLists : InvertedLists {
     OnDiskInvertedLists();
 };
 
+/** Builds compact OnDiskInvertedLists for a trained IndexIVF from a stream
+ * of vectors, with bounded RAM usage.
+ *
+ * The vectors are assigned and encoded by batches (both steps are
+ * parallel). The (list_no, id, code) entries are buffered in RAM and, when
+ * the buffer is full, sorted by list number and spilled to a temporary run
+ * file. finish() k-way merges the runs list by list into the final
+ * OnDiskInvertedLists file, so both the runs and the output file are
+ * accessed sequentially. Within a list, the entries are in the order they
+ * were added. All runs are open at the same time during the merge.
+ *
+ *   OnDiskInvertedListsBuilder builder(&index, "/tmp/build_runs");
+ *   builder.add_fvecs("base.fvecs"); // or several builder.add()
+ *   OnDiskInvertedLists* il = builder.finish("index.ivfdata");
+ *   index.replace_invlists(il, true);
+ *   index.ntotal = builder.ntotal;
+ */
+struct OnDiskInvertedListsBuilder {
+    const IndexIVF* index; ///< used to assign and encode the vectors
+
+    std::string tmp_prefix; ///< prefix of the run files
+    size_t max_run_size;    ///< max nb of entries buffered in RAM
+    size_t batch_size = 65536; ///< nb of vectors read at a time by add_fvecs
+    bool verbose = false;
+
+    idx_t ntotal = 0; ///< nb of entries added so far
+
+    /// entries of the current run
+    std::vector<idx_t> run_list_nos;
+    std::vector<idx_t> run_ids;
+    std::vector<uint8_t> run_codes;
+
+    /// files of the spilled runs
+    std::vector<std::string> run_files;
+    /// list sizes in each run, size run_files.size() * nlist
+    std::vector<size_t> run_list_sizes;
+
+    OnDiskInvertedListsBuilder(
+            const IndexIVF* index,
+            const char* tmp_prefix,
+            size_t max_run_size = 1 << 20);
+
+    /// add n vectors, with sequential ids starting at ntotal if xids is
+    /// not provided
+    void add(idx_t n, const float* x, const idx_t* xids = nullptr);
+
+    /// add all the vectors of a .fvecs file with sequential ids. The next
+    /// batch is read while the current one is encoded.
+    /// @return nb of vectors read
+    size_t add_fvecs(const char* fname);
+
+    /// sort the current run by list number and write it to disk
+    void spill_run();
+
+    /// merge the runs into a compact OnDiskInvertedLists stored in
+    /// filename, and remove the run files
+    OnDiskInvertedLists* finish(const char* filename);
+
+    /// remove the run files
+    void remove_runs();
+
+    ~OnDiskInvertedListsBuilder();
+};
+
 struct OnDiskInvertedListsIOHook : InvertedListsIOHook {
     OnDiskInvertedListsIOHook();
     void write(const InvertedLists* ils, IOWriter* f) const override;
@@ -492,7 +492,8 @@ def handle_Index(the_class):
             assert x.ndim == 1
             index_ivf = try_extract_index_ivf(self)
             x = np.ascontiguousarray(x, dtype='int64')
-            if index_ivf and index_ivf.direct_map.type == DirectMap.Hashtable:
+            if index_ivf and index_ivf.direct_map.type in (
+                    DirectMap.Hashtable, DirectMap.CompactHashtable):
                 sel = IDSelectorArray(x.size, swig_ptr(x))
             else:
                 sel = IDSelectorBatch(x.size, swig_ptr(x))
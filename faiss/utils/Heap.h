@@ -631,6 +631,45 @@ void merge_knn_results(
         typename C::T* distances,
         idx_t* labels);
 
+/** Merge the sorted results of one shard into sorted results, for one
+ * query. A -1 label ends a result list. Same comparator as
+ * merge_knn_results.
+ *
+ * @param D_in, I_in    results of the shard, size k
+ * @param D, I          results to update in-place, size k
+ * @param D_tmp, I_tmp  temporary buffers, size k
+ */
+template <class idx_t, class C>
+void merge_knn_result_into(
+        size_t k,
+        const typename C::T* D_in,
+        const idx_t* I_in,
+        typename C::T* D,
+        idx_t* I,
+        typename C::T* D_tmp,
+        idx_t* I_tmp) {
+    if (I_in[0] < 0 || (I[k - 1] >= 0 && !C::cmp(D_in[0], D[k - 1]))) {
+        return; // nothing to merge
+    }
+    size_t a = 0, b = 0;
+    for (size_t j = 0; j < k; j++) {
+        bool has_a = a < k && I[a] >= 0;
+        bool has_b = b < k && I_in[b] >= 0;
+        if (has_b && (!has_a || C::cmp(D_in[b], D[a]))) {
+            D_tmp[j] = D_in[b];
+            I_tmp[j] = I_in[b++];
+        } else if (has_a) {
+            D_tmp[j] = D[a];
+            I_tmp[j] = I[a++];
+        } else {
+            D_tmp[j] = C::Crev::neutral();
+            I_tmp[j] = -1;
+        }
+    }
+    memcpy(D, D_tmp, k * sizeof(*D));
+    memcpy(I, I_tmp, k * sizeof(*I));
+}
+
 } // namespace faiss
 
 #endif /* FAISS_Heap_h */
@@ -833,6 +833,27 @@ int distance_compute_blas_query_bs = 4096;
 int distance_compute_blas_database_bs = 1024;
 int distance_compute_min_k_reservoir = 100;
 
+namespace {
+
+// top-k within radius for the search paths that do not seed their heaps:
+// the results are sorted, so the ones outside the radius are at the end
+template <class C>
+void crop_results_to_radius(
+        size_t nx,
+        size_t k,
+        float* vals,
+        int64_t* ids,
+        float radius) {
+    for (size_t i = 0; i < nx * k; i++) {
+        if (!C::cmp(radius, vals[i])) {
+            vals[i] = C::neutral();
+            ids[i] = -1;
+        }
+    }
+}
+
+} // anonymous namespace
+
 void knn_inner_product(
         const float* x,
         const float* y,
@@ -842,7 +863,9 @@ void knn_inner_product(
         size_t k,
         float* vals,
         int64_t* ids,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        ApproxTopK_mode_t approx_topk_mode,
+        float radius) {
     int64_t imin = 0;
     if (auto selr = dynamic_cast<const IDSelectorRange*>(sel)) {
         imin = std::max(selr->imin, int64_t(0));
@@ -854,12 +877,48 @@ void knn_inner_product(
     if (auto sela = dynamic_cast<const IDSelectorArray*>(sel)) {
         knn_inner_products_by_idx(
                 x, y, sela->ids, d, nx, ny, sela->n, k, vals, ids, 0);
+        if (radius != -HUGE_VALF) {
+            crop_results_to_radius<CMin<float, int64_t>>(
+                    nx, k, vals, ids, radius);
+        }
         return;
     }
 
     Run_search_inner_product r;
-    dispatch_knn_ResultHandler(
-            nx, vals, ids, k, METRIC_INNER_PRODUCT, sel, r, x, y, d, nx, ny);
+    if (radius != -HUGE_VALF) {
+        dispatch_knn_radius_ResultHandler(
+                nx,
+                vals,
+                ids,
+                k,
+                radius,
+                METRIC_INNER_PRODUCT,
+                sel,
+                r,
+                x,
+                y,
+                d,
+                nx,
+                ny);
+    } else if (approx_topk_mode != EXACT_TOPK && k > 1) {
+        dispatch_approx_topk_ResultHandler(
+                nx,
+                vals,
+                ids,
+                k,
+                approx_topk_mode,
+                METRIC_INNER_PRODUCT,
+                sel,
+                r,
+                x,
+                y,
+                d,
+                nx,
+                ny);
+    } else {
+        dispatch_knn_ResultHandler(
+                nx, vals, ids, k, METRIC_INNER_PRODUCT, sel, r, x, y, d, nx, ny);
+    }
 
     if (imin != 0) {
         for (size_t i = 0; i < nx * k; i++) {
@@ -877,9 +936,20 @@ void knn_inner_product(
         size_t nx,
         size_t ny,
         float_minheap_array_t* res,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        ApproxTopK_mode_t approx_topk_mode) {
     FAISS_THROW_IF_NOT(nx == res->nh);
-    knn_inner_product(x, y, d, nx, ny, res->k, res->val, res->ids, sel);
+    knn_inner_product(
+            x,
+            y,
+            d,
+            nx,
+            ny,
+            res->k,
+            res->val,
+            res->ids,
+            sel,
+            approx_topk_mode);
 }
 
 void knn_L2sqr(
@@ -892,7 +962,9 @@ void knn_L2sqr(
         float* vals,
         int64_t* ids,
         const float* y_norm2,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        ApproxTopK_mode_t approx_topk_mode,
+        float radius) {
     int64_t imin = 0;
     if (auto selr = dynamic_cast<const IDSelectorRange*>(sel)) {
         imin = std::max(selr->imin, int64_t(0));
@@ -903,12 +975,50 @@ void knn_L2sqr(
     }
     if (auto sela = dynamic_cast<const IDSelectorArray*>(sel)) {
         knn_L2sqr_by_idx(x, y, sela->ids, d, nx, ny, sela->n, k, vals, ids, 0);
+        if (radius != HUGE_VALF) {
+            crop_results_to_radius<CMax<float, int64_t>>(
+                    nx, k, vals, ids, radius);
+        }
         return;
     }
 
     Run_search_L2sqr r;
-    dispatch_knn_ResultHandler(
-            nx, vals, ids, k, METRIC_L2, sel, r, x, y, d, nx, ny, y_norm2);
+    if (radius != HUGE_VALF) {
+        dispatch_knn_radius_ResultHandler(
+                nx,
+                vals,
+                ids,
+                k,
+                radius,
+                METRIC_L2,
+                sel,
+                r,
+                x,
+                y,
+                d,
+                nx,
+                ny,
+                y_norm2);
+    } else if (approx_topk_mode != EXACT_TOPK && k > 1) {
+        dispatch_approx_topk_ResultHandler(
+                nx,
+                vals,
+                ids,
+                k,
+                approx_topk_mode,
+                METRIC_L2,
+                sel,
+                r,
+                x,
+                y,
+                d,
+                nx,
+                ny,
+                y_norm2);
+    } else {
+        dispatch_knn_ResultHandler(
+                nx, vals, ids, k, METRIC_L2, sel, r, x, y, d, nx, ny, y_norm2);
+    }
 
     if (imin != 0) {
         for (size_t i = 0; i < nx * k; i++) {
@@ -927,9 +1037,21 @@ void knn_L2sqr(
         size_t ny,
         float_maxheap_array_t* res,
         const float* y_norm2,
-        const IDSelector* sel) {
+        const IDSelector* sel,
+        ApproxTopK_mode_t approx_topk_mode) {
     FAISS_THROW_IF_NOT(res->nh == nx);
-    knn_L2sqr(x, y, d, nx, ny, res->k, res->val, res->ids, y_norm2, sel);
+    knn_L2sqr(
+            x,
+            y,
+            d,
+            nx,
+            ny,
+            res->k,
+            res->val,
+            res->ids,
+            y_norm2,
+            sel,
+            approx_topk_mode);
 }
 
 /***************************************************************************
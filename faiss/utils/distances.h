@@ -13,8 +13,11 @@
 
 #include <stdint.h>
 
+#include <cmath>
+
 #include <faiss/impl/platform_macros.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/approx_topk/mode.h>
 
 namespace faiss {
 
@@ -299,7 +302,8 @@ void knn_inner_product(
         size_t nx,
         size_t ny,
         float_minheap_array_t* res,
-        const IDSelector* sel = nullptr);
+        const IDSelector* sel = nullptr,
+        ApproxTopK_mode_t approx_topk_mode = EXACT_TOPK);
 
 /**  Return the k nearest neighbors of each of the nx vectors x among the ny
  *  vector y, for the inner product metric.
@@ -308,6 +312,10 @@ void knn_inner_product(
  * @param y    database vectors, size ny * d
  * @param distances  output distances, size nq * k
  * @param indexes    output vector ids, size nq * k
+ * @param approx_topk_mode  collect the results with an approximate top-k
+ * @param radius     return only the results with an inner product
+ *                   > radius (top-k within radius). The approximate
+ *                   top-k is not used in that case.
  */
 void knn_inner_product(
         const float* x,
@@ -318,7 +326,9 @@ void knn_inner_product(
         size_t k,
         float* distances,
         int64_t* indexes,
-        const IDSelector* sel = nullptr);
+        const IDSelector* sel = nullptr,
+        ApproxTopK_mode_t approx_topk_mode = EXACT_TOPK,
+        float radius = -HUGE_VALF);
 
 /** Return the k nearest neighbors of each of the nx vectors x among the ny
  *  vector y, for the L2 distance
@@ -336,7 +346,8 @@ void knn_L2sqr(
         size_t ny,
         float_maxheap_array_t* res,
         const float* y_norm2 = nullptr,
-        const IDSelector* sel = nullptr);
+        const IDSelector* sel = nullptr,
+        ApproxTopK_mode_t approx_topk_mode = EXACT_TOPK);
 
 /**  Return the k nearest neighbors of each of the nx vectors x among the ny
  *  vector y, for the L2 distance
@@ -347,6 +358,13 @@ void knn_L2sqr(
  * @param indexes    output vector ids, size nq * k
  * @param y_norm2    (optional) norms for the y vectors (nullptr or size ny)
  * @param sel  search in this subset of vectors
+ * @param approx_topk_mode  collect the results with an approximate top-k.
+ *             With BLAS, the buckets are computed per block of
+ *             distance_compute_blas_database_bs vectors, so this block size
+ *             should be large w.r.t. k.
+ * @param radius     return only the results with a distance < radius (top-k
+ *                   within radius). The approximate top-k is not used in that
+ *                   case.
  */
 void knn_L2sqr(
         const float* x,
@@ -358,7 +376,9 @@ void knn_L2sqr(
         float* distances,
         int64_t* indexes,
         const float* y_norm2 = nullptr,
-        const IDSelector* sel = nullptr);
+        const IDSelector* sel = nullptr,
+        ApproxTopK_mode_t approx_topk_mode = EXACT_TOPK,
+        float radius = HUGE_VALF);
 
 /** Find the max inner product neighbors for nx queries in a set of ny vectors
  * indexed by ids. May be useful for re-ranking a pre-selected vector list
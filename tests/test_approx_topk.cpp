@@ -17,8 +17,13 @@
 
 #include <faiss/utils/approx_topk/approx_topk.h>
 
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
 #include <faiss/impl/FaissException.h>
+#include <faiss/impl/ResultHandler.h>
 #include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
 
 //
 using namespace faiss;
@@ -222,3 +227,122 @@ TEST(testApproxTopk, COMMON) {
 }
 
 //
+
+// compare the approximate search results with the exact ones, returns the
+// recall
+float test_approx_topk_search(
+        Index& index,
+        const ApproxTopK_mode_t mode,
+        const float min_recall,
+        const idx_t k = 50) {
+    const size_t d = index.d;
+    const size_t nb = 20000;
+    const size_t nq = 30;
+    const bool is_ip = index.metric_type == METRIC_INNER_PRODUCT;
+
+    std::vector<float> xb(nb * d), xq(nq * d);
+    float_rand(xb.data(), xb.size(), 123);
+    float_rand(xq.data(), xq.size(), 456);
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+
+    std::vector<float> D_ref(nq * k), D(nq * k);
+    std::vector<idx_t> I_ref(nq * k), I(nq * k);
+
+    SearchParametersIVF params;
+    params.nprobe = 8;
+    index.search(nq, xq.data(), k, D_ref.data(), I_ref.data(), &params);
+    params.approx_topk_mode = mode;
+    index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+
+    size_t nfound = 0;
+    for (size_t q = 0; q < nq; q++) {
+        std::unordered_set<idx_t> ref(I_ref.begin() + q * k,
+                                      I_ref.begin() + (q + 1) * k);
+        for (size_t j = 0; j < k; j++) {
+            nfound += ref.count(I[q * k + j]);
+            // returned distances are exact and sorted
+            if (j > 0 && is_ip) {
+                EXPECT_GE(D[q * k + j - 1], D[q * k + j]);
+            } else if (j > 0) {
+                EXPECT_LE(D[q * k + j - 1], D[q * k + j]);
+            }
+            const float* y = xb.data() + I[q * k + j] * d;
+            float ref_dis = is_ip ? fvec_inner_product(xq.data() + q * d, y, d)
+                                  : fvec_L2sqr(xq.data() + q * d, y, d);
+            EXPECT_NEAR(D[q * k + j], ref_dis, 1e-5 * (1 + ref_dis));
+        }
+    }
+    float recall = nfound / float(nq * k);
+    EXPECT_GE(recall, min_recall) << "mode " << int(mode);
+    return recall;
+}
+
+TEST(testApproxTopk, IndexFlat) {
+    for (auto mode :
+         {APPROX_TOPK_BUCKETS_B32_D2,
+          APPROX_TOPK_BUCKETS_B8_D3,
+          APPROX_TOPK_BUCKETS_B16_D2,
+          APPROX_TOPK_BUCKETS_B8_D2}) {
+        IndexFlatL2 index(16);
+        test_approx_topk_search(index, mode, 0.7);
+    }
+}
+
+TEST(testApproxTopk, IndexFlatIP) {
+    for (auto mode :
+         {APPROX_TOPK_BUCKETS_B32_D2,
+          APPROX_TOPK_BUCKETS_B8_D3,
+          APPROX_TOPK_BUCKETS_B16_D2,
+          APPROX_TOPK_BUCKETS_B8_D2}) {
+        IndexFlatIP index(16);
+        test_approx_topk_search(index, mode, 0.7);
+    }
+}
+
+// with a large k, the results of a single database block are too few to be
+// reduced, so the approximation must be applied across blocks
+TEST(testApproxTopk, IndexFlatLargeK) {
+    for (auto mode : {APPROX_TOPK_BUCKETS_B32_D2, APPROX_TOPK_BUCKETS_B8_D3}) {
+        IndexFlatL2 index(16);
+        float recall = test_approx_topk_search(index, mode, 0.7, 1000);
+        // the search is not exact
+        EXPECT_LT(recall, 1.0) << "mode " << int(mode);
+    }
+}
+
+TEST(testApproxTopk, IndexIVFFlat) {
+    for (auto mode :
+         {APPROX_TOPK_BUCKETS_B32_D2,
+          APPROX_TOPK_BUCKETS_B8_D3,
+          APPROX_TOPK_BUCKETS_B16_D2,
+          APPROX_TOPK_BUCKETS_B8_D2}) {
+        IndexFlatL2 quantizer(16);
+        IndexIVFFlat index(&quantizer, 16, 32);
+        test_approx_topk_search(index, mode, 0.7);
+    }
+}
+
+TEST(testApproxTopk, IndexIVFFlatIP) {
+    for (auto mode : {APPROX_TOPK_BUCKETS_B32_D2, APPROX_TOPK_BUCKETS_B8_D3}) {
+        IndexFlatIP quantizer(16);
+        IndexIVFFlat index(&quantizer, 16, 32, METRIC_INNER_PRODUCT);
+        test_approx_topk_search(index, mode, 0.7);
+    }
+}
+
+// the per-query buffers of a query block are O(k)
+TEST(testApproxTopk, BlockBufferSize) {
+    using C = CMax<float, int64_t>;
+    for (auto mode :
+         {APPROX_TOPK_BUCKETS_B32_D2,
+          APPROX_TOPK_BUCKETS_B8_D3,
+          APPROX_TOPK_BUCKETS_B16_D2,
+          APPROX_TOPK_BUCKETS_B8_D2}) {
+        for (size_t k : {1, 10, 100, 1000, 12345}) {
+            size_t cap = ApproxTopN<C>::min_capacity(k, mode);
+            EXPECT_GE(cap, 2 * k);
+            EXPECT_LE(cap, 2 * k + 128);
+        }
+    }
+}
@@ -14,6 +14,7 @@
 
 #include <faiss/Index.h>
 #include <faiss/Index2Layer.h>
+#include <faiss/IndexAdditiveQuantizer.h>
 #include <faiss/IndexIVFPQ.h>
 #include <faiss/IndexPQ.h>
 #include <faiss/impl/io.h>
@@ -547,6 +548,23 @@ void verifyMinMaxIndex2LevelDecoder(
     }
 }
 
+// the centroids table of the decoders that use a single table
+const float* getFineCentroids(const faiss::Index* const index) {
+    const faiss::IndexPQ* const indexPQ =
+            dynamic_cast<const faiss::IndexPQ*>(index);
+    if (indexPQ != nullptr) {
+        return indexPQ->pq.centroids.data();
+    }
+
+    const faiss::IndexAdditiveQuantizer* const indexAQ =
+            dynamic_cast<const faiss::IndexAdditiveQuantizer*>(index);
+    if (indexAQ != nullptr) {
+        return indexAQ->aq->codebooks.data();
+    }
+
+    return nullptr;
+}
+
 template <typename T>
 void verifyIndexPQDecoder(
         const uint64_t n,
@@ -554,9 +572,8 @@ void verifyIndexPQDecoder(
         const std::shared_ptr<faiss::Index>& index,
         const std::vector<uint8_t>& encodedData) {
     //
-    const faiss::IndexPQ* const indexQ =
-            dynamic_cast<const faiss::IndexPQ*>(index.get());
-    const float* const pqFineCentroidsQ = indexQ->pq.centroids.data();
+    const float* const pqFineCentroidsQ = getFineCentroids(index.get());
+    ASSERT_NE(pqFineCentroidsQ, nullptr);
 
     //
     const size_t codeSize = index->sa_code_size();
@@ -743,9 +760,8 @@ void verifyMinMaxIndexPQDecoder(
     auto subIndex = indexMinMax->index;
 
     //
-    const faiss::IndexPQ* const indexQ =
-            dynamic_cast<const faiss::IndexPQ*>(subIndex);
-    const float* const pqFineCentroidsQ = indexQ->pq.centroids.data();
+    const float* const pqFineCentroidsQ = getFineCentroids(subIndex);
+    ASSERT_NE(pqFineCentroidsQ, nullptr);
 
     //
     const size_t codeSize = index->sa_code_size();
@@ -1304,3 +1320,45 @@ TEST(testCppcontribSaDecode, D256_Residual4x12_PQ16x12) {
 }
 
 #endif
+
+// additive quantizers decode with IndexPQDecoder-like kernels
+TEST(testCppcontribSaDecode, D128_RQ8x8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 8>;
+    testIndexPQDecoder<T>(NSAMPLES, 128, "RQ8x8");
+}
+
+TEST(testCppcontribSaDecode, D64_RQ4x8_Nqint8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<64, 4>;
+    testIndexPQDecoder<T>(NSAMPLES, 64, "RQ4x8_Nqint8");
+}
+
+TEST(testCppcontribSaDecode, D44_RQ4x8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<44, 4>;
+    testIndexPQDecoder<T>(NSAMPLES, 44, "RQ4x8");
+}
+
+TEST(testCppcontribSaDecode, D42_RQ4x8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<42, 4>;
+    testIndexPQDecoder<T>(NSAMPLES, 42, "RQ4x8");
+}
+
+TEST(testCppcontribSaDecode, D64_RQ3x10) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<64, 3, 10>;
+    testIndexPQDecoder<T>(NSAMPLES * 4, 64, "RQ3x10");
+}
+
+TEST(testCppcontribSaDecode, D64_LSQ4x8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<64, 4>;
+    testIndexPQDecoder<T>(NSAMPLES, 64, "LSQ4x8");
+}
+
+TEST(testCppcontribSaDecode, D128_PRQ2x4x8) {
+    using T = faiss::cppcontrib::IndexAdditiveDecoder<128, 8, 8, 2>;
+    testIndexPQDecoder<T>(NSAMPLES, 128, "PRQ2x4x8");
+}
+
+TEST(testCppcontribSaDecode, D64_MINMAX_RQ4x8) {
+    using SubT = faiss::cppcontrib::IndexAdditiveDecoder<64, 4>;
+    using T = faiss::cppcontrib::IndexMinMaxDecoder<SubT>;
+    testMinMaxIndexPQDecoder<T>(NSAMPLES, 64, "MinMax,RQ4x8");
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/impl/io.h>
+#include <faiss/index_io.h>
+#include <faiss/invlists/DirectMap.h>
+#include <faiss/utils/random.h>
+
+using faiss::idx_t;
+
+namespace {
+
+void check_same(
+        const faiss::CompactIdMap& map,
+        const std::unordered_map<idx_t, idx_t>& ref) {
+    ASSERT_EQ(map.size(), ref.size());
+    for (const auto& it : ref) {
+        idx_t lo;
+        ASSERT_TRUE(map.find(it.first, lo));
+        ASSERT_EQ(lo, it.second);
+    }
+    std::vector<std::pair<idx_t, idx_t>> pairs;
+    map.get_all(pairs);
+    ASSERT_EQ(pairs.size(), ref.size());
+    for (const auto& p : pairs) {
+        ASSERT_EQ(ref.at(p.first), p.second);
+    }
+}
+
+} // namespace
+
+TEST(DirectMap, compact_map) {
+    std::mt19937 rng(123);
+    faiss::CompactIdMap map;
+    std::unordered_map<idx_t, idx_t> ref;
+
+    // ids from a growing domain, to exercise the rebuilds
+    for (int i = 0; i < 20000; i++) {
+        idx_t max_id = i < 10000 ? 30000 : idx_t(1) << 40;
+        idx_t id = std::uniform_int_distribution<idx_t>(0, max_id)(rng);
+        idx_t lo =
+                faiss::lo_build(rng() % (i < 5000 ? 16 : 5000), rng() % 1000);
+        map.set(id, lo);
+        ref[id] = lo;
+        if (i % 3 == 0) {
+            // erase a present key and an absent one
+            idx_t id2 = std::uniform_int_distribution<idx_t>(0, max_id)(rng);
+            EXPECT_EQ(map.erase(id2), ref.erase(id2) == 1);
+            EXPECT_TRUE(map.erase(id));
+            ref.erase(id);
+        }
+    }
+    check_same(map, ref);
+
+    idx_t lo;
+    EXPECT_FALSE(map.find(-1, lo));
+    EXPECT_FALSE(map.find(idx_t(1) << 62, lo));
+
+    // dense ids use few bits per entry
+    faiss::CompactIdMap dense;
+    size_t n = 100000;
+    dense.reserve(n, 1024, 200);
+    for (size_t i = 0; i < n; i++) {
+        dense.set(i, faiss::lo_build(i % 1024, i / 1024));
+    }
+    EXPECT_LT(dense.memory_usage(), n * 6);
+    for (size_t i = 0; i < n; i += 7) {
+        ASSERT_TRUE(dense.find(i, lo));
+        EXPECT_EQ(lo, faiss::lo_build(i % 1024, i / 1024));
+    }
+}
+
+TEST(DirectMap, compact_hashtable_ivf) {
+    int d = 8, nlist = 16, nb = 3000;
+    faiss::IndexFlatL2 quantizer(d);
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    std::vector<float> xb(nb * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    index.train(nb, xb.data());
+
+    std::vector<idx_t> ids(nb);
+    for (int i = 0; i < nb; i++) {
+        ids[i] = 1000 + 7 * i;
+    }
+    index.add_with_ids(nb / 2, xb.data(), ids.data());
+    index.set_direct_map_type(faiss::DirectMap::CompactHashtable);
+    index.add_with_ids(
+            nb - nb / 2, xb.data() + nb / 2 * d, ids.data() + nb / 2);
+
+    std::vector<float> recons(d);
+    for (int i = 0; i < nb; i += 11) {
+        index.reconstruct(ids[i], recons.data());
+        EXPECT_EQ(0, memcmp(recons.data(), xb.data() + i * d, d * 4));
+    }
+
+    // remove every 3rd vector
+    std::vector<idx_t> toremove;
+    for (int i = 0; i < nb; i += 3) {
+        toremove.push_back(ids[i]);
+    }
+    faiss::IDSelectorArray sel(toremove.size(), toremove.data());
+    EXPECT_EQ(index.remove_ids(sel), toremove.size());
+    EXPECT_EQ(index.direct_map.compact_map.size(), index.ntotal);
+
+    // update a few vectors
+    std::vector<float> xu(4 * d);
+    faiss::float_rand(xu.data(), xu.size(), 456);
+    std::vector<idx_t> uids = {ids[1], ids[2], ids[4], ids[5]};
+    index.update_vectors(4, uids.data(), xu.data());
+
+    // check after serialization
+    faiss::VectorIOWriter writer;
+    faiss::write_index(&index, &writer);
+    faiss::VectorIOReader reader;
+    reader.data = writer.data;
+    std::unique_ptr<faiss::IndexIVF> index2(
+            dynamic_cast<faiss::IndexIVF*>(faiss::read_index(&reader)));
+    EXPECT_EQ(index2->direct_map.type, faiss::DirectMap::CompactHashtable);
+
+    for (const faiss::IndexIVF* idx : {(const faiss::IndexIVF*)&index,
+                                       (const faiss::IndexIVF*)index2.get()}) {
+        for (int i = 0; i < nb; i++) {
+            if (i % 3 == 0) {
+                EXPECT_THROW(
+                        idx->reconstruct(ids[i], recons.data()),
+                        faiss::FaissException);
+                continue;
+            }
+            idx->reconstruct(ids[i], recons.data());
+            const float* ref = xb.data() + i * d;
+            for (int j = 0; j < 4; j++) {
+                if (uids[j] == ids[i]) {
+                    ref = xu.data() + j * d;
+                }
+            }
+            EXPECT_EQ(0, memcmp(recons.data(), ref, d * 4));
+        }
+    }
+}
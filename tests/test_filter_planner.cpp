@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFilterPlanner.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIDMap.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/utils/random.h>
+
+using faiss::idx_t;
+
+namespace {
+
+struct PlannerTest {
+    int d = 16, nb = 10000, nq = 20, k = 10;
+    std::vector<float> xb, xq;
+    std::unique_ptr<faiss::IndexFilterPlanner> planner;
+
+    PlannerTest() {
+        xb.resize(nb * d);
+        faiss::float_rand(xb.data(), xb.size(), 123);
+        xq.resize(nq * d);
+        faiss::float_rand(xq.data(), xq.size(), 456);
+
+        faiss::IndexFlatL2* flat = new faiss::IndexFlatL2(d);
+        faiss::IndexIVFFlat* ivf =
+                new faiss::IndexIVFFlat(new faiss::IndexFlatL2(d), d, 64);
+        ivf->own_fields = true;
+        ivf->nprobe = 4;
+        faiss::IndexHNSWFlat* hnsw = new faiss::IndexHNSWFlat(d, 16);
+        planner.reset(new faiss::IndexFilterPlanner(flat, ivf, hnsw));
+        planner->own_fields = true;
+        planner->train(nb, xb.data());
+        planner->add(nb, xb.data());
+    }
+
+    void search(
+            const faiss::Index& index,
+            faiss::IDSelector* sel,
+            std::vector<float>& D,
+            std::vector<idx_t>& I) {
+        D.resize(nq * k);
+        I.resize(nq * k);
+        faiss::SearchParameters params;
+        params.sel = sel;
+        index.search(nq, xq.data(), k, D.data(), I.data(), &params);
+    }
+};
+
+} // namespace
+
+TEST(IndexFilterPlanner, selectivity) {
+    PlannerTest t;
+    EXPECT_EQ(t.planner->ntotal, t.nb);
+    EXPECT_EQ(t.planner->estimate_selectivity(nullptr), 1.0);
+
+    faiss::IDSelectorRange range(1000, 3000);
+    EXPECT_DOUBLE_EQ(t.planner->estimate_selectivity(&range), 0.2);
+
+    std::vector<idx_t> ids = {1, 5, 7, 20000};
+    faiss::IDSelectorBatch batch(ids.size(), ids.data());
+    EXPECT_DOUBLE_EQ(t.planner->estimate_selectivity(&batch), 3.0 / t.nb);
+
+    faiss::IDSelectorNot not_range(&range);
+    EXPECT_DOUBLE_EQ(t.planner->estimate_selectivity(&not_range), 0.8);
+
+    // no cardinality: sampled
+    faiss::IDSelectorAll all;
+    faiss::IDSelectorAnd sel_and(&range, &all);
+    EXPECT_NEAR(t.planner->estimate_selectivity(&sel_and), 0.2, 0.05);
+}
+
+TEST(IndexFilterPlanner, strategies) {
+    PlannerTest t;
+    t.planner->calibrate(t.nq, t.xq.data(), t.k);
+    EXPECT_GT(t.planner->flat_cost_per_code, 0);
+
+    // very selective filter: exact search on the selected vectors
+    std::vector<idx_t> ids;
+    for (idx_t i = 0; i < 30; i++) {
+        ids.push_back(i * 97);
+    }
+    faiss::IDSelectorBatch batch(ids.size(), ids.data());
+    EXPECT_EQ(
+            t.planner->plan(t.planner->estimate_selectivity(&batch), t.k),
+            faiss::IndexFilterPlanner::STRATEGY_FLAT_SUBSET);
+
+    std::vector<float> D, refD;
+    std::vector<idx_t> I, refI;
+    t.search(*t.planner, &batch, D, I);
+    EXPECT_EQ(t.planner->n_search_flat_subset, 1);
+    t.search(*t.planner->flat, &batch, refD, refI);
+    EXPECT_EQ(I, refI);
+
+    // without filter, the flat index is too slow
+    EXPECT_NE(
+            t.planner->plan(1.0, t.k),
+            faiss::IndexFilterPlanner::STRATEGY_FLAT_SUBSET);
+
+    // with the IVF strategy, nprobe is scaled by the selectivity
+    t.planner->hnsw_cost_per_ef = 1e10;
+    t.planner->flat_cost_per_code = 1e10;
+    faiss::IDSelectorRange range(0, t.nb / 4);
+    EXPECT_EQ(
+            t.planner->plan(0.25, t.k),
+            faiss::IndexFilterPlanner::STRATEGY_IVF);
+    t.search(*t.planner, &range, D, I);
+    EXPECT_EQ(t.planner->n_search_ivf, 1);
+    {
+        faiss::SearchParametersIVF params;
+        params.sel = &range;
+        params.nprobe = 16;
+        refD.resize(t.nq * t.k);
+        refI.resize(t.nq * t.k);
+        t.planner->ivf->search(
+                t.nq, t.xq.data(), t.k, refD.data(), refI.data(), &params);
+        EXPECT_EQ(I, refI);
+    }
+
+    // HNSW is used only above hnsw_min_selectivity
+    t.planner->hnsw_cost_per_ef = 0;
+    EXPECT_EQ(
+            t.planner->plan(0.25, t.k),
+            faiss::IndexFilterPlanner::STRATEGY_HNSW);
+    EXPECT_EQ(
+            t.planner->plan(0.001, t.k),
+            faiss::IndexFilterPlanner::STRATEGY_IVF);
+    t.search(*t.planner, &range, D, I);
+    EXPECT_EQ(t.planner->n_search_hnsw, 1);
+    for (idx_t i : I) {
+        EXPECT_TRUE(i >= 0 && i < t.nb / 4);
+    }
+}
+
+TEST(IndexFilterPlanner, id_map) {
+    PlannerTest t;
+    faiss::IndexFilterPlanner* planner = new faiss::IndexFilterPlanner(
+            new faiss::IndexFlatL2(t.d), nullptr, nullptr);
+    planner->own_fields = true;
+    faiss::IndexIDMap index(planner);
+    index.own_fields = true;
+    std::vector<idx_t> ids(t.nb);
+    for (idx_t i = 0; i < t.nb; i++) {
+        ids[i] = 1000000 + 7 * i;
+    }
+    index.add_with_ids(t.nb, t.xb.data(), ids.data());
+
+    // the selector is translated, so its selectivity is sampled
+    faiss::IDSelectorRange range(1000000, 1000000 + 7 * 100);
+    EXPECT_LT(planner->estimate_selectivity(&range), 0.005);
+
+    std::vector<float> D;
+    std::vector<idx_t> I;
+    t.search(index, &range, D, I);
+    EXPECT_EQ(planner->n_search_flat_subset, 1);
+    for (idx_t i : I) {
+        EXPECT_TRUE(i >= 1000000 && i < 1000000 + 7 * 100);
+    }
+}
@@ -624,3 +624,52 @@ TEST_F(HNSWTest, TEST_search_level_0) {
     EXPECT_GT(stats1.n1, stats2.n1);
     EXPECT_GT(stats1.n2, stats2.n2);
 }
+
+TEST(HNSW, Test_visited_hashset) {
+    faiss::VisitedTable vt(1 << 20, true);
+    EXPECT_TRUE(vt.visited.empty());
+    for (int rep = 0; rep < 3; rep++) {
+        for (int i = 0; i < 5000; i++) {
+            vt.set(i * 193 + rep);
+        }
+        for (int i = 0; i < 5000; i++) {
+            EXPECT_TRUE(vt.get(i * 193 + rep));
+            EXPECT_FALSE(vt.get(i * 193 + rep + 1));
+        }
+        EXPECT_EQ(vt.hashset_count, 5000);
+        vt.advance();
+        EXPECT_FALSE(vt.get(rep));
+    }
+    EXPECT_LE(vt.hashset.size(), 16384);
+
+    EXPECT_FALSE(faiss::VisitedTable::hashset_preferred(10000, 100));
+    EXPECT_TRUE(faiss::VisitedTable::hashset_preferred(1 << 30, 10000));
+}
+
+TEST_F(HNSWTest, TEST_search_visited_hashset) {
+    omp_set_num_threads(1);
+    std::vector<faiss::idx_t> I1(k * nq), I2(k * nq);
+    std::vector<float> D1(k * nq), D2(k * nq);
+
+    using RH = faiss::HeapBlockResultHandler<faiss::HNSW::C>;
+    RH bres1(nq, D1.data(), I1.data(), k);
+    RH::SingleResultHandler res1(bres1);
+    RH bres2(nq, D2.data(), I2.data(), k);
+    RH::SingleResultHandler res2(bres2);
+
+    faiss::VisitedTable vt1(index->ntotal);
+    faiss::VisitedTable vt2(index->ntotal, true);
+    for (int i = 0; i < nq; i++) {
+        dis->set_query(xq->data() + i * d);
+        res1.begin(i);
+        faiss::HNSWStats stats1 = index->hnsw.search(*dis, res1, vt1);
+        res1.end();
+        res2.begin(i);
+        faiss::HNSWStats stats2 = index->hnsw.search(*dis, res2, vt2);
+        res2.end();
+        EXPECT_EQ(stats1.ndis, stats2.ndis);
+        EXPECT_EQ(stats1.nhops, stats2.nhops);
+    }
+    EXPECT_EQ(I1, I2);
+    EXPECT_EQ(D1, D2);
+}
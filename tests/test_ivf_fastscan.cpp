@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <omp.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFPQFastScan.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/impl/pq4_fast_scan.h>
+#include <faiss/invlists/BlockInvertedLists.h>
+#include <faiss/utils/hamming.h>
+#include <faiss/utils/random.h>
+
+using faiss::idx_t;
+
+namespace {
+
+struct IVFFastScanTest {
+    int d = 32, nb = 3000, nq = 50, nlist = 16;
+    std::vector<float> xb, xq;
+    std::unique_ptr<faiss::IndexFlatL2> quantizer;
+    std::unique_ptr<faiss::IndexIVFPQFastScan> index;
+
+    explicit IVFFastScanTest(faiss::MetricType metric = faiss::METRIC_L2) {
+        xb.resize(nb * d);
+        faiss::float_rand(xb.data(), xb.size(), 123);
+        xq.resize(nq * d);
+        faiss::float_rand(xq.data(), xq.size(), 456);
+        quantizer.reset(new faiss::IndexFlatL2(d));
+        index.reset(new faiss::IndexIVFPQFastScan(
+                quantizer.get(), d, nlist, d / 2, 4, metric));
+        index->train(nb, xb.data());
+        index->add(nb, xb.data());
+    }
+
+    /// exact search among the reconstructed vectors
+    void reference_search(
+            int k,
+            std::vector<float>& D,
+            std::vector<idx_t>& I) const {
+        std::vector<float> recons(nb * d);
+        size_t coarse_size = index->coarse_code_size();
+        std::vector<uint8_t> code(coarse_size + index->code_size);
+        for (idx_t list_no = 0; list_no < nlist; list_no++) {
+            faiss::InvertedLists::ScopedCodes codes(index->invlists, list_no);
+            faiss::InvertedLists::ScopedIds ids(index->invlists, list_no);
+            for (size_t j = 0; j < index->invlists->list_size(list_no); j++) {
+                // unpack the code and decode it with the coarse centroid
+                std::fill(code.begin(), code.end(), 0);
+                index->encode_listno(list_no, code.data());
+                faiss::BitstringWriter bsw(
+                        code.data() + coarse_size, index->code_size);
+                for (size_t m = 0; m < index->M; m++) {
+                    bsw.write(
+                            faiss::pq4_get_packed_element(
+                                    codes.get(), index->bbs, index->M2, j, m),
+                            index->nbits);
+                }
+                index->sa_decode(1, code.data(), recons.data() + ids[j] * d);
+            }
+        }
+        faiss::IndexFlat flat(d, index->metric_type);
+        flat.add(nb, recons.data());
+        D.resize(nq * k);
+        I.resize(nq * k);
+        flat.search(nq, xq.data(), k, D.data(), I.data());
+    }
+};
+
+double recall(
+        const std::vector<idx_t>& I,
+        const std::vector<idx_t>& ref,
+        int nq,
+        int k) {
+    size_t n_ok = 0;
+    for (int i = 0; i < nq; i++) {
+        std::set<idx_t> ref_i(ref.begin() + i * k, ref.begin() + (i + 1) * k);
+        for (int j = 0; j < k; j++) {
+            n_ok += ref_i.count(I[i * k + j]);
+        }
+    }
+    return double(n_ok) / (nq * k);
+}
+
+} // namespace
+
+TEST(IVFFastScan, rerank_exhaustive) {
+    for (faiss::MetricType metric :
+         {faiss::METRIC_L2, faiss::METRIC_INNER_PRODUCT}) {
+        SCOPED_TRACE(metric);
+        IVFFastScanTest t(metric);
+        int k = 10;
+        std::vector<float> refD;
+        std::vector<idx_t> refI;
+        t.reference_search(k, refD, refI);
+
+        // all candidates are reranked: same results as the exact search
+        // among the reconstructed vectors
+        t.index->nprobe = t.nlist;
+        t.index->rerank_k_factor = t.nb / k;
+        for (int implem : {0, 10, 11, 12, 13, 14, 15, 110}) {
+            SCOPED_TRACE(implem);
+            t.index->implem = implem;
+            std::vector<float> D(t.nq * k);
+            std::vector<idx_t> I(t.nq * k);
+            t.index->search(t.nq, t.xq.data(), k, D.data(), I.data());
+            for (int i = 0; i < t.nq * k; i++) {
+                EXPECT_NEAR(D[i], refD[i], 1e-4 * std::abs(refD[i]) + 1e-4);
+            }
+            EXPECT_GE(recall(I, refI, t.nq, k), 0.99);
+        }
+    }
+}
+
+TEST(IVFFastScan, rerank_recall) {
+    IVFFastScanTest t;
+    int k = 10;
+    std::vector<float> refD;
+    std::vector<idx_t> refI;
+    t.reference_search(k, refD, refI);
+
+    // all lists are visited, the errors come from the quantized LUTs
+    t.index->nprobe = t.nlist;
+    std::vector<float> D(t.nq * k);
+    std::vector<idx_t> I(t.nq * k);
+    t.index->search(t.nq, t.xq.data(), k, D.data(), I.data());
+    double recall_scan = recall(I, refI, t.nq, k);
+
+    t.index->rerank_k_factor = 4;
+    t.index->search(t.nq, t.xq.data(), k, D.data(), I.data());
+    double recall_rerank = recall(I, refI, t.nq, k);
+    EXPECT_GT(recall_rerank, recall_scan);
+
+    // the radius applies to the reranked distances
+    float radius = refD[t.nq * k / 2];
+    faiss::SearchParametersIVF params;
+    params.nprobe = t.nlist;
+    params.use_radius = true;
+    params.radius = radius;
+    t.index->rerank_k_factor = 1000;
+    t.index->search(t.nq, t.xq.data(), k, D.data(), I.data(), &params);
+    for (int i = 0; i < t.nq * k; i++) {
+        bool within = refD[i] < radius - 1e-4;
+        bool outside = refD[i] > radius + 1e-4;
+        if (within) {
+            EXPECT_EQ(I[i], refI[i]);
+        } else if (outside) {
+            EXPECT_EQ(I[i], -1);
+        }
+    }
+}
+
+namespace {
+
+/// check that index and ref return the same results
+void expect_same_search(
+        const faiss::Index& index,
+        const faiss::Index& ref,
+        int nq,
+        const float* xq) {
+    int k = 10;
+    std::vector<float> D(nq * k), refD(nq * k);
+    std::vector<idx_t> I(nq * k), refI(nq * k);
+    index.search(nq, xq, k, D.data(), I.data());
+    ref.search(nq, xq, k, refD.data(), refI.data());
+    EXPECT_EQ(D, refD);
+    // the order of ties may differ
+    EXPECT_GE(recall(I, refI, nq, k), 0.98);
+}
+
+} // namespace
+
+TEST(IVFFastScan, remove_and_add) {
+    IVFFastScanTest t;
+    t.index->nprobe = 4;
+    auto* bil = dynamic_cast<faiss::BlockInvertedLists*>(t.index->invlists);
+    ASSERT_TRUE(bil);
+
+    // reference index with the same trained quantizers
+    std::unique_ptr<faiss::IndexIVFPQFastScan> ref(
+            dynamic_cast<faiss::IndexIVFPQFastScan*>(
+                    faiss::clone_index(t.index.get())));
+    ref->reset();
+
+    // remove 1 vector out of 5: the lists are not compacted
+    std::vector<idx_t> removed, kept;
+    for (idx_t i = 0; i < t.nb; i++) {
+        (i % 5 == 2 ? removed : kept).push_back(i);
+    }
+    faiss::IDSelectorBatch sel(removed.size(), removed.data());
+    EXPECT_EQ(t.index->remove_ids(sel), removed.size());
+    EXPECT_EQ(t.index->ntotal, kept.size());
+    EXPECT_EQ(t.index->remove_ids(sel), 0);
+
+    size_t n_slots = 0, n_removed = 0;
+    for (size_t list_no = 0; list_no < t.nlist; list_no++) {
+        n_slots += bil->list_size(list_no);
+        n_removed += bil->n_removed[list_no];
+    }
+    EXPECT_GT(n_removed, 0);
+    EXPECT_EQ(n_slots - n_removed, kept.size());
+
+    std::vector<float> xkept;
+    for (idx_t i : kept) {
+        xkept.insert(
+                xkept.end(),
+                t.xb.begin() + i * t.d,
+                t.xb.begin() + (i + 1) * t.d);
+    }
+    ref->add_with_ids(kept.size(), xkept.data(), kept.data());
+    for (int implem : {10, 12, 14}) {
+        SCOPED_TRACE(implem);
+        t.index->implem = ref->implem = implem;
+        expect_same_search(*t.index, *ref, t.nq, t.xq.data());
+    }
+
+    // the removed vectors are added back in the free slots
+    std::vector<float> xremoved;
+    for (idx_t i : removed) {
+        xremoved.insert(
+                xremoved.end(),
+                t.xb.begin() + i * t.d,
+                t.xb.begin() + (i + 1) * t.d);
+    }
+    t.index->add_with_ids(removed.size(), xremoved.data(), removed.data());
+    ref->add_with_ids(removed.size(), xremoved.data(), removed.data());
+    size_t n_slots2 = 0;
+    for (size_t list_no = 0; list_no < t.nlist; list_no++) {
+        n_slots2 += bil->list_size(list_no);
+        EXPECT_EQ(bil->n_removed[list_no], 0);
+    }
+    EXPECT_LE(n_slots2, n_slots + removed.size() - n_removed);
+    t.index->implem = ref->implem = 0;
+    expect_same_search(*t.index, *ref, t.nq, t.xq.data());
+
+    // removing half of the vectors compacts the lists
+    faiss::IDSelectorRange range(0, t.nb / 2);
+    EXPECT_EQ(t.index->remove_ids(range), t.nb / 2);
+    faiss::IDSelectorRange range_ref(0, t.nb / 2);
+    ref->remove_ids(range_ref);
+    for (size_t list_no = 0; list_no < t.nlist; list_no++) {
+        EXPECT_LE(
+                bil->n_removed[list_no],
+                bil->max_removed_ratio * bil->list_size(list_no));
+    }
+    expect_same_search(*t.index, *ref, t.nq, t.xq.data());
+
+    // new vectors are added in the compacted lists
+    t.index->add_with_ids(removed.size(), xremoved.data(), removed.data());
+    ref->add_with_ids(removed.size(), xremoved.data(), removed.data());
+    expect_same_search(*t.index, *ref, t.nq, t.xq.data());
+}
+
+TEST(IVFFastScan, single_query_parallel) {
+    IVFFastScanTest t;
+    int k = 10;
+    int nt = omp_get_max_threads();
+    omp_set_num_threads(4);
+    t.index->nprobe = 8;
+
+    // reference: single-threaded scan of each query
+    t.index->implem = 112;
+    std::vector<float> refD(t.nq * k);
+    std::vector<idx_t> refI(t.nq * k);
+    for (int i = 0; i < t.nq; i++) {
+        t.index->search(
+                1,
+                t.xq.data() + i * t.d,
+                k,
+                refD.data() + i * k,
+                refI.data() + i * k);
+    }
+
+    // with small min_codes_per_thread, the auto-selection splits the lists
+    // of each query over the threads
+    t.index->implem = 0;
+    for (size_t min_codes : {size_t(100), size_t(1000), size_t(1) << 20}) {
+        SCOPED_TRACE(min_codes);
+        t.index->min_codes_per_thread = min_codes;
+        faiss::IVFFastScan_stats.reset();
+        for (int kk : {k, 30}) {
+            std::vector<float> D(t.nq * kk);
+            std::vector<idx_t> I(t.nq * kk);
+            for (int i = 0; i < t.nq; i++) {
+                t.index->search(
+                        1,
+                        t.xq.data() + i * t.d,
+                        kk,
+                        D.data() + i * kk,
+                        I.data() + i * kk);
+            }
+            for (int i = 0; i < t.nq; i++) {
+                for (int j = 0; j < k; j++) {
+                    EXPECT_EQ(D[i * kk + j], refD[i * k + j]);
+                }
+            }
+        }
+        // about 1500 codes are scanned per query
+        const faiss::IVFFastScanStats& stats = faiss::IVFFastScan_stats;
+        if (min_codes == 100) {
+            EXPECT_EQ(stats.n_implem_14, uint64_t(2 * t.nq));
+            EXPECT_GT(stats.n_implem_14_threads, stats.n_implem_14);
+        } else if (min_codes > 1000) {
+            EXPECT_EQ(stats.n_implem_14, uint64_t(0));
+        }
+    }
+
+    // 0 would divide by 0 when selecting the number of threads
+    t.index->min_codes_per_thread = 0;
+    std::vector<float> D(k);
+    std::vector<idx_t> I(k);
+    EXPECT_THROW(
+            t.index->search(1, t.xq.data(), k, D.data(), I.data()),
+            faiss::FaissException);
+    omp_set_num_threads(nt);
+}
+
+TEST(IVFFastScan, fused_LUT_quantization) {
+    IVFFastScanTest t;
+    // the fused computation is used for residual L2 encoding only
+    t.index.reset(new faiss::IndexIVFPQFastScan(
+            t.quantizer.get(), t.d, t.nlist, t.d / 2, 4));
+    t.index->by_residual = true;
+    t.index->train(t.nb, t.xb.data());
+    t.index->add(t.nb, t.xb.data());
+    ASSERT_EQ(t.index->use_precomputed_table, 1);
+    for (int nprobe : {1, 5, 16}) {
+        for (int n : {1, t.nq}) {
+            std::vector<float> coarse_dis(n * nprobe);
+            std::vector<idx_t> coarse_ids(n * nprobe);
+            t.quantizer->search(
+                    n, t.xq.data(), nprobe, coarse_dis.data(), coarse_ids.data());
+            faiss::IndexIVFFastScan::CoarseQuantized cq = {
+                    size_t(nprobe), coarse_dis.data(), coarse_ids.data()};
+
+            faiss::AlignedTable<uint8_t> LUT, refLUT;
+            faiss::AlignedTable<uint16_t> biases, refBiases;
+            std::vector<float> normalizers(2 * n), refNormalizers(2 * n);
+            t.index->compute_LUT_uint8(
+                    n, t.xq.data(), cq, LUT, biases, normalizers.data());
+            // reference: float LUTs of all queries, then quantization
+            t.index->IndexIVFFastScan::compute_LUT_uint8(
+                    n,
+                    t.xq.data(),
+                    cq,
+                    refLUT,
+                    refBiases,
+                    refNormalizers.data());
+
+            ASSERT_EQ(LUT.size(), refLUT.size());
+            EXPECT_EQ(memcmp(LUT.get(), refLUT.get(), LUT.size()), 0);
+            ASSERT_EQ(biases.size(), refBiases.size());
+            EXPECT_EQ(
+                    memcmp(biases.get(), refBiases.get(), biases.nbytes()), 0);
+            EXPECT_EQ(normalizers, refNormalizers);
+        }
+    }
+
+    // nprobe from the search parameters
+    int k = 10;
+    std::vector<float> D(t.nq * k), refD(t.nq * k);
+    std::vector<idx_t> I(t.nq * k), refI(t.nq * k);
+    faiss::SearchParametersIVF params;
+    params.nprobe = 6;
+    t.index->nprobe = 1;
+    t.index->search(t.nq, t.xq.data(), k, D.data(), I.data(), &params);
+    t.index->nprobe = 6;
+    t.index->search(t.nq, t.xq.data(), k, refD.data(), refI.data());
+    EXPECT_EQ(D, refD);
+    EXPECT_EQ(I, refI);
+}
@@ -16,7 +16,9 @@
 
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
 #include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/distances.h>
 
 namespace {
 
@@ -238,3 +240,70 @@ TEST(IVF, list_context) {
                 << "should return the query vector";
     }
 }
+
+namespace {
+
+// search with the heap-based and the reservoir-based result collection and
+// check that they return the same results
+void test_reservoir_search(faiss::IndexIVF& index, bool compare_labels) {
+    constexpr int nb = 5000;
+    constexpr int nq = 20;
+    constexpr faiss::idx_t k = 300;
+    size_t d = index.d;
+
+    std::mt19937 rng(123);
+    std::uniform_real_distribution<float> distrib;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    for (auto& v : xb) {
+        v = distrib(rng);
+    }
+    for (auto& v : xq) {
+        v = distrib(rng);
+    }
+    index.train(nb, xb.data());
+    index.add(nb, xb.data());
+    index.nprobe = 4;
+
+    std::vector<float> D_heap(nq * k), D_res(nq * k);
+    std::vector<faiss::idx_t> I_heap(nq * k), I_res(nq * k);
+
+    int prev_min_k = faiss::distance_compute_min_k_reservoir;
+    faiss::distance_compute_min_k_reservoir = k + 1;
+    index.search(nq, xq.data(), k, D_heap.data(), I_heap.data());
+    faiss::distance_compute_min_k_reservoir = k;
+    index.search(nq, xq.data(), k, D_res.data(), I_res.data());
+    faiss::distance_compute_min_k_reservoir = prev_min_k;
+
+    for (size_t i = 0; i < nq * k; i++) {
+        EXPECT_EQ(I_heap[i] < 0, I_res[i] < 0);
+        if (I_heap[i] >= 0) {
+            EXPECT_FLOAT_EQ(D_heap[i], D_res[i]);
+        }
+        if (compare_labels) {
+            EXPECT_EQ(I_heap[i], I_res[i]);
+        }
+    }
+}
+
+} // namespace
+
+TEST(IVF, reservoir_search_flat) {
+    constexpr int d = 16;
+    faiss::IndexFlatL2 quantizer(d);
+    faiss::IndexIVFFlat index(&quantizer, d, 16);
+    test_reservoir_search(index, true);
+}
+
+TEST(IVF, reservoir_search_flat_IP) {
+    constexpr int d = 16;
+    faiss::IndexFlatIP quantizer(d);
+    faiss::IndexIVFFlat index(&quantizer, d, 16, faiss::METRIC_INNER_PRODUCT);
+    test_reservoir_search(index, true);
+}
+
+TEST(IVF, reservoir_search_pq) {
+    constexpr int d = 16;
+    faiss::IndexFlatL2 quantizer(d);
+    faiss::IndexIVFPQ index(&quantizer, d, 16, 4, 6);
+    test_reservoir_search(index, false);
+}
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/invlists/LoggingInvertedLists.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+struct Tempfilename {
+    std::string filename = "/tmp/faiss_tmp_XXXXXX";
+
+    Tempfilename() {
+        int fd = mkstemp(&filename[0]);
+        close(fd);
+        unlink(filename.c_str());
+    }
+
+    ~Tempfilename() {
+        unlink(filename.c_str());
+    }
+
+    const char* c_str() {
+        return filename.c_str();
+    }
+};
+
+std::string read_file(const char* fname) {
+    std::string s;
+    FILE* f = fopen(fname, "r");
+    if (f) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            s.append(buf, n);
+        }
+        fclose(f);
+    }
+    return s;
+}
+
+void write_file(const char* fname, const std::string& s, const char* mode) {
+    FILE* f = fopen(fname, mode);
+    ASSERT_TRUE(f);
+    fwrite(s.data(), 1, s.size(), f);
+    fclose(f);
+}
+
+struct LogTest {
+    int d = 16, nlist = 20, nb = 2000, nq = 100, k = 10;
+    faiss::IndexFlatL2 quantizer;
+    std::vector<float> xb, xq;
+
+    LogTest() : quantizer(d) {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), x.size(), 123);
+        quantizer.add(nlist, x.data());
+        xb.resize(d * nb);
+        faiss::float_rand(xb.data(), xb.size(), 456);
+        xq.resize(d * nq);
+        faiss::float_rand(xq.data(), xq.size(), 789);
+    }
+
+    // the index contains vectors [0, n) minus the ones with id % 7 == 0
+    // if removed
+    void ref_search(
+            int n,
+            bool removed,
+            std::vector<float>& D,
+            std::vector<faiss::idx_t>& I) {
+        faiss::IndexIVFFlat index(&quantizer, d, nlist);
+        index.add(n, xb.data());
+        if (removed) {
+            remove_7(index);
+        }
+        search(index, D, I);
+    }
+
+    static void remove_7(faiss::IndexIVF& index) {
+        std::vector<faiss::idx_t> ids;
+        for (faiss::idx_t i = 0; i < index.ntotal; i += 7) {
+            ids.push_back(i);
+        }
+        faiss::IDSelectorBatch sel(ids.size(), ids.data());
+        index.remove_ids(sel);
+    }
+
+    void search(
+            faiss::Index& index,
+            std::vector<float>& D,
+            std::vector<faiss::idx_t>& I) {
+        D.resize(nq * k);
+        I.resize(nq * k);
+        index.search(nq, xq.data(), k, D.data(), I.data());
+    }
+
+    void check(faiss::IndexIVF& index, int n, bool removed) {
+        std::vector<float> refD, D;
+        std::vector<faiss::idx_t> refI, I;
+        ref_search(n, removed, refD, refI);
+        search(index, D, I);
+        EXPECT_EQ(refI, I);
+        EXPECT_EQ(refD, D);
+        faiss::IndexIVFFlat ref(&quantizer, d, nlist);
+        ref.add(n, xb.data());
+        if (removed) {
+            remove_7(ref);
+        }
+        EXPECT_EQ(ref.ntotal, index.ntotal);
+    }
+};
+
+} // namespace
+
+TEST(IVFLog, replay) {
+    LogTest t;
+    Tempfilename ckpt, log;
+
+    {
+        faiss::IndexIVFFlat index(&t.quantizer, t.d, t.nlist);
+        faiss::LoggingInvertedLists* lil =
+                faiss::attach_ivf_log(&index, log.c_str());
+        index.add(500, t.xb.data());
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        index.add(1000, t.xb.data() + 500 * t.d);
+        LogTest::remove_7(index);
+        lil->flush();
+        t.check(index, 1500, true);
+        // "crash": the index is not checkpointed again
+    }
+
+    {
+        std::unique_ptr<faiss::IndexIVF> index(
+                faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+        t.check(*index, 1500, true);
+
+        // continue ingesting on top of the replayed state
+        index->add(500, t.xb.data() + 1500 * t.d);
+        dynamic_cast<faiss::LoggingInvertedLists*>(index->invlists)->flush();
+    }
+
+    {
+        std::unique_ptr<faiss::IndexIVF> index(
+                faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+        EXPECT_EQ(index->ntotal, 2000 - (1500 + 6) / 7);
+    }
+}
+
+TEST(IVFLog, torn_record) {
+    LogTest t;
+    Tempfilename ckpt, log;
+
+    {
+        faiss::IndexIVFFlat index(&t.quantizer, t.d, t.nlist);
+        faiss::LoggingInvertedLists* lil =
+                faiss::attach_ivf_log(&index, log.c_str());
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        index.add(1000, t.xb.data());
+        lil->flush();
+    }
+    std::string complete = read_file(log.c_str());
+
+    // simulate a record cut in the middle by a crash
+    write_file(log.c_str(), std::string(30, '\x01'), "a");
+
+    {
+        std::unique_ptr<faiss::IndexIVF> index(
+                faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+        t.check(*index, 1000, false);
+    }
+    // the torn record was removed
+    EXPECT_EQ(complete, read_file(log.c_str()));
+}
+
+TEST(IVFLog, crash_during_checkpoint) {
+    LogTest t;
+    Tempfilename ckpt, log;
+
+    {
+        faiss::IndexIVFFlat index(&t.quantizer, t.d, t.nlist);
+        faiss::LoggingInvertedLists* lil =
+                faiss::attach_ivf_log(&index, log.c_str());
+        index.add(1000, t.xb.data());
+        lil->flush();
+        std::string before = read_file(log.c_str());
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        // the checkpoint was renamed but the log was not truncated
+        write_file(log.c_str(), before, "w");
+    }
+
+    std::unique_ptr<faiss::IndexIVF> index(
+            faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+    // the mutations already in the checkpoint are not applied twice
+    t.check(*index, 1000, false);
+}
+
+TEST(IVFLog, crash_before_checkpoint_rename) {
+    LogTest t;
+    Tempfilename ckpt, log;
+    std::string prev_fname = std::string(log.c_str()) + ".prev";
+
+    {
+        faiss::IndexIVFFlat index(&t.quantizer, t.d, t.nlist);
+        faiss::LoggingInvertedLists* lil =
+                faiss::attach_ivf_log(&index, log.c_str());
+        index.add(500, t.xb.data());
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        std::string ckpt_before = read_file(ckpt.c_str());
+        index.add(500, t.xb.data() + 500 * t.d);
+        lil->flush();
+        std::string log_before = read_file(log.c_str());
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        EXPECT_NE(0, access(prev_fname.c_str(), F_OK));
+        index.add(500, t.xb.data() + 1000 * t.d);
+        LogTest::remove_7(index);
+        lil->flush();
+        // the log was rotated but the new checkpoint was not renamed
+        write_file(ckpt.c_str(), ckpt_before, "w");
+        write_file(prev_fname.c_str(), log_before, "w");
+    }
+
+    std::unique_ptr<faiss::IndexIVF> index(
+            faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+    t.check(*index, 1500, true);
+
+    // the next checkpoint makes the rotated log obsolete
+    faiss::write_index_ivf_checkpoint(index.get(), ckpt.c_str());
+    EXPECT_NE(0, access(prev_fname.c_str(), F_OK));
+    index.reset(faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+    t.check(*index, 1500, true);
+    unlink(prev_fname.c_str());
+}
+
+TEST(IVFLog, checkpoint_concurrent_add) {
+    LogTest t;
+    Tempfilename ckpt, log;
+
+    {
+        faiss::IndexIVFFlat index(&t.quantizer, t.d, t.nlist);
+        index.set_direct_map_type(faiss::DirectMap::Hashtable);
+        faiss::LoggingInvertedLists* lil =
+                faiss::attach_ivf_log(&index, log.c_str());
+        std::thread adder([&] {
+            for (int i0 = 0; i0 < t.nb; i0 += 100) {
+                std::lock_guard<std::mutex> guard(lil->index_mutex);
+                index.add(100, t.xb.data() + i0 * t.d);
+            }
+        });
+        for (int i = 0; i < 10; i++) {
+            faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        }
+        adder.join();
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+        EXPECT_EQ(index.ntotal, t.nb);
+
+        // the lists of an add whose ntotal and direct map are not
+        // updated yet, as seen by a checkpoint that does not hold
+        // index_mutex
+        std::vector<faiss::idx_t> ids = {t.nb, t.nb + 1};
+        index.invlists->add_entries(
+                0,
+                2,
+                ids.data(),
+                reinterpret_cast<const uint8_t*>(t.xq.data()));
+        faiss::write_index_ivf_checkpoint(&index, ckpt.c_str());
+    }
+
+    // the log is empty
+    std::unique_ptr<faiss::IndexIVF> index(
+            faiss::read_index_ivf_with_log(ckpt.c_str(), log.c_str()));
+    EXPECT_EQ(index->ntotal, t.nb + 2);
+    std::vector<float> recons(t.d);
+    for (faiss::idx_t id : {faiss::idx_t(0), faiss::idx_t(t.nb - 1)}) {
+        index->reconstruct(id, recons.data());
+        EXPECT_EQ(
+                std::vector<float>(
+                        t.xb.data() + id * t.d, t.xb.data() + (id + 1) * t.d),
+                recons);
+    }
+    index->reconstruct(t.nb + 1, recons.data());
+    EXPECT_EQ(
+            std::vector<float>(t.xq.data() + t.d, t.xq.data() + 2 * t.d),
+            recons);
+}
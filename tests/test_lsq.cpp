@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <omp.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/impl/LocalSearchQuantizer.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+float encode_error(
+        const LocalSearchQuantizer& lsq,
+        size_t n,
+        const float* x,
+        std::vector<uint8_t>& codes) {
+    codes.resize(n * lsq.code_size);
+    lsq.compute_codes(x, codes.data(), n);
+    std::vector<float> recons(n * lsq.d);
+    lsq.decode(codes.data(), recons.data(), n);
+    return fvec_L2sqr(x, recons.data(), n * lsq.d) / n;
+}
+
+} // namespace
+
+TEST(LSQ, icm_encoder_blocked) {
+    size_t d = 16, n = 3000;
+    std::vector<float> x(n * d);
+    float_randn(x.data(), x.size(), 123);
+
+    LocalSearchQuantizer lsq(d, 4, 5);
+    lsq.train_iters = 4;
+    lsq.train(n, x.data());
+
+    std::vector<uint8_t> codes_ref, codes1, codes2;
+    float err_ref = encode_error(lsq, n, x.data(), codes_ref);
+
+    auto factory = new lsq::IcmEncoderBlockedFactory();
+    factory->block_size = 64;
+    lsq.icm_encoder_factory = factory;
+
+    float err = encode_error(lsq, n, x.data(), codes1);
+    EXPECT_LT(err, err_ref * 1.02);
+
+    // the result does not depend on the number of threads
+    int nt = omp_get_max_threads();
+    omp_set_num_threads(1);
+    encode_error(lsq, n, x.data(), codes2);
+    omp_set_num_threads(nt);
+    EXPECT_EQ(codes1, codes2);
+}
@@ -7,6 +7,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <random>
 
 #include <unistd.h>
@@ -156,6 +157,83 @@ TEST(ONDISK, test_add) {
     }
 }
 
+TEST(ONDISK, builder) {
+    int d = 8;
+    int nlist = 30, nq = 200, nb = 1500, k = 10;
+    faiss::IndexFlatL2 quantizer(d);
+    {
+        std::vector<float> x(d * nlist);
+        faiss::float_rand(x.data(), d * nlist, 12345);
+        quantizer.add(nlist, x.data());
+    }
+    std::vector<float> xb(d * nb);
+    faiss::float_rand(xb.data(), d * nb, 23456);
+
+    faiss::IndexIVFFlat index(&quantizer, d, nlist);
+    index.add(nb, xb.data());
+
+    std::vector<float> xq(d * nq);
+    faiss::float_rand(xq.data(), d * nq, 34567);
+
+    std::vector<float> ref_D(nq * k);
+    std::vector<faiss::idx_t> ref_I(nq * k);
+    index.search(nq, xq.data(), k, ref_D.data(), ref_I.data());
+
+    Tempfilename runs, filename, fvecs;
+
+    auto check = [&](faiss::OnDiskInvertedLists* il, size_t ntotal) {
+        faiss::IndexIVFFlat index2(&quantizer, d, nlist);
+        index2.replace_invlists(il, true);
+        index2.ntotal = ntotal;
+        EXPECT_EQ(index2.ntotal, nb);
+        for (int j = 0; j < nlist; j++) {
+            size_t size = index.invlists->list_size(j);
+            ASSERT_EQ(size, il->list_size(j));
+            EXPECT_EQ(
+                    memcmp(index.invlists->get_ids(j),
+                           il->get_ids(j),
+                           size * sizeof(faiss::idx_t)),
+                    0);
+            EXPECT_EQ(
+                    memcmp(index.invlists->get_codes(j),
+                           il->get_codes(j),
+                           size * index.code_size),
+                    0);
+        }
+        std::vector<float> new_D(nq * k);
+        std::vector<faiss::idx_t> new_I(nq * k);
+        index2.search(nq, xq.data(), k, new_D.data(), new_I.data());
+        EXPECT_EQ(ref_D, new_D);
+        EXPECT_EQ(ref_I, new_I);
+    };
+
+    // several add calls that spill several runs
+    {
+        faiss::OnDiskInvertedListsBuilder builder(&index, runs.c_str(), 200);
+        builder.add(700, xb.data());
+        builder.add(nb - 700, xb.data() + 700 * d);
+        EXPECT_GT(builder.run_files.size(), 1);
+        check(builder.finish(filename.c_str()), builder.ntotal);
+        EXPECT_EQ(builder.run_files.size(), 0);
+    }
+
+    // from a .fvecs file, read by batches
+    {
+        FILE* f = fopen(fvecs.c_str(), "w");
+        ASSERT_TRUE(f);
+        for (int i = 0; i < nb; i++) {
+            fwrite(&d, sizeof(d), 1, f);
+            fwrite(xb.data() + i * d, sizeof(float), d, f);
+        }
+        fclose(f);
+
+        faiss::OnDiskInvertedListsBuilder builder(&index, runs.c_str(), 500);
+        builder.batch_size = 300;
+        EXPECT_EQ(builder.add_fvecs(fvecs.c_str()), nb);
+        check(builder.finish(filename.c_str()), builder.ntotal);
+    }
+}
+
 // WARN this thest will run multithreaded only in opt mode
 TEST(ONDISK, make_invlists_threaded) {
     int nlist = 100;
@@ -14,6 +14,8 @@
 #include <faiss/IndexPQFastScan.h>
 #include <faiss/impl/ProductQuantizer.h>
 #include <faiss/impl/pq4_fast_scan.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
 
 namespace {
 
@@ -143,3 +145,41 @@ TEST(PQFastScan, set_packed_element) {
         }
     }
 }
+
+namespace {
+
+float pq_train_and_encode(faiss::ProductQuantizer& pq, const float* x, size_t n) {
+    pq.train(n, x);
+    std::vector<uint8_t> codes(n * pq.code_size);
+    pq.compute_codes(x, codes.data(), n);
+    std::vector<float> recons(n * pq.d);
+    pq.decode(codes.data(), recons.data(), n);
+    return faiss::fvec_L2sqr(x, recons.data(), n * pq.d) / n;
+}
+
+} // namespace
+
+TEST(PQTrain, concurrent) {
+    size_t d = 32, n = 20000;
+    std::vector<float> x(n * d);
+    faiss::float_randn(x.data(), x.size(), 123);
+
+    faiss::ProductQuantizer pq_ref(d, 8, 6);
+    float err_ref = pq_train_and_encode(pq_ref, x.data(), n);
+
+    for (auto train_type :
+         {faiss::ProductQuantizer::Train_default,
+          faiss::ProductQuantizer::Train_kmeanspp}) {
+        faiss::ProductQuantizer pq(d, 8, 6);
+        pq.concurrent_train = true;
+        pq.train_type = train_type;
+        float err = pq_train_and_encode(pq, x.data(), n);
+        EXPECT_LT(err, err_ref * 1.02);
+    }
+
+    // k-means++ initialization of the sequential training
+    faiss::ProductQuantizer pq(d, 8, 6);
+    pq.train_type = faiss::ProductQuantizer::Train_kmeanspp;
+    float err = pq_train_and_encode(pq, x.data(), n);
+    EXPECT_LT(err, err_ref * 1.02);
+}
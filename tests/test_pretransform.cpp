@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexPreTransform.h>
+#include <faiss/VectorTransform.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/ProductQuantizer.h>
+#include <faiss/utils/distances.h>
+#include <faiss/utils/random.h>
+
+using namespace faiss;
+
+namespace {
+
+// apply the transforms of the chain one by one
+std::vector<float> apply_reference(
+        const IndexPreTransform& index,
+        idx_t n,
+        const float* x) {
+    std::vector<float> v(x, x + n * index.d);
+    for (const VectorTransform* vt : index.chain) {
+        std::vector<float> v2(n * vt->d_out);
+        vt->apply_noalloc(n, v.data(), v2.data());
+        v.swap(v2);
+    }
+    return v;
+}
+
+void test_fused_chain(IndexPreTransform& index, size_t expected_nsteps) {
+    int d = index.d;
+    size_t nt = 2000;
+    std::vector<float> xt(nt * d);
+    float_rand(xt.data(), xt.size(), 1234);
+    index.train(nt, xt.data());
+    index.add(nt, xt.data());
+
+    EXPECT_EQ(index.fused_chain.size(), expected_nsteps);
+    EXPECT_EQ(index.fused_chain_size, index.chain.size());
+
+    // cover both the matrix-vector and the sgemm code paths
+    for (idx_t n : {1, 5, 100}) {
+        std::vector<float> x(n * d);
+        float_rand(x.data(), x.size(), 567 + n);
+        std::vector<float> ref = apply_reference(index, n, x.data());
+        std::vector<float> new_x(ref.size());
+        index.apply_chain_noalloc(n, x.data(), new_x.data());
+        for (size_t i = 0; i < ref.size(); i++) {
+            EXPECT_NEAR(new_x[i], ref[i], 1e-4);
+        }
+
+        int k = 5;
+        std::vector<float> D(n * k), D_ref(n * k);
+        std::vector<idx_t> I(n * k), I_ref(n * k);
+        index.search(n, x.data(), k, D.data(), I.data());
+        index.index->search(n, ref.data(), k, D_ref.data(), I_ref.data());
+        for (size_t i = 0; i < D.size(); i++) {
+            EXPECT_NEAR(D[i], D_ref[i], 1e-3);
+        }
+    }
+
+    std::unique_ptr<IndexPreTransform> clone(
+            dynamic_cast<IndexPreTransform*>(clone_index(&index)));
+    EXPECT_EQ(clone->fused_chain.size(), expected_nsteps);
+}
+
+} // namespace
+
+TEST(IndexPreTransform, fuse_linear) {
+    int d = 32;
+    IndexFlatL2 sub_index(16);
+    IndexPreTransform index(&sub_index);
+    RandomRotationMatrix rr(16, 16);
+    PCAMatrix pca(d, 16);
+    CenteringTransform ct(d);
+    index.prepend_transform(&rr);
+    index.prepend_transform(&pca);
+    index.prepend_transform(&ct);
+    test_fused_chain(index, 1);
+}
+
+TEST(IndexPreTransform, fuse_normalization) {
+    int d = 32;
+    IndexFlatIP sub_index(24);
+    IndexPreTransform index(&sub_index);
+    NormalizationTransform norm(24);
+    PCAMatrix pca(d, 24);
+    index.prepend_transform(&norm);
+    index.prepend_transform(&pca);
+    test_fused_chain(index, 1);
+}
+
+TEST(IndexPreTransform, no_fusion) {
+    int d = 32;
+    IndexFlatL2 sub_index(8);
+    IndexPreTransform index(&sub_index);
+    // the 32 -> 8 -> 32 -> 8 product is cheaper to apply in two steps
+    RemapDimensionsTransform remap(32, 8, true);
+    RandomRotationMatrix rr(8, 32);
+    PCAMatrix pca(d, 8);
+    index.prepend_transform(&remap);
+    index.prepend_transform(&rr);
+    index.prepend_transform(&pca);
+    test_fused_chain(index, 3);
+}
+
+namespace {
+
+// PQ reconstruction error after the OPQ rotation
+float opq_pq_error(const OPQMatrix& opq, size_t n, const float* x) {
+    std::vector<float> xt(n * opq.d_out);
+    opq.apply_noalloc(n, x, xt.data());
+    ProductQuantizer pq(opq.d_out, opq.M, 8);
+    pq.train(n, xt.data());
+    std::vector<uint8_t> codes(n * pq.code_size);
+    pq.compute_codes(xt.data(), codes.data(), n);
+    std::vector<float> recons(n * opq.d_out);
+    pq.decode(codes.data(), recons.data(), n);
+    return fvec_L2sqr(xt.data(), recons.data(), xt.size()) / n;
+}
+
+} // namespace
+
+TEST(OPQMatrix, sampling_schedule) {
+    int d = 32;
+    size_t n = 5000;
+    std::vector<float> x(n * d);
+    float_randn(x.data(), x.size(), 123);
+    // make the data anisotropic so that the rotation matters
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < d; j++) {
+            x[i * d + j] *= 1 + j % 8;
+        }
+    }
+
+    OPQMatrix opq_ref(d, 4);
+    opq_ref.niter = 8;
+    opq_ref.train(n, x.data());
+
+    OPQMatrix opq(d, 4);
+    opq.niter = 8;
+    opq.n_train_sample_0 = 500;
+    opq.train(n, x.data());
+
+    // the rotation is orthonormal
+    std::vector<float> x_rot(n * d), x_back(n * d);
+    opq.apply_noalloc(n, x.data(), x_rot.data());
+    opq.reverse_transform(n, x_rot.data(), x_back.data());
+    for (size_t i = 0; i < x.size(); i++) {
+        EXPECT_NEAR(x[i], x_back[i], 1e-3 * (1 + std::fabs(x[i])));
+    }
+
+    float err_ref = opq_pq_error(opq_ref, n, x.data());
+    float err = opq_pq_error(opq, n, x.data());
+    EXPECT_LT(err, err_ref * 1.05);
+}
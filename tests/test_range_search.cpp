@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQFastScan.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/utils/random.h>
+
+using faiss::idx_t;
+
+namespace {
+
+typedef std::vector<std::vector<std::pair<idx_t, float>>> PerQueryResults;
+
+/// sorted results of each query
+PerQueryResults sorted_results(const faiss::RangeSearchResult& res) {
+    PerQueryResults out(res.nq);
+    for (size_t i = 0; i < res.nq; i++) {
+        for (size_t j = res.lims[i]; j < res.lims[i + 1]; j++) {
+            out[i].push_back({res.labels[j], res.distances[j]});
+        }
+        std::sort(out[i].begin(), out[i].end());
+    }
+    return out;
+}
+
+struct CollectingCallback : faiss::RangeSearchResultCallback {
+    std::mutex mutex;
+    PerQueryResults results;
+    size_t n_calls = 0;
+
+    explicit CollectingCallback(size_t nq)
+            : faiss::RangeSearchResultCallback(nq), results(nq) {}
+
+    void consume(
+            idx_t qno,
+            size_t n,
+            const idx_t* labels,
+            const float* distances) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < n; i++) {
+            results[qno].push_back({labels[i], distances[i]});
+        }
+        n_calls++;
+    }
+
+    PerQueryResults sorted() {
+        PerQueryResults out = results;
+        for (auto& r : out) {
+            std::sort(r.begin(), r.end());
+        }
+        return out;
+    }
+};
+
+/// the results with distances close to the radius may depend on the
+/// distance computation, so they are ignored
+PerQueryResults remove_boundary(const PerQueryResults& a, float radius) {
+    PerQueryResults out(a.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        for (const auto& r : a[i]) {
+            if (std::abs(r.second - radius) > 1e-4) {
+                out[i].push_back(r);
+            }
+        }
+    }
+    return out;
+}
+
+void expect_same_results(
+        const PerQueryResults& a0,
+        const PerQueryResults& b0,
+        float radius) {
+    PerQueryResults a = remove_boundary(a0, radius);
+    PerQueryResults b = remove_boundary(b0, radius);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_EQ(a[i].size(), b[i].size()) << "query " << i;
+        for (size_t j = 0; j < a[i].size(); j++) {
+            EXPECT_EQ(a[i][j].first, b[i][j].first);
+            EXPECT_NEAR(a[i][j].second, b[i][j].second, 1e-4);
+        }
+    }
+}
+
+struct RangeSearchTest {
+    int d = 16, nb = 5000, nq = 100;
+    float radius = 1.2;
+    std::vector<float> xb, xq;
+    faiss::IndexFlatL2 ref_index;
+    PerQueryResults ref;
+    size_t ref_total;
+
+    RangeSearchTest() : ref_index(d) {
+        xb.resize(nb * d);
+        faiss::float_rand(xb.data(), xb.size(), 123);
+        xq.resize(nq * d);
+        faiss::float_rand(xq.data(), xq.size(), 456);
+        ref_index.add(nb, xb.data());
+
+        // reference computed one query at a time
+        ref.resize(nq);
+        ref_total = 0;
+        for (int i = 0; i < nq; i++) {
+            faiss::RangeSearchResult res(1);
+            ref_index.range_search(1, xq.data() + i * d, radius, &res);
+            ref[i] = sorted_results(res)[0];
+            ref_total += ref[i].size();
+        }
+    }
+};
+
+} // namespace
+
+TEST(RangeSearch, flat_merge) {
+    RangeSearchTest t;
+    EXPECT_GT(t.ref_total, 1000);
+    // more than 20 queries: the database is processed by blocks, each in a
+    // separate partial result
+    for (size_t buffer_size : {size_t(1) << 18, size_t(17)}) {
+        faiss::RangeSearchResult res(t.nq);
+        res.buffer_size = buffer_size;
+        t.ref_index.range_search(t.nq, t.xq.data(), t.radius, &res);
+        expect_same_results(t.ref, sorted_results(res), t.radius);
+    }
+}
+
+TEST(RangeSearch, ivf_parallel_modes) {
+    RangeSearchTest t;
+    faiss::IndexFlatL2 quantizer(t.d);
+    faiss::IndexIVFFlat index(&quantizer, t.d, 20);
+    index.train(t.nb, t.xb.data());
+    index.add(t.nb, t.xb.data());
+    index.nprobe = 20; // exhaustive
+
+    for (int pmode : {0, 1, 2}) {
+        SCOPED_TRACE(pmode);
+        index.parallel_mode = pmode;
+        faiss::RangeSearchResult res(t.nq);
+        res.buffer_size = 31;
+        index.range_search(t.nq, t.xq.data(), t.radius, &res);
+        expect_same_results(t.ref, sorted_results(res), t.radius);
+    }
+}
+
+TEST(RangeSearch, stream_results) {
+    RangeSearchTest t;
+    faiss::IndexFlatL2 quantizer(t.d);
+    faiss::IndexIVFFlat index(&quantizer, t.d, 20);
+    index.train(t.nb, t.xb.data());
+    index.add(t.nb, t.xb.data());
+    index.nprobe = 20;
+
+    // a small buffer size so that the results are flushed many times
+    size_t buffer_size = 13;
+    {
+        // few queries: 1 partial result per thread
+        int nq = 10;
+        CollectingCallback cb(nq);
+        cb.buffer_size = buffer_size;
+        t.ref_index.range_search(nq, t.xq.data(), t.radius, &cb);
+        PerQueryResults ref(t.ref.begin(), t.ref.begin() + nq);
+        expect_same_results(ref, cb.sorted(), t.radius);
+        EXPECT_EQ(cb.lims[nq], 0);
+        EXPECT_EQ(cb.labels, nullptr);
+    }
+    {
+        // partial results per database block
+        CollectingCallback cb(t.nq);
+        cb.buffer_size = buffer_size;
+        t.ref_index.range_search(t.nq, t.xq.data(), t.radius, &cb);
+        expect_same_results(t.ref, cb.sorted(), t.radius);
+        EXPECT_GE(cb.n_calls, t.ref_total / buffer_size);
+    }
+    for (int pmode : {0, 1, 2}) {
+        SCOPED_TRACE(pmode);
+        index.parallel_mode = pmode;
+        CollectingCallback cb(t.nq);
+        cb.buffer_size = buffer_size;
+        index.range_search(t.nq, t.xq.data(), t.radius, &cb);
+        expect_same_results(t.ref, cb.sorted(), t.radius);
+    }
+}
+
+namespace {
+
+/// search with and without radius. The results within the radius are a
+/// prefix of the top-k results, so both should match after cropping.
+void test_knn_within_radius(
+        const faiss::Index& index,
+        const float* xq,
+        int nq,
+        int k,
+        float radius,
+        faiss::SearchParameters& params,
+        bool exact_labels = true) {
+    std::vector<float> D(nq * k), Dr(nq * k);
+    std::vector<idx_t> I(nq * k), Ir(nq * k);
+    index.search(nq, xq, k, D.data(), I.data(), &params);
+    params.use_radius = true;
+    params.radius = radius;
+    index.search(nq, xq, k, Dr.data(), Ir.data(), &params);
+    params.use_radius = false;
+
+    bool is_similarity = faiss::is_similarity_metric(index.metric_type);
+    size_t nres = 0, nfull = 0;
+    for (int i = 0; i < nq * k; i++) {
+        bool within = I[i] >= 0 &&
+                (is_similarity ? D[i] > radius : D[i] < radius);
+        if (!within) {
+            EXPECT_EQ(Ir[i], -1) << "result " << i;
+            continue;
+        }
+        nres++;
+        if (i % k == k - 1) {
+            nfull++;
+        }
+        if (exact_labels) {
+            EXPECT_EQ(I[i], Ir[i]) << "result " << i;
+        } else {
+            EXPECT_GE(Ir[i], 0) << "result " << i;
+        }
+        EXPECT_NEAR(D[i], Dr[i], 1e-4) << "result " << i;
+    }
+    // the radius should be selective, but not too much
+    EXPECT_GT(nres, nq);
+    EXPECT_LT(nfull, nq);
+}
+
+} // namespace
+
+TEST(RangeSearch, knn_within_radius_flat) {
+    RangeSearchTest t;
+    faiss::SearchParameters params;
+    int k = 20;
+    // sequential (few queries) and BLAS code paths
+    for (int nq : {10, t.nq}) {
+        test_knn_within_radius(
+                t.ref_index, t.xq.data(), nq, k, t.radius, params);
+    }
+    faiss::IndexFlatIP index_ip(t.d);
+    index_ip.add(t.nb, t.xb.data());
+    for (int nq : {10, t.nq}) {
+        test_knn_within_radius(index_ip, t.xq.data(), nq, k, 6.5, params);
+    }
+    // search in a subset
+    std::vector<idx_t> subset;
+    for (idx_t i = 0; i < t.nb; i += 2) {
+        subset.push_back(i);
+    }
+    faiss::IDSelectorArray sel(subset.size(), subset.data());
+    params.sel = &sel;
+    test_knn_within_radius(t.ref_index, t.xq.data(), t.nq, 10, 1.0, params);
+}
+
+TEST(RangeSearch, knn_within_radius_ivf) {
+    RangeSearchTest t;
+    faiss::IndexFlatL2 quantizer(t.d);
+    faiss::IndexIVFFlat index(&quantizer, t.d, 20);
+    index.train(t.nb, t.xb.data());
+    index.add(t.nb, t.xb.data());
+    faiss::SearchParametersIVF params;
+    params.nprobe = 5;
+    for (int pmode : {0, 1, 2}) {
+        SCOPED_TRACE(pmode);
+        index.parallel_mode = pmode;
+        test_knn_within_radius(index, t.xq.data(), t.nq, 20, t.radius, params);
+    }
+}
+
+TEST(RangeSearch, knn_within_radius_hnsw) {
+    RangeSearchTest t;
+    faiss::IndexHNSWFlat index(t.d, 16);
+    index.add(t.nb, t.xb.data());
+    faiss::SearchParametersHNSW params;
+    params.efSearch = 32;
+    // the graph traversal does not depend on the radius
+    test_knn_within_radius(index, t.xq.data(), t.nq, 20, t.radius, params);
+}
+
+TEST(RangeSearch, knn_within_radius_fastscan) {
+    RangeSearchTest t;
+    faiss::IndexFlatL2 quantizer(t.d);
+    faiss::IndexIVFPQFastScan index(&quantizer, t.d, 20, 8, 4);
+    index.train(t.nb, t.xb.data());
+    index.add(t.nb, t.xb.data());
+    faiss::SearchParametersIVF params;
+    params.nprobe = 5;
+    for (int implem : {0, 11, 13, 14, 15}) {
+        SCOPED_TRACE(implem);
+        index.implem = implem;
+        // the quantized distances have ties, so the labels may differ
+        test_knn_within_radius(
+                index, t.xq.data(), t.nq, 20, t.radius, params, false);
+    }
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <faiss/Index.h>
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/ScratchArena.h>
+#include <faiss/index_factory.h>
+#include <faiss/utils/random.h>
+
+namespace {
+
+void test_codec(
+        const char* factory_string,
+        faiss::MetricType metric = faiss::METRIC_L2) {
+    SCOPED_TRACE(factory_string);
+    int d = 32, nt = 3000, n = 2000;
+    std::unique_ptr<faiss::Index> index(
+            faiss::index_factory(d, factory_string, metric));
+    std::vector<float> x(nt * d);
+    faiss::float_rand(x.data(), x.size(), 123);
+    index->train(nt, x.data());
+
+    size_t code_size = index->sa_code_size();
+    std::vector<uint8_t> ref_codes(n * code_size), codes(n * code_size);
+    index->sa_encode(n, x.data(), ref_codes.data());
+
+    faiss::ScratchArena arena;
+    size_t chunk_size = 256;
+    faiss::sa_encode_chunked(
+            index.get(), n, x.data(), codes.data(), arena, chunk_size);
+
+    // the coarse assignment may differ on ties
+    int ndiff = 0;
+    for (int i = 0; i < n; i++) {
+        if (memcmp(codes.data() + i * code_size,
+                   ref_codes.data() + i * code_size,
+                   code_size)) {
+            ndiff++;
+        }
+    }
+    EXPECT_LE(ndiff, n / 100);
+
+    std::vector<float> ref_decoded(n * d), decoded(n * d);
+    index->sa_decode(n, ref_codes.data(), ref_decoded.data());
+    faiss::sa_decode_chunked(
+            index.get(),
+            n,
+            ref_codes.data(),
+            decoded.data(),
+            arena,
+            chunk_size);
+    EXPECT_EQ(ref_decoded, decoded);
+
+    // the arena has grown to the size needed for a chunk
+    size_t n_heap_alloc = arena.n_heap_alloc;
+    faiss::sa_encode_chunked(
+            index.get(), n, x.data(), codes.data(), arena, chunk_size);
+    faiss::sa_decode_chunked(
+            index.get(),
+            n,
+            ref_codes.data(),
+            decoded.data(),
+            arena,
+            chunk_size);
+    EXPECT_EQ(n_heap_alloc, arena.n_heap_alloc);
+}
+
+} // namespace
+
+TEST(ScratchArena, scopes) {
+    faiss::ScratchArena arena(100);
+    {
+        faiss::ScratchArena::Scope scope(arena);
+        float* a = arena.alloc<float>(10);
+        EXPECT_EQ((uintptr_t)a % faiss::ScratchArena::alignment, 0);
+        {
+            faiss::ScratchArena::Scope scope2(arena);
+            float* b = arena.alloc<float>(1000); // overflows
+            EXPECT_EQ((uintptr_t)b % faiss::ScratchArena::alignment, 0);
+            b[999] = 1;
+        }
+        // released in stack order
+        EXPECT_EQ(a + 16, arena.alloc<float>(10));
+    }
+    // the block was grown to the peak usage
+    EXPECT_GE(arena.capacity(), 1000 * sizeof(float));
+    size_t n_heap_alloc = arena.n_heap_alloc;
+    {
+        faiss::ScratchArena::Scope scope(arena);
+        arena.alloc<float>(10);
+        arena.alloc<float>(1000);
+    }
+    EXPECT_EQ(n_heap_alloc, arena.n_heap_alloc);
+}
+
+TEST(ScratchArena, pretransform_ivfpq) {
+    test_codec("PCA16,IVF32,PQ8x4");
+}
+
+TEST(ScratchArena, ivfpq) {
+    test_codec("IVF32,PQ8x4");
+}
+
+TEST(ScratchArena, ivfpq_dsub16) {
+    // exercises the distance tables of compute_codes_arena
+    test_codec("IVF32,PQ2x6");
+}
+
+TEST(ScratchArena, pq) {
+    test_codec("PQ8x4");
+}
+
+TEST(ScratchArena, ivfsq) {
+    test_codec("IVF32,SQ8");
+}
+
+TEST(ScratchArena, ivf_inner_product) {
+    test_codec("IVF32,PQ8x4", faiss::METRIC_INNER_PRODUCT);
+}
+
+TEST(ScratchArena, ivfflat) {
+    test_codec("IVF32,Flat");
+}
+
+TEST(ScratchArena, thread_arena_search) {
+    int d = 16, nb = 2000, nq = 10, k = 5;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+    for (const char* key : {"IVF32,Flat", "IVF32,PQ4x4fs", "HNSW16"}) {
+        std::unique_ptr<faiss::Index> index(faiss::index_factory(d, key));
+        index->train(nb, xb.data());
+        index->add(nb, xb.data());
+        std::vector<float> D(nq * k), D2(nq * k);
+        std::vector<faiss::idx_t> I(nq * k), I2(nq * k);
+        index->search(nq, xq.data(), k, D.data(), I.data());
+
+        // the following searches do not enlarge the arena of this thread
+        faiss::ScratchArena& arena = faiss::get_thread_scratch_arena();
+        size_t n_heap_alloc = arena.n_heap_alloc;
+        for (int rep = 0; rep < 3; rep++) {
+            index->search(nq, xq.data(), k, D2.data(), I2.data());
+            EXPECT_EQ(I, I2);
+            EXPECT_EQ(D, D2);
+        }
+        EXPECT_EQ(n_heap_alloc, arena.n_heap_alloc) << key;
+    }
+}
+
+TEST(ScratchArena, scoped_visited_table) {
+    faiss::VisitedTable* table;
+    {
+        faiss::ScopedVisitedTable svt(100);
+        table = &svt.get();
+        table->set(3);
+        table->visited[4] = table->visno + 1;
+        EXPECT_TRUE(table->get(3));
+    }
+    {
+        // the table is reused, without the flags of the previous search
+        faiss::ScopedVisitedTable svt(200);
+        EXPECT_EQ(table, &svt.get());
+        EXPECT_GE(svt.get().visited.size(), 200);
+        for (int i = 0; i < 200; i++) {
+            EXPECT_FALSE(svt.get().get(i));
+            EXPECT_LT(svt.get().visited[i], svt.get().visno);
+        }
+        // nested uses get different tables
+        faiss::ScopedVisitedTable svt2(10);
+        EXPECT_NE(&svt.get(), &svt2.get());
+    }
+}
+
+TEST(ScratchArena, release_thread_buffers) {
+    int d = 16, nb = 2000, nq = 10, k = 5;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+    std::unique_ptr<faiss::Index> index(faiss::index_factory(d, "HNSW16"));
+    index->add(nb, xb.data());
+    std::vector<float> D(nq * k);
+    std::vector<faiss::idx_t> I(nq * k);
+    faiss::ScratchArena& arena = faiss::get_thread_scratch_arena();
+    {
+        faiss::ScratchArena::Scope scope(arena);
+        arena.alloc<float>(1000);
+    }
+    index->search(1, xq.data(), k, D.data(), I.data());
+    EXPECT_GT(arena.capacity(), 0);
+    EXPECT_GE(faiss::ScopedVisitedTable::pool_bytes(), size_t(nb));
+
+    faiss::release_thread_search_buffers();
+    EXPECT_EQ(arena.capacity(), 0);
+    EXPECT_EQ(faiss::ScopedVisitedTable::pool_bytes(), 0);
+
+    // the tables above the limit are not pooled
+    size_t max_pooled = faiss::visited_table_max_pooled_bytes;
+    faiss::visited_table_max_pooled_bytes = nb / 2;
+    index->search(1, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(faiss::ScopedVisitedTable::pool_bytes(), 0);
+    {
+        faiss::ScopedVisitedTable svt(nb / 4);
+    }
+    EXPECT_GE(faiss::ScopedVisitedTable::pool_bytes(), size_t(nb / 4));
+    faiss::visited_table_max_pooled_bytes = max_pooled;
+    faiss::ScopedVisitedTable::release_pool();
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIDMap.h>
+#include <faiss/SearchServer.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/random.h>
+
+using faiss::idx_t;
+
+namespace {
+
+struct ServerTest {
+    int d = 16, nb = 2000, nq = 40, k = 10;
+    std::vector<float> xb, xq;
+    faiss::IndexFlatL2 index;
+    std::vector<float> refD;
+    std::vector<idx_t> refI;
+
+    ServerTest() : index(d) {
+        xb.resize(nb * d);
+        faiss::float_rand(xb.data(), xb.size(), 123);
+        xq.resize(nq * d);
+        faiss::float_rand(xq.data(), xq.size(), 456);
+        index.add(nb, xb.data());
+        refD.resize(nq * k);
+        refI.resize(nq * k);
+        index.search(nq, xq.data(), k, refD.data(), refI.data());
+    }
+};
+
+} // namespace
+
+TEST(SearchServer, tcp_and_unix) {
+    ServerTest t;
+    faiss::SearchServer server(&t.index);
+    server.n_io_threads = 2;
+    int port = server.listen_tcp(0);
+    std::string path = "/tmp/faiss_server_" + std::to_string(getpid());
+    server.listen_unix(path.c_str());
+    server.start();
+
+    for (std::string endpoint :
+         {"127.0.0.1:" + std::to_string(port), "unix:" + path}) {
+        faiss::SearchClient client(endpoint);
+        EXPECT_EQ(client.d, t.d);
+        EXPECT_EQ(client.ntotal, t.nb);
+        EXPECT_EQ(client.metric_type, faiss::METRIC_L2);
+
+        std::vector<float> D(t.nq * t.k);
+        std::vector<idx_t> I(t.nq * t.k);
+        client.search(t.nq, t.xq.data(), t.k, D.data(), I.data());
+        EXPECT_EQ(t.refI, I);
+        EXPECT_EQ(t.refD, D);
+
+        // errors are reported to the client, the connection stays usable
+        EXPECT_THROW(
+                client.search(1, t.xq.data(), 0, D.data(), I.data()),
+                faiss::FaissException);
+        client.search(t.nq, t.xq.data(), t.k, D.data(), I.data());
+        EXPECT_EQ(t.refI, I);
+    }
+    server.stop();
+}
+
+TEST(SearchServer, batching) {
+    ServerTest t;
+    faiss::SearchServer server(&t.index);
+    server.n_io_threads = 2;
+    server.max_batch_size = 16;
+    server.max_delay_ms = 20;
+    int port = server.listen_tcp(0);
+    server.start();
+    std::string endpoint = "127.0.0.1:" + std::to_string(port);
+
+    // each thread sends single-query requests
+    int nt = 8;
+    std::vector<std::thread> threads;
+    std::vector<idx_t> I(t.nq * t.k);
+    std::vector<float> D(t.nq * t.k);
+    for (int rank = 0; rank < nt; rank++) {
+        threads.emplace_back([&, rank] {
+            faiss::SearchClient client(endpoint);
+            for (int q = rank; q < t.nq; q += nt) {
+                client.search(
+                        1,
+                        t.xq.data() + q * t.d,
+                        t.k,
+                        D.data() + q * t.k,
+                        I.data() + q * t.k);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    // the batches are not the same as in the reference search, so the
+    // distances may be computed differently
+    EXPECT_EQ(t.refI, I);
+    for (int i = 0; i < t.nq * t.k; i++) {
+        EXPECT_NEAR(t.refD[i], D[i], 1e-5);
+    }
+    EXPECT_EQ(server.n_requests, t.nq);
+    EXPECT_LT(server.n_batches, server.n_requests);
+}
+
+TEST(SearchServer, limits) {
+    ServerTest t;
+    faiss::SearchServer server(&t.index);
+    server.n_io_threads = 1;
+    server.max_request_results = 100;
+    int port = server.listen_tcp(0);
+    server.start();
+
+    faiss::SearchClient client("127.0.0.1:" + std::to_string(port));
+    std::vector<float> D(t.nq * t.k);
+    std::vector<idx_t> I(t.nq * t.k);
+    // rejected before allocating anything for the results
+    EXPECT_THROW(
+            client.search(1, t.xq.data(), idx_t(1) << 40, D.data(), I.data()),
+            faiss::FaissException);
+    EXPECT_THROW(
+            client.search(1, t.xq.data(), server.max_k + 1, D.data(), I.data()),
+            faiss::FaissException);
+    EXPECT_THROW(
+            client.search(t.nq, t.xq.data(), t.k, D.data(), I.data()),
+            faiss::FaissException);
+
+    // the server is still alive
+    faiss::SearchClient client2("127.0.0.1:" + std::to_string(port));
+    client2.search(t.nq / 4, t.xq.data(), t.k, D.data(), I.data());
+    EXPECT_TRUE(std::equal(
+            I.begin(), I.begin() + t.nq / 4 * t.k, t.refI.begin()));
+    client.search(t.nq / 4, t.xq.data(), t.k, D.data(), I.data());
+    EXPECT_TRUE(std::equal(
+            I.begin(), I.begin() + t.nq / 4 * t.k, t.refI.begin()));
+    server.stop();
+}
+
+TEST(SearchServer, oversized_request) {
+    ServerTest t;
+    faiss::SearchServer server(&t.index);
+    server.n_io_threads = 1;
+    server.max_request_queries = 10;
+    int port = server.listen_tcp(0);
+    server.start();
+
+    // a header that announces a payload larger than max_request_queries
+    // queries: the connection is closed without waiting for the payload
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    uint64_t header[3] = {0x71737366 | (uint64_t(2) << 32), 1, 0};
+    header[2] = 16 + 11 * t.d * sizeof(float);
+    ASSERT_EQ(send(fd, header, sizeof(header), 0), ssize_t(sizeof(header)));
+    char c;
+    EXPECT_LE(recv(fd, &c, 1, 0), 0);
+    close(fd);
+
+    // requests within the limit are served
+    faiss::SearchClient client("127.0.0.1:" + std::to_string(port));
+    std::vector<float> D(t.nq * t.k);
+    std::vector<idx_t> I(t.nq * t.k);
+    EXPECT_THROW(
+            client.search(11, t.xq.data(), t.k, D.data(), I.data()),
+            faiss::FaissException);
+    faiss::SearchClient client2("127.0.0.1:" + std::to_string(port));
+    client2.search(10, t.xq.data(), t.k, D.data(), I.data());
+    EXPECT_TRUE(std::equal(I.begin(), I.begin() + 10 * t.k, t.refI.begin()));
+    server.stop();
+}
+
+TEST(SearchServer, timeout) {
+    ServerTest t;
+    faiss::SearchServer server(&t.index);
+    server.n_io_threads = 1;
+    server.max_batch_size = 16;
+    server.max_delay_ms = 300; // a single query waits for its batch
+    int port = server.listen_tcp(0);
+    server.start();
+
+    faiss::SearchClient client("127.0.0.1:" + std::to_string(port));
+    std::vector<float> D(t.nq * t.k);
+    std::vector<idx_t> I(t.nq * t.k);
+    EXPECT_THROW(
+            client.search(1, t.xq.data(), t.k, D.data(), I.data(), 10),
+            faiss::FaissException);
+    // the full batch is searched immediately, the late response to the
+    // first request is skipped
+    client.search(t.nq, t.xq.data(), t.k, D.data(), I.data(), 10000);
+    EXPECT_EQ(t.refI, I);
+}
+
+TEST(SearchServer, shards) {
+    ServerTest t;
+    int nshard = 3;
+    std::vector<std::unique_ptr<faiss::IndexIDMap>> shards;
+    std::vector<std::unique_ptr<faiss::SearchServer>> servers;
+    std::vector<std::unique_ptr<faiss::SearchClient>> clients;
+    std::vector<faiss::SearchClient*> client_ptrs;
+    for (int s = 0; s < nshard; s++) {
+        shards.emplace_back(
+                new faiss::IndexIDMap(new faiss::IndexFlatL2(t.d)));
+        shards.back()->own_fields = true;
+        std::vector<idx_t> ids;
+        std::vector<float> x;
+        for (int i = s; i < t.nb; i += nshard) {
+            ids.push_back(i);
+            x.insert(x.end(), &t.xb[i * t.d], &t.xb[(i + 1) * t.d]);
+        }
+        shards.back()->add_with_ids(ids.size(), x.data(), ids.data());
+        servers.emplace_back(new faiss::SearchServer(shards.back().get()));
+        servers.back()->n_io_threads = 1;
+        int port = servers.back()->listen_tcp(0);
+        servers.back()->start();
+        clients.emplace_back(
+                new faiss::SearchClient("127.0.0.1:" + std::to_string(port)));
+        client_ptrs.push_back(clients.back().get());
+    }
+
+    std::vector<float> D(t.nq * t.k);
+    std::vector<idx_t> I(t.nq * t.k);
+    faiss::search_remote_shards(
+            client_ptrs, t.nq, t.xq.data(), t.k, D.data(), I.data());
+    EXPECT_EQ(t.refI, I);
+    EXPECT_EQ(t.refD, D);
+}
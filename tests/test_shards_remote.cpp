@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexShardsRemote.h>
+#include <faiss/SearchServer.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/utils/random.h>
+#include <faiss/utils/utils.h>
+
+using faiss::idx_t;
+
+namespace {
+
+struct ShardsTest {
+    int d = 16, nb = 3000, nq = 30, k = 10, nshard = 3;
+    std::vector<float> xb, xq;
+
+    /// shard s contains vectors [s * nb / nshard, (s + 1) * nb / nshard)
+    std::vector<std::unique_ptr<faiss::IndexFlatL2>> shards;
+    std::vector<std::unique_ptr<faiss::SearchServer>> servers;
+
+    ShardsTest() {
+        xb.resize(nb * d);
+        faiss::float_rand(xb.data(), xb.size(), 123);
+        xq.resize(nq * d);
+        faiss::float_rand(xq.data(), xq.size(), 456);
+        for (int s = 0; s < nshard; s++) {
+            shards.emplace_back(new faiss::IndexFlatL2(d));
+            shards.back()->add(
+                    nb / nshard, xb.data() + s * (nb / nshard) * d);
+        }
+    }
+
+    /// start a server on shard s, returns its endpoint
+    std::string serve(int s, double max_delay_ms = 0) {
+        servers.emplace_back(new faiss::SearchServer(shards[s].get()));
+        servers.back()->n_io_threads = 1;
+        servers.back()->max_delay_ms = max_delay_ms;
+        int port = servers.back()->listen_tcp(0);
+        servers.back()->start();
+        return "127.0.0.1:" + std::to_string(port);
+    }
+
+    /// reference search on the shards in `included`
+    void ref_search(
+            const std::vector<int>& included,
+            std::vector<float>& D,
+            std::vector<idx_t>& I) {
+        faiss::IndexFlatL2 index(d);
+        for (int s : included) {
+            index.add(nb / nshard, xb.data() + s * (nb / nshard) * d);
+        }
+        D.resize(nq * k);
+        I.resize(nq * k);
+        index.search(nq, xq.data(), k, D.data(), I.data());
+        for (idx_t& i : I) {
+            // translate to the ids of the full database
+            i = included[i / (nb / nshard)] * (nb / nshard) + i % (nb / nshard);
+        }
+    }
+
+    void search(
+            const faiss::Index& index,
+            std::vector<float>& D,
+            std::vector<idx_t>& I) {
+        D.resize(nq * k);
+        I.resize(nq * k);
+        index.search(nq, xq.data(), k, D.data(), I.data());
+    }
+};
+
+} // namespace
+
+TEST(IndexShardsRemote, search) {
+    ShardsTest t;
+    faiss::IndexShardsRemote index;
+    index.successive_ids = true;
+    for (int s = 0; s < t.nshard; s++) {
+        index.add_shard(t.serve(s));
+    }
+    EXPECT_EQ(index.d, t.d);
+    EXPECT_EQ(index.ntotal, t.nb);
+
+    std::vector<float> refD, D;
+    std::vector<idx_t> refI, I;
+    t.ref_search({0, 1, 2}, refD, refI);
+    t.search(index, D, I);
+    EXPECT_EQ(refI, I);
+    for (int i = 0; i < t.nq * t.k; i++) {
+        EXPECT_NEAR(refD[i], D[i], 1e-5);
+    }
+    EXPECT_EQ(index.n_failed_shards, 0);
+    EXPECT_EQ(index.n_hedged, 0);
+}
+
+TEST(IndexShardsRemote, hedging) {
+    ShardsTest t;
+    faiss::IndexShardsRemote index;
+    index.successive_ids = true;
+    index.hedge_delay_ms = 20;
+    // the first replica of shard 1 waits for 5 s before searching
+    for (int s = 0; s < t.nshard; s++) {
+        if (s == 1) {
+            std::string slow = t.serve(s, 5000);
+            index.add_shard({slow, t.serve(s)});
+        } else {
+            index.add_shard(t.serve(s));
+        }
+    }
+
+    std::vector<float> refD, D;
+    std::vector<idx_t> refI, I;
+    t.ref_search({0, 1, 2}, refD, refI);
+    double t0 = faiss::getmillisecs();
+    t.search(index, D, I);
+    EXPECT_LT(faiss::getmillisecs() - t0, 2500);
+    EXPECT_EQ(refI, I);
+    EXPECT_EQ(index.n_hedged, 1);
+
+    // the fast replica is now preferred
+    t.search(index, D, I);
+    EXPECT_EQ(refI, I);
+    EXPECT_EQ(index.n_hedged, 1);
+}
+
+TEST(IndexShardsRemote, partial_results) {
+    ShardsTest t;
+    faiss::IndexShardsRemote index;
+    index.successive_ids = true;
+    index.shard_timeout_ms = 100;
+    index.add_shard(t.serve(0));
+    index.add_shard(t.serve(1, 5000)); // times out
+    index.add_shard(t.serve(2));
+
+    std::vector<float> refD, D;
+    std::vector<idx_t> refI, I;
+    EXPECT_THROW(t.search(index, D, I), faiss::FaissException);
+
+    index.allow_partial_results = true;
+    t.ref_search({0, 2}, refD, refI);
+    t.search(index, D, I);
+    EXPECT_EQ(index.n_failed_shards, 1);
+    EXPECT_EQ(refI, I);
+}
+
+TEST(IndexShardsRemote, failover) {
+    ShardsTest t;
+    std::string down;
+    {
+        // an endpoint that does not answer anymore
+        faiss::SearchServer server(t.shards[0].get());
+        down = "127.0.0.1:" + std::to_string(server.listen_tcp(0));
+    }
+    faiss::IndexShardsRemote index;
+    index.successive_ids = true;
+    index.add_shard({down, t.serve(0)});
+    index.add_shard(t.serve(1));
+    index.add_shard(t.serve(2));
+
+    std::vector<float> refD, D;
+    std::vector<idx_t> refI, I;
+    t.ref_search({0, 1, 2}, refD, refI);
+    t.search(index, D, I);
+    EXPECT_EQ(refI, I);
+    EXPECT_EQ(index.n_failed_shards, 0);
+}
+
+TEST(IndexShardsRemote, hung_replica) {
+    ShardsTest t;
+    // a replica whose connections are accepted by the kernel but that never
+    // answers
+    int hung_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(hung_fd, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(bind(hung_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(hung_fd, 16), 0);
+    ASSERT_EQ(getsockname(hung_fd, (sockaddr*)&addr, &len), 0);
+    std::string hung = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+
+    faiss::IndexShardsRemote index;
+    index.successive_ids = true;
+    index.shard_timeout_ms = 300;
+    double t0 = faiss::getmillisecs();
+    index.add_shard({t.serve(0), hung});
+    index.add_shard(t.serve(1));
+    index.add_shard(t.serve(2));
+    EXPECT_LT(faiss::getmillisecs() - t0, 2000);
+    EXPECT_EQ(index.shards[0][1].latency_ms, HUGE_VAL);
+
+    std::vector<float> refD, D;
+    std::vector<idx_t> refI, I;
+    t.ref_search({0, 1, 2}, refD, refI);
+
+    // force a reconnection to the hung replica first: it is given up at
+    // the hedging delay and the search fails over to the other replica
+    index.shard_timeout_ms = 5000;
+    index.hedge_delay_ms = 50;
+    index.shards[0][1].latency_ms = -1;
+    t0 = faiss::getmillisecs();
+    t.search(index, D, I);
+    EXPECT_LT(faiss::getmillisecs() - t0, 2500);
+    EXPECT_EQ(index.n_failed_shards, 0);
+    EXPECT_EQ(refI, I);
+    EXPECT_EQ(index.shards[0][1].latency_ms, HUGE_VAL);
+
+    // without hedging, the reconnection is bounded by the shard timeout
+    index.shard_timeout_ms = 200;
+    index.hedge_delay_ms = -1;
+    index.allow_partial_results = true;
+    index.shards[0][1].latency_ms = -1;
+    t0 = faiss::getmillisecs();
+    t.search(index, D, I);
+    EXPECT_LT(faiss::getmillisecs() - t0, 2000);
+    EXPECT_GE(index.n_failed_shards, 1);
+
+    // the hung replica is now tried last
+    t.search(index, D, I);
+    EXPECT_EQ(index.n_failed_shards, 0);
+    EXPECT_EQ(refI, I);
+    close(hung_fd);
+}
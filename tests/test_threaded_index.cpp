@@ -5,11 +5,18 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexIVFFlat.h>
 #include <faiss/IndexReplicas.h>
 #include <faiss/IndexShards.h>
+#include <faiss/IndexShardsIVF.h>
+#include <faiss/clone_index.h>
+#include <faiss/index_factory.h>
 #include <faiss/impl/ThreadedIndex.h>
+#include <faiss/utils/random.h>
 
 #include <gtest/gtest.h>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <thread>
@@ -250,11 +257,298 @@ TEST(ThreadedIndex, TestShards) {
             EXPECT_EQ(idxs[i]->nCalled, n);
             EXPECT_EQ(idxs[i]->xCalled, x.data());
             EXPECT_EQ(idxs[i]->kCalled, k);
-            // There is a temporary buffer used for shards
-            EXPECT_EQ(
-                    idxs[i]->distancesCalled,
-                    idxs[0]->distancesCalled + i * k * n);
-            EXPECT_EQ(idxs[i]->labelsCalled, idxs[0]->labelsCalled + i * k * n);
+            // the shards search into temporary buffers that are merged
+            EXPECT_NE(idxs[i]->distancesCalled, distances.data());
+            EXPECT_NE(idxs[i]->labelsCalled, labels.data());
         }
     }
 }
+
+namespace {
+
+/// flat index whose searches take at least delay_ms
+struct SlowIndex : faiss::IndexFlatL2 {
+    int delay_ms;
+    mutable std::atomic<int> nsearch{0};
+
+    SlowIndex(idx_t d, int delay_ms)
+            : faiss::IndexFlatL2(d), delay_ms(delay_ms) {}
+
+    void search(
+            idx_t n,
+            const float* x,
+            idx_t k,
+            float* distances,
+            idx_t* labels,
+            const faiss::SearchParameters* params = nullptr) const override {
+        nsearch++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        faiss::IndexFlatL2::search(n, x, k, distances, labels, params);
+    }
+};
+
+} // namespace
+
+TEST(ThreadedIndex, ReplicaBalanced) {
+    int d = 8, nb = 1000, nq = 50, k = 5;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    std::vector<std::unique_ptr<SlowIndex>> idxs;
+    faiss::IndexReplicas replicas(d);
+    replicas.dispatch_mode = faiss::IndexReplicas::DISPATCH_BALANCED;
+    replicas.slice_size = 7;
+    for (int i = 0; i < 3; i++) {
+        idxs.emplace_back(new SlowIndex(d, 1));
+        replicas.addIndex(idxs.back().get());
+    }
+    replicas.add(nb, xb.data());
+
+    std::vector<float> refD(nq * k), D(nq * k);
+    std::vector<idx_t> refI(nq * k), I(nq * k);
+    idxs[0]->faiss::IndexFlatL2::search(
+            nq, xq.data(), k, refD.data(), refI.data());
+    replicas.search(nq, xq.data(), k, D.data(), I.data());
+    EXPECT_EQ(refI, I);
+    int nsearch = 0;
+    for (auto& idx : idxs) {
+        nsearch += idx->nsearch;
+    }
+    EXPECT_EQ(nsearch, (nq + 6) / 7);
+
+    // single-query searches from concurrent threads use all replicas
+    for (auto& idx : idxs) {
+        idx->delay_ms = 20;
+        idx->nsearch = 0;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([&, t] {
+            for (int q = t; q < nq; q += 3) {
+                replicas.search(
+                        1,
+                        xq.data() + q * d,
+                        k,
+                        D.data() + q * k,
+                        I.data() + q * k);
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    EXPECT_EQ(refI, I);
+    for (auto& idx : idxs) {
+        EXPECT_GT(idx->nsearch, 0);
+    }
+}
+
+TEST(ThreadedIndex, ReplicaHedging) {
+    int d = 8, nb = 1000, nq = 10, k = 5;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    // the replica that gets the query first is a straggler
+    SlowIndex slow(d, 600), fast(d, 0);
+    faiss::IndexReplicas replicas(d);
+    replicas.dispatch_mode = faiss::IndexReplicas::DISPATCH_BALANCED;
+    replicas.slice_size = nq;
+    replicas.hedge_delay_ms = 20;
+    replicas.addIndex(&slow);
+    replicas.addIndex(&fast);
+    replicas.add(nb, xb.data());
+
+    std::vector<float> refD(nq * k), D(nq * k);
+    std::vector<idx_t> refI(nq * k), I(nq * k);
+    fast.search(nq, xq.data(), k, refD.data(), refI.data());
+
+    auto t0 = std::chrono::steady_clock::now();
+    replicas.search(nq, xq.data(), k, D.data(), I.data());
+    auto dt = std::chrono::steady_clock::now() - t0;
+    EXPECT_LT(dt, std::chrono::milliseconds(400));
+    EXPECT_EQ(refI, I);
+    EXPECT_EQ(refD, D);
+    EXPECT_EQ(replicas.get_n_hedged(), 1);
+    EXPECT_EQ(slow.nsearch, 1);
+
+    // the load of the straggler is dropped when it completes
+    EXPECT_EQ(replicas.get_n_busy_replicas(), 1);
+    for (int i = 0; i < 100 && replicas.get_n_busy_replicas() > 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_EQ(replicas.get_n_busy_replicas(), 0);
+}
+
+TEST(ThreadedIndex, ShardsStreamingMerge) {
+    int d = 16, nb = 4000, nq = 50, k = 20, nlist = 32, nshard = 4;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    faiss::IndexFlatL2 quantizer(d);
+    faiss::IndexIVFFlat ref(&quantizer, d, nlist);
+    ref.train(nb, xb.data());
+    ref.add(nb, xb.data());
+    ref.nprobe = 8;
+    std::vector<float> refD(nq * k), D(nq * k);
+    std::vector<idx_t> refI(nq * k), I(nq * k);
+    ref.search(nq, xq.data(), k, refD.data(), refI.data());
+
+    for (bool threaded : {false, true}) {
+        std::vector<std::unique_ptr<faiss::IndexIVFFlat>> ivfs;
+        faiss::IndexShards shards(d, threaded);
+        for (int i = 0; i < nshard; i++) {
+            ivfs.emplace_back(new faiss::IndexIVFFlat(&quantizer, d, nlist));
+            ivfs.back()->nprobe = 8;
+            shards.add_shard(ivfs.back().get());
+        }
+        shards.add(nb, xb.data());
+        // several query blocks per shard
+        shards.merge_block_size = 7 * k;
+
+        size_t nheap[2];
+        for (bool share : {false, true}) {
+            shards.share_result_bounds = share;
+            faiss::indexIVF_stats.reset();
+            shards.search(nq, xq.data(), k, D.data(), I.data());
+            nheap[share] = faiss::indexIVF_stats.nheap_updates;
+            EXPECT_EQ(refI, I);
+            EXPECT_EQ(refD, D);
+        }
+        if (!threaded) {
+            // the shards searched after the first one are pruned
+            EXPECT_LT(nheap[1], nheap[0]);
+        }
+    }
+}
+
+TEST(ThreadedIndex, ShardsStreamingMergeTies) {
+    // nq is below distance_compute_blas_threshold, so that the blocks give
+    // the same distances as the full batch
+    int d = 16, nb = 500, nq = 15, k = 8, nshard = 4;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    // all the shards contain the same vectors, so all the results are tied
+    std::vector<std::unique_ptr<faiss::IndexFlatL2>> flats;
+    faiss::IndexShards shards(d, true, true);
+    EXPECT_EQ(shards.merge_block_size, 0);
+    for (int i = 0; i < nshard; i++) {
+        flats.emplace_back(new faiss::IndexFlatL2(d));
+        flats.back()->add(nb, xb.data());
+        shards.add_shard(flats.back().get());
+    }
+    faiss::IndexFlatL2 ref(d);
+    ref.add(nb, xb.data());
+    std::vector<float> refD(nq * k), D(nq * k);
+    std::vector<idx_t> refI(nq * k), I(nq * k);
+    ref.search(nq, xq.data(), k, refD.data(), refI.data());
+
+    for (idx_t bs : {idx_t(0), idx_t(3 * k)}) {
+        shards.merge_block_size = bs;
+        for (int rep = 0; rep < 5; rep++) {
+            shards.search(nq, xq.data(), k, D.data(), I.data());
+            // the ties are resolved by shard order
+            for (int q = 0; q < nq; q++) {
+                for (int j = 0; j < k; j++) {
+                    int shard = j % nshard, jref = q * k + j / nshard;
+                    EXPECT_EQ(I[q * k + j], refI[jref] + shard * nb);
+                    EXPECT_EQ(D[q * k + j], refD[jref]);
+                }
+            }
+        }
+    }
+}
+
+TEST(ThreadedIndex, ShardsResultBoundsFallback) {
+    int d = 16, nb = 3000, nq = 30, k = 10, nshard = 3;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    // the fast-scan shards do not accept search parameters, the IVFPQR
+    // shards collect a shortlist larger than k: both are searched without
+    // the shared bounds
+    for (const char* factory : {"IVF16,RQ2x4fs_Nrq2x4", "IVF16,PQ4+8"}) {
+        SCOPED_TRACE(factory);
+        std::unique_ptr<faiss::Index> trained(faiss::index_factory(d, factory));
+        trained->train(nb, xb.data());
+
+        std::vector<std::unique_ptr<faiss::Index>> sub;
+        faiss::IndexShards shards(d, false);
+        for (int i = 0; i < nshard; i++) {
+            sub.emplace_back(faiss::clone_index(trained.get()));
+            dynamic_cast<faiss::IndexIVF*>(sub.back().get())->nprobe = 4;
+            shards.add_shard(sub.back().get());
+        }
+        shards.add(nb, xb.data());
+
+        std::vector<float> refD(nq * k), D(nq * k);
+        std::vector<idx_t> refI(nq * k), I(nq * k);
+        shards.search(nq, xq.data(), k, refD.data(), refI.data());
+        shards.share_result_bounds = true;
+        shards.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(refI, I);
+        EXPECT_EQ(refD, D);
+    }
+}
+
+TEST(ThreadedIndex, ShardsIVFListRouting) {
+    int d = 16, nb = 4000, nq = 50, k = 20, nlist = 64, nshard = 8;
+    int nprobe = 4;
+    std::vector<float> xb(nb * d), xq(nq * d);
+    faiss::float_rand(xb.data(), xb.size(), 123);
+    faiss::float_rand(xq.data(), xq.size(), 456);
+
+    faiss::IndexFlatL2 quantizer(d);
+    faiss::IndexIVFFlat ref(&quantizer, d, nlist);
+    ref.train(nb, xb.data());
+    ref.add(nb, xb.data());
+    ref.nprobe = nprobe;
+    std::vector<float> refD(nq * k), D(nq * k);
+    std::vector<idx_t> refI(nq * k), I(nq * k);
+    faiss::indexIVF_stats.reset();
+    ref.search(nq, xq.data(), k, refD.data(), refI.data());
+    size_t ref_ndis = faiss::indexIVF_stats.ndis;
+
+    for (bool threaded : {false, true}) {
+        faiss::IndexShardsIVF shards(&quantizer, nlist, threaded);
+        std::vector<std::unique_ptr<faiss::IndexIVFFlat>> ivfs;
+        for (int i = 0; i < nshard; i++) {
+            faiss::IndexFlatL2* q = new faiss::IndexFlatL2(d);
+            q->add(nlist, quantizer.get_xb());
+            ivfs.emplace_back(new faiss::IndexIVFFlat(q, d, nlist));
+            ivfs.back()->own_fields = true;
+            ivfs.back()->nprobe = nprobe;
+            shards.add_shard(ivfs.back().get());
+        }
+        shards.assign_lists_by_range();
+        shards.add(nb / 2, xb.data());
+        shards.add(nb - nb / 2, xb.data() + nb / 2 * d);
+        EXPECT_EQ(shards.ntotal, nb);
+
+        // the shards hold only their lists
+        for (int l = 0; l < nlist; l++) {
+            for (int i = 0; i < nshard; i++) {
+                size_t list_size = ivfs[i]->invlists->list_size(l);
+                if (shards.list_shard[l] == i) {
+                    EXPECT_EQ(list_size, ref.invlists->list_size(l));
+                } else {
+                    EXPECT_EQ(list_size, 0);
+                }
+            }
+        }
+
+        faiss::indexIVF_stats.reset();
+        shards.search(nq, xq.data(), k, D.data(), I.data());
+        EXPECT_EQ(refI, I);
+        EXPECT_EQ(refD, D);
+        EXPECT_EQ(faiss::indexIVF_stats.ndis, ref_ndis);
+        // the queries are sent to at most nprobe shards
+        EXPECT_LE(faiss::indexIVF_stats.nq, nq * nprobe);
+        EXPECT_LT(faiss::indexIVF_stats.nq, nq * nshard);
+    }
+}